@@ -0,0 +1,108 @@
+#!/bin/bash
+
+# Microbenchmark of the Bloom filter in src/backend/utils/misc/bloom.c.
+#
+# Calls postgres_fdw_bloom_benchmark() for every combination of the
+# parameters below on a scratch cluster and writes one CSV line per run to
+# $BENCH_REPORT: add and check throughput, encode and decode time, memory per
+# key, and the empirical false-positive rate next to the target one.  Every
+# parameter can be overridden from the environment, e.g.
+#
+#     SIZES="1000000" KEY_TYPES=int HASH_COUNTS="0 1 2" ./bench_bloom.sh
+#
+# Set SKIP_BUILD=1 to reuse an existing installation.
+
+# --- CONFIGURATION ---
+INSTALL_DIR="$HOME/postgres-build"
+SOURCE_DIR=$(pwd)
+
+# Paths
+BIN_DIR="$INSTALL_DIR/bin"
+LIB_DIR="$INSTALL_DIR/lib"
+DATA_DIR="$INSTALL_DIR/bench_data_bloom"
+LOG_FILE="$INSTALL_DIR/bench_bloom.log"
+PORT=${PORT:-5434}
+BENCH_REPORT=${BENCH_REPORT:-"$SOURCE_DIR/bench_bloom.csv"}
+
+# Number of keys added to the filter
+SIZES=${SIZES:-"1000 100000 1000000 10000000"}
+# Target false-positive rates the filter is sized for
+FPRS=${FPRS:-"0.1 0.01 0.001"}
+# int: decimal integers; text: "key-" prefixed; hex: 16 random-looking hex digits
+KEY_TYPES=${KEY_TYPES:-"int text hex"}
+# Number of hash functions; 0 takes the optimum for the size
+HASH_COUNTS=${HASH_COUNTS:-"0"}
+REPEAT=${REPEAT:-3}
+
+# Export environment
+export PATH="$BIN_DIR:$PATH"
+export LD_LIBRARY_PATH="$LIB_DIR:$LD_LIBRARY_PATH"
+
+PSQL=("$BIN_DIR/psql" -X -q -At -v ON_ERROR_STOP=1 -p "$PORT" -d postgres)
+
+# --- CLEANUP FUNCTION ---
+cleanup() {
+    "$BIN_DIR/pg_ctl" -D "$DATA_DIR" stop -m fast > /dev/null 2>&1
+    echo "Report: $BENCH_REPORT"
+    exit
+}
+trap cleanup SIGINT
+
+# --- STEP 1: BUILD ---
+echo "=========================================="
+echo " [1/3] COMPILING & INSTALLING..."
+echo "=========================================="
+if [ "$SKIP_BUILD" != "1" ]; then
+    make -j4 install > build.log 2>&1
+    if [ $? -ne 0 ]; then echo "❌ Core build failed. See build.log"; exit 1; fi
+    cd contrib/postgres_fdw || exit
+    make install >> ../../build.log 2>&1
+    if [ $? -ne 0 ]; then echo "❌ Extension build failed. See build.log"; exit 1; fi
+    cd ../..
+fi
+
+# --- STEP 2: START SERVER ---
+echo "=========================================="
+echo " [2/3] STARTING SERVER..."
+echo "=========================================="
+rm -rf "$DATA_DIR"
+"$BIN_DIR/initdb" -D "$DATA_DIR" > /dev/null 2>&1
+"$BIN_DIR/pg_ctl" -D "$DATA_DIR" -l "$LOG_FILE" -o "-p $PORT" -w start > /dev/null
+
+"${PSQL[@]}" <<EOF
+-- Not in the extension script
+CREATE FUNCTION postgres_fdw_bloom_benchmark (
+    nkeys int8, fpr float8 DEFAULT 0.01, key_type text DEFAULT 'int',
+    hash_count int DEFAULT 0, nprobes int8 DEFAULT 0,
+    OUT keys int8, OUT target_fpr float8, OUT hashes int,
+    OUT nbits int8, OUT bytes_per_key float8,
+    OUT add_ns_per_key float8, OUT check_ns_per_key float8,
+    OUT encode_ms float8, OUT decode_ms float8, OUT encoded_bytes int8,
+    OUT probes int8, OUT false_positives int8, OUT observed_fpr float8,
+    OUT estimated_keys float8)
+RETURNS record
+AS '\$libdir/postgres_fdw', 'postgres_fdw_bloom_benchmark'
+LANGUAGE C STRICT;
+EOF
+
+# --- STEP 3: RUN ---
+echo "=========================================="
+echo " [3/3] RUNNING BENCHMARKS..."
+echo "=========================================="
+echo "key_type,run,keys,target_fpr,hashes,nbits,bytes_per_key,add_ns_per_key,check_ns_per_key,encode_ms,decode_ms,encoded_bytes,probes,false_positives,observed_fpr,estimated_keys" > "$BENCH_REPORT"
+for size in $SIZES; do
+for fpr in $FPRS; do
+for keytype in $KEY_TYPES; do
+for hashes in $HASH_COUNTS; do
+    for run in $(seq 1 "$REPEAT"); do
+        ROW=$("${PSQL[@]}" -F ',' -c "SELECT * FROM postgres_fdw_bloom_benchmark($size, $fpr, '$keytype', $hashes)" 2>&1)
+        if [ $? -ne 0 ]; then echo "❌ $ROW"; continue; fi
+        echo "$keytype,$run,$ROW" >> "$BENCH_REPORT"
+    done
+    echo " keys=$size fpr=$fpr key=$keytype hashes=$hashes: $(tail -n 1 "$BENCH_REPORT" | cut -d, -f15) observed fpr"
+done
+done
+done
+done
+
+cleanup
@@ -0,0 +1,321 @@
+#!/bin/bash
+
+# Benchmark harness for the semijoin filter.
+#
+# Generates a local and a remote table for every combination of the
+# parameters below, then runs each query under each strategy and appends one
+# CSV line per run to $BENCH_REPORT.  Every parameter can be overridden from
+# the environment, e.g.
+#
+#     SCALES="1 10" SKEWS="1 3" KEY_TYPES=text ./bench_semijoin.sh
+#
+# Set SKIP_BUILD=1 to reuse an existing installation.
+#
+# Loopback makes shipping nearly free.  NETWORKS routes postgres_fdw through
+# netem_proxy.py to emulate slower links, each given as
+# name:megabits_per_second:latency_ms:jitter_ms (latency is one-way), e.g.
+#
+#     NETWORKS="loopback lan:1000:0.2:0 wan:100:20:2 slow:10:50:5" ./bench_semijoin.sh
+#
+# and the summary shows, per network, how much faster the filtered scan is
+# than the unfiltered one, to find the break-even point and to calibrate
+# fdw_startup_cost and fdw_tuple_cost.
+
+# --- CONFIGURATION ---
+USER_NAME=$(whoami)
+INSTALL_DIR="$HOME/postgres-build"
+SOURCE_DIR=$(pwd)
+
+# Paths
+BIN_DIR="$INSTALL_DIR/bin"
+LIB_DIR="$INSTALL_DIR/lib"
+DATA_LOCAL="$INSTALL_DIR/bench_data_local"
+DATA_FOREIGN="$INSTALL_DIR/bench_data_foreign"
+LOG_LOCAL="$INSTALL_DIR/bench_local.log"
+LOG_FOREIGN="$INSTALL_DIR/bench_foreign.log"
+LOCAL_PORT=${LOCAL_PORT:-5432}
+REMOTE_PORT=${REMOTE_PORT:-5433}
+BENCH_REPORT=${BENCH_REPORT:-"$SOURCE_DIR/bench_results.csv"}
+
+# Remote rows are SCALE * 100000
+SCALES=${SCALES:-"1 10"}
+# Key frequency skew: 1 is uniform, larger values favour small keys
+SKEWS=${SKEWS:-"1 3"}
+# Fraction of the distinct remote keys present locally
+SELECTIVITIES=${SELECTIVITIES:-"0.001 0.01 0.1 0.5"}
+# One of int4, int8, text
+KEY_TYPES=${KEY_TYPES:-"int4 text"}
+# Number of payload columns of the remote table
+COLUMN_COUNTS=${COLUMN_COUNTS:-"1 8"}
+# semi: EXISTS (key only); inner: inner join fetching the payload
+QUERIES=${QUERIES:-"semi inner"}
+# filtered, filtered_binary, unfiltered, param_nestloop
+VARIANTS=${VARIANTS:-"filtered filtered_binary unfiltered param_nestloop"}
+REPEAT=${REPEAT:-3}
+# loopback, or name:megabits_per_second:latency_ms:jitter_ms
+NETWORKS=${NETWORKS:-"loopback"}
+PROXY_BASE_PORT=${PROXY_BASE_PORT:-6540}
+
+# Export environment
+export PATH="$BIN_DIR:$PATH"
+export LD_LIBRARY_PATH="$LIB_DIR:$LD_LIBRARY_PATH"
+
+LOCAL_PSQL=("$BIN_DIR/psql" -X -q -At -v ON_ERROR_STOP=1 -p "$LOCAL_PORT" -d localdb)
+REMOTE_PSQL=("$BIN_DIR/psql" -X -q -At -v ON_ERROR_STOP=1 -p "$REMOTE_PORT" -d foreigndb)
+
+# Port postgres_fdw connects to: the remote server's, or its proxy's
+FDW_PORT=$REMOTE_PORT
+PROXY_PIDS=""
+
+# --- CLEANUP FUNCTION ---
+cleanup() {
+    echo ""
+    echo "=========================================="
+    echo " SHUTTING DOWN..."
+    echo "=========================================="
+    [ -n "$PROXY_PIDS" ] && kill $PROXY_PIDS 2>/dev/null
+    "$BIN_DIR/pg_ctl" -D "$DATA_LOCAL" stop -m fast > /dev/null 2>&1
+    "$BIN_DIR/pg_ctl" -D "$DATA_FOREIGN" stop -m fast > /dev/null 2>&1
+    echo "Report: $BENCH_REPORT"
+    exit
+}
+trap cleanup SIGINT
+
+# --- STEP 1: BUILD ---
+echo "=========================================="
+echo " [1/4] COMPILING & INSTALLING..."
+echo "=========================================="
+if [ "$SKIP_BUILD" != "1" ]; then
+    make -j4 install > build.log 2>&1
+    if [ $? -ne 0 ]; then echo "❌ Core build failed. See build.log"; exit 1; fi
+    cd contrib/postgres_fdw || exit
+    make install >> ../../build.log 2>&1
+    if [ $? -ne 0 ]; then echo "❌ Extension build failed. See build.log"; exit 1; fi
+    cd ../..
+fi
+
+# --- STEP 2: START SERVERS ---
+echo "=========================================="
+echo " [2/4] INITIALIZING & STARTING SERVERS..."
+echo "=========================================="
+rm -rf "$DATA_LOCAL" "$DATA_FOREIGN"
+"$BIN_DIR/initdb" -D "$DATA_FOREIGN" > /dev/null 2>&1
+"$BIN_DIR/initdb" -D "$DATA_LOCAL" > /dev/null 2>&1
+"$BIN_DIR/pg_ctl" -D "$DATA_FOREIGN" -l "$LOG_FOREIGN" -o "-p $REMOTE_PORT" -w start > /dev/null
+"$BIN_DIR/pg_ctl" -D "$DATA_LOCAL" -l "$LOG_LOCAL" -o "-p $LOCAL_PORT" -w start > /dev/null
+"$BIN_DIR/createdb" -p "$REMOTE_PORT" foreigndb
+"$BIN_DIR/createdb" -p "$LOCAL_PORT" localdb
+
+"${LOCAL_PSQL[@]}" <<EOF
+CREATE EXTENSION postgres_fdw;
+CREATE SERVER foreign_server FOREIGN DATA WRAPPER postgres_fdw OPTIONS (host 'localhost', port '$REMOTE_PORT', dbname 'foreigndb');
+CREATE USER MAPPING FOR CURRENT_USER SERVER foreign_server OPTIONS (user '$USER_NAME');
+EOF
+
+# One proxy per emulated network, listening on consecutive ports
+i=0
+for net in $NETWORKS; do
+    if [ "$net" != "loopback" ]; then
+        IFS=: read -r name mbit latency jitter <<< "$net"
+        python3 "$SOURCE_DIR/netem_proxy.py" --listen-port $((PROXY_BASE_PORT + i)) \
+            --target-port "$REMOTE_PORT" --bandwidth "${mbit:-0}" \
+            --latency "${latency:-0}" --jitter "${jitter:-0}" \
+            --log "$INSTALL_DIR/proxy_$name.log" &
+        PROXY_PIDS="$PROXY_PIDS $!"
+    fi
+    i=$((i + 1))
+done
+
+echo "scale,skew,selectivity,key_type,columns,network,query,variant,run,latency_ms,remote_rows,bytes_sent,bytes_received,local_peak_kb,remote_peak_kb" > "$BENCH_REPORT"
+
+# --- DATA GENERATION ---
+
+# Expression turning the integer k into a key of the given type
+key_expr() {
+    case "$1" in
+        int4) echo "k" ;;
+        int8) echo "k::int8 * 1000003" ;;
+        text) echo "'key-' || k" ;;
+        *) echo "❌ Unknown key type $1" >&2; exit 1 ;;
+    esac
+}
+
+# generate_tables SCALE SKEW SELECTIVITY KEY_TYPE COLUMNS
+generate_tables() {
+    local rows=$(( $1 * 100000 ))
+    local nkeys=$(( rows / 10 ))
+    local key
+    local payload=""
+    local i
+
+    key=$(key_expr "$4")
+    for i in $(seq 1 "$5"); do
+        payload="$payload, md5((g * $i)::text) AS c$i"
+    done
+
+    # Remote keys follow k = floor(nkeys * r^skew): skew 1 is uniform
+    "${REMOTE_PSQL[@]}" <<EOF
+DROP TABLE IF EXISTS fact;
+CREATE TABLE fact AS
+    SELECT $key AS k $payload
+    FROM (SELECT g, floor($nkeys * power(random(), $2))::int AS k
+          FROM generate_series(1, $rows) g) s;
+ANALYZE fact;
+EOF
+
+    # Pick local keys by hash, so that the selectivity doesn't depend on skew
+    "${LOCAL_PSQL[@]}" <<EOF
+DROP FOREIGN TABLE IF EXISTS fact;
+IMPORT FOREIGN SCHEMA public LIMIT TO (fact) FROM SERVER foreign_server INTO public;
+DROP TABLE IF EXISTS dim;
+CREATE TABLE dim AS
+    SELECT $key AS k, g AS v
+    FROM (SELECT g, g AS k FROM generate_series(0, $nkeys - 1) g) s
+    WHERE (hashint4(k) & 1048575) < 1048576 * $3;
+ANALYZE dim;
+ANALYZE fact;
+EOF
+}
+
+# --- MEASUREMENT ---
+
+# use_network INDEX NETWORK: points the foreign server at the network's proxy
+use_network() {
+    if [ "$2" = "loopback" ]; then
+        FDW_PORT=$REMOTE_PORT
+    else
+        FDW_PORT=$((PROXY_BASE_PORT + $1))
+    fi
+    "${LOCAL_PSQL[@]}" -c "ALTER SERVER foreign_server OPTIONS (SET port '$FDW_PORT')"
+}
+
+variant_settings() {
+    case "$1" in
+        filtered) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = off;" ;;
+        filtered_binary) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = on;" ;;
+        unfiltered) echo "SET semijoin.enable_filter = off;" ;;
+        # Remote lookups per local key instead of one filtered scan.  These
+        # need remote estimates; the transaction is never committed, so the
+        # option only lasts for the session.
+        param_nestloop) echo "BEGIN; ALTER FOREIGN TABLE fact OPTIONS (ADD use_remote_estimate 'true'); SET LOCAL semijoin.enable_filter = off; SET LOCAL enable_hashjoin = off; SET LOCAL enable_mergejoin = off;" ;;
+        *) echo "❌ Unknown variant $1" >&2; exit 1 ;;
+    esac
+}
+
+query_text() {
+    case "$1" in
+        semi) echo "SELECT count(*) FROM dim d WHERE EXISTS (SELECT 1 FROM fact f WHERE f.k = d.k)" ;;
+        inner) echo "SELECT count(*), max(f.c1) FROM dim d JOIN fact f ON f.k = d.k" ;;
+        *) echo "❌ Unknown query $1" >&2; exit 1 ;;
+    esac
+}
+
+# Runs the query once in a new session and prints
+# "latency,bytes_sent,bytes_received,local_peak_kb,remote_peak_kb".  The byte
+# counts are those of the session's connection to the remote server, read
+# from the kernel's TCP counters, so they include the connection setup.
+# Through a proxy, its log has the same counts as seen at the far end.
+measure_once() {
+    local out
+    local latency sent received local_peak remote_peak
+
+    out=$("${LOCAL_PSQL[@]}" 2>&1 <<EOF
+$(variant_settings "$2")
+SELECT pg_backend_pid() AS pid \gset
+\setenv BENCH_PID :pid
+\timing on
+$1;
+\timing off
+\! echo "@@wire \$(ss -tinH state established '( dport = :$FDW_PORT )' | tr '\n' ' ')"
+\! echo "@@local \$(grep VmHWM /proc/\$BENCH_PID/status)"
+\! for p in \$("$BIN_DIR/psql" -X -At -p $REMOTE_PORT -d foreigndb -c "SELECT pid FROM pg_stat_activity WHERE application_name = 'postgres_fdw'"); do echo "@@remote \$(grep VmHWM /proc/\$p/status)"; done
+EOF
+)
+    if echo "$out" | grep -q "ERROR"; then
+        echo "$out" >&2
+        echo ",,,,"
+        return
+    fi
+
+    latency=$(echo "$out" | grep -m 1 "^Time:" | sed -E 's/Time: ([0-9.]+) ms.*/\1/')
+    sent=$(echo "$out" | grep "^@@wire" | grep -o "bytes_sent:[0-9]*" | head -n 1 | cut -d: -f2)
+    received=$(echo "$out" | grep "^@@wire" | grep -o "bytes_received:[0-9]*" | head -n 1 | cut -d: -f2)
+    local_peak=$(echo "$out" | grep "^@@local" | grep -o "[0-9]\+" | head -n 1)
+    remote_peak=$(echo "$out" | grep "^@@remote" | grep -o "[0-9]\+" | head -n 1)
+    echo "$latency,$sent,$received,$local_peak,$remote_peak"
+}
+
+# Prints the number of rows the foreign scan returned
+remote_rows() {
+    local out
+
+    out=$("${LOCAL_PSQL[@]}" 2>&1 <<EOF
+$(variant_settings "$2")
+EXPLAIN (ANALYZE, VERBOSE) $1;
+EOF
+)
+    echo "$out" | grep "Foreign Scan on public.fact" | head -n 1 | grep -o "actual time=[^)]*rows=[0-9]*" | sed -E 's/.*rows=([0-9]+)/\1/'
+}
+
+# --- STEP 3: RUN ---
+echo "=========================================="
+echo " [3/4] RUNNING BENCHMARKS..."
+echo "=========================================="
+for scale in $SCALES; do
+for skew in $SKEWS; do
+for sel in $SELECTIVITIES; do
+for keytype in $KEY_TYPES; do
+for ncols in $COLUMN_COUNTS; do
+    echo " scale=$scale skew=$skew selectivity=$sel key=$keytype columns=$ncols"
+    generate_tables "$scale" "$skew" "$sel" "$keytype" "$ncols"
+    i=0
+    for net in $NETWORKS; do
+        use_network $i "$net"
+        i=$((i + 1))
+        for query in $QUERIES; do
+            sql=$(query_text "$query")
+            for variant in $VARIANTS; do
+                rows=$(remote_rows "$sql" "$variant")
+                # The EXPLAIN ANALYZE above doubles as the warm-up run
+                for run in $(seq 1 "$REPEAT"); do
+                    echo "$scale,$skew,$sel,$keytype,$ncols,${net%%:*},$query,$variant,$run,$(measure_once "$sql" "$variant" | sed "s/^\([^,]*\),/\1,$rows,/")" >> "$BENCH_REPORT"
+                done
+            done
+        done
+    done
+done
+done
+done
+done
+done
+
+# --- STEP 4: SUMMARY ---
+echo "=========================================="
+echo " [4/4] SUMMARY (median latency in ms)"
+echo "=========================================="
+"${LOCAL_PSQL[@]}" -P footer=off -F ' ' <<EOF
+CREATE TEMP TABLE bench (scale int, skew float8, selectivity float8,
+    key_type text, columns int, network text, query text, variant text,
+    run int,
+    latency_ms float8, remote_rows int8, bytes_sent int8,
+    bytes_received int8, local_peak_kb int8, remote_peak_kb int8);
+\copy bench FROM '$BENCH_REPORT' WITH (FORMAT csv, HEADER)
+CREATE TEMP VIEW medians AS
+SELECT scale, skew, selectivity, key_type, columns, network, query, variant,
+       percentile_cont(0.5) WITHIN GROUP (ORDER BY latency_ms) AS latency_ms,
+       max(remote_rows) AS remote_rows,
+       max(bytes_received) AS bytes_received
+FROM bench
+GROUP BY 1, 2, 3, 4, 5, 6, 7, 8;
+SELECT * FROM medians ORDER BY 1, 2, 3, 4, 5, 6, 7, 8;
+\echo
+\echo Speedup of the filtered over the unfiltered scan (break-even at 1)
+SELECT f.scale, f.skew, f.selectivity, f.key_type, f.columns, f.network,
+       f.query, round((u.latency_ms / nullif(f.latency_ms, 0))::numeric, 2) AS speedup
+FROM medians f JOIN medians u USING (scale, skew, selectivity, key_type,
+                                     columns, network, query)
+WHERE f.variant = 'filtered' AND u.variant = 'unfiltered'
+ORDER BY f.network, f.query, f.selectivity, 1, 2, 4, 5;
+EOF
+
+cleanup
@@ -13,15 +13,18 @@
 #include "postgres.h"
 
 #include <limits.h>
+#include <math.h>
 
 #include "access/htup_details.h"
 #include "access/sysattr.h"
+#include "access/transam.h"
 #include "access/table.h"
 #include "catalog/pg_class.h"
 #include "catalog/pg_opfamily.h"
 #include "commands/defrem.h"
 #include "commands/explain.h"
 #include "commands/vacuum.h"
+#include "common/hashfn.h"
 #include "executor/execAsync.h"
 #include "foreign/fdwapi.h"
 #include "funcapi.h"
@@ -43,6 +46,8 @@
 #include "parser/parsetree.h"
 #include "postgres_fdw.h"
 #include "storage/latch.h"
+#include "storage/lwlock.h"
+#include "storage/shmem.h"
 #include "utils/builtins.h"
 #include "utils/float.h"
 #include "utils/guc.h"
@@ -51,6 +56,8 @@
 #include "utils/rel.h"
 #include "utils/sampling.h"
 #include "utils/selfuncs.h"
+#include "utils/typcache.h"
+#include "utils/wait_event.h"
 
 extern void apply_scanjoin_target_to_paths(PlannerInfo *root,
 							   RelOptInfo *rel,
@@ -59,6 +66,8 @@ extern void apply_scanjoin_target_to_paths(PlannerInfo *root,
 							   bool scanjoin_target_parallel_safe,
 							   bool tlist_same_exprs);
 extern void set_plain_rel_pathlist(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte);
+extern void set_foreign_size(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte);
+extern void set_foreign_pathlist(PlannerInfo *root, RelOptInfo *rel, RangeTblEntry *rte);
 
 PG_MODULE_MAGIC;
 
@@ -71,6 +80,50 @@ PG_MODULE_MAGIC;
 /* If no remote estimates, assume a sort costs 20% extra */
 #define DEFAULT_FDW_SORT_MULTIPLIER 1.2
 
+/* If false, never plan a semijoin-filtered foreign scan */
+static bool semijoin_enable_filter = true;
+
+/* True while planning the scan of a foreign table that feeds a filter */
+static bool planning_semijoin_source = false;
+
+/* If true, fetch scan results in binary format where the types allow */
+static bool semijoin_binary_transfer = false;
+
+/*
+ * If true, semijoin-filtered scans first fetch the key columns and ctid of
+ * the rows passing the filter, and then only the rows whose key matches
+ */
+static bool semijoin_late_materialization = false;
+
+/* Number of ctids per phase-two cursor of a two-phase scan */
+#define LATE_MATERIALIZATION_BATCH	10000
+
+/*
+ * If true, the planner may instead copy the local keys into a remote
+ * temporary table, and join the foreign table with that remotely
+ */
+static bool semijoin_enable_key_table = false;
+
+/* COPY data sent to the remote per message, when uploading keys */
+#define KEY_TABLE_COPY_CHUNK	65536
+
+/*
+ * If true, the planner may instead look up the foreign rows by batches of
+ * local keys, passed to the remote query as an array
+ */
+static bool semijoin_enable_key_array = false;
+
+/*
+ * Number of keys per remote lookup.  The remote plans each batch with the
+ * array at hand: a larger one saves round trips, but past some size makes
+ * the remote give up index scans for a scan of the whole table.
+ */
+#define KEY_ARRAY_BATCH		1000
+
+/* Local memory taken by one fetched row, on top of its data */
+#define FETCHED_ROW_OVERHEAD \
+	(HEAPTUPLESIZE + MAXALIGN(SizeofHeapTupleHeader) + sizeof(HeapTuple))
+
 /*
  * Indexes of FDW-private information stored in fdw_private lists.
  *
@@ -86,6 +139,14 @@ enum FdwScanPrivateIndex
 	FdwScanPrivateRetrievedAttrs,
 	/* Integer representing the desired fetch_size */
 	FdwScanPrivateFetchSize,
+	/* List of two-phase scan queries and result columns, or NIL */
+	FdwScanPrivateLateMaterialization,
+	/* List describing the remote key table to join with, or NIL */
+	FdwScanPrivateKeyTable,
+	/* SQL statement looking up the rows of the keys in $1, or NULL */
+	FdwScanPrivateKeyArraySql,
+	/* Integer list of semijoin filter key positions in the result, or NIL */
+	FdwScanPrivateFilterKeys,
 
 	/*
 	 * String describing join i.e. names of relations being joined and types
@@ -94,6 +155,38 @@ enum FdwScanPrivateIndex
 	FdwScanPrivateRelations
 };
 
+/*
+ * Similarly, this enum describes the FdwScanPrivateLateMaterialization list
+ * of a semijoin-filtered scan running in two phases.
+ */
+enum FdwLateMaterializationIndex
+{
+	/* SQL statement fetching key columns and ctid (as a String node) */
+	FdwLateLocatorSql,
+	/* Integer list of key column positions in its result, in key order */
+	FdwLateKeyColumns,
+	/* Integer giving the ctid's position in its result */
+	FdwLateCtidColumn,
+	/* SQL statement fetching the rows with the ctids in $1 (String node) */
+	FdwLateFetchSql
+};
+
+/*
+ * Similarly, this enum describes the FdwScanPrivateKeyTable list of a scan
+ * joined remotely with the local keys, uploaded into a temporary table.
+ */
+enum FdwKeyTableIndex
+{
+	/* SELECT of the foreign key columns, giving the table's columns */
+	FdwKeyTableSelectSql,
+	/* Comma-separated remote names of those columns (as a String node) */
+	FdwKeyTableColumns,
+	/* Does the scan's SQL statement have a WHERE clause? (Boolean node) */
+	FdwKeyTableHasWhere,
+	/* Integer list of outer plan columns going into each table column */
+	FdwKeyTableOuterColumns
+};
+
 /*
  * Similarly, this enum describes what's kept in the fdw_private list for
  * a ModifyTable node referencing a postgres_fdw foreign table.  We store:
@@ -160,6 +253,8 @@ typedef struct PgFdwScanState
 	PgFdwConnState *conn_state; /* extra per-connection state */
 	unsigned int cursor_number; /* quasi-unique ID for my cursor */
 	bool		cursor_exists;	/* have we created the cursor? */
+	int			filter_part;	/* index in node->semijoin_filters of the
+								 * filter the cursor was declared with */
 	int			numParams;		/* number of parameters passed to query */
 	FmgrInfo   *param_flinfo;	/* output conversion functions for them */
 	List	   *param_exprs;	/* executable expressions for param values */
@@ -182,6 +277,48 @@ typedef struct PgFdwScanState
 	MemoryContext temp_cxt;		/* context for per-tuple temporary data */
 
 	int			fetch_size;		/* number of tuples per fetch */
+	int			base_fetch_size;	/* configured fetch_size, the minimum */
+	Size		batch_mem_limit;	/* memory one batch of tuples may take */
+
+	/* for fetching in binary format; NULL if fetching in text format */
+	FmgrInfo   *recvfuncs;		/* receive functions, per attribute */
+	Oid		   *recvtypes;		/* expected type of each result column */
+
+	/* what the semijoin filter did, for EXPLAIN ANALYZE */
+	bool		filter_reported;	/* has the remote reported on it? */
+	uint64		filter_scanned; /* remote rows checked against it */
+	uint64		filter_rejected;	/* remote rows it rejected */
+	uint64		filter_checked; /* fetched rows checked for a local match */
+	uint64		filter_matched; /* of those, rows with a local key */
+	PQnoticeReceiver prev_notice_receiver;	/* while collecting the report */
+	int			nfilterkeys;	/* number of filter key columns in the result */
+	int		   *filterkeys;		/* their positions, in key order */
+
+	/* for two-phase late materialization; see collect_late_matches */
+	char	   *locator_query;	/* text of SELECT of key columns and ctid;
+								 * NULL if the scan runs in one phase */
+	int			nkeycols;		/* number of key columns in its result */
+	int		   *keycols;		/* their positions, in key order */
+	int			ctid_col;		/* position of the ctid */
+	char	   *fetch_query;	/* text of SELECT of rows by ctid, or by key
+								 * for a key array scan */
+	List	   *late_batches;	/* ctid or key array literals, one per
+								 * cursor */
+	int			late_batch;		/* index in late_batches of the cursor's
+								 * batch; -1 before phase one */
+
+	/* for joining with the local keys remotely; see upload_semijoin_keys */
+	char	   *key_table;		/* name of the remote temporary table; NULL
+								 * if the scan ships a filter, if any */
+	char	   *key_table_select;	/* SELECT giving its columns */
+	int			key_table_ncols;	/* number of its columns */
+	int		   *key_table_outer;	/* outer plan column going into each */
+	bool		key_table_created;	/* does the table exist remotely? */
+	uint64		key_table_rows; /* keys uploaded last */
+
+	/* for looking up rows by batches of keys; see collect_key_batches */
+	bool		key_array;		/* does fetch_query take keys? */
+	uint64		key_array_keys; /* keys in late_batches */
 } PgFdwScanState;
 
 /*
@@ -288,13 +425,21 @@ typedef struct PgFdwAnalyzeState
  *
  * 1) Boolean flag showing if the remote query has the final sort
  * 2) Boolean flag showing if the remote query has the LIMIT clause
+ * 3) Boolean flag showing if the remote query returns only distinct rows
+ *    (optional; only semijoin-filtered scans set it)
  */
 enum FdwPathPrivateIndex
 {
 	/* has-final-sort flag (as a Boolean node) */
 	FdwPathPrivateHasFinalSort,
 	/* has-limit flag (as a Boolean node) */
-	FdwPathPrivateHasLimit
+	FdwPathPrivateHasLimit,
+	/* remote-distinct flag (as a Boolean node) */
+	FdwPathPrivateRemoteDistinct,
+	/* key-table flag (as a Boolean node) */
+	FdwPathPrivateKeyTable,
+	/* key-array flag (as a Boolean node) */
+	FdwPathPrivateKeyArray
 };
 
 /* Struct for extra information passed to estimate_path_cost_size() */
@@ -318,6 +463,60 @@ typedef struct ConversionLocation
 	ForeignScanState *fsstate;	/* plan node being processed, or NULL */
 } ConversionLocation;
 
+/*
+ * Cumulative semijoin filter statistics of all sessions, kept in shared
+ * memory per database, foreign server and foreign table (InvalidOid for a
+ * scan of a remote join).
+ */
+typedef struct SemijoinStatsKey
+{
+	Oid			dbid;
+	Oid			serverid;
+	Oid			relid;
+} SemijoinStatsKey;
+
+typedef struct SemijoinStatsEntry
+{
+	SemijoinStatsKey key;		/* hash key; must be first */
+	int64		filters_built;	/* filters built, not counting shared ones */
+	int64		filters_shared; /* scans that used another scan's filter */
+	int64		fallbacks;		/* scans that could ship no filter */
+	int64		filter_bytes;	/* serialized size of the filters built */
+	double		build_time;		/* ms spent building and encoding them */
+	int64		rows_scanned;	/* remote rows checked against filters */
+	int64		rows_rejected;	/* remote rows the filters rejected */
+	int64		checked_rejected;	/* of those, rejected by scans that
+									 * checked for false positives */
+	int64		rows_checked;	/* rows checked for false positives */
+	int64		false_positives;	/* of those, rows without a local key */
+} SemijoinStatsEntry;
+
+#define SEMIJOIN_STATS_COLS 13
+
+#define BLOOM_BENCHMARK_COLS 14
+
+/*
+ * Number of entries the shared statistics can hold.  Since the library need
+ * not be preloaded, they are allocated on first use from the spare space of
+ * the main shared memory segment, which is small; once full, scans of further
+ * tables are not counted until the statistics are reset, but the updates lost
+ * that way are.  If even the allocation fails, the session collects no
+ * statistics.
+ */
+#define SEMIJOIN_STATS_MAX	256
+
+/* Shared state of the statistics, besides the hash table */
+typedef struct SemijoinStatsShared
+{
+	LWLock		lock;			/* protects the hash table and dropped */
+	int			tranche_id;		/* tranche of the lock */
+	int64		dropped;		/* updates lost to a full hash table */
+} SemijoinStatsShared;
+
+static SemijoinStatsShared *SemijoinStats = NULL;
+static HTAB *SemijoinStatsHash = NULL;
+static bool SemijoinStatsFailed = false;	/* could not attach to them */
+
 /* Callback argument for ec_member_matches_foreign */
 typedef struct
 {
@@ -329,6 +528,10 @@ typedef struct
  * SQL functions
  */
 PG_FUNCTION_INFO_V1(postgres_fdw_handler);
+PG_FUNCTION_INFO_V1(postgres_fdw_semijoin_stats);
+PG_FUNCTION_INFO_V1(postgres_fdw_semijoin_stats_dropped);
+PG_FUNCTION_INFO_V1(postgres_fdw_semijoin_stats_reset);
+PG_FUNCTION_INFO_V1(postgres_fdw_bloom_benchmark);
 
 /*
  * FDW callback routines
@@ -397,6 +600,7 @@ static TupleTableSlot *postgresIterateDirectModify(ForeignScanState *node);
 static void postgresEndDirectModify(ForeignScanState *node);
 static void postgresExplainForeignScan(ForeignScanState *node,
 									   ExplainState *es);
+static void explain_semijoin_filter(ForeignScanState *node, ExplainState *es);
 static void postgresExplainForeignModify(ModifyTableState *mtstate,
 										 ResultRelInfo *rinfo,
 										 List *fdw_private,
@@ -457,7 +661,26 @@ static bool ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
 									  EquivalenceClass *ec, EquivalenceMember *em,
 									  void *arg);
 static void create_cursor(ForeignScanState *node);
+static void abandon_pipeline(PGconn *conn, int nqueued, const char *query);
 static void fetch_more_data(ForeignScanState *node);
+static void store_fetched_rows(ForeignScanState *node, PGresult *res);
+static void adjust_fetch_size(PgFdwScanState *fsstate, int numrows);
+static void send_fetch_query(PgFdwScanState *fsstate, const char *query);
+static void prepare_binary_transfer(PgFdwScanState *fsstate);
+static void check_binary_result(PgFdwScanState *fsstate, PGresult *res);
+static bool begin_next_filter_partition(ForeignScanState *node);
+static void count_filter_matches(ForeignScanState *node, PGresult *res);
+static void append_filter_key_header(StringInfo buf, int nkeys,
+									 const int *keys);
+static char *binary_column_text(HeapTuple tuple, TupleDesc tupdesc, int attno);
+static void collect_late_matches(ForeignScanState *node);
+static void upload_semijoin_keys(ForeignScanState *node);
+static void collect_key_batches(ForeignScanState *node);
+static void append_copy_text(StringInfo buf, const char *value);
+static void close_scan_cursor(ForeignScanState *node);
+static void semijoin_stats_receiver(void *arg, const PGresult *res);
+static bool semijoin_stats_attach(void);
+static void record_semijoin_stats(ForeignScanState *node);
 static void close_cursor(PGconn *conn, unsigned int cursor_number,
 						 PgFdwConnState *conn_state);
 static PgFdwModifyState *create_foreign_modify(EState *estate,
@@ -516,10 +739,12 @@ static void analyze_row_processor(PGresult *res, int row,
 static void produce_tuple_asynchronously(AsyncRequest *areq, bool fetch);
 static void fetch_more_data_begin(AsyncRequest *areq);
 static void complete_pending_request(AsyncRequest *areq);
+static void define_semijoin_variables(void);
 static HeapTuple make_tuple_from_result_row(PGresult *res,
 											int row,
 											Relation rel,
 											AttInMetadata *attinmeta,
+											FmgrInfo *recvfuncs,
 											List *retrieved_attrs,
 											ForeignScanState *fsstate,
 											MemoryContext temp_context);
@@ -562,6 +787,8 @@ postgres_fdw_handler(PG_FUNCTION_ARGS)
 {
 	FdwRoutine *routine = makeNode(FdwRoutine);
 
+	define_semijoin_variables();
+
 	/* Functions for scanning foreign tables */
 	routine->GetForeignRelSize = postgresGetForeignRelSize;
 	routine->GetForeignPaths = postgresGetForeignPaths;
@@ -1016,9 +1243,43 @@ get_useful_pathkeys_for_relation(PlannerInfo *root, RelOptInfo *rel)
 // External declaration for create_distinct_paths from planner.c
 extern RelOptInfo *create_distinct_paths(PlannerInfo *root, RelOptInfo *input_rel);
 
+/*
+ * Add the attributes of possible filter sources used in quals to join_attrs,
+ * as TargetEntries.  A source is a local table, or a foreign table other
+ * than the one being scanned, exclude_relid.
+ */
+static void
+add_join_attributes(PlannerInfo *root, Node *quals, Index exclude_relid,
+					List **join_attrs)
+{
+	List	   *vars = pull_var_clause(quals,
+									   PVC_RECURSE_AGGREGATES |
+									   PVC_RECURSE_PLACEHOLDERS);
+	ListCell   *lc;
+
+	foreach(lc, vars)
+	{
+		Var		   *var = (Var *) lfirst(lc);
+		RangeTblEntry *rte;
+
+		Assert(var->varno > 0 &&
+			   (int) var->varno <= list_length(root->parse->rtable));
+		if (var->varno == exclude_relid)
+			continue;
+		rte = rt_fetch(var->varno, root->parse->rtable);
+		if (rte->relkind == RELKIND_RELATION ||
+			rte->relkind == RELKIND_FOREIGN_TABLE)
+		{
+			TargetEntry *te = makeTargetEntry((Expr *)var, var->varattno, get_rte_attribute_name(rte, var->varattno), false);
+			*join_attrs = lappend(*join_attrs, te);
+		}
+	}
+}
+
 // Function to find the join attributes in a query
 static void
-find_join_attributes(PlannerInfo *root, Node *node, List **join_attrs)
+find_join_attributes(PlannerInfo *root, Node *node, Index exclude_relid,
+					 List **join_attrs)
 {
 	if (node == NULL)
 		return;
@@ -1029,32 +1290,11 @@ find_join_attributes(PlannerInfo *root, Node *node, List **join_attrs)
 
 		/* Extract join conditions (quals) */
 		if (join->quals)
-		{
-			List *vars = pull_var_clause(join->quals,
-										 PVC_RECURSE_AGGREGATES |
-											 PVC_RECURSE_PLACEHOLDERS);
-			ListCell *lc;
-
-			foreach (lc, vars)
-			{
-				Var *var = (Var *)lfirst(lc);
-
-				// Add attributes of only local relation
-				RangeTblEntry *rte;
-				Assert(var->varno > 0 &&
-					   (int)var->varno <= list_length(root->parse->rtable));
-				rte = rt_fetch(var->varno, root->parse->rtable);
-				if (rte->relkind == 'r')
-				{
-					TargetEntry *te = makeTargetEntry((Expr *)var, var->varattno, get_rte_attribute_name(rte, var->varattno), false);
-					*join_attrs = lappend(*join_attrs, te);
-				}
-			}
-		}
+			add_join_attributes(root, join->quals, exclude_relid, join_attrs);
 
 		/* Recursively process left and right children */
-		find_join_attributes(root, join->larg, join_attrs);
-		find_join_attributes(root, join->rarg, join_attrs);
+		find_join_attributes(root, join->larg, exclude_relid, join_attrs);
+		find_join_attributes(root, join->rarg, exclude_relid, join_attrs);
 	}
 	else if (IsA(node, FromExpr))
 	{
@@ -1064,18 +1304,46 @@ find_join_attributes(PlannerInfo *root, Node *node, List **join_attrs)
 		ListCell *lc;
 		foreach (lc, from->fromlist)
 		{
-			find_join_attributes(root, (Node *)lfirst(lc), join_attrs);
+			find_join_attributes(root, (Node *)lfirst(lc), exclude_relid,
+								 join_attrs);
 		}
 
 		/* Process WHERE clause, if any */
 		if (from->quals)
+			add_join_attributes(root, from->quals, exclude_relid, join_attrs);
+	}
+}
+
+/*
+ * Pick the relation whose join keys build the filter for a scan, among those
+ * whose attributes find_join_attributes found.  A local table is cheapest to
+ * read; failing that, take the foreign table expected to return the fewest
+ * rows.  Returns 0 if there is none.
+ */
+static Index
+choose_semijoin_source(PlannerInfo *root, List *join_attrs)
+{
+	Index		best = 0;
+	double		best_rows = 0;
+	ListCell   *lc;
+
+	foreach(lc, join_attrs)
+	{
+		Var		   *var = (Var *) lfirst_node(TargetEntry, lc)->expr;
+		RelOptInfo *rel = root->simple_rel_array[var->varno];
+		double		rows;
+
+		if (root->simple_rte_array[var->varno]->relkind == RELKIND_RELATION)
+			return var->varno;
+		rows = rel != NULL ? rel->rows : 0;
+		if (best == 0 || rows < best_rows)
 		{
-			List *vars = pull_var_clause(from->quals,
-										 PVC_RECURSE_AGGREGATES |
-											 PVC_RECURSE_PLACEHOLDERS);
-			*join_attrs = list_concat(*join_attrs, vars);
+			best = var->varno;
+			best_rows = rows;
 		}
 	}
+
+	return best;
 }
 
 // Create a distinct clause to use for the parent node of seqscan
@@ -1106,7 +1374,7 @@ create_distinct_clause(PlannerInfo *root, List *tlist)
 		sgc->eqop = eqop;
 		sgc->sortop = sortop;
 		sgc->nulls_first = false;
-		sgc->hashable = true;
+		sgc->hashable = op_hashjoinable(eqop, vartype);
 
 		tle->ressortgroupref = sgc->tleSortGroupRef; /* Link to TLE */
 		distinctClause = lappend(distinctClause, sgc);
@@ -1158,2997 +1426,5649 @@ static void set_pathtargets_for_distinct(PlannerInfo *root, RelOptInfo *rel, Lis
 }
 
 /*
- * postgresGetForeignPaths
- *		Create possible scan paths for a scan on the foreign table
+ * collect_semijoin_clauses
+ *		Add to *clauses the equality clauses among "quals" that compare a
+ *		column of the foreign relation with a column of the local relation.
  */
 static void
-postgresGetForeignPaths(PlannerInfo *root,
-						RelOptInfo *baserel,
-						Oid foreigntableid)
+collect_semijoin_clauses(PlannerInfo *root, Node *quals, Relids relids,
+						 List **clauses)
 {
-	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) baserel->fdw_private;
-	ForeignPath *path;
-	List	   *ppi_list;
+	List	   *qual_list;
 	ListCell   *lc;
 
-	/*
-	 * Create simplest ForeignScan path node and add it to baserel.  This path
-	 * corresponds to SeqScan path of regular tables (though depending on what
-	 * baserestrict conditions we were able to send to remote, there might
-	 * actually be an indexscan happening there).  We already did all the work
-	 * to estimate cost and size of this path.
-	 *
-	 * Although this path uses no join clauses, it could still have required
-	 * parameterization due to LATERAL refs in its tlist.
-	 */
-	bool non_semi_join = true;
-	Path *outer_path = NULL;
+	if (quals == NULL)
+		return;
+
+	if (IsA(quals, List))
+		qual_list = (List *) quals;
+	else
+		qual_list = make_ands_implicit((Expr *) quals);
 
-	if (true) // Enable for all, logic inside will filter
+	foreach(lc, qual_list)
 	{
-		bool sortable = true;
-		int varno = baserel->relid;
-		RelOptInfo *local_scan_rel;
-		List *join_attrs_tte = NIL;
-		List *join_attrs_var = NIL;
-		RangeTblEntry *rte;
-		RelOptInfo *distinct_rel;
-		int local_varno;
-		RelOptInfo *saved_rel;
+		Expr	   *clause = (Expr *) lfirst(lc);
+		OpExpr	   *opexpr;
+		Oid			lefttype;
 
-		elog(NOTICE, "FDW: Starting semijoin path generation for varno %d", varno);
+		if (!is_opclause(clause) || list_length(((OpExpr *) clause)->args) != 2)
+			continue;
+		opexpr = (OpExpr *) clause;
+		lefttype = exprType((Node *) linitial(opexpr->args));
+		if (!op_mergejoinable(opexpr->opno, lefttype) &&
+			!op_hashjoinable(opexpr->opno, lefttype))
+			continue;
 
-		// Set the target list of the seq scan to the join attribute
-		find_join_attributes(root, (Node *)root->parse->jointree, &join_attrs_tte);
-		
-		if (join_attrs_tte != NIL)
-		{
-			TargetEntry *first_tle = (TargetEntry *) linitial(join_attrs_tte);
-			Var *first_var = (Var *) first_tle->expr;
-			local_varno = first_var->varno;
-			
-			elog(NOTICE, "FDW: Identified local_varno %d", local_varno);
+		if (bms_equal(pull_varnos(root, (Node *) clause), relids))
+			*clauses = lappend(*clauses, clause);
+	}
+}
 
-			// Save original rel
-			saved_rel = root->simple_rel_array[local_varno];
+/*
+ * find_semijoin_clauses
+ *		Walk the query's join tree and collect the equality clauses linking
+ *		the foreign relation "relid" to the local relation "local_relid".
+ */
+static void
+find_semijoin_clauses(PlannerInfo *root, Node *node, Relids relids,
+					  List **clauses)
+{
+	if (node == NULL)
+		return;
 
-			// Clear the slot so build_simple_rel creates a new RelOptInfo
-			root->simple_rel_array[local_varno] = NULL;
-			
-			local_scan_rel = build_simple_rel(root, local_varno, NULL);
-			
-			elog(NOTICE, "FDW: Built local_scan_rel");
+	if (IsA(node, JoinExpr))
+	{
+		JoinExpr   *join = (JoinExpr *) node;
 
-			extract_var_list(join_attrs_tte, &join_attrs_var, local_varno);
-			add_vars_to_targetlist(root, join_attrs_var, bms_make_singleton(local_varno));
-			
-			// Make a seq scan node
-			rte = root->simple_rte_array[local_varno];
-			set_plain_rel_pathlist(root, local_scan_rel, rte);
-			set_cheapest(local_scan_rel);
-			
-			elog(NOTICE, "FDW: Created local scan path");
+		collect_semijoin_clauses(root, join->quals, relids, clauses);
+		find_semijoin_clauses(root, join->larg, relids, clauses);
+		find_semijoin_clauses(root, join->rarg, relids, clauses);
+	}
+	else if (IsA(node, FromExpr))
+	{
+		FromExpr   *from = (FromExpr *) node;
+		ListCell   *lc;
 
-			// Setup for distinct node
-			root->processed_distinctClause = create_distinct_clause(root, join_attrs_tte);
-			set_pathtargets_for_distinct(root, local_scan_rel, join_attrs_tte);
-			set_cheapest(local_scan_rel);
-			
-			root->distinct_pathkeys = make_pathkeys_for_sortclauses_extended(root, &root->processed_distinctClause, join_attrs_tte, true, &sortable);
-			
-			// Make a distinct node
-			// We manually create a Unique path to avoid issues with create_distinct_paths looking at the main query's target list
-			{
-				List *distinctExprs = NIL;
-				ListCell *lc;
-				double numDistinctRows;
-				Path *input_path;
-				Path *distinct_path;
+		foreach(lc, from->fromlist)
+			find_semijoin_clauses(root, (Node *) lfirst(lc), relids, clauses);
+		collect_semijoin_clauses(root, from->quals, relids, clauses);
+	}
+}
 
-				// Extract expressions for estimation
-				foreach(lc, join_attrs_tte)
-				{
-					TargetEntry *tle = (TargetEntry *) lfirst(lc);
-					distinctExprs = lappend(distinctExprs, tle->expr);
-				}
-				
-				numDistinctRows = estimate_num_groups(root, distinctExprs, local_scan_rel->rows, NULL, NULL);
+/*
+ * semijoin_filter_is_safe
+ *		Can the foreign relation's rows be restricted to those whose join keys
+ *		occur in the local relation "local_relid"?
+ *
+ * That is so if a foreign row without a local match can't show up in the
+ * query result: in inner joins and semijoins, and in anti joins and outer
+ * joins in which the foreign relation is on the nullable side of the local
+ * one.  It is not so if the foreign relation is on the preserved side of a
+ * LEFT or ANTI join whose other side holds the local relation, nor on either
+ * side of a FULL join between the two, since then the unmatched rows are
+ * emitted null-extended or are the very result.  Outer joins that don't
+ * separate the two relations don't matter.
+ */
+static bool
+semijoin_filter_is_safe(PlannerInfo *root, RelOptInfo *baserel,
+						Index local_relid)
+{
+	ListCell   *lc;
 
-				// Create a standalone RelOptInfo for the distinct path
-				distinct_rel = makeNode(RelOptInfo);
-				distinct_rel->reloptkind = RELOPT_UPPER_REL;
-				distinct_rel->reltarget = create_pathtarget(root, join_attrs_tte);
-				distinct_rel->rows = numDistinctRows;
-				distinct_rel->serverid = local_scan_rel->serverid;
-				distinct_rel->userid = local_scan_rel->userid;
-				distinct_rel->useridiscurrent = local_scan_rel->useridiscurrent;
-				distinct_rel->fdwroutine = local_scan_rel->fdwroutine;
-				distinct_rel->consider_parallel = local_scan_rel->consider_parallel;
-				distinct_rel->relids = local_scan_rel->relids; // Inherit relids
+	foreach(lc, root->join_info_list)
+	{
+		SpecialJoinInfo *sjinfo = (SpecialJoinInfo *) lfirst(lc);
+		bool		foreign_left = bms_overlap(sjinfo->syn_lefthand, baserel->relids);
+		bool		foreign_right = bms_overlap(sjinfo->syn_righthand, baserel->relids);
+		bool		local_left = bms_is_member(local_relid, sjinfo->syn_lefthand);
+		bool		local_right = bms_is_member(local_relid, sjinfo->syn_righthand);
 
-				// Create Sort path to ensure input is sorted
-				input_path = (Path *) create_sort_path(root, distinct_rel, local_scan_rel->cheapest_total_path, root->distinct_pathkeys, -1.0);
+		switch (sjinfo->jointype)
+		{
+			case JOIN_LEFT:
+			case JOIN_ANTI:
+				if (foreign_left && local_right)
+					return false;
+				break;
+			case JOIN_FULL:
+				if ((foreign_left && local_right) ||
+					(foreign_right && local_left))
+					return false;
+				break;
+			default:
+				break;
+		}
+	}
 
-				// Create Unique path on top of the sorted path
-				distinct_path = (Path *) create_upper_unique_path(root, distinct_rel, input_path, list_length(root->distinct_pathkeys), numDistinctRows);
-				
-				add_path(distinct_rel, distinct_path);
-				set_cheapest(distinct_rel);
-			}
-			
-			elog(NOTICE, "FDW: Created distinct path");
+	return true;
+}
 
-			outer_path = distinct_rel->cheapest_total_path;
+/*
+ * estimate_semijoin_match_sel
+ *		Estimate the fraction of the foreign relation's rows whose join keys
+ *		also occur on the local side.
+ *
+ * This is the selectivity of a semijoin of the foreign relation against the
+ * local one, so we let eqjoinsel_semi() work it out from the column
+ * statistics of both sides.  For the foreign table those are the n_distinct
+ * and MCV entries that ANALYZE computed from the sample postgres_fdw pulled,
+ * so no remote round trip is needed at plan time.  Returns 1.0, ie. assume
+ * the filter rejects nothing, if no usable join clause is found.
+ */
+static double
+estimate_semijoin_match_sel(PlannerInfo *root, RelOptInfo *baserel,
+							Index local_relid)
+{
+	SpecialJoinInfo sjinfo;
+	Relids		relids;
+	List	   *clauses = NIL;
+
+	relids = bms_add_member(bms_copy(baserel->relids), local_relid);
+	find_semijoin_clauses(root, (Node *) root->parse->jointree, relids,
+						  &clauses);
+	if (clauses == NIL)
+		return 1.0;
+
+	/* Make up a SpecialJoinInfo for the foreign SEMI JOIN local case */
+	memset(&sjinfo, 0, sizeof(sjinfo));
+	sjinfo.type = T_SpecialJoinInfo;
+	sjinfo.min_lefthand = baserel->relids;
+	sjinfo.min_righthand = bms_make_singleton(local_relid);
+	sjinfo.syn_lefthand = sjinfo.min_lefthand;
+	sjinfo.syn_righthand = sjinfo.min_righthand;
+	sjinfo.jointype = JOIN_SEMI;
+
+	return clauselist_selectivity(root, clauses, 0, JOIN_SEMI, &sjinfo);
+}
 
-			// Restore original rel
-			root->simple_rel_array[local_varno] = saved_rel;
-			
-			elog(NOTICE, "FDW: Restored planner state");
+/*
+ * semijoin_keys_only
+ *		Does the query need no more from the foreign relation than which of
+ *		its join key values exist?
+ *
+ * That is the case when the foreign relation alone makes up the inner side
+ * of a semijoin or anti join with the local relation "local_relid", and each
+ * column it has to return is compared by its type's equality with a column
+ * of the local relation.  The remote query can then return every key value
+ * just once, with SELECT DISTINCT.  Queries with row marks or local
+ * conditions on the foreign relation are left alone.
+ */
+static bool
+semijoin_keys_only(PlannerInfo *root, RelOptInfo *baserel, Index local_relid)
+{
+	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) baserel->fdw_private;
+	bool		inner_side = false;
+	Relids		relids;
+	List	   *clauses = NIL;
+	ListCell   *lc;
 
-			path = create_foreignscan_path(root, baserel,
-								   NULL, /* default pathtarget */
-								   fpinfo->rows,
-								   fpinfo->startup_cost,
-								   fpinfo->total_cost,
-								   NIL, /* no pathkeys */
-								   baserel->lateral_relids,
-								   outer_path, /* extra plan for semi join */
-								   NIL); /* no fdw_private list */
+	if (root->rowMarks != NIL || fpinfo->local_conds != NIL ||
+		baserel->reltarget->exprs == NIL)
+		return false;
 
-			non_semi_join = false;
-		}
-	}
+	foreach(lc, root->join_info_list)
+	{
+		SpecialJoinInfo *sjinfo = (SpecialJoinInfo *) lfirst(lc);
 
-	if(non_semi_join){
-		path = create_foreignscan_path(root, baserel,
-								   NULL, /* default pathtarget */
-								   fpinfo->rows,
-								   fpinfo->startup_cost,
-								   fpinfo->total_cost,
-								   NIL, /* no pathkeys */
-								   baserel->lateral_relids,
-								   NULL, /* no extra plan */
-								   NIL); /* no fdw_private list */
+		if ((sjinfo->jointype == JOIN_SEMI || sjinfo->jointype == JOIN_ANTI) &&
+			bms_equal(sjinfo->syn_righthand, baserel->relids) &&
+			bms_is_member(local_relid, sjinfo->syn_lefthand))
+			inner_side = true;
 	}
+	if (!inner_side)
+		return false;
 
+	relids = bms_add_member(bms_copy(baserel->relids), local_relid);
+	find_semijoin_clauses(root, (Node *) root->parse->jointree, relids,
+						  &clauses);
 
-	add_path(baserel, (Path *) path);
+	foreach(lc, baserel->reltarget->exprs)
+	{
+		Var		   *var = (Var *) lfirst(lc);
+		TypeCacheEntry *typentry;
+		bool		is_key = false;
+		ListCell   *lc2;
 
-	/* Add paths with pathkeys */
-	add_paths_with_pathkeys_for_rel(root, baserel, NULL);
+		if (!IsA(var, Var) || var->varattno <= 0)
+			return false;
 
-	/*
-	 * If we're not using remote estimates, stop here.  We have no way to
-	 * estimate whether any join clauses would be worth sending across, so
-	 * don't bother building parameterized paths.
-	 */
-	if (!fpinfo->use_remote_estimate)
-		return;
+		/* The remote DISTINCT compares with the type's default equality */
+		typentry = lookup_type_cache(var->vartype, TYPECACHE_EQ_OPR);
+		if (!OidIsValid(typentry->eq_opr))
+			return false;
 
-	/*
-	 * Thumb through all join clauses for the rel to identify which outer
-	 * relations could supply one or more safe-to-send-to-remote join clauses.
-	 * We'll build a parameterized path for each such outer relation.
-	 *
-	 * It's convenient to manage this by representing each candidate outer
-	 * relation by the ParamPathInfo node for it.  We can then use the
-	 * ppi_clauses list in the ParamPathInfo node directly as a list of the
-	 * interesting join clauses for that rel.  This takes care of the
-	 * possibility that there are multiple safe join clauses for such a rel,
-	 * and also ensures that we account for unsafe join clauses that we'll
-	 * still have to enforce locally (since the parameterized-path machinery
-	 * insists that we handle all movable clauses).
-	 */
-	ppi_list = NIL;
-	foreach(lc, baserel->joininfo)
-	{
-		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
-		Relids		required_outer;
-		ParamPathInfo *param_info;
+		foreach(lc2, clauses)
+		{
+			OpExpr	   *opexpr = (OpExpr *) lfirst(lc2);
+			ListCell   *lc3;
 
-		/* Check if clause can be moved to this rel */
-		if (!join_clause_is_movable_to(rinfo, baserel))
-			continue;
+			if (!equality_ops_are_compatible(opexpr->opno, typentry->eq_opr))
+				continue;
+			foreach(lc3, opexpr->args)
+			{
+				Node	   *arg = (Node *) lfirst(lc3);
 
-		/* See if it is safe to send to remote */
-		if (!is_foreign_expr(root, baserel, rinfo->clause))
-			continue;
+				if (IsA(arg, RelabelType))
+					arg = (Node *) ((RelabelType *) arg)->arg;
+				if (equal(arg, var))
+					is_key = true;
+			}
+		}
+		if (!is_key)
+			return false;
+	}
 
-		/* Calculate required outer rels for the resulting path */
-		required_outer = bms_union(rinfo->clause_relids,
-								   baserel->lateral_relids);
-		/* We do not want the foreign rel itself listed in required_outer */
-		required_outer = bms_del_member(required_outer, baserel->relid);
+	return true;
+}
 
-		/*
-		 * required_outer probably can't be empty here, but if it were, we
-		 * couldn't make a parameterized path.
-		 */
-		if (bms_is_empty(required_outer))
-			continue;
+/*
+ * semijoin_foreign_key_attrs
+ *		Find the column of the foreign relation that each key column of a
+ *		semijoin filter's outer plan is equated with.
+ *
+ * Returns their attribute numbers in the order of the outer plan's target
+ * list, which is the order in which the key's parts are joined, or NIL if a
+ * key column is not equated with a plain column of the foreign relation.
+ */
+static List *
+semijoin_foreign_key_attrs(PlannerInfo *root, RelOptInfo *foreignrel,
+						   Plan *outer_plan)
+{
+	List	   *attrs = NIL;
+	List	   *clauses = NIL;
+	Relids		relids = NULL;
+	ListCell   *lc;
 
-		/* Get the ParamPathInfo */
-		param_info = get_baserel_parampathinfo(root, baserel,
-											   required_outer);
-		Assert(param_info != NULL);
+	foreach(lc, outer_plan->targetlist)
+	{
+		TargetEntry *tle = lfirst_node(TargetEntry, lc);
 
-		/*
-		 * Add it to list unless we already have it.  Testing pointer equality
-		 * is OK since get_baserel_parampathinfo won't make duplicates.
-		 */
-		ppi_list = list_append_unique_ptr(ppi_list, param_info);
+		if (!IsA(tle->expr, Var))
+			return NIL;
+		relids = bms_add_member(relids, ((Var *) tle->expr)->varno);
 	}
+	if (bms_num_members(relids) != 1)
+		return NIL;
 
-	/*
-	 * The above scan examined only "generic" join clauses, not those that
-	 * were absorbed into EquivalenceClauses.  See if we can make anything out
-	 * of EquivalenceClauses.
-	 */
-	if (baserel->has_eclass_joins)
+	relids = bms_add_members(relids, foreignrel->relids);
+	find_semijoin_clauses(root, (Node *) root->parse->jointree, relids,
+						  &clauses);
+
+	foreach(lc, outer_plan->targetlist)
 	{
-		/*
-		 * We repeatedly scan the eclass list looking for column references
-		 * (or expressions) belonging to the foreign rel.  Each time we find
-		 * one, we generate a list of equivalence joinclauses for it, and then
-		 * see if any are safe to send to the remote.  Repeat till there are
-		 * no more candidate EC members.
-		 */
-		ec_member_foreign_arg arg;
+		Var		   *local_var = (Var *) lfirst_node(TargetEntry, lc)->expr;
+		AttrNumber	attno = InvalidAttrNumber;
+		ListCell   *lc2;
 
-		arg.already_used = NIL;
-		for (;;)
+		foreach(lc2, clauses)
 		{
-			List	   *clauses;
+			OpExpr	   *opexpr = (OpExpr *) lfirst(lc2);
+			Var		   *left = (Var *) strip_implicit_coercions(linitial(opexpr->args));
+			Var		   *right = (Var *) strip_implicit_coercions(lsecond(opexpr->args));
 
-			/* Make clauses, skipping any that join to lateral_referencers */
-			arg.current = NULL;
-			clauses = generate_implied_equalities_for_column(root,
-															 baserel,
-															 ec_member_matches_foreign,
-															 (void *) &arg,
-															 baserel->lateral_referencers);
+			if (!IsA(left, Var) || !IsA(right, Var))
+				continue;
+			if (left->varno != local_var->varno)
+			{
+				Var		   *tmp = left;
 
-			/* Done if there are no more expressions in the foreign rel */
-			if (arg.current == NULL)
+				left = right;
+				right = tmp;
+			}
+			if (left->varno == local_var->varno &&
+				left->varattno == local_var->varattno &&
+				right->varno == foreignrel->relid && right->varattno > 0)
 			{
-				Assert(clauses == NIL);
+				attno = right->varattno;
 				break;
 			}
+		}
+		if (attno == InvalidAttrNumber)
+			return NIL;
+		attrs = lappend_int(attrs, attno);
+	}
 
-			/* Scan the extracted join clauses */
-			foreach(lc, clauses)
+	return attrs;
+}
+
+/*
+ * semijoin_filter_key_columns
+ *		Find where in the remote query's result the columns making up the key
+ *		of a semijoin filter are.
+ *
+ * Returns their positions in the order of the outer plan's target list, in
+ * which the local keys are built, or NIL if a key column is not retrieved or
+ * the key doesn't fit in the filter's key header.
+ */
+static List *
+semijoin_filter_key_columns(PlannerInfo *root, RelOptInfo *foreignrel,
+							Plan *outer_plan, List *retrieved_attrs)
+{
+	List	   *key_attrs;
+	List	   *key_columns = NIL;
+	ListCell   *lc;
+
+	key_attrs = semijoin_foreign_key_attrs(root, foreignrel, outer_plan);
+	if (key_attrs == NIL || list_length(key_attrs) >= 0xff)
+		return NIL;
+
+	foreach(lc, key_attrs)
+	{
+		int			position = 0;
+		ListCell   *lc2;
+
+		foreach(lc2, retrieved_attrs)
+		{
+			if (lfirst_int(lc2) == lfirst_int(lc))
 			{
-				RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
-				Relids		required_outer;
-				ParamPathInfo *param_info;
+				position = foreach_current_index(lc2) + 1;
+				break;
+			}
+		}
+		if (position == 0 || position > 0xff)
+			return NIL;
+		key_columns = lappend_int(key_columns, position);
+	}
 
-				/* Check if clause can be moved to this rel */
-				if (!join_clause_is_movable_to(rinfo, baserel))
-					continue;
+	return key_columns;
+}
 
-				/* See if it is safe to send to remote */
-				if (!is_foreign_expr(root, baserel, rinfo->clause))
-					continue;
+/*
+ * Append the key header of a semijoin filter to buf: the number of key
+ * columns and their positions in the cursor's rows, in key order.
+ */
+static void
+append_filter_key_header(StringInfo buf, int nkeys, const int *keys)
+{
+	int			k;
 
-				/* Calculate required outer rels for the resulting path */
-				required_outer = bms_union(rinfo->clause_relids,
-										   baserel->lateral_relids);
-				required_outer = bms_del_member(required_outer, baserel->relid);
-				if (bms_is_empty(required_outer))
-					continue;
+	appendStringInfo(buf, "K%02x", nkeys);
+	for (k = 0; k < nkeys; k++)
+		appendStringInfo(buf, "%02x", keys[k]);
+}
 
-				/* Get the ParamPathInfo */
-				param_info = get_baserel_parampathinfo(root, baserel,
-													   required_outer);
-				Assert(param_info != NULL);
+/*
+ * build_late_materialization
+ *		Make up the two remote queries of a semijoin-filtered scan of a base
+ *		relation that runs in two phases.
+ *
+ * The locator query applies the scan's remote conditions like the regular
+ * one, but fetches only the foreign key columns and the ctid.  The fetch
+ * query returns the columns of the regular query for the rows whose ctids
+ * are given in $1.  Returns the FdwScanPrivateLateMaterialization list, or
+ * NIL if the keys can't be mapped to foreign columns.
+ */
+static List *
+build_late_materialization(PlannerInfo *root, RelOptInfo *foreignrel,
+						   Plan *outer_plan, List *remote_exprs)
+{
+	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
+	Bitmapset  *attrs_used = fpinfo->attrs_used;
+	List	   *key_attrs;
+	List	   *key_columns = NIL;
+	int			ctid_column = 0;
+	List	   *locator_attrs;
+	List	   *fetch_attrs;
+	List	   *params_list = NIL;
+	StringInfoData locator_sql;
+	StringInfoData fetch_sql;
+	ListCell   *lc;
 
-				/* Add it to list unless we already have it */
-				ppi_list = list_append_unique_ptr(ppi_list, param_info);
-			}
+	key_attrs = semijoin_foreign_key_attrs(root, foreignrel, outer_plan);
+	if (key_attrs == NIL || list_length(key_attrs) >= 0xff)
+		return NIL;
+
+	/* Deparse the locator query with just the key columns and ctid used */
+	fpinfo->attrs_used = bms_make_singleton(SelfItemPointerAttributeNumber -
+											FirstLowInvalidHeapAttributeNumber);
+	foreach(lc, key_attrs)
+		fpinfo->attrs_used = bms_add_member(fpinfo->attrs_used,
+											lfirst_int(lc) -
+											FirstLowInvalidHeapAttributeNumber);
+	initStringInfo(&locator_sql);
+	deparseSelectStmtForRel(&locator_sql, root, foreignrel, NIL,
+							remote_exprs, NIL, false, false, false,
+							&locator_attrs, &params_list);
+	fpinfo->attrs_used = attrs_used;
+
+	foreach(lc, key_attrs)
+	{
+		ListCell   *lc2;
 
-			/* Try again, now ignoring the expression we found this time */
-			arg.already_used = lappend(arg.already_used, arg.current);
+		foreach(lc2, locator_attrs)
+		{
+			if (lfirst_int(lc2) == lfirst_int(lc))
+				key_columns = lappend_int(key_columns,
+										  foreach_current_index(lc2) + 1);
 		}
 	}
-
-	/*
-	 * Now build a path for each useful outer relation.
-	 */
-	foreach(lc, ppi_list)
+	foreach(lc, locator_attrs)
 	{
-		ParamPathInfo *param_info = (ParamPathInfo *) lfirst(lc);
-		double		rows;
-		int			width;
-		Cost		startup_cost;
-		Cost		total_cost;
+		if (lfirst_int(lc) == SelfItemPointerAttributeNumber)
+			ctid_column = foreach_current_index(lc) + 1;
+	}
 
-		/* Get a cost estimate from the remote */
-		estimate_path_cost_size(root, baserel,
-								param_info->ppi_clauses, NIL, NULL,
-								&rows, &width,
-								&startup_cost, &total_cost);
+	/* The remote conditions held for these rows already */
+	initStringInfo(&fetch_sql);
+	deparseSelectStmtForRel(&fetch_sql, root, foreignrel, NIL,
+							NIL, NIL, false, false, false,
+							&fetch_attrs, &params_list);
+	appendStringInfoString(&fetch_sql,
+						   " WHERE ctid = ANY ($1::pg_catalog.tid[])");
 
-		/*
-		 * ppi_rows currently won't get looked at by anything, but still we
-		 * may as well ensure that it matches our idea of the rowcount.
-		 */
-		param_info->ppi_rows = rows;
+	/* Items in the list must match order in enum FdwLateMaterializationIndex */
+	return list_make4(makeString(locator_sql.data),
+					  key_columns,
+					  makeInteger(ctid_column),
+					  makeString(fetch_sql.data));
+}
 
-		/* Make the path */
-		path = create_foreignscan_path(root, baserel,
-									   NULL,	/* default pathtarget */
-									   rows,
-									   startup_cost,
-									   total_cost,
-									   NIL, /* no pathkeys */
-									   param_info->ppi_req_outer,
-									   NULL,
-									   NIL);	/* no fdw_private list */
-		add_path(baserel, (Path *) path);
+/*
+ * remote_column_name
+ *		The quoted name of a foreign table's column on the remote server.
+ */
+static char *
+remote_column_name(Oid relid, AttrNumber attno)
+{
+	char	   *colname = NULL;
+	ListCell   *lc;
+
+	foreach(lc, GetForeignColumnOptions(relid, attno))
+	{
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "column_name") == 0)
+			colname = defGetString(def);
 	}
+	if (colname == NULL)
+		colname = get_attname(relid, attno, false);
+
+	return pstrdup(quote_identifier(colname));
 }
 
 /*
- * postgresGetForeignPlan
- *		Create ForeignScan plan node which implements selected best path
+ * build_key_array_sql
+ *		Make up the remote query of a semijoin scan of a base relation that
+ *		looks up the rows of a batch of local keys at a time.
+ *
+ * The query is the scan's regular one, further restricted to the foreign
+ * key column being equal to one element of the array in $1.  Only a
+ * single-column key of a built-in type qualifies, whose local column has the
+ * foreign column's type, so that the keys' text converts as is.  Returns
+ * NULL if the key doesn't qualify.
  */
-static ForeignScan *
-postgresGetForeignPlan(PlannerInfo *root,
-					   RelOptInfo *foreignrel,
-					   Oid foreigntableid,
-					   ForeignPath *best_path,
-					   List *tlist,
-					   List *scan_clauses,
-					   Plan *outer_plan)
+static char *
+build_key_array_sql(PlannerInfo *root, RelOptInfo *foreignrel,
+					Plan *outer_plan, List *remote_exprs, const char *sql)
+{
+	Oid			relid = planner_rt_fetch(foreignrel->relid, root)->relid;
+	List	   *key_attrs;
+	AttrNumber	attno;
+	Oid			typid;
+	Oid			arraytypid;
+
+	if (list_length(outer_plan->targetlist) != 1)
+		return NULL;
+	key_attrs = semijoin_foreign_key_attrs(root, foreignrel, outer_plan);
+	if (key_attrs == NIL)
+		return NULL;
+
+	attno = linitial_int(key_attrs);
+	typid = get_atttype(relid, attno);
+	arraytypid = get_array_type(typid);
+	if (typid >= FirstGenbkiObjectId || !OidIsValid(arraytypid) ||
+		exprType((Node *) linitial_node(TargetEntry,
+										outer_plan->targetlist)->expr) != typid)
+		return NULL;
+
+	return psprintf("%s %s %s = ANY ($1::%s)",
+					sql, remote_exprs != NIL ? "AND" : "WHERE",
+					remote_column_name(relid, attno),
+					format_type_be(arraytypid));
+}
+
+/*
+ * build_key_table
+ *		Describe the remote temporary table that the local keys of a
+ *		semijoin scan of a base relation go into, for the remote query to
+ *		join with.
+ *
+ * The table takes the types of the foreign key columns from the remote
+ * table itself, by CREATE TABLE AS of a SELECT of them, so that the remote
+ * planner can join on them with an index.  The keys are copied into it as
+ * text, which only converts safely if the local key columns have the types
+ * of the foreign ones.  Returns the FdwScanPrivateKeyTable list, or NIL if
+ * the keys can't be mapped to foreign columns of the same types.
+ */
+static List *
+build_key_table(PlannerInfo *root, RelOptInfo *foreignrel, Plan *outer_plan,
+				List *remote_exprs)
 {
 	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
-	Index		scan_relid;
-	List	   *fdw_private;
-	List	   *remote_exprs = NIL;
-	List	   *local_exprs = NIL;
+	Oid			relid = planner_rt_fetch(foreignrel->relid, root)->relid;
+	Bitmapset  *attrs_used = fpinfo->attrs_used;
+	List	   *key_attrs;
+	List	   *select_attrs;
+	List	   *outer_columns = NIL;
 	List	   *params_list = NIL;
-	List	   *fdw_scan_tlist = NIL;
-	List	   *fdw_recheck_quals = NIL;
-	List	   *retrieved_attrs;
-	StringInfoData sql;
-	bool		has_final_sort = false;
-	bool		has_limit = false;
+	StringInfoData select_sql;
+	StringInfoData columns;
 	ListCell   *lc;
 
-	/*
-	 * Get FDW private data created by postgresGetForeignUpperPaths(), if any.
-	 */
-	if (best_path->fdw_private)
+	key_attrs = semijoin_foreign_key_attrs(root, foreignrel, outer_plan);
+	if (key_attrs == NIL)
+		return NIL;
+	foreach(lc, outer_plan->targetlist)
 	{
-		has_final_sort = boolVal(list_nth(best_path->fdw_private,
-										  FdwPathPrivateHasFinalSort));
-		has_limit = boolVal(list_nth(best_path->fdw_private,
-									 FdwPathPrivateHasLimit));
+		TargetEntry *tle = lfirst_node(TargetEntry, lc);
+		AttrNumber	attno = list_nth_int(key_attrs, foreach_current_index(lc));
+
+		if (exprType((Node *) tle->expr) != get_atttype(relid, attno))
+			return NIL;
 	}
 
-	if (IS_SIMPLE_REL(foreignrel))
-	{
-		/*
-		 * For base relations, set scan_relid as the relid of the relation.
-		 */
-		scan_relid = foreignrel->relid;
+	/* Deparse a SELECT of just the key columns */
+	fpinfo->attrs_used = NULL;
+	foreach(lc, key_attrs)
+		fpinfo->attrs_used = bms_add_member(fpinfo->attrs_used,
+											lfirst_int(lc) -
+											FirstLowInvalidHeapAttributeNumber);
+	initStringInfo(&select_sql);
+	deparseSelectStmtForRel(&select_sql, root, foreignrel, NIL,
+							NIL, NIL, false, false, false,
+							&select_attrs, &params_list);
+	fpinfo->attrs_used = attrs_used;
+
+	/*
+	 * Name the columns as the remote does, and find the outer plan column
+	 * that goes into each.  If two outer columns are equated with the same
+	 * foreign column, the first one will do: the local join still checks
+	 * the other.
+	 */
+	initStringInfo(&columns);
+	foreach(lc, select_attrs)
+	{
+		AttrNumber	attno = lfirst_int(lc);
+		ListCell   *lc2;
 
-		/*
-		 * In a base-relation scan, we must apply the given scan_clauses.
-		 *
-		 * Separate the scan_clauses into those that can be executed remotely
-		 * and those that can't.  baserestrictinfo clauses that were
-		 * previously determined to be safe or unsafe by classifyConditions
-		 * are found in fpinfo->remote_conds and fpinfo->local_conds. Anything
-		 * else in the scan_clauses list will be a join clause, which we have
-		 * to check for remote-safety.
-		 *
-		 * Note: the join clauses we see here should be the exact same ones
-		 * previously examined by postgresGetForeignPaths.  Possibly it'd be
-		 * worth passing forward the classification work done then, rather
-		 * than repeating it here.
-		 *
-		 * This code must match "extract_actual_clauses(scan_clauses, false)"
-		 * except for the additional decision about remote versus local
-		 * execution.
-		 */
-		foreach(lc, scan_clauses)
-		{
-			RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+		if (columns.len > 0)
+			appendStringInfoString(&columns, ", ");
+		appendStringInfoString(&columns, remote_column_name(relid, attno));
 
-			/* Ignore any pseudoconstants, they're dealt with elsewhere */
-			if (rinfo->pseudoconstant)
-				continue;
-
-			if (list_member_ptr(fpinfo->remote_conds, rinfo))
-				remote_exprs = lappend(remote_exprs, rinfo->clause);
-			else if (list_member_ptr(fpinfo->local_conds, rinfo))
-				local_exprs = lappend(local_exprs, rinfo->clause);
-			else if (is_foreign_expr(root, foreignrel, rinfo->clause))
-				remote_exprs = lappend(remote_exprs, rinfo->clause);
-			else
-				local_exprs = lappend(local_exprs, rinfo->clause);
+		foreach(lc2, key_attrs)
+		{
+			if (lfirst_int(lc2) == attno)
+			{
+				outer_columns = lappend_int(outer_columns,
+											foreach_current_index(lc2) + 1);
+				break;
+			}
 		}
-
-		/*
-		 * For a base-relation scan, we have to support EPQ recheck, which
-		 * should recheck all the remote quals.
-		 */
-		fdw_recheck_quals = remote_exprs;
 	}
-	else
-	{
-		/*
-		 * Join relation or upper relation - set scan_relid to 0.
-		 */
-		scan_relid = 0;
 
-		/*
-		 * For a join rel, baserestrictinfo is NIL and we are not considering
-		 * parameterization right now, so there should be no scan_clauses for
-		 * a joinrel or an upper rel either.
-		 */
-		Assert(!scan_clauses);
+	/* Items in the list must match order in enum FdwKeyTableIndex */
+	return list_make4(makeString(select_sql.data),
+					  makeString(columns.data),
+					  makeBoolean(remote_exprs != NIL),
+					  outer_columns);
+}
 
-		/*
-		 * Instead we get the conditions to apply from the fdw_private
-		 * structure.
-		 */
-		remote_exprs = extract_actual_clauses(fpinfo->remote_conds, false);
-		local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
+/*
+ * estimate_semijoin_path_cost
+ *		Estimate rows and costs of a foreign scan whose remote query is
+ *		filtered by a Bloom filter built from outer_path's output.
+ *
+ * The filter has to be complete before the cursor is opened, so the whole
+ * cost of the outer path plus hashing its keys counts as startup cost.  The
+ * remote side pays for probing the filter once per scanned row, and we save
+ * the transfer cost of every row the filter rejects.
+ *
+ * If remote_groups is positive, the remote query is a SELECT DISTINCT that
+ * collapses the scanned rows into that many groups before the filter sees
+ * them, at the price of one more comparison per scanned row.
+ */
+static void
+estimate_semijoin_path_cost(PgFdwRelationInfo *fpinfo, Path *outer_path,
+							double match_sel, double remote_groups,
+							double *p_rows,
+							Cost *p_startup_cost, Cost *p_total_cost)
+{
+	double		fpr = BLOOM_FILTER_DEFAULT_FPR;
+	double		pass_sel;
+	double		probed_rows = fpinfo->retrieved_rows;
+	double		retrieved_rows;
+	int			nhashes;
+	Cost		build_cost;
+	Cost		probe_cost;
+	Cost		distinct_cost = 0;
+	Cost		startup_cost;
+	Cost		total_cost;
 
-		/*
-		 * We leave fdw_recheck_quals empty in this case, since we never need
-		 * to apply EPQ recheck clauses.  In the case of a joinrel, EPQ
-		 * recheck is handled elsewhere --- see postgresGetForeignJoinPaths().
-		 * If we're planning an upperrel (ie, remote grouping or aggregation)
-		 * then there's no EPQ to do because SELECT FOR UPDATE wouldn't be
-		 * allowed, and indeed we *can't* put the remote clauses into
-		 * fdw_recheck_quals because the unaggregated Vars won't be available
-		 * locally.
-		 */
+	/* Optimal number of hash functions for the target false-positive rate */
+	nhashes = (int) ceil(-log(fpr) / log(2.0));
 
-		/* Build the list of columns to be fetched from the foreign server. */
-		fdw_scan_tlist = build_tlist_to_deparse(foreignrel);
+	if (remote_groups > 0)
+	{
+		distinct_cost = cpu_operator_cost * fpinfo->retrieved_rows;
+		probed_rows = Min(remote_groups, fpinfo->retrieved_rows);
+	}
 
-		/*
-		 * Ensure that the outer plan produces a tuple whose descriptor
-		 * matches our scan tuple slot.  Also, remove the local conditions
-		 * from outer plan's quals, lest they be evaluated twice, once by the
-		 * local plan and once by the scan.
-		 */
-		if (outer_plan)
-		{
-			/*
-			 * Right now, we only consider grouping and aggregation beyond
-			 * joins. Queries involving aggregates or grouping do not require
-			 * EPQ mechanism, hence should not have an outer plan here.
-			 */
-			Assert(!IS_UPPER_REL(foreignrel));
+	pass_sel = match_sel + (1.0 - match_sel) * fpr;
+	retrieved_rows = clamp_row_est(probed_rows * pass_sel);
 
-			/*
-			 * First, update the plan's qual list if possible.  In some cases
-			 * the quals might be enforced below the topmost plan level, in
-			 * which case we'll fail to remove them; it's not worth working
-			 * harder than this.
-			 */
-			foreach(lc, local_exprs)
-			{
-				Node	   *qual = lfirst(lc);
+	build_cost = outer_path->total_cost +
+		cpu_operator_cost * nhashes * outer_path->rows;
+	probe_cost = cpu_operator_cost * nhashes * probed_rows;
 
-				outer_plan->qual = list_delete(outer_plan->qual, qual);
+	startup_cost = fpinfo->startup_cost + build_cost;
+	total_cost = fpinfo->total_cost + build_cost + distinct_cost + probe_cost -
+		(fpinfo->fdw_tuple_cost + cpu_tuple_cost) *
+		(fpinfo->retrieved_rows - retrieved_rows);
 
-				/*
-				 * For an inner join the local conditions of foreign scan plan
-				 * can be part of the joinquals as well.  (They might also be
-				 * in the mergequals or hashquals, but we can't touch those
-				 * without breaking the plan.)
-				 */
-				if (IsA(outer_plan, NestLoop) ||
-					IsA(outer_plan, MergeJoin) ||
-					IsA(outer_plan, HashJoin))
-				{
-					Join	   *join_plan = (Join *) outer_plan;
+	*p_rows = remote_groups > 0 ? retrieved_rows :
+		clamp_row_est(fpinfo->rows * pass_sel);
+	*p_startup_cost = startup_cost;
+	*p_total_cost = Max(total_cost, startup_cost);
+}
 
-					if (join_plan->jointype == JOIN_INNER)
-						join_plan->joinqual = list_delete(join_plan->joinqual,
-														  qual);
-				}
-			}
+/*
+ * estimate_key_table_path_cost
+ *		Estimate rows and costs of a foreign scan whose remote query joins
+ *		with outer_path's output, uploaded into a remote temporary table.
+ *
+ * Uploading is done before the cursor is opened: creating or emptying the
+ * table, copying the keys in and analyzing them take a round trip each, and
+ * every key is shipped as a row.  We cost the remote join as a hash join;
+ * an index on the foreign key columns may make it cheaper still, but we
+ * can't tell from here.  Unlike a Bloom filter, the join lets no row through
+ * that doesn't match.
+ */
+static void
+estimate_key_table_path_cost(PgFdwRelationInfo *fpinfo, Path *outer_path,
+							 double match_sel, double remote_groups,
+							 double *p_rows,
+							 Cost *p_startup_cost, Cost *p_total_cost)
+{
+	double		probed_rows = fpinfo->retrieved_rows;
+	double		retrieved_rows;
+	Cost		upload_cost;
+	Cost		join_cost;
+	Cost		distinct_cost = 0;
+	Cost		startup_cost;
+	Cost		total_cost;
 
-			/*
-			 * Now fix the subplan's tlist --- this might result in inserting
-			 * a Result node atop the plan tree.
-			 */
-			outer_plan = change_plan_targetlist(outer_plan, fdw_scan_tlist,
-												best_path->path.parallel_safe);
-		}
+	if (remote_groups > 0)
+	{
+		distinct_cost = cpu_operator_cost * fpinfo->retrieved_rows;
+		probed_rows = Min(remote_groups, fpinfo->retrieved_rows);
 	}
 
-	/*
-	 * Build the query string to be sent for execution, and identify
-	 * expressions to be sent as parameters.
-	 */
-	initStringInfo(&sql);
-	deparseSelectStmtForRel(&sql, root, foreignrel, fdw_scan_tlist,
-							remote_exprs, best_path->path.pathkeys,
-							has_final_sort, has_limit, false,
-							&retrieved_attrs, &params_list);
+	retrieved_rows = clamp_row_est(probed_rows * match_sel);
 
-	/* Remember remote_exprs for possible use by postgresPlanDirectModify */
-	fpinfo->final_remote_exprs = remote_exprs;
+	upload_cost = outer_path->total_cost + 3 * fpinfo->fdw_startup_cost +
+		(fpinfo->fdw_tuple_cost + cpu_tuple_cost) * outer_path->rows;
+	join_cost = cpu_operator_cost * (outer_path->rows + fpinfo->retrieved_rows);
 
-	/*
-	 * Build the fdw_private list that will be available to the executor.
-	 * Items in the list must match order in enum FdwScanPrivateIndex.
-	 */
-	fdw_private = list_make3(makeString(sql.data),
-							 retrieved_attrs,
-							 makeInteger(fpinfo->fetch_size));
-	if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
-		fdw_private = lappend(fdw_private,
-							  makeString(fpinfo->relation_name));
+	startup_cost = fpinfo->startup_cost + upload_cost;
+	total_cost = fpinfo->total_cost + upload_cost + distinct_cost + join_cost -
+		(fpinfo->fdw_tuple_cost + cpu_tuple_cost) *
+		(fpinfo->retrieved_rows - retrieved_rows);
 
-	/*
-	 * Create the ForeignScan node for the given relation.
-	 *
-	 * Note that the remote parameter expressions are stored in the fdw_exprs
-	 * field of the finished plan node; we can't keep them in private state
-	 * because then they wouldn't be subject to later planner processing.
-	 */
-	return make_foreignscan(tlist,
-							local_exprs,
-							scan_relid,
-							params_list,
-							fdw_private,
-							fdw_scan_tlist,
-							fdw_recheck_quals,
-							outer_plan);
+	*p_rows = remote_groups > 0 ? retrieved_rows :
+		clamp_row_est(fpinfo->rows * match_sel);
+	*p_startup_cost = startup_cost;
+	*p_total_cost = Max(total_cost, startup_cost);
 }
 
 /*
- * Construct a tuple descriptor for the scan tuples handled by a foreign join.
+ * estimate_key_array_path_cost
+ *		Estimate rows and costs of a foreign scan that looks up the rows of
+ *		outer_path's keys remotely, KEY_ARRAY_BATCH keys at a time.
+ *
+ * Each batch takes a round trip.  We assume an index on the foreign key
+ * column, so that each key costs the remote a descent of it, but no batch
+ * more than a scan of the whole remote relation.  Like a key table, the
+ * lookups let no row through that doesn't match.
  */
-static TupleDesc
-get_tupdesc_for_join_scan_tuples(ForeignScanState *node)
+static void
+estimate_key_array_path_cost(PgFdwRelationInfo *fpinfo, RelOptInfo *baserel,
+							 Path *outer_path, double match_sel,
+							 double remote_groups, double *p_rows,
+							 Cost *p_startup_cost, Cost *p_total_cost)
 {
-	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
-	EState	   *estate = node->ss.ps.state;
-	TupleDesc	tupdesc;
-
-	/*
-	 * The core code has already set up a scan tuple slot based on
-	 * fsplan->fdw_scan_tlist, and this slot's tupdesc is mostly good enough,
-	 * but there's one case where it isn't.  If we have any whole-row row
-	 * identifier Vars, they may have vartype RECORD, and we need to replace
-	 * that with the associated table's actual composite type.  This ensures
-	 * that when we read those ROW() expression values from the remote server,
-	 * we can convert them to a composite type the local server knows.
-	 */
-	tupdesc = CreateTupleDescCopy(node->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
-	for (int i = 0; i < tupdesc->natts; i++)
-	{
-		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
-		Var		   *var;
-		RangeTblEntry *rte;
-		Oid			reltype;
-
-		/* Nothing to do if it's not a generic RECORD attribute */
-		if (att->atttypid != RECORDOID || att->atttypmod >= 0)
-			continue;
+	double		probed_rows = fpinfo->retrieved_rows;
+	double		retrieved_rows;
+	double		nbatches;
+	Cost		lookup_cost;
+	Cost		scan_cost;
+	Cost		startup_cost;
+	Cost		total_cost;
 
-		/*
-		 * If we can't identify the referenced table, do nothing.  This'll
-		 * likely lead to failure later, but perhaps we can muddle through.
-		 */
-		var = (Var *) list_nth_node(TargetEntry, fsplan->fdw_scan_tlist,
-									i)->expr;
-		if (!IsA(var, Var) || var->varattno != 0)
-			continue;
-		rte = list_nth(estate->es_range_table, var->varno - 1);
-		if (rte->rtekind != RTE_RELATION)
-			continue;
-		reltype = get_rel_type_id(rte->relid);
-		if (!OidIsValid(reltype))
-			continue;
-		att->atttypid = reltype;
-		/* shouldn't need to change anything else */
-	}
-	return tupdesc;
+	if (remote_groups > 0)
+		probed_rows = Min(remote_groups, fpinfo->retrieved_rows);
+	retrieved_rows = clamp_row_est(probed_rows * match_sel);
+
+	nbatches = Max(ceil(outer_path->rows / KEY_ARRAY_BATCH), 1.0);
+	lookup_cost = outer_path->rows *
+		(random_page_cost + cpu_index_tuple_cost +
+		 cpu_operator_cost * log2(Max(baserel->tuples, 2.0)));
+	scan_cost = nbatches *
+		(fpinfo->total_cost - fpinfo->startup_cost -
+		 (fpinfo->fdw_tuple_cost + cpu_tuple_cost) * fpinfo->retrieved_rows);
+	if (scan_cost > 0)
+		lookup_cost = Min(lookup_cost, scan_cost);
+
+	startup_cost = fpinfo->startup_cost + outer_path->total_cost +
+		cpu_operator_cost * outer_path->rows;
+	total_cost = startup_cost + (nbatches - 1) * fpinfo->fdw_startup_cost +
+		lookup_cost + cpu_tuple_cost * probed_rows * match_sel +
+		(fpinfo->fdw_tuple_cost + cpu_tuple_cost) * retrieved_rows;
+
+	*p_rows = remote_groups > 0 ? retrieved_rows :
+		clamp_row_est(fpinfo->rows * match_sel);
+	*p_startup_cost = startup_cost;
+	*p_total_cost = total_cost;
 }
 
 /*
- * postgresBeginForeignScan
- *		Initiate an executor scan of a foreign PostgreSQL table.
+ * postgresGetForeignPaths
+ *		Create possible scan paths for a scan on the foreign table
  */
 static void
-postgresBeginForeignScan(ForeignScanState *node, int eflags)
+postgresGetForeignPaths(PlannerInfo *root,
+						RelOptInfo *baserel,
+						Oid foreigntableid)
 {
-	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
-	EState	   *estate = node->ss.ps.state;
-	PgFdwScanState *fsstate;
-	RangeTblEntry *rte;
-	Oid			userid;
-	ForeignTable *table;
-	UserMapping *user;
-	int			rtindex;
-	int			numParams;
-
-	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
-	 */
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) baserel->fdw_private;
+	ForeignPath *path;
+	List	   *ppi_list;
+	ListCell   *lc;
 
 	/*
-	 * We'll save private state in node->fdw_state.
+	 * Create simplest ForeignScan path node and add it to baserel.  This path
+	 * corresponds to SeqScan path of regular tables (though depending on what
+	 * baserestrict conditions we were able to send to remote, there might
+	 * actually be an indexscan happening there).  We already did all the work
+	 * to estimate cost and size of this path.
+	 *
+	 * Although this path uses no join clauses, it could still have required
+	 * parameterization due to LATERAL refs in its tlist.
 	 */
-	fsstate = (PgFdwScanState *) palloc0(sizeof(PgFdwScanState));
-	node->fdw_state = (void *) fsstate;
+	List *outer_paths = NIL;
+	double match_sel = 1.0;
+	double remote_groups = 0;
+	List *semijoin_private = NIL;
+	bool remote_distinct = false;
+	bool single_key = false;
 
-	/*
+	if (semijoin_enable_filter && !planning_semijoin_source) // logic inside will filter
+	{
+		bool sortable = true;
+		int varno = baserel->relid;
+		RelOptInfo *local_scan_rel;
+		List *join_attrs_tte = NIL;
+		List *join_attrs_var = NIL;
+		RangeTblEntry *rte;
+		RelOptInfo *distinct_rel;
+		int local_varno;
+		RelOptInfo *saved_rel;
+
+		elog(DEBUG2, "FDW: Starting semijoin path generation for varno %d", varno);
+
+		// Set the target list of the seq scan to the join attribute
+		find_join_attributes(root, (Node *)root->parse->jointree, varno,
+							 &join_attrs_tte);
+		
+		if (join_attrs_tte != NIL)
+		{
+			local_varno = choose_semijoin_source(root, join_attrs_tte);
+			
+			elog(DEBUG2, "FDW: Identified local_varno %d", local_varno);
+
+			/* The filter is keyed on the attributes of that relation only */
+			foreach(lc, join_attrs_tte)
+			{
+				Var *var = (Var *) lfirst_node(TargetEntry, lc)->expr;
+
+				if (var->varno != local_varno)
+					join_attrs_tte = foreach_delete_current(join_attrs_tte, lc);
+			}
+
+			/*
+			 * Anti joins and outer joins qualify only with the foreign table
+			 * on the nullable side.
+			 */
+			if (!semijoin_filter_is_safe(root, baserel, local_varno))
+			{
+				elog(DEBUG2, "FDW: Foreign rows without a match in varno %d reach the result, no semijoin filter", local_varno);
+				join_attrs_tte = NIL;
+			}
+		}
+
+		if (join_attrs_tte != NIL)
+		{
+			// Save original rel
+			saved_rel = root->simple_rel_array[local_varno];
+
+			// Clear the slot so build_simple_rel creates a new RelOptInfo
+			root->simple_rel_array[local_varno] = NULL;
+			
+			local_scan_rel = build_simple_rel(root, local_varno, NULL);
+
+			/*
+			 * Scanning the local side in parallel is as safe as it was for
+			 * the original rel, which make_one_rel() has already checked.
+			 * The scan then gets partial paths, and Gather paths over them.
+			 */
+			if (saved_rel != NULL)
+				local_scan_rel->consider_parallel = saved_rel->consider_parallel;
+			
+			elog(DEBUG2, "FDW: Built local_scan_rel");
+
+			extract_var_list(join_attrs_tte, &join_attrs_var, local_varno);
+			add_vars_to_targetlist(root, join_attrs_var, bms_make_singleton(local_varno));
+			
+			// Make a seq scan node
+			rte = root->simple_rte_array[local_varno];
+			if (rte->relkind == RELKIND_FOREIGN_TABLE)
+			{
+				/*
+				 * The source is itself a foreign table, possibly on another
+				 * server: its keys are read through its own FDW.  Keep its
+				 * restriction clauses, so that they are still pushed to its
+				 * server and the filter only holds keys that can join.  The
+				 * source scan gets no semijoin paths of its own, which would
+				 * take this relation as their source in turn.
+				 */
+				if (saved_rel != NULL)
+				{
+					local_scan_rel->baserestrictinfo = saved_rel->baserestrictinfo;
+					local_scan_rel->baserestrict_min_security = saved_rel->baserestrict_min_security;
+				}
+				set_foreign_size(root, local_scan_rel, rte);
+				planning_semijoin_source = true;
+				PG_TRY();
+				{
+					set_foreign_pathlist(root, local_scan_rel, rte);
+				}
+				PG_FINALLY();
+				{
+					planning_semijoin_source = false;
+				}
+				PG_END_TRY();
+			}
+			else
+				set_plain_rel_pathlist(root, local_scan_rel, rte);
+			set_cheapest(local_scan_rel);
+			
+			elog(DEBUG2, "FDW: Created local scan path");
+
+			// Setup for distinct node
+			root->processed_distinctClause = create_distinct_clause(root, join_attrs_tte);
+			set_pathtargets_for_distinct(root, local_scan_rel, join_attrs_tte);
+			set_cheapest(local_scan_rel);
+			
+			root->distinct_pathkeys = make_pathkeys_for_sortclauses_extended(root, &root->processed_distinctClause, join_attrs_tte, true, &sortable);
+			
+			// Make a distinct node
+			// We manually create a Unique path to avoid issues with create_distinct_paths looking at the main query's target list
+			{
+				List *distinctExprs = NIL;
+				ListCell *lc;
+				double numDistinctRows;
+				Path *input_path;
+				Path *distinct_path;
+
+				// Extract expressions for estimation
+				foreach(lc, join_attrs_tte)
+				{
+					TargetEntry *tle = (TargetEntry *) lfirst(lc);
+					distinctExprs = lappend(distinctExprs, tle->expr);
+				}
+				
+				numDistinctRows = estimate_num_groups(root, distinctExprs, local_scan_rel->rows, NULL, NULL);
+
+				// Create a standalone RelOptInfo for the distinct path
+				distinct_rel = makeNode(RelOptInfo);
+				distinct_rel->reloptkind = RELOPT_UPPER_REL;
+				distinct_rel->reltarget = create_pathtarget(root, join_attrs_tte);
+				distinct_rel->rows = numDistinctRows;
+				distinct_rel->serverid = local_scan_rel->serverid;
+				distinct_rel->userid = local_scan_rel->userid;
+				distinct_rel->useridiscurrent = local_scan_rel->useridiscurrent;
+				distinct_rel->fdwroutine = local_scan_rel->fdwroutine;
+				distinct_rel->consider_parallel = local_scan_rel->consider_parallel;
+				distinct_rel->relids = local_scan_rel->relids; // Inherit relids
+
+				/*
+				 * A Bloom filter doesn't mind duplicate keys, and the executor
+				 * sizes it by its own estimate of the distinct keys, so the
+				 * local scan can feed it as is.  Removing duplicates first
+				 * only pays when that is cheaper than hashing them all, which
+				 * estimate_semijoin_path_cost weighs: offer a Sort + Unique
+				 * and a HashAggregate as well, and let add_path choose.
+				 */
+				outer_paths = lappend(outer_paths, local_scan_rel->cheapest_total_path);
+
+				if (sortable)
+				{
+					// Create Sort path to ensure input is sorted
+					input_path = (Path *) create_sort_path(root, distinct_rel, local_scan_rel->cheapest_total_path, root->distinct_pathkeys, -1.0);
+
+					// Create Unique path on top of the sorted path
+					distinct_path = (Path *) create_upper_unique_path(root, distinct_rel, input_path, list_length(root->distinct_pathkeys), numDistinctRows);
+					outer_paths = lappend(outer_paths, distinct_path);
+				}
+
+				if (grouping_is_hashable(root->processed_distinctClause))
+				{
+					distinct_path = (Path *) create_agg_path(root, distinct_rel,
+															 local_scan_rel->cheapest_total_path,
+															 local_scan_rel->cheapest_total_path->pathtarget,
+															 AGG_HASHED,
+															 AGGSPLIT_SIMPLE,
+															 root->processed_distinctClause,
+															 NIL,
+															 NULL,
+															 numDistinctRows);
+					outer_paths = lappend(outer_paths, distinct_path);
+				}
+
+				/*
+				 * With a parallel scan, the workers can also remove
+				 * duplicates from their share of the keys before passing them
+				 * to the leader, which merges the partial key sets.
+				 */
+				if (local_scan_rel->partial_pathlist != NIL &&
+					grouping_is_hashable(root->processed_distinctClause))
+				{
+					Path	   *partial_path = (Path *) linitial(local_scan_rel->partial_pathlist);
+					PathTarget *target = partial_path->pathtarget;
+
+					distinct_path = (Path *) create_agg_path(root, distinct_rel,
+															 partial_path,
+															 target,
+															 AGG_HASHED,
+															 AGGSPLIT_SIMPLE,
+															 root->processed_distinctClause,
+															 NIL,
+															 NULL,
+															 Min(numDistinctRows, partial_path->rows));
+					distinct_path = (Path *) create_gather_path(root, distinct_rel,
+																distinct_path,
+																target,
+																NULL, NULL);
+					distinct_path = (Path *) create_agg_path(root, distinct_rel,
+															 distinct_path,
+															 target,
+															 AGG_HASHED,
+															 AGGSPLIT_SIMPLE,
+															 root->processed_distinctClause,
+															 NIL,
+															 NULL,
+															 numDistinctRows);
+					outer_paths = lappend(outer_paths, distinct_path);
+				}
+			}
+			
+			elog(DEBUG2, "FDW: Created key source paths");
+
+			// Restore original rel
+			root->simple_rel_array[local_varno] = saved_rel;
+			
+			elog(DEBUG2, "FDW: Restored planner state");
+
+			match_sel = estimate_semijoin_match_sel(root, baserel, local_varno);
+			single_key = list_length(join_attrs_tte) == 1;
+
+			/*
+			 * If only the existence of key values matters, have the remote
+			 * side send each one once.  Items in the list must match order in
+			 * enum FdwPathPrivateIndex.
+			 */
+			if (semijoin_keys_only(root, baserel, local_varno))
+			{
+				remote_groups = estimate_num_groups(root, baserel->reltarget->exprs,
+													fpinfo->retrieved_rows,
+													NULL, NULL);
+				remote_distinct = true;
+				semijoin_private = list_make3(makeBoolean(false),
+											  makeBoolean(false),
+											  makeBoolean(true));
+				elog(DEBUG2, "FDW: Remote query returns distinct keys only, %.0f groups", remote_groups);
+			}
+		}
+	}
+
+	path = create_foreignscan_path(root, baserel,
+								   NULL, /* default pathtarget */
+								   fpinfo->rows,
+								   fpinfo->startup_cost,
+								   fpinfo->total_cost,
+								   NIL, /* no pathkeys */
+								   baserel->lateral_relids,
+								   NULL, /* no extra plan */
+								   NIL); /* no fdw_private list */
+	add_path(baserel, (Path *) path);
+
+	/*
+	 * Offer the filtered scans alongside the plain one, and let add_path()
+	 * decide whether building the filter pays for itself, and from which
+	 * key source.
+	 */
+	foreach(lc, outer_paths)
+	{
+		Path	   *outer_path = (Path *) lfirst(lc);
+		double		rows;
+		Cost		startup_cost;
+		Cost		total_cost;
+
+		estimate_semijoin_path_cost(fpinfo, outer_path, match_sel,
+									remote_groups,
+									&rows, &startup_cost, &total_cost);
+		path = create_foreignscan_path(root, baserel,
+									   NULL, /* default pathtarget */
+									   rows,
+									   startup_cost,
+									   total_cost,
+									   NIL, /* no pathkeys */
+									   baserel->lateral_relids,
+									   outer_path, /* extra plan for semi join */
+									   semijoin_private);
+		add_path(baserel, (Path *) path);
+
+		/*
+		 * Also offer to join with the keys remotely, which filters exactly.
+		 * Items in the list must match order in enum FdwPathPrivateIndex.
+		 */
+		if (semijoin_enable_key_table && root->rowMarks == NIL)
+		{
+			estimate_key_table_path_cost(fpinfo, outer_path, match_sel,
+										 remote_groups,
+										 &rows, &startup_cost, &total_cost);
+			path = create_foreignscan_path(root, baserel,
+										   NULL, /* default pathtarget */
+										   rows,
+										   startup_cost,
+										   total_cost,
+										   NIL, /* no pathkeys */
+										   baserel->lateral_relids,
+										   outer_path,
+										   list_make4(makeBoolean(false),
+													  makeBoolean(false),
+													  makeBoolean(remote_distinct),
+													  makeBoolean(true)));
+			add_path(baserel, (Path *) path);
+		}
+
+		/* And to look up the rows of a single-column key by batches */
+		if (semijoin_enable_key_array && single_key && root->rowMarks == NIL)
+		{
+			estimate_key_array_path_cost(fpinfo, baserel, outer_path,
+										 match_sel, remote_groups,
+										 &rows, &startup_cost, &total_cost);
+			path = create_foreignscan_path(root, baserel,
+										   NULL, /* default pathtarget */
+										   rows,
+										   startup_cost,
+										   total_cost,
+										   NIL, /* no pathkeys */
+										   baserel->lateral_relids,
+										   outer_path,
+										   list_make5(makeBoolean(false),
+													  makeBoolean(false),
+													  makeBoolean(remote_distinct),
+													  makeBoolean(false),
+													  makeBoolean(true)));
+			add_path(baserel, (Path *) path);
+		}
+	}
+
+	/* Add paths with pathkeys */
+	add_paths_with_pathkeys_for_rel(root, baserel, NULL);
+
+	/*
+	 * If we're not using remote estimates, stop here.  We have no way to
+	 * estimate whether any join clauses would be worth sending across, so
+	 * don't bother building parameterized paths.
+	 */
+	if (!fpinfo->use_remote_estimate)
+		return;
+
+	/*
+	 * Thumb through all join clauses for the rel to identify which outer
+	 * relations could supply one or more safe-to-send-to-remote join clauses.
+	 * We'll build a parameterized path for each such outer relation.
+	 *
+	 * It's convenient to manage this by representing each candidate outer
+	 * relation by the ParamPathInfo node for it.  We can then use the
+	 * ppi_clauses list in the ParamPathInfo node directly as a list of the
+	 * interesting join clauses for that rel.  This takes care of the
+	 * possibility that there are multiple safe join clauses for such a rel,
+	 * and also ensures that we account for unsafe join clauses that we'll
+	 * still have to enforce locally (since the parameterized-path machinery
+	 * insists that we handle all movable clauses).
+	 */
+	ppi_list = NIL;
+	foreach(lc, baserel->joininfo)
+	{
+		RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+		Relids		required_outer;
+		ParamPathInfo *param_info;
+
+		/* Check if clause can be moved to this rel */
+		if (!join_clause_is_movable_to(rinfo, baserel))
+			continue;
+
+		/* See if it is safe to send to remote */
+		if (!is_foreign_expr(root, baserel, rinfo->clause))
+			continue;
+
+		/* Calculate required outer rels for the resulting path */
+		required_outer = bms_union(rinfo->clause_relids,
+								   baserel->lateral_relids);
+		/* We do not want the foreign rel itself listed in required_outer */
+		required_outer = bms_del_member(required_outer, baserel->relid);
+
+		/*
+		 * required_outer probably can't be empty here, but if it were, we
+		 * couldn't make a parameterized path.
+		 */
+		if (bms_is_empty(required_outer))
+			continue;
+
+		/* Get the ParamPathInfo */
+		param_info = get_baserel_parampathinfo(root, baserel,
+											   required_outer);
+		Assert(param_info != NULL);
+
+		/*
+		 * Add it to list unless we already have it.  Testing pointer equality
+		 * is OK since get_baserel_parampathinfo won't make duplicates.
+		 */
+		ppi_list = list_append_unique_ptr(ppi_list, param_info);
+	}
+
+	/*
+	 * The above scan examined only "generic" join clauses, not those that
+	 * were absorbed into EquivalenceClauses.  See if we can make anything out
+	 * of EquivalenceClauses.
+	 */
+	if (baserel->has_eclass_joins)
+	{
+		/*
+		 * We repeatedly scan the eclass list looking for column references
+		 * (or expressions) belonging to the foreign rel.  Each time we find
+		 * one, we generate a list of equivalence joinclauses for it, and then
+		 * see if any are safe to send to the remote.  Repeat till there are
+		 * no more candidate EC members.
+		 */
+		ec_member_foreign_arg arg;
+
+		arg.already_used = NIL;
+		for (;;)
+		{
+			List	   *clauses;
+
+			/* Make clauses, skipping any that join to lateral_referencers */
+			arg.current = NULL;
+			clauses = generate_implied_equalities_for_column(root,
+															 baserel,
+															 ec_member_matches_foreign,
+															 (void *) &arg,
+															 baserel->lateral_referencers);
+
+			/* Done if there are no more expressions in the foreign rel */
+			if (arg.current == NULL)
+			{
+				Assert(clauses == NIL);
+				break;
+			}
+
+			/* Scan the extracted join clauses */
+			foreach(lc, clauses)
+			{
+				RestrictInfo *rinfo = (RestrictInfo *) lfirst(lc);
+				Relids		required_outer;
+				ParamPathInfo *param_info;
+
+				/* Check if clause can be moved to this rel */
+				if (!join_clause_is_movable_to(rinfo, baserel))
+					continue;
+
+				/* See if it is safe to send to remote */
+				if (!is_foreign_expr(root, baserel, rinfo->clause))
+					continue;
+
+				/* Calculate required outer rels for the resulting path */
+				required_outer = bms_union(rinfo->clause_relids,
+										   baserel->lateral_relids);
+				required_outer = bms_del_member(required_outer, baserel->relid);
+				if (bms_is_empty(required_outer))
+					continue;
+
+				/* Get the ParamPathInfo */
+				param_info = get_baserel_parampathinfo(root, baserel,
+													   required_outer);
+				Assert(param_info != NULL);
+
+				/* Add it to list unless we already have it */
+				ppi_list = list_append_unique_ptr(ppi_list, param_info);
+			}
+
+			/* Try again, now ignoring the expression we found this time */
+			arg.already_used = lappend(arg.already_used, arg.current);
+		}
+	}
+
+	/*
+	 * Now build a path for each useful outer relation.
+	 */
+	foreach(lc, ppi_list)
+	{
+		ParamPathInfo *param_info = (ParamPathInfo *) lfirst(lc);
+		double		rows;
+		int			width;
+		Cost		startup_cost;
+		Cost		total_cost;
+
+		/* Get a cost estimate from the remote */
+		estimate_path_cost_size(root, baserel,
+								param_info->ppi_clauses, NIL, NULL,
+								&rows, &width,
+								&startup_cost, &total_cost);
+
+		/*
+		 * ppi_rows currently won't get looked at by anything, but still we
+		 * may as well ensure that it matches our idea of the rowcount.
+		 */
+		param_info->ppi_rows = rows;
+
+		/* Make the path */
+		path = create_foreignscan_path(root, baserel,
+									   NULL,	/* default pathtarget */
+									   rows,
+									   startup_cost,
+									   total_cost,
+									   NIL, /* no pathkeys */
+									   param_info->ppi_req_outer,
+									   NULL,
+									   NIL);	/* no fdw_private list */
+		add_path(baserel, (Path *) path);
+	}
+}
+
+/*
+ * postgresGetForeignPlan
+ *		Create ForeignScan plan node which implements selected best path
+ */
+static ForeignScan *
+postgresGetForeignPlan(PlannerInfo *root,
+					   RelOptInfo *foreignrel,
+					   Oid foreigntableid,
+					   ForeignPath *best_path,
+					   List *tlist,
+					   List *scan_clauses,
+					   Plan *outer_plan)
+{
+	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
+	Index		scan_relid;
+	List	   *fdw_private;
+	List	   *remote_exprs = NIL;
+	List	   *local_exprs = NIL;
+	List	   *params_list = NIL;
+	List	   *fdw_scan_tlist = NIL;
+	List	   *fdw_recheck_quals = NIL;
+	List	   *retrieved_attrs;
+	StringInfoData sql;
+	bool		has_final_sort = false;
+	bool		has_limit = false;
+	bool		remote_distinct = false;
+	bool		key_table = false;
+	bool		key_array = false;
+	List	   *late_materialization = NIL;
+	List	   *key_table_info = NIL;
+	char	   *key_array_sql = NULL;
+	List	   *filter_keys = NIL;
+	ListCell   *lc;
+
+	/*
+	 * Get FDW private data created by postgresGetForeignUpperPaths() or for a
+	 * semijoin-filtered scan by postgresGetForeignPaths(), if any.
+	 */
+	if (best_path->fdw_private)
+	{
+		has_final_sort = boolVal(list_nth(best_path->fdw_private,
+										  FdwPathPrivateHasFinalSort));
+		has_limit = boolVal(list_nth(best_path->fdw_private,
+									 FdwPathPrivateHasLimit));
+		if (list_length(best_path->fdw_private) > FdwPathPrivateRemoteDistinct)
+			remote_distinct = boolVal(list_nth(best_path->fdw_private,
+											   FdwPathPrivateRemoteDistinct));
+		if (list_length(best_path->fdw_private) > FdwPathPrivateKeyTable)
+			key_table = boolVal(list_nth(best_path->fdw_private,
+										 FdwPathPrivateKeyTable));
+		if (list_length(best_path->fdw_private) > FdwPathPrivateKeyArray)
+			key_array = boolVal(list_nth(best_path->fdw_private,
+										 FdwPathPrivateKeyArray));
+	}
+
+	if (IS_SIMPLE_REL(foreignrel))
+	{
+		/*
+		 * For base relations, set scan_relid as the relid of the relation.
+		 */
+		scan_relid = foreignrel->relid;
+
+		/*
+		 * In a base-relation scan, we must apply the given scan_clauses.
+		 *
+		 * Separate the scan_clauses into those that can be executed remotely
+		 * and those that can't.  baserestrictinfo clauses that were
+		 * previously determined to be safe or unsafe by classifyConditions
+		 * are found in fpinfo->remote_conds and fpinfo->local_conds. Anything
+		 * else in the scan_clauses list will be a join clause, which we have
+		 * to check for remote-safety.
+		 *
+		 * Note: the join clauses we see here should be the exact same ones
+		 * previously examined by postgresGetForeignPaths.  Possibly it'd be
+		 * worth passing forward the classification work done then, rather
+		 * than repeating it here.
+		 *
+		 * This code must match "extract_actual_clauses(scan_clauses, false)"
+		 * except for the additional decision about remote versus local
+		 * execution.
+		 */
+		foreach(lc, scan_clauses)
+		{
+			RestrictInfo *rinfo = lfirst_node(RestrictInfo, lc);
+
+			/* Ignore any pseudoconstants, they're dealt with elsewhere */
+			if (rinfo->pseudoconstant)
+				continue;
+
+			if (list_member_ptr(fpinfo->remote_conds, rinfo))
+				remote_exprs = lappend(remote_exprs, rinfo->clause);
+			else if (list_member_ptr(fpinfo->local_conds, rinfo))
+				local_exprs = lappend(local_exprs, rinfo->clause);
+			else if (is_foreign_expr(root, foreignrel, rinfo->clause))
+				remote_exprs = lappend(remote_exprs, rinfo->clause);
+			else
+				local_exprs = lappend(local_exprs, rinfo->clause);
+		}
+
+		/*
+		 * For a base-relation scan, we have to support EPQ recheck, which
+		 * should recheck all the remote quals.
+		 */
+		fdw_recheck_quals = remote_exprs;
+	}
+	else
+	{
+		/*
+		 * Join relation or upper relation - set scan_relid to 0.
+		 */
+		scan_relid = 0;
+
+		/*
+		 * For a join rel, baserestrictinfo is NIL and we are not considering
+		 * parameterization right now, so there should be no scan_clauses for
+		 * a joinrel or an upper rel either.
+		 */
+		Assert(!scan_clauses);
+
+		/*
+		 * Instead we get the conditions to apply from the fdw_private
+		 * structure.
+		 */
+		remote_exprs = extract_actual_clauses(fpinfo->remote_conds, false);
+		local_exprs = extract_actual_clauses(fpinfo->local_conds, false);
+
+		/*
+		 * We leave fdw_recheck_quals empty in this case, since we never need
+		 * to apply EPQ recheck clauses.  In the case of a joinrel, EPQ
+		 * recheck is handled elsewhere --- see postgresGetForeignJoinPaths().
+		 * If we're planning an upperrel (ie, remote grouping or aggregation)
+		 * then there's no EPQ to do because SELECT FOR UPDATE wouldn't be
+		 * allowed, and indeed we *can't* put the remote clauses into
+		 * fdw_recheck_quals because the unaggregated Vars won't be available
+		 * locally.
+		 */
+
+		/* Build the list of columns to be fetched from the foreign server. */
+		fdw_scan_tlist = build_tlist_to_deparse(foreignrel);
+
+		/*
+		 * Ensure that the outer plan produces a tuple whose descriptor
+		 * matches our scan tuple slot.  Also, remove the local conditions
+		 * from outer plan's quals, lest they be evaluated twice, once by the
+		 * local plan and once by the scan.
+		 */
+		if (outer_plan)
+		{
+			/*
+			 * Right now, we only consider grouping and aggregation beyond
+			 * joins. Queries involving aggregates or grouping do not require
+			 * EPQ mechanism, hence should not have an outer plan here.
+			 */
+			Assert(!IS_UPPER_REL(foreignrel));
+
+			/*
+			 * First, update the plan's qual list if possible.  In some cases
+			 * the quals might be enforced below the topmost plan level, in
+			 * which case we'll fail to remove them; it's not worth working
+			 * harder than this.
+			 */
+			foreach(lc, local_exprs)
+			{
+				Node	   *qual = lfirst(lc);
+
+				outer_plan->qual = list_delete(outer_plan->qual, qual);
+
+				/*
+				 * For an inner join the local conditions of foreign scan plan
+				 * can be part of the joinquals as well.  (They might also be
+				 * in the mergequals or hashquals, but we can't touch those
+				 * without breaking the plan.)
+				 */
+				if (IsA(outer_plan, NestLoop) ||
+					IsA(outer_plan, MergeJoin) ||
+					IsA(outer_plan, HashJoin))
+				{
+					Join	   *join_plan = (Join *) outer_plan;
+
+					if (join_plan->jointype == JOIN_INNER)
+						join_plan->joinqual = list_delete(join_plan->joinqual,
+														  qual);
+				}
+			}
+
+			/*
+			 * Now fix the subplan's tlist --- this might result in inserting
+			 * a Result node atop the plan tree.
+			 */
+			outer_plan = change_plan_targetlist(outer_plan, fdw_scan_tlist,
+												best_path->path.parallel_safe);
+		}
+	}
+
+	/*
+	 * Build the query string to be sent for execution, and identify
+	 * expressions to be sent as parameters.
+	 */
+	initStringInfo(&sql);
+	deparseSelectStmtForRel(&sql, root, foreignrel, fdw_scan_tlist,
+							remote_exprs, best_path->path.pathkeys,
+							has_final_sort, has_limit, false,
+							&retrieved_attrs, &params_list);
+
+	/*
+	 * A semijoin that only needs the foreign relation's key values gets each
+	 * of them once.  A base relation's query has no ORDER BY, LIMIT or
+	 * locking clause then, so DISTINCT can go right after SELECT.
+	 */
+	if (remote_distinct)
+	{
+		StringInfoData distinct_sql;
+
+		Assert(IS_SIMPLE_REL(foreignrel) && best_path->path.pathkeys == NIL);
+		Assert(strncmp(sql.data, "SELECT ", 7) == 0);
+		initStringInfo(&distinct_sql);
+		appendStringInfo(&distinct_sql, "SELECT DISTINCT %s", sql.data + 7);
+		pfree(sql.data);
+		sql = distinct_sql;
+	}
+
+	/*
+	 * Have the remote join with the uploaded keys, or look up batches of
+	 * them, if the path says so.  The condition on the keys goes last in a
+	 * base relation's query.  If the keys can't be shipped that way after
+	 * all, the scan ships a filter instead.  Batches take $1, so there must
+	 * be no other parameters.
+	 *
+	 * Otherwise, have a semijoin-filtered scan fetch only the rows that
+	 * really join, if asked to.  Its remote query must be a plain one over a
+	 * base relation, without parameters, and without an order to keep.
+	 */
+	if (key_array && outer_plan != NULL && params_list == NIL)
+	{
+		Assert(IS_SIMPLE_REL(foreignrel) && best_path->path.pathkeys == NIL);
+		key_array_sql = build_key_array_sql(root, foreignrel, outer_plan,
+											remote_exprs, sql.data);
+	}
+	else if (key_table && outer_plan != NULL)
+	{
+		Assert(IS_SIMPLE_REL(foreignrel) && best_path->path.pathkeys == NIL);
+		key_table_info = build_key_table(root, foreignrel, outer_plan,
+										 remote_exprs);
+	}
+	else if (semijoin_late_materialization && outer_plan != NULL &&
+			 IS_SIMPLE_REL(foreignrel) && !remote_distinct &&
+			 params_list == NIL && root->rowMarks == NIL &&
+			 best_path->path.pathkeys == NIL)
+		late_materialization = build_late_materialization(root, foreignrel,
+														  outer_plan,
+														  remote_exprs);
+
+	/*
+	 * A scan shipping a Bloom filter tells the remote which columns of its
+	 * rows make up the key, in the order the local keys are built in; the
+	 * remote query may return other columns too.  If the key columns can't
+	 * be told, the scan goes unfiltered: a filter checked against other
+	 * values would reject rows that join.
+	 */
+	if (outer_plan != NULL && IS_SIMPLE_REL(foreignrel) &&
+		key_array_sql == NULL && key_table_info == NIL)
+	{
+		filter_keys = semijoin_filter_key_columns(root, foreignrel,
+												  outer_plan,
+												  retrieved_attrs);
+		if (filter_keys == NIL)
+		{
+			outer_plan = NULL;
+			late_materialization = NIL;
+		}
+	}
+
+	/* Remember remote_exprs for possible use by postgresPlanDirectModify */
+	fpinfo->final_remote_exprs = remote_exprs;
+
+	/*
+	 * Build the fdw_private list that will be available to the executor.
+	 * Items in the list must match order in enum FdwScanPrivateIndex.
+	 */
+	fdw_private = list_make5(makeString(sql.data),
+							 retrieved_attrs,
+							 makeInteger(fpinfo->fetch_size),
+							 late_materialization,
+							 key_table_info);
+	fdw_private = lappend(fdw_private,
+						  key_array_sql ? makeString(key_array_sql) : NULL);
+	fdw_private = lappend(fdw_private, filter_keys);
+	if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
+		fdw_private = lappend(fdw_private,
+							  makeString(fpinfo->relation_name));
+
+	/*
+	 * Create the ForeignScan node for the given relation.
+	 *
+	 * Note that the remote parameter expressions are stored in the fdw_exprs
+	 * field of the finished plan node; we can't keep them in private state
+	 * because then they wouldn't be subject to later planner processing.
+	 */
+	return make_foreignscan(tlist,
+							local_exprs,
+							scan_relid,
+							params_list,
+							fdw_private,
+							fdw_scan_tlist,
+							fdw_recheck_quals,
+							outer_plan);
+}
+
+/*
+ * Construct a tuple descriptor for the scan tuples handled by a foreign join.
+ */
+static TupleDesc
+get_tupdesc_for_join_scan_tuples(ForeignScanState *node)
+{
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	TupleDesc	tupdesc;
+
+	/*
+	 * The core code has already set up a scan tuple slot based on
+	 * fsplan->fdw_scan_tlist, and this slot's tupdesc is mostly good enough,
+	 * but there's one case where it isn't.  If we have any whole-row row
+	 * identifier Vars, they may have vartype RECORD, and we need to replace
+	 * that with the associated table's actual composite type.  This ensures
+	 * that when we read those ROW() expression values from the remote server,
+	 * we can convert them to a composite type the local server knows.
+	 */
+	tupdesc = CreateTupleDescCopy(node->ss.ss_ScanTupleSlot->tts_tupleDescriptor);
+	for (int i = 0; i < tupdesc->natts; i++)
+	{
+		Form_pg_attribute att = TupleDescAttr(tupdesc, i);
+		Var		   *var;
+		RangeTblEntry *rte;
+		Oid			reltype;
+
+		/* Nothing to do if it's not a generic RECORD attribute */
+		if (att->atttypid != RECORDOID || att->atttypmod >= 0)
+			continue;
+
+		/*
+		 * If we can't identify the referenced table, do nothing.  This'll
+		 * likely lead to failure later, but perhaps we can muddle through.
+		 */
+		var = (Var *) list_nth_node(TargetEntry, fsplan->fdw_scan_tlist,
+									i)->expr;
+		if (!IsA(var, Var) || var->varattno != 0)
+			continue;
+		rte = list_nth(estate->es_range_table, var->varno - 1);
+		if (rte->rtekind != RTE_RELATION)
+			continue;
+		reltype = get_rel_type_id(rte->relid);
+		if (!OidIsValid(reltype))
+			continue;
+		att->atttypid = reltype;
+		/* shouldn't need to change anything else */
+	}
+	return tupdesc;
+}
+
+/*
+ * postgresBeginForeignScan
+ *		Initiate an executor scan of a foreign PostgreSQL table.
+ */
+static void
+postgresBeginForeignScan(ForeignScanState *node, int eflags)
+{
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	PgFdwScanState *fsstate;
+	RangeTblEntry *rte;
+	Oid			userid;
+	ForeignTable *table;
+	UserMapping *user;
+	int			rtindex;
+	int			numParams;
+	List	   *late_materialization;
+	List	   *key_table_info;
+	Node	   *key_array_sql;
+	List	   *filter_keys;
+
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/*
+	 * We'll save private state in node->fdw_state.
+	 */
+	fsstate = (PgFdwScanState *) palloc0(sizeof(PgFdwScanState));
+	node->fdw_state = (void *) fsstate;
+
+	/*
 	 * Identify which user to do the remote access as.  This should match what
 	 * ExecCheckPermissions() does.
 	 */
-	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
-	if (fsplan->scan.scanrelid > 0)
-		rtindex = fsplan->scan.scanrelid;
+	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
+	if (fsplan->scan.scanrelid > 0)
+		rtindex = fsplan->scan.scanrelid;
+	else
+		rtindex = bms_next_member(fsplan->fs_base_relids, -1);
+	rte = exec_rt_fetch(rtindex, estate);
+
+	/* Get info about foreign table. */
+	table = GetForeignTable(rte->relid);
+	user = GetUserMapping(userid, table->serverid);
+
+	/*
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
+	 */
+	fsstate->conn = GetConnection(user, false, &fsstate->conn_state);
+
+	/* Assign a unique ID for my cursor */
+	fsstate->cursor_number = GetCursorNumber(fsstate->conn);
+	fsstate->cursor_exists = false;
+
+	/* Get private info created by planner functions. */
+	fsstate->query = strVal(list_nth(fsplan->fdw_private,
+									 FdwScanPrivateSelectSql));
+	fsstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+												 FdwScanPrivateRetrievedAttrs);
+	fsstate->fetch_size = intVal(list_nth(fsplan->fdw_private,
+										  FdwScanPrivateFetchSize));
+
+	/*
+	 * Batches start out at the configured fetch_size, and grow from there as
+	 * long as they come back full; see adjust_fetch_size.  The PGresult that
+	 * carries a batch takes about as much memory again as its tuples, so the
+	 * tuples get half of work_mem.  A semijoin-filtered scan is expected to
+	 * return all of its predicted rows, so it starts out with a batch large
+	 * enough to hold them, memory permitting.
+	 */
+	fsstate->base_fetch_size = fsstate->fetch_size;
+	fsstate->batch_mem_limit = (Size) work_mem * 1024 / 2;
+	if (outerPlan(fsplan) != NULL)
+	{
+		Plan	   *plan = &fsplan->scan.plan;
+		double		row_bytes;
+		double		rows;
+
+		row_bytes = MAXALIGN(plan->plan_width) + FETCHED_ROW_OVERHEAD;
+
+		/* Ask for one row more than predicted, to see EOF in one batch */
+		rows = Min(plan->plan_rows + 1, fsstate->batch_mem_limit / row_bytes);
+		rows = Min(rows, INT_MAX);
+		if (rows > fsstate->fetch_size)
+			fsstate->fetch_size = (int) rows;
+	}
+
+	/* Create contexts for batches of tuples and per-tuple temp workspace. */
+	fsstate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
+											   "postgres_fdw tuple data",
+											   ALLOCSET_DEFAULT_SIZES);
+	fsstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
+											  "postgres_fdw temporary data",
+											  ALLOCSET_SMALL_SIZES);
+
+	/*
+	 * Get info we'll need for converting data fetched from the foreign server
+	 * into local representation and error reporting during that process.
+	 */
+	if (fsplan->scan.scanrelid > 0)
+	{
+		fsstate->rel = node->ss.ss_currentRelation;
+		fsstate->tupdesc = RelationGetDescr(fsstate->rel);
+	}
+	else
+	{
+		fsstate->rel = NULL;
+		fsstate->tupdesc = get_tupdesc_for_join_scan_tuples(node);
+	}
+
+	fsstate->attinmeta = TupleDescGetAttInMetadata(fsstate->tupdesc);
+
+	/*
+	 * Prepare for processing of parameters used in remote query, if any.
+	 */
+	numParams = list_length(fsplan->fdw_exprs);
+	fsstate->numParams = numParams;
+	if (numParams > 0)
+		prepare_query_params((PlanState *) node,
+							 fsplan->fdw_exprs,
+							 numParams,
+							 &fsstate->param_flinfo,
+							 &fsstate->param_exprs,
+							 &fsstate->param_values);
+
+	/* Set the async-capable flag */
+	fsstate->async_capable = node->ss.ps.async_capable;
+
+	/*
+	 * Set up a two-phase scan, if planned.  Phase one runs synchronously
+	 * before the first cursor is declared, so async scans keep to one phase.
+	 * It needs the exact set of local keys besides the filter.
+	 */
+	fsstate->late_batch = -1;
+	late_materialization = (List *) list_nth(fsplan->fdw_private,
+											 FdwScanPrivateLateMaterialization);
+	if (late_materialization != NIL && !fsstate->async_capable &&
+		numParams == 0)
+	{
+		List	   *keycols = (List *) list_nth(late_materialization,
+												FdwLateKeyColumns);
+		ListCell   *lc;
+
+		fsstate->locator_query = strVal(list_nth(late_materialization,
+												 FdwLateLocatorSql));
+		fsstate->nkeycols = list_length(keycols);
+		fsstate->keycols = (int *) palloc(fsstate->nkeycols * sizeof(int));
+		foreach(lc, keycols)
+			fsstate->keycols[foreach_current_index(lc)] = lfirst_int(lc);
+		fsstate->ctid_col = intVal(list_nth(late_materialization,
+											FdwLateCtidColumn));
+		fsstate->fetch_query = strVal(list_nth(late_materialization,
+											   FdwLateFetchSql));
+		node->semijoin_keep_keys = true;
+	}
+
+	/*
+	 * Set up joining with the local keys remotely, if planned.  The key
+	 * table is named after our cursor, which makes it unique within the
+	 * remote transaction, at whose end it goes away.
+	 */
+	key_table_info = (List *) list_nth(fsplan->fdw_private,
+									   FdwScanPrivateKeyTable);
+	if (key_table_info != NIL)
+	{
+		List	   *outer_columns = (List *) list_nth(key_table_info,
+													  FdwKeyTableOuterColumns);
+		char	   *columns = strVal(list_nth(key_table_info,
+											  FdwKeyTableColumns));
+		ListCell   *lc;
+
+		fsstate->key_table = psprintf("pg_temp.postgres_fdw_keys_%u",
+									  fsstate->cursor_number);
+		fsstate->key_table_select = strVal(list_nth(key_table_info,
+													FdwKeyTableSelectSql));
+		fsstate->key_table_ncols = list_length(outer_columns);
+		fsstate->key_table_outer = (int *)
+			palloc(fsstate->key_table_ncols * sizeof(int));
+		foreach(lc, outer_columns)
+			fsstate->key_table_outer[foreach_current_index(lc)] = lfirst_int(lc);
+		fsstate->query = psprintf("%s %s (%s) IN (SELECT %s FROM %s)",
+								  fsstate->query,
+								  boolVal(list_nth(key_table_info,
+												   FdwKeyTableHasWhere)) ?
+								  "AND" : "WHERE",
+								  columns, columns, fsstate->key_table);
+		node->semijoin_fdw_keys = true;
+	}
+
+	/* Or set up looking up the rows by batches of local keys, if planned */
+	key_array_sql = (Node *) list_nth(fsplan->fdw_private,
+									  FdwScanPrivateKeyArraySql);
+	if (key_array_sql != NULL)
+	{
+		Assert(numParams == 0);
+		fsstate->key_array = true;
+		fsstate->fetch_query = strVal(key_array_sql);
+		node->semijoin_fdw_keys = true;
+	}
+
+	/* Where the key columns of a semijoin filter are in the result */
+	filter_keys = (List *) list_nth(fsplan->fdw_private,
+									FdwScanPrivateFilterKeys);
+	if (filter_keys != NIL)
+	{
+		ListCell   *lc;
+
+		fsstate->nfilterkeys = list_length(filter_keys);
+		fsstate->filterkeys = (int *) palloc(fsstate->nfilterkeys * sizeof(int));
+		foreach(lc, filter_keys)
+			fsstate->filterkeys[foreach_current_index(lc)] = lfirst_int(lc);
+	}
+
+	/* Fetch in binary format if asked to, and the column types allow */
+	if (semijoin_binary_transfer)
+		prepare_binary_transfer(fsstate);
+}
+
+/*
+ * postgresIterateForeignScan
+ *		Retrieve next row from the result set, or clear tuple slot to indicate
+ *		EOF.
+ */
+static TupleTableSlot *
+postgresIterateForeignScan(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+
+	/*
+	 * In sync mode, if this is the first call after Begin or ReScan, we need
+	 * to create the cursor on the remote side.  In async mode, we would have
+	 * already created the cursor before we get here, even if this is the
+	 * first call after Begin or ReScan.
+	 */
+	if (!fsstate->cursor_exists)
+		create_cursor(node);
+
+	/*
+	 * Get some more tuples, if we've run out.
+	 */
+	if (fsstate->next_tuple >= fsstate->num_tuples)
+	{
+		/* In async mode, just clear tuple slot. */
+		if (fsstate->async_capable)
+			return ExecClearTuple(slot);
+		/* No point in another fetch if we already detected EOF, though. */
+		if (!fsstate->eof_reached)
+			fetch_more_data(node);
+		/*
+		 * At EOF, go on with the next semijoin filter partition, if any.  Its
+		 * cursor comes with its first batch already fetched.
+		 */
+		while (fsstate->next_tuple >= fsstate->num_tuples &&
+			   fsstate->eof_reached &&
+			   begin_next_filter_partition(node))
+			;
+		/* If we didn't get any tuples, must be end of data. */
+		if (fsstate->next_tuple >= fsstate->num_tuples)
+			return ExecClearTuple(slot);
+	}
+
+	/*
+	 * Return the next tuple.
+	 */
+	ExecStoreHeapTuple(fsstate->tuples[fsstate->next_tuple++],
+					   slot,
+					   false);
+
+	return slot;
+}
+
+/*
+ * postgresReScanForeignScan
+ *		Restart the scan.
+ */
+static void
+postgresReScanForeignScan(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	char		sql[64];
+	PGresult   *res;
+
+	/* If we haven't created the cursor yet, nothing to do. */
+	if (!fsstate->cursor_exists)
+		return;
+
+	/*
+	 * If the node is async-capable, and an asynchronous fetch for it has
+	 * begun, the asynchronous fetch might not have yet completed.  Check if
+	 * the node is async-capable, and an asynchronous fetch for it is still in
+	 * progress; if so, complete the asynchronous fetch before restarting the
+	 * scan.
+	 */
+	if (fsstate->async_capable &&
+		fsstate->conn_state->pendingAreq &&
+		fsstate->conn_state->pendingAreq->requestee == (PlanState *) node)
+		fetch_more_data(node);
+
+	/*
+	 * If any internal parameters affecting this node have changed, we'd
+	 * better destroy and recreate the cursor.  Otherwise, if the remote
+	 * server is v14 or older, rewinding it should be good enough; if not,
+	 * rewind is only allowed for scrollable cursors, but we don't have a way
+	 * to check the scrollability of it, so destroy and recreate it in any
+	 * case.  If we've only fetched zero or one batch, we needn't even rewind
+	 * the cursor, just rescan what we have.
+	 */
+	if (node->ss.ps.chgParam != NULL || fsstate->filter_part > 0 ||
+		fsstate->late_batch > 0)
+	{
+		/* Also, rewinding would only rewind the current filter partition */
+		close_scan_cursor(node);
+	}
+	else if (fsstate->fetch_ct_2 > 1)
+	{
+		if (PQserverVersion(fsstate->conn) < 150000)
+		{
+			snprintf(sql, sizeof(sql), "MOVE BACKWARD ALL IN c%u",
+					 fsstate->cursor_number);
+
+			/*
+			 * We don't use a PG_TRY block here, so be careful not to throw
+			 * error without releasing the PGresult.
+			 */
+			res = pgfdw_exec_query(fsstate->conn, sql, fsstate->conn_state);
+			if (PQresultStatus(res) != PGRES_COMMAND_OK)
+				pgfdw_report_error(ERROR, res, fsstate->conn, true, sql);
+			PQclear(res);
+		}
+		else
+			close_scan_cursor(node);
+	}
+	else
+	{
+		/* Easy: just rescan what we already have in memory, if anything */
+		fsstate->next_tuple = 0;
+		return;
+	}
+
+	/* Now force a fresh FETCH. */
+	fsstate->tuples = NULL;
+	fsstate->num_tuples = 0;
+	fsstate->next_tuple = 0;
+	fsstate->fetch_ct_2 = 0;
+	fsstate->eof_reached = false;
+	fsstate->filter_part = 0;
+
+	/*
+	 * A new filter means locating the matching rows anew.  New keys mean new
+	 * key batches, which create_cursor makes up once the executor has told
+	 * us so by resetting child_materialised.
+	 */
+	if (node->ss.ps.chgParam != NULL && !fsstate->key_array)
+		fsstate->late_batch = -1;
+	else if (fsstate->late_batch > 0)
+		fsstate->late_batch = 0;
+}
+
+/*
+ * postgresEndForeignScan
+ *		Finish scanning foreign table and dispose objects used for this scan
+ */
+static void
+postgresEndForeignScan(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+
+	/* if fsstate is NULL, we are in EXPLAIN; nothing to do */
+	if (fsstate == NULL)
+		return;
+
+	/* Close the cursor if open, to prevent accumulation of cursors */
+	if (fsstate->cursor_exists)
+		close_scan_cursor(node);
+
+	/* Add what the semijoin filter did to the cumulative statistics */
+	if (node->semijoin_instr)
+		record_semijoin_stats(node);
+
+	/* Release remote connection */
+	ReleaseConnection(fsstate->conn);
+	fsstate->conn = NULL;
+
+	/* MemoryContexts will be deleted automatically. */
+}
+
+/*
+ * postgresAddForeignUpdateTargets
+ *		Add resjunk column(s) needed for update/delete on a foreign table
+ */
+static void
+postgresAddForeignUpdateTargets(PlannerInfo *root,
+								Index rtindex,
+								RangeTblEntry *target_rte,
+								Relation target_relation)
+{
+	Var		   *var;
+
+	/*
+	 * In postgres_fdw, what we need is the ctid, same as for a regular table.
+	 */
+
+	/* Make a Var representing the desired value */
+	var = makeVar(rtindex,
+				  SelfItemPointerAttributeNumber,
+				  TIDOID,
+				  -1,
+				  InvalidOid,
+				  0);
+
+	/* Register it as a row-identity column needed by this target rel */
+	add_row_identity_var(root, var, rtindex, "ctid");
+}
+
+/*
+ * postgresPlanForeignModify
+ *		Plan an insert/update/delete operation on a foreign table
+ */
+static List *
+postgresPlanForeignModify(PlannerInfo *root,
+						  ModifyTable *plan,
+						  Index resultRelation,
+						  int subplan_index)
+{
+	CmdType		operation = plan->operation;
+	RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+	Relation	rel;
+	StringInfoData sql;
+	List	   *targetAttrs = NIL;
+	List	   *withCheckOptionList = NIL;
+	List	   *returningList = NIL;
+	List	   *retrieved_attrs = NIL;
+	bool		doNothing = false;
+	int			values_end_len = -1;
+
+	initStringInfo(&sql);
+
+	/*
+	 * Core code already has some lock on each rel being planned, so we can
+	 * use NoLock here.
+	 */
+	rel = table_open(rte->relid, NoLock);
+
+	/*
+	 * In an INSERT, we transmit all columns that are defined in the foreign
+	 * table.  In an UPDATE, if there are BEFORE ROW UPDATE triggers on the
+	 * foreign table, we transmit all columns like INSERT; else we transmit
+	 * only columns that were explicitly targets of the UPDATE, so as to avoid
+	 * unnecessary data transmission.  (We can't do that for INSERT since we
+	 * would miss sending default values for columns not listed in the source
+	 * statement, and for UPDATE if there are BEFORE ROW UPDATE triggers since
+	 * those triggers might change values for non-target columns, in which
+	 * case we would miss sending changed values for those columns.)
+	 */
+	if (operation == CMD_INSERT ||
+		(operation == CMD_UPDATE &&
+		 rel->trigdesc &&
+		 rel->trigdesc->trig_update_before_row))
+	{
+		TupleDesc	tupdesc = RelationGetDescr(rel);
+		int			attnum;
+
+		for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+		{
+			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+
+			if (!attr->attisdropped)
+				targetAttrs = lappend_int(targetAttrs, attnum);
+		}
+	}
+	else if (operation == CMD_UPDATE)
+	{
+		int			col;
+		RelOptInfo *rel = find_base_rel(root, resultRelation);
+		Bitmapset  *allUpdatedCols = get_rel_all_updated_cols(root, rel);
+
+		col = -1;
+		while ((col = bms_next_member(allUpdatedCols, col)) >= 0)
+		{
+			/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
+			AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+
+			if (attno <= InvalidAttrNumber) /* shouldn't happen */
+				elog(ERROR, "system-column update is not supported");
+			targetAttrs = lappend_int(targetAttrs, attno);
+		}
+	}
+
+	/*
+	 * Extract the relevant WITH CHECK OPTION list if any.
+	 */
+	if (plan->withCheckOptionLists)
+		withCheckOptionList = (List *) list_nth(plan->withCheckOptionLists,
+												subplan_index);
+
+	/*
+	 * Extract the relevant RETURNING list if any.
+	 */
+	if (plan->returningLists)
+		returningList = (List *) list_nth(plan->returningLists, subplan_index);
+
+	/*
+	 * ON CONFLICT DO UPDATE and DO NOTHING case with inference specification
+	 * should have already been rejected in the optimizer, as presently there
+	 * is no way to recognize an arbiter index on a foreign table.  Only DO
+	 * NOTHING is supported without an inference specification.
+	 */
+	if (plan->onConflictAction == ONCONFLICT_NOTHING)
+		doNothing = true;
+	else if (plan->onConflictAction != ONCONFLICT_NONE)
+		elog(ERROR, "unexpected ON CONFLICT specification: %d",
+			 (int) plan->onConflictAction);
+
+	/*
+	 * Construct the SQL command string.
+	 */
+	switch (operation)
+	{
+		case CMD_INSERT:
+			deparseInsertSql(&sql, rte, resultRelation, rel,
+							 targetAttrs, doNothing,
+							 withCheckOptionList, returningList,
+							 &retrieved_attrs, &values_end_len);
+			break;
+		case CMD_UPDATE:
+			deparseUpdateSql(&sql, rte, resultRelation, rel,
+							 targetAttrs,
+							 withCheckOptionList, returningList,
+							 &retrieved_attrs);
+			break;
+		case CMD_DELETE:
+			deparseDeleteSql(&sql, rte, resultRelation, rel,
+							 returningList,
+							 &retrieved_attrs);
+			break;
+		default:
+			elog(ERROR, "unexpected operation: %d", (int) operation);
+			break;
+	}
+
+	table_close(rel, NoLock);
+
+	/*
+	 * Build the fdw_private list that will be available to the executor.
+	 * Items in the list must match enum FdwModifyPrivateIndex, above.
+	 */
+	return list_make5(makeString(sql.data),
+					  targetAttrs,
+					  makeInteger(values_end_len),
+					  makeBoolean((retrieved_attrs != NIL)),
+					  retrieved_attrs);
+}
+
+/*
+ * postgresBeginForeignModify
+ *		Begin an insert/update/delete operation on a foreign table
+ */
+static void
+postgresBeginForeignModify(ModifyTableState *mtstate,
+						   ResultRelInfo *resultRelInfo,
+						   List *fdw_private,
+						   int subplan_index,
+						   int eflags)
+{
+	PgFdwModifyState *fmstate;
+	char	   *query;
+	List	   *target_attrs;
+	bool		has_returning;
+	int			values_end_len;
+	List	   *retrieved_attrs;
+	RangeTblEntry *rte;
+
+	/*
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  resultRelInfo->ri_FdwState
+	 * stays NULL.
+	 */
+	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
+		return;
+
+	/* Deconstruct fdw_private data. */
+	query = strVal(list_nth(fdw_private,
+							FdwModifyPrivateUpdateSql));
+	target_attrs = (List *) list_nth(fdw_private,
+									 FdwModifyPrivateTargetAttnums);
+	values_end_len = intVal(list_nth(fdw_private,
+									 FdwModifyPrivateLen));
+	has_returning = boolVal(list_nth(fdw_private,
+									 FdwModifyPrivateHasReturning));
+	retrieved_attrs = (List *) list_nth(fdw_private,
+										FdwModifyPrivateRetrievedAttrs);
+
+	/* Find RTE. */
+	rte = exec_rt_fetch(resultRelInfo->ri_RangeTableIndex,
+						mtstate->ps.state);
+
+	/* Construct an execution state. */
+	fmstate = create_foreign_modify(mtstate->ps.state,
+									rte,
+									resultRelInfo,
+									mtstate->operation,
+									outerPlanState(mtstate)->plan,
+									query,
+									target_attrs,
+									values_end_len,
+									has_returning,
+									retrieved_attrs);
+
+	resultRelInfo->ri_FdwState = fmstate;
+}
+
+/*
+ * postgresExecForeignInsert
+ *		Insert one row into a foreign table
+ */
+static TupleTableSlot *
+postgresExecForeignInsert(EState *estate,
+						  ResultRelInfo *resultRelInfo,
+						  TupleTableSlot *slot,
+						  TupleTableSlot *planSlot)
+{
+	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
+	TupleTableSlot **rslot;
+	int			numSlots = 1;
+
+	/*
+	 * If the fmstate has aux_fmstate set, use the aux_fmstate (see
+	 * postgresBeginForeignInsert())
+	 */
+	if (fmstate->aux_fmstate)
+		resultRelInfo->ri_FdwState = fmstate->aux_fmstate;
+	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_INSERT,
+								   &slot, &planSlot, &numSlots);
+	/* Revert that change */
+	if (fmstate->aux_fmstate)
+		resultRelInfo->ri_FdwState = fmstate;
+
+	return rslot ? *rslot : NULL;
+}
+
+/*
+ * postgresExecForeignBatchInsert
+ *		Insert multiple rows into a foreign table
+ */
+static TupleTableSlot **
+postgresExecForeignBatchInsert(EState *estate,
+							   ResultRelInfo *resultRelInfo,
+							   TupleTableSlot **slots,
+							   TupleTableSlot **planSlots,
+							   int *numSlots)
+{
+	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
+	TupleTableSlot **rslot;
+
+	/*
+	 * If the fmstate has aux_fmstate set, use the aux_fmstate (see
+	 * postgresBeginForeignInsert())
+	 */
+	if (fmstate->aux_fmstate)
+		resultRelInfo->ri_FdwState = fmstate->aux_fmstate;
+	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_INSERT,
+								   slots, planSlots, numSlots);
+	/* Revert that change */
+	if (fmstate->aux_fmstate)
+		resultRelInfo->ri_FdwState = fmstate;
+
+	return rslot;
+}
+
+/*
+ * postgresGetForeignModifyBatchSize
+ *		Determine the maximum number of tuples that can be inserted in bulk
+ *
+ * Returns the batch size specified for server or table. When batching is not
+ * allowed (e.g. for tables with BEFORE/AFTER ROW triggers or with RETURNING
+ * clause), returns 1.
+ */
+static int
+postgresGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
+{
+	int			batch_size;
+	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
+
+	/* should be called only once */
+	Assert(resultRelInfo->ri_BatchSize == 0);
+
+	/*
+	 * Should never get called when the insert is being performed on a table
+	 * that is also among the target relations of an UPDATE operation, because
+	 * postgresBeginForeignInsert() currently rejects such insert attempts.
+	 */
+	Assert(fmstate == NULL || fmstate->aux_fmstate == NULL);
+
+	/*
+	 * In EXPLAIN without ANALYZE, ri_FdwState is NULL, so we have to lookup
+	 * the option directly in server/table options. Otherwise just use the
+	 * value we determined earlier.
+	 */
+	if (fmstate)
+		batch_size = fmstate->batch_size;
 	else
-		rtindex = bms_next_member(fsplan->fs_base_relids, -1);
-	rte = exec_rt_fetch(rtindex, estate);
+		batch_size = get_batch_size_option(resultRelInfo->ri_RelationDesc);
+
+	/*
+	 * Disable batching when we have to use RETURNING, there are any
+	 * BEFORE/AFTER ROW INSERT triggers on the foreign table, or there are any
+	 * WITH CHECK OPTION constraints from parent views.
+	 *
+	 * When there are any BEFORE ROW INSERT triggers on the table, we can't
+	 * support it, because such triggers might query the table we're inserting
+	 * into and act differently if the tuples that have already been processed
+	 * and prepared for insertion are not there.
+	 */
+	if (resultRelInfo->ri_projectReturning != NULL ||
+		resultRelInfo->ri_WithCheckOptions != NIL ||
+		(resultRelInfo->ri_TrigDesc &&
+		 (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
+		  resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
+		return 1;
+
+	/*
+	 * If the foreign table has no columns, disable batching as the INSERT
+	 * syntax doesn't allow batching multiple empty rows into a zero-column
+	 * table in a single statement.  This is needed for COPY FROM, in which
+	 * case fmstate must be non-NULL.
+	 */
+	if (fmstate && list_length(fmstate->target_attrs) == 0)
+		return 1;
+
+	/*
+	 * Otherwise use the batch size specified for server/table. The number of
+	 * parameters in a batch is limited to 65535 (uint16), so make sure we
+	 * don't exceed this limit by using the maximum batch_size possible.
+	 */
+	if (fmstate && fmstate->p_nums > 0)
+		batch_size = Min(batch_size, PQ_QUERY_PARAM_MAX_LIMIT / fmstate->p_nums);
+
+	return batch_size;
+}
+
+/*
+ * postgresExecForeignUpdate
+ *		Update one row in a foreign table
+ */
+static TupleTableSlot *
+postgresExecForeignUpdate(EState *estate,
+						  ResultRelInfo *resultRelInfo,
+						  TupleTableSlot *slot,
+						  TupleTableSlot *planSlot)
+{
+	TupleTableSlot **rslot;
+	int			numSlots = 1;
+
+	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_UPDATE,
+								   &slot, &planSlot, &numSlots);
+
+	return rslot ? rslot[0] : NULL;
+}
+
+/*
+ * postgresExecForeignDelete
+ *		Delete one row from a foreign table
+ */
+static TupleTableSlot *
+postgresExecForeignDelete(EState *estate,
+						  ResultRelInfo *resultRelInfo,
+						  TupleTableSlot *slot,
+						  TupleTableSlot *planSlot)
+{
+	TupleTableSlot **rslot;
+	int			numSlots = 1;
+
+	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_DELETE,
+								   &slot, &planSlot, &numSlots);
+
+	return rslot ? rslot[0] : NULL;
+}
+
+/*
+ * postgresEndForeignModify
+ *		Finish an insert/update/delete operation on a foreign table
+ */
+static void
+postgresEndForeignModify(EState *estate,
+						 ResultRelInfo *resultRelInfo)
+{
+	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
 
-	/* Get info about foreign table. */
-	table = GetForeignTable(rte->relid);
-	user = GetUserMapping(userid, table->serverid);
+	/* If fmstate is NULL, we are in EXPLAIN; nothing to do */
+	if (fmstate == NULL)
+		return;
+
+	/* Destroy the execution state */
+	finish_foreign_modify(fmstate);
+}
+
+/*
+ * postgresBeginForeignInsert
+ *		Begin an insert operation on a foreign table
+ */
+static void
+postgresBeginForeignInsert(ModifyTableState *mtstate,
+						   ResultRelInfo *resultRelInfo)
+{
+	PgFdwModifyState *fmstate;
+	ModifyTable *plan = castNode(ModifyTable, mtstate->ps.plan);
+	EState	   *estate = mtstate->ps.state;
+	Index		resultRelation;
+	Relation	rel = resultRelInfo->ri_RelationDesc;
+	RangeTblEntry *rte;
+	TupleDesc	tupdesc = RelationGetDescr(rel);
+	int			attnum;
+	int			values_end_len;
+	StringInfoData sql;
+	List	   *targetAttrs = NIL;
+	List	   *retrieved_attrs = NIL;
+	bool		doNothing = false;
 
 	/*
-	 * Get connection to the foreign server.  Connection manager will
-	 * establish new connection if necessary.
+	 * If the foreign table we are about to insert routed rows into is also an
+	 * UPDATE subplan result rel that will be updated later, proceeding with
+	 * the INSERT will result in the later UPDATE incorrectly modifying those
+	 * routed rows, so prevent the INSERT --- it would be nice if we could
+	 * handle this case; but for now, throw an error for safety.
 	 */
-	fsstate->conn = GetConnection(user, false, &fsstate->conn_state);
+	if (plan && plan->operation == CMD_UPDATE &&
+		(resultRelInfo->ri_usesFdwDirectModify ||
+		 resultRelInfo->ri_FdwState))
+		ereport(ERROR,
+				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
+				 errmsg("cannot route tuples into foreign table to be updated \"%s\"",
+						RelationGetRelationName(rel))));
 
-	/* Assign a unique ID for my cursor */
-	fsstate->cursor_number = GetCursorNumber(fsstate->conn);
-	fsstate->cursor_exists = false;
+	initStringInfo(&sql);
 
-	/* Get private info created by planner functions. */
-	fsstate->query = strVal(list_nth(fsplan->fdw_private,
-									 FdwScanPrivateSelectSql));
-	fsstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
-												 FdwScanPrivateRetrievedAttrs);
-	fsstate->fetch_size = intVal(list_nth(fsplan->fdw_private,
-										  FdwScanPrivateFetchSize));
+	/* We transmit all columns that are defined in the foreign table. */
+	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	{
+		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
 
-	/* Create contexts for batches of tuples and per-tuple temp workspace. */
-	fsstate->batch_cxt = AllocSetContextCreate(estate->es_query_cxt,
-											   "postgres_fdw tuple data",
-											   ALLOCSET_DEFAULT_SIZES);
-	fsstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
-											  "postgres_fdw temporary data",
-											  ALLOCSET_SMALL_SIZES);
+		if (!attr->attisdropped)
+			targetAttrs = lappend_int(targetAttrs, attnum);
+	}
+
+	/* Check if we add the ON CONFLICT clause to the remote query. */
+	if (plan)
+	{
+		OnConflictAction onConflictAction = plan->onConflictAction;
+
+		/* We only support DO NOTHING without an inference specification. */
+		if (onConflictAction == ONCONFLICT_NOTHING)
+			doNothing = true;
+		else if (onConflictAction != ONCONFLICT_NONE)
+			elog(ERROR, "unexpected ON CONFLICT specification: %d",
+				 (int) onConflictAction);
+	}
 
 	/*
-	 * Get info we'll need for converting data fetched from the foreign server
-	 * into local representation and error reporting during that process.
+	 * If the foreign table is a partition that doesn't have a corresponding
+	 * RTE entry, we need to create a new RTE describing the foreign table for
+	 * use by deparseInsertSql and create_foreign_modify() below, after first
+	 * copying the parent's RTE and modifying some fields to describe the
+	 * foreign partition to work on. However, if this is invoked by UPDATE,
+	 * the existing RTE may already correspond to this partition if it is one
+	 * of the UPDATE subplan target rels; in that case, we can just use the
+	 * existing RTE as-is.
 	 */
-	if (fsplan->scan.scanrelid > 0)
+	if (resultRelInfo->ri_RangeTableIndex == 0)
 	{
-		fsstate->rel = node->ss.ss_currentRelation;
-		fsstate->tupdesc = RelationGetDescr(fsstate->rel);
+		ResultRelInfo *rootResultRelInfo = resultRelInfo->ri_RootResultRelInfo;
+
+		rte = exec_rt_fetch(rootResultRelInfo->ri_RangeTableIndex, estate);
+		rte = copyObject(rte);
+		rte->relid = RelationGetRelid(rel);
+		rte->relkind = RELKIND_FOREIGN_TABLE;
+
+		/*
+		 * For UPDATE, we must use the RT index of the first subplan target
+		 * rel's RTE, because the core code would have built expressions for
+		 * the partition, such as RETURNING, using that RT index as varno of
+		 * Vars contained in those expressions.
+		 */
+		if (plan && plan->operation == CMD_UPDATE &&
+			rootResultRelInfo->ri_RangeTableIndex == plan->rootRelation)
+			resultRelation = mtstate->resultRelInfo[0].ri_RangeTableIndex;
+		else
+			resultRelation = rootResultRelInfo->ri_RangeTableIndex;
 	}
 	else
 	{
-		fsstate->rel = NULL;
-		fsstate->tupdesc = get_tupdesc_for_join_scan_tuples(node);
+		resultRelation = resultRelInfo->ri_RangeTableIndex;
+		rte = exec_rt_fetch(resultRelation, estate);
 	}
 
-	fsstate->attinmeta = TupleDescGetAttInMetadata(fsstate->tupdesc);
+	/* Construct the SQL command string. */
+	deparseInsertSql(&sql, rte, resultRelation, rel, targetAttrs, doNothing,
+					 resultRelInfo->ri_WithCheckOptions,
+					 resultRelInfo->ri_returningList,
+					 &retrieved_attrs, &values_end_len);
+
+	/* Construct an execution state. */
+	fmstate = create_foreign_modify(mtstate->ps.state,
+									rte,
+									resultRelInfo,
+									CMD_INSERT,
+									NULL,
+									sql.data,
+									targetAttrs,
+									values_end_len,
+									retrieved_attrs != NIL,
+									retrieved_attrs);
 
 	/*
-	 * Prepare for processing of parameters used in remote query, if any.
+	 * If the given resultRelInfo already has PgFdwModifyState set, it means
+	 * the foreign table is an UPDATE subplan result rel; in which case, store
+	 * the resulting state into the aux_fmstate of the PgFdwModifyState.
 	 */
-	numParams = list_length(fsplan->fdw_exprs);
-	fsstate->numParams = numParams;
-	if (numParams > 0)
-		prepare_query_params((PlanState *) node,
-							 fsplan->fdw_exprs,
-							 numParams,
-							 &fsstate->param_flinfo,
-							 &fsstate->param_exprs,
-							 &fsstate->param_values);
-
-	/* Set the async-capable flag */
-	fsstate->async_capable = node->ss.ps.async_capable;
+	if (resultRelInfo->ri_FdwState)
+	{
+		Assert(plan && plan->operation == CMD_UPDATE);
+		Assert(resultRelInfo->ri_usesFdwDirectModify == false);
+		((PgFdwModifyState *) resultRelInfo->ri_FdwState)->aux_fmstate = fmstate;
+	}
+	else
+		resultRelInfo->ri_FdwState = fmstate;
 }
 
 /*
- * postgresIterateForeignScan
- *		Retrieve next row from the result set, or clear tuple slot to indicate
- *		EOF.
+ * postgresEndForeignInsert
+ *		Finish an insert operation on a foreign table
  */
-static TupleTableSlot *
-postgresIterateForeignScan(ForeignScanState *node)
+static void
+postgresEndForeignInsert(EState *estate,
+						 ResultRelInfo *resultRelInfo)
 {
-	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
-	TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-
-	/*
-	 * In sync mode, if this is the first call after Begin or ReScan, we need
-	 * to create the cursor on the remote side.  In async mode, we would have
-	 * already created the cursor before we get here, even if this is the
-	 * first call after Begin or ReScan.
-	 */
-	if (!fsstate->cursor_exists)
-		create_cursor(node);
+	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
 
-	/*
-	 * Get some more tuples, if we've run out.
-	 */
-	if (fsstate->next_tuple >= fsstate->num_tuples)
-	{
-		/* In async mode, just clear tuple slot. */
-		if (fsstate->async_capable)
-			return ExecClearTuple(slot);
-		/* No point in another fetch if we already detected EOF, though. */
-		if (!fsstate->eof_reached)
-			fetch_more_data(node);
-		/* If we didn't get any tuples, must be end of data. */
-		if (fsstate->next_tuple >= fsstate->num_tuples)
-			return ExecClearTuple(slot);
-	}
+	Assert(fmstate != NULL);
 
 	/*
-	 * Return the next tuple.
+	 * If the fmstate has aux_fmstate set, get the aux_fmstate (see
+	 * postgresBeginForeignInsert())
 	 */
-	ExecStoreHeapTuple(fsstate->tuples[fsstate->next_tuple++],
-					   slot,
-					   false);
+	if (fmstate->aux_fmstate)
+		fmstate = fmstate->aux_fmstate;
 
-	return slot;
+	/* Destroy the execution state */
+	finish_foreign_modify(fmstate);
 }
 
 /*
- * postgresReScanForeignScan
- *		Restart the scan.
+ * postgresIsForeignRelUpdatable
+ *		Determine whether a foreign table supports INSERT, UPDATE and/or
+ *		DELETE.
  */
-static void
-postgresReScanForeignScan(ForeignScanState *node)
+static int
+postgresIsForeignRelUpdatable(Relation rel)
 {
-	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
-	char		sql[64];
-	PGresult   *res;
-
-	/* If we haven't created the cursor yet, nothing to do. */
-	if (!fsstate->cursor_exists)
-		return;
-
-	/*
-	 * If the node is async-capable, and an asynchronous fetch for it has
-	 * begun, the asynchronous fetch might not have yet completed.  Check if
-	 * the node is async-capable, and an asynchronous fetch for it is still in
-	 * progress; if so, complete the asynchronous fetch before restarting the
-	 * scan.
-	 */
-	if (fsstate->async_capable &&
-		fsstate->conn_state->pendingAreq &&
-		fsstate->conn_state->pendingAreq->requestee == (PlanState *) node)
-		fetch_more_data(node);
+	bool		updatable;
+	ForeignTable *table;
+	ForeignServer *server;
+	ListCell   *lc;
 
 	/*
-	 * If any internal parameters affecting this node have changed, we'd
-	 * better destroy and recreate the cursor.  Otherwise, if the remote
-	 * server is v14 or older, rewinding it should be good enough; if not,
-	 * rewind is only allowed for scrollable cursors, but we don't have a way
-	 * to check the scrollability of it, so destroy and recreate it in any
-	 * case.  If we've only fetched zero or one batch, we needn't even rewind
-	 * the cursor, just rescan what we have.
+	 * By default, all postgres_fdw foreign tables are assumed updatable. This
+	 * can be overridden by a per-server setting, which in turn can be
+	 * overridden by a per-table setting.
 	 */
-	if (node->ss.ps.chgParam != NULL)
-	{
-		fsstate->cursor_exists = false;
-		snprintf(sql, sizeof(sql), "CLOSE c%u",
-				 fsstate->cursor_number);
-	}
-	else if (fsstate->fetch_ct_2 > 1)
+	updatable = true;
+
+	table = GetForeignTable(RelationGetRelid(rel));
+	server = GetForeignServer(table->serverid);
+
+	foreach(lc, server->options)
 	{
-		if (PQserverVersion(fsstate->conn) < 150000)
-			snprintf(sql, sizeof(sql), "MOVE BACKWARD ALL IN c%u",
-					 fsstate->cursor_number);
-		else
-		{
-			fsstate->cursor_exists = false;
-			snprintf(sql, sizeof(sql), "CLOSE c%u",
-					 fsstate->cursor_number);
-		}
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "updatable") == 0)
+			updatable = defGetBoolean(def);
 	}
-	else
+	foreach(lc, table->options)
 	{
-		/* Easy: just rescan what we already have in memory, if anything */
-		fsstate->next_tuple = 0;
-		return;
+		DefElem    *def = (DefElem *) lfirst(lc);
+
+		if (strcmp(def->defname, "updatable") == 0)
+			updatable = defGetBoolean(def);
 	}
 
 	/*
-	 * We don't use a PG_TRY block here, so be careful not to throw error
-	 * without releasing the PGresult.
+	 * Currently "updatable" means support for INSERT, UPDATE and DELETE.
 	 */
-	res = pgfdw_exec_query(fsstate->conn, sql, fsstate->conn_state);
-	if (PQresultStatus(res) != PGRES_COMMAND_OK)
-		pgfdw_report_error(ERROR, res, fsstate->conn, true, sql);
-	PQclear(res);
-
-	/* Now force a fresh FETCH. */
-	fsstate->tuples = NULL;
-	fsstate->num_tuples = 0;
-	fsstate->next_tuple = 0;
-	fsstate->fetch_ct_2 = 0;
-	fsstate->eof_reached = false;
+	return updatable ?
+		(1 << CMD_INSERT) | (1 << CMD_UPDATE) | (1 << CMD_DELETE) : 0;
 }
 
 /*
- * postgresEndForeignScan
- *		Finish scanning foreign table and dispose objects used for this scan
+ * postgresRecheckForeignScan
+ *		Execute a local join execution plan for a foreign join
  */
-static void
-postgresEndForeignScan(ForeignScanState *node)
+static bool
+postgresRecheckForeignScan(ForeignScanState *node, TupleTableSlot *slot)
 {
-	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	Index		scanrelid = ((Scan *) node->ss.ps.plan)->scanrelid;
+	PlanState  *outerPlan = outerPlanState(node);
+	TupleTableSlot *result;
 
-	/* if fsstate is NULL, we are in EXPLAIN; nothing to do */
-	if (fsstate == NULL)
-		return;
+	/* For base foreign relations, it suffices to set fdw_recheck_quals */
+	if (scanrelid > 0)
+		return true;
 
-	/* Close the cursor if open, to prevent accumulation of cursors */
-	if (fsstate->cursor_exists)
-		close_cursor(fsstate->conn, fsstate->cursor_number,
-					 fsstate->conn_state);
+	Assert(outerPlan != NULL);
 
-	/* Release remote connection */
-	ReleaseConnection(fsstate->conn);
-	fsstate->conn = NULL;
+	/* Execute a local join execution plan */
+	result = ExecProcNode(outerPlan);
+	if (TupIsNull(result))
+		return false;
 
-	/* MemoryContexts will be deleted automatically. */
+	/* Store result in the given slot */
+	ExecCopySlot(slot, result);
+
+	return true;
 }
 
 /*
- * postgresAddForeignUpdateTargets
- *		Add resjunk column(s) needed for update/delete on a foreign table
+ * find_modifytable_subplan
+ *		Helper routine for postgresPlanDirectModify to find the
+ *		ModifyTable subplan node that scans the specified RTI.
+ *
+ * Returns NULL if the subplan couldn't be identified.  That's not a fatal
+ * error condition, we just abandon trying to do the update directly.
  */
-static void
-postgresAddForeignUpdateTargets(PlannerInfo *root,
-								Index rtindex,
-								RangeTblEntry *target_rte,
-								Relation target_relation)
+static ForeignScan *
+find_modifytable_subplan(PlannerInfo *root,
+						 ModifyTable *plan,
+						 Index rtindex,
+						 int subplan_index)
 {
-	Var		   *var;
+	Plan	   *subplan = outerPlan(plan);
 
 	/*
-	 * In postgres_fdw, what we need is the ctid, same as for a regular table.
+	 * The cases we support are (1) the desired ForeignScan is the immediate
+	 * child of ModifyTable, or (2) it is the subplan_index'th child of an
+	 * Append node that is the immediate child of ModifyTable.  There is no
+	 * point in looking further down, as that would mean that local joins are
+	 * involved, so we can't do the update directly.
+	 *
+	 * There could be a Result atop the Append too, acting to compute the
+	 * UPDATE targetlist values.  We ignore that here; the tlist will be
+	 * checked by our caller.
+	 *
+	 * In principle we could examine all the children of the Append, but it's
+	 * currently unlikely that the core planner would generate such a plan
+	 * with the children out-of-order.  Moreover, such a search risks costing
+	 * O(N^2) time when there are a lot of children.
 	 */
+	if (IsA(subplan, Append))
+	{
+		Append	   *appendplan = (Append *) subplan;
 
-	/* Make a Var representing the desired value */
-	var = makeVar(rtindex,
-				  SelfItemPointerAttributeNumber,
-				  TIDOID,
-				  -1,
-				  InvalidOid,
-				  0);
+		if (subplan_index < list_length(appendplan->appendplans))
+			subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+	}
+	else if (IsA(subplan, Result) &&
+			 outerPlan(subplan) != NULL &&
+			 IsA(outerPlan(subplan), Append))
+	{
+		Append	   *appendplan = (Append *) outerPlan(subplan);
 
-	/* Register it as a row-identity column needed by this target rel */
-	add_row_identity_var(root, var, rtindex, "ctid");
+		if (subplan_index < list_length(appendplan->appendplans))
+			subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
+	}
+
+	/* Now, have we got a ForeignScan on the desired rel? */
+	if (IsA(subplan, ForeignScan))
+	{
+		ForeignScan *fscan = (ForeignScan *) subplan;
+
+		if (bms_is_member(rtindex, fscan->fs_base_relids))
+			return fscan;
+	}
+
+	return NULL;
 }
 
 /*
- * postgresPlanForeignModify
- *		Plan an insert/update/delete operation on a foreign table
+ * postgresPlanDirectModify
+ *		Consider a direct foreign table modification
+ *
+ * Decide whether it is safe to modify a foreign table directly, and if so,
+ * rewrite subplan accordingly.
  */
-static List *
-postgresPlanForeignModify(PlannerInfo *root,
-						  ModifyTable *plan,
-						  Index resultRelation,
-						  int subplan_index)
+static bool
+postgresPlanDirectModify(PlannerInfo *root,
+						 ModifyTable *plan,
+						 Index resultRelation,
+						 int subplan_index)
 {
 	CmdType		operation = plan->operation;
-	RangeTblEntry *rte = planner_rt_fetch(resultRelation, root);
+	RelOptInfo *foreignrel;
+	RangeTblEntry *rte;
+	PgFdwRelationInfo *fpinfo;
 	Relation	rel;
 	StringInfoData sql;
+	ForeignScan *fscan;
+	List	   *processed_tlist = NIL;
 	List	   *targetAttrs = NIL;
-	List	   *withCheckOptionList = NIL;
+	List	   *remote_exprs;
+	List	   *params_list = NIL;
 	List	   *returningList = NIL;
 	List	   *retrieved_attrs = NIL;
-	bool		doNothing = false;
-	int			values_end_len = -1;
 
-	initStringInfo(&sql);
+	/*
+	 * Decide whether it is safe to modify a foreign table directly.
+	 */
 
 	/*
-	 * Core code already has some lock on each rel being planned, so we can
-	 * use NoLock here.
+	 * The table modification must be an UPDATE or DELETE.
 	 */
-	rel = table_open(rte->relid, NoLock);
+	if (operation != CMD_UPDATE && operation != CMD_DELETE)
+		return false;
 
 	/*
-	 * In an INSERT, we transmit all columns that are defined in the foreign
-	 * table.  In an UPDATE, if there are BEFORE ROW UPDATE triggers on the
-	 * foreign table, we transmit all columns like INSERT; else we transmit
-	 * only columns that were explicitly targets of the UPDATE, so as to avoid
-	 * unnecessary data transmission.  (We can't do that for INSERT since we
-	 * would miss sending default values for columns not listed in the source
-	 * statement, and for UPDATE if there are BEFORE ROW UPDATE triggers since
-	 * those triggers might change values for non-target columns, in which
-	 * case we would miss sending changed values for those columns.)
+	 * Try to locate the ForeignScan subplan that's scanning resultRelation.
 	 */
-	if (operation == CMD_INSERT ||
-		(operation == CMD_UPDATE &&
-		 rel->trigdesc &&
-		 rel->trigdesc->trig_update_before_row))
-	{
-		TupleDesc	tupdesc = RelationGetDescr(rel);
-		int			attnum;
+	fscan = find_modifytable_subplan(root, plan, resultRelation, subplan_index);
+	if (!fscan)
+		return false;
 
-		for (attnum = 1; attnum <= tupdesc->natts; attnum++)
-		{
-			Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
+	/*
+	 * It's unsafe to modify a foreign table directly if there are any quals
+	 * that should be evaluated locally.
+	 */
+	if (fscan->scan.plan.qual != NIL)
+		return false;
 
-			if (!attr->attisdropped)
-				targetAttrs = lappend_int(targetAttrs, attnum);
-		}
+	/* Safe to fetch data about the target foreign rel */
+	if (fscan->scan.scanrelid == 0)
+	{
+		foreignrel = find_join_rel(root, fscan->fs_relids);
+		/* We should have a rel for this foreign join. */
+		Assert(foreignrel);
 	}
-	else if (operation == CMD_UPDATE)
+	else
+		foreignrel = root->simple_rel_array[resultRelation];
+	rte = root->simple_rte_array[resultRelation];
+	fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
+
+	/*
+	 * It's unsafe to update a foreign table directly, if any expressions to
+	 * assign to the target columns are unsafe to evaluate remotely.
+	 */
+	if (operation == CMD_UPDATE)
 	{
-		int			col;
-		RelOptInfo *rel = find_base_rel(root, resultRelation);
-		Bitmapset  *allUpdatedCols = get_rel_all_updated_cols(root, rel);
+		ListCell   *lc,
+				   *lc2;
 
-		col = -1;
-		while ((col = bms_next_member(allUpdatedCols, col)) >= 0)
+		/*
+		 * The expressions of concern are the first N columns of the processed
+		 * targetlist, where N is the length of the rel's update_colnos.
+		 */
+		get_translated_update_targetlist(root, resultRelation,
+										 &processed_tlist, &targetAttrs);
+		forboth(lc, processed_tlist, lc2, targetAttrs)
 		{
-			/* bit numbers are offset by FirstLowInvalidHeapAttributeNumber */
-			AttrNumber	attno = col + FirstLowInvalidHeapAttributeNumber;
+			TargetEntry *tle = lfirst_node(TargetEntry, lc);
+			AttrNumber	attno = lfirst_int(lc2);
+
+			/* update's new-value expressions shouldn't be resjunk */
+			Assert(!tle->resjunk);
 
 			if (attno <= InvalidAttrNumber) /* shouldn't happen */
 				elog(ERROR, "system-column update is not supported");
-			targetAttrs = lappend_int(targetAttrs, attno);
+
+			if (!is_foreign_expr(root, foreignrel, (Expr *) tle->expr))
+				return false;
 		}
 	}
 
 	/*
-	 * Extract the relevant WITH CHECK OPTION list if any.
+	 * Ok, rewrite subplan so as to modify the foreign table directly.
 	 */
-	if (plan->withCheckOptionLists)
-		withCheckOptionList = (List *) list_nth(plan->withCheckOptionLists,
-												subplan_index);
+	initStringInfo(&sql);
+
+	/*
+	 * Core code already has some lock on each rel being planned, so we can
+	 * use NoLock here.
+	 */
+	rel = table_open(rte->relid, NoLock);
+
+	/*
+	 * Recall the qual clauses that must be evaluated remotely.  (These are
+	 * bare clauses not RestrictInfos, but deparse.c's appendConditions()
+	 * doesn't care.)
+	 */
+	remote_exprs = fpinfo->final_remote_exprs;
 
 	/*
 	 * Extract the relevant RETURNING list if any.
 	 */
 	if (plan->returningLists)
+	{
 		returningList = (List *) list_nth(plan->returningLists, subplan_index);
 
-	/*
-	 * ON CONFLICT DO UPDATE and DO NOTHING case with inference specification
-	 * should have already been rejected in the optimizer, as presently there
-	 * is no way to recognize an arbiter index on a foreign table.  Only DO
-	 * NOTHING is supported without an inference specification.
-	 */
-	if (plan->onConflictAction == ONCONFLICT_NOTHING)
-		doNothing = true;
-	else if (plan->onConflictAction != ONCONFLICT_NONE)
-		elog(ERROR, "unexpected ON CONFLICT specification: %d",
-			 (int) plan->onConflictAction);
+		/*
+		 * When performing an UPDATE/DELETE .. RETURNING on a join directly,
+		 * we fetch from the foreign server any Vars specified in RETURNING
+		 * that refer not only to the target relation but to non-target
+		 * relations.  So we'll deparse them into the RETURNING clause of the
+		 * remote query; use a targetlist consisting of them instead, which
+		 * will be adjusted to be new fdw_scan_tlist of the foreign-scan plan
+		 * node below.
+		 */
+		if (fscan->scan.scanrelid == 0)
+			returningList = build_remote_returning(resultRelation, rel,
+												   returningList);
+	}
 
 	/*
 	 * Construct the SQL command string.
 	 */
 	switch (operation)
 	{
-		case CMD_INSERT:
-			deparseInsertSql(&sql, rte, resultRelation, rel,
-							 targetAttrs, doNothing,
-							 withCheckOptionList, returningList,
-							 &retrieved_attrs, &values_end_len);
-			break;
 		case CMD_UPDATE:
-			deparseUpdateSql(&sql, rte, resultRelation, rel,
-							 targetAttrs,
-							 withCheckOptionList, returningList,
-							 &retrieved_attrs);
+			deparseDirectUpdateSql(&sql, root, resultRelation, rel,
+								   foreignrel,
+								   processed_tlist,
+								   targetAttrs,
+								   remote_exprs, &params_list,
+								   returningList, &retrieved_attrs);
 			break;
 		case CMD_DELETE:
-			deparseDeleteSql(&sql, rte, resultRelation, rel,
-							 returningList,
-							 &retrieved_attrs);
+			deparseDirectDeleteSql(&sql, root, resultRelation, rel,
+								   foreignrel,
+								   remote_exprs, &params_list,
+								   returningList, &retrieved_attrs);
 			break;
 		default:
 			elog(ERROR, "unexpected operation: %d", (int) operation);
 			break;
 	}
 
-	table_close(rel, NoLock);
+	/*
+	 * Update the operation and target relation info.
+	 */
+	fscan->operation = operation;
+	fscan->resultRelation = resultRelation;
 
 	/*
-	 * Build the fdw_private list that will be available to the executor.
-	 * Items in the list must match enum FdwModifyPrivateIndex, above.
+	 * Update the fdw_exprs list that will be available to the executor.
 	 */
-	return list_make5(makeString(sql.data),
-					  targetAttrs,
-					  makeInteger(values_end_len),
-					  makeBoolean((retrieved_attrs != NIL)),
-					  retrieved_attrs);
+	fscan->fdw_exprs = params_list;
+
+	/*
+	 * Update the fdw_private list that will be available to the executor.
+	 * Items in the list must match enum FdwDirectModifyPrivateIndex, above.
+	 */
+	fscan->fdw_private = list_make4(makeString(sql.data),
+									makeBoolean((retrieved_attrs != NIL)),
+									retrieved_attrs,
+									makeBoolean(plan->canSetTag));
+
+	/*
+	 * Update the foreign-join-related fields.
+	 */
+	if (fscan->scan.scanrelid == 0)
+	{
+		/* No need for the outer subplan. */
+		fscan->scan.plan.lefttree = NULL;
+
+		/* Build new fdw_scan_tlist if UPDATE/DELETE .. RETURNING. */
+		if (returningList)
+			rebuild_fdw_scan_tlist(fscan, returningList);
+	}
+
+	/*
+	 * Finally, unset the async-capable flag if it is set, as we currently
+	 * don't support asynchronous execution of direct modifications.
+	 */
+	if (fscan->scan.plan.async_capable)
+		fscan->scan.plan.async_capable = false;
+
+	table_close(rel, NoLock);
+	return true;
 }
 
 /*
- * postgresBeginForeignModify
- *		Begin an insert/update/delete operation on a foreign table
+ * postgresBeginDirectModify
+ *		Prepare a direct foreign table modification
  */
 static void
-postgresBeginForeignModify(ModifyTableState *mtstate,
-						   ResultRelInfo *resultRelInfo,
-						   List *fdw_private,
-						   int subplan_index,
-						   int eflags)
+postgresBeginDirectModify(ForeignScanState *node, int eflags)
 {
-	PgFdwModifyState *fmstate;
-	char	   *query;
-	List	   *target_attrs;
-	bool		has_returning;
-	int			values_end_len;
-	List	   *retrieved_attrs;
-	RangeTblEntry *rte;
+	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
+	EState	   *estate = node->ss.ps.state;
+	PgFdwDirectModifyState *dmstate;
+	Index		rtindex;
+	Oid			userid;
+	ForeignTable *table;
+	UserMapping *user;
+	int			numParams;
 
 	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  resultRelInfo->ri_FdwState
-	 * stays NULL.
+	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
 	 */
 	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
 		return;
 
-	/* Deconstruct fdw_private data. */
-	query = strVal(list_nth(fdw_private,
-							FdwModifyPrivateUpdateSql));
-	target_attrs = (List *) list_nth(fdw_private,
-									 FdwModifyPrivateTargetAttnums);
-	values_end_len = intVal(list_nth(fdw_private,
-									 FdwModifyPrivateLen));
-	has_returning = boolVal(list_nth(fdw_private,
-									 FdwModifyPrivateHasReturning));
-	retrieved_attrs = (List *) list_nth(fdw_private,
-										FdwModifyPrivateRetrievedAttrs);
+	/*
+	 * We'll save private state in node->fdw_state.
+	 */
+	dmstate = (PgFdwDirectModifyState *) palloc0(sizeof(PgFdwDirectModifyState));
+	node->fdw_state = (void *) dmstate;
 
-	/* Find RTE. */
-	rte = exec_rt_fetch(resultRelInfo->ri_RangeTableIndex,
-						mtstate->ps.state);
+	/*
+	 * Identify which user to do the remote access as.  This should match what
+	 * ExecCheckPermissions() does.
+	 */
+	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
 
-	/* Construct an execution state. */
-	fmstate = create_foreign_modify(mtstate->ps.state,
-									rte,
-									resultRelInfo,
-									mtstate->operation,
-									outerPlanState(mtstate)->plan,
-									query,
-									target_attrs,
-									values_end_len,
-									has_returning,
-									retrieved_attrs);
+	/* Get info about foreign table. */
+	rtindex = node->resultRelInfo->ri_RangeTableIndex;
+	if (fsplan->scan.scanrelid == 0)
+		dmstate->rel = ExecOpenScanRelation(estate, rtindex, eflags);
+	else
+		dmstate->rel = node->ss.ss_currentRelation;
+	table = GetForeignTable(RelationGetRelid(dmstate->rel));
+	user = GetUserMapping(userid, table->serverid);
 
-	resultRelInfo->ri_FdwState = fmstate;
+	/*
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
+	 */
+	dmstate->conn = GetConnection(user, false, &dmstate->conn_state);
+
+	/* Update the foreign-join-related fields. */
+	if (fsplan->scan.scanrelid == 0)
+	{
+		/* Save info about foreign table. */
+		dmstate->resultRel = dmstate->rel;
+
+		/*
+		 * Set dmstate->rel to NULL to teach get_returning_data() and
+		 * make_tuple_from_result_row() that columns fetched from the remote
+		 * server are described by fdw_scan_tlist of the foreign-scan plan
+		 * node, not the tuple descriptor for the target relation.
+		 */
+		dmstate->rel = NULL;
+	}
+
+	/* Initialize state variable */
+	dmstate->num_tuples = -1;	/* -1 means not set yet */
+
+	/* Get private info created by planner functions. */
+	dmstate->query = strVal(list_nth(fsplan->fdw_private,
+									 FdwDirectModifyPrivateUpdateSql));
+	dmstate->has_returning = boolVal(list_nth(fsplan->fdw_private,
+											  FdwDirectModifyPrivateHasReturning));
+	dmstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
+												 FdwDirectModifyPrivateRetrievedAttrs);
+	dmstate->set_processed = boolVal(list_nth(fsplan->fdw_private,
+											  FdwDirectModifyPrivateSetProcessed));
+
+	/* Create context for per-tuple temp workspace. */
+	dmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
+											  "postgres_fdw temporary data",
+											  ALLOCSET_SMALL_SIZES);
+
+	/* Prepare for input conversion of RETURNING results. */
+	if (dmstate->has_returning)
+	{
+		TupleDesc	tupdesc;
+
+		if (fsplan->scan.scanrelid == 0)
+			tupdesc = get_tupdesc_for_join_scan_tuples(node);
+		else
+			tupdesc = RelationGetDescr(dmstate->rel);
+
+		dmstate->attinmeta = TupleDescGetAttInMetadata(tupdesc);
+
+		/*
+		 * When performing an UPDATE/DELETE .. RETURNING on a join directly,
+		 * initialize a filter to extract an updated/deleted tuple from a scan
+		 * tuple.
+		 */
+		if (fsplan->scan.scanrelid == 0)
+			init_returning_filter(dmstate, fsplan->fdw_scan_tlist, rtindex);
+	}
+
+	/*
+	 * Prepare for processing of parameters used in remote query, if any.
+	 */
+	numParams = list_length(fsplan->fdw_exprs);
+	dmstate->numParams = numParams;
+	if (numParams > 0)
+		prepare_query_params((PlanState *) node,
+							 fsplan->fdw_exprs,
+							 numParams,
+							 &dmstate->param_flinfo,
+							 &dmstate->param_exprs,
+							 &dmstate->param_values);
 }
 
 /*
- * postgresExecForeignInsert
- *		Insert one row into a foreign table
+ * postgresIterateDirectModify
+ *		Execute a direct foreign table modification
  */
 static TupleTableSlot *
-postgresExecForeignInsert(EState *estate,
-						  ResultRelInfo *resultRelInfo,
-						  TupleTableSlot *slot,
-						  TupleTableSlot *planSlot)
+postgresIterateDirectModify(ForeignScanState *node)
 {
-	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
-	TupleTableSlot **rslot;
-	int			numSlots = 1;
+	PgFdwDirectModifyState *dmstate = (PgFdwDirectModifyState *) node->fdw_state;
+	EState	   *estate = node->ss.ps.state;
+	ResultRelInfo *resultRelInfo = node->resultRelInfo;
 
 	/*
-	 * If the fmstate has aux_fmstate set, use the aux_fmstate (see
-	 * postgresBeginForeignInsert())
+	 * If this is the first call after Begin, execute the statement.
 	 */
-	if (fmstate->aux_fmstate)
-		resultRelInfo->ri_FdwState = fmstate->aux_fmstate;
-	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_INSERT,
-								   &slot, &planSlot, &numSlots);
-	/* Revert that change */
-	if (fmstate->aux_fmstate)
-		resultRelInfo->ri_FdwState = fmstate;
+	if (dmstate->num_tuples == -1)
+		execute_dml_stmt(node);
 
-	return rslot ? *rslot : NULL;
+	/*
+	 * If the local query doesn't specify RETURNING, just clear tuple slot.
+	 */
+	if (!resultRelInfo->ri_projectReturning)
+	{
+		TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
+		Instrumentation *instr = node->ss.ps.instrument;
+
+		Assert(!dmstate->has_returning);
+
+		/* Increment the command es_processed count if necessary. */
+		if (dmstate->set_processed)
+			estate->es_processed += dmstate->num_tuples;
+
+		/* Increment the tuple count for EXPLAIN ANALYZE if necessary. */
+		if (instr)
+			instr->tuplecount += dmstate->num_tuples;
+
+		return ExecClearTuple(slot);
+	}
+
+	/*
+	 * Get the next RETURNING tuple.
+	 */
+	return get_returning_data(node);
 }
 
 /*
- * postgresExecForeignBatchInsert
- *		Insert multiple rows into a foreign table
+ * postgresEndDirectModify
+ *		Finish a direct foreign table modification
  */
-static TupleTableSlot **
-postgresExecForeignBatchInsert(EState *estate,
-							   ResultRelInfo *resultRelInfo,
-							   TupleTableSlot **slots,
-							   TupleTableSlot **planSlots,
-							   int *numSlots)
+static void
+postgresEndDirectModify(ForeignScanState *node)
 {
-	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
-	TupleTableSlot **rslot;
+	PgFdwDirectModifyState *dmstate = (PgFdwDirectModifyState *) node->fdw_state;
 
-	/*
-	 * If the fmstate has aux_fmstate set, use the aux_fmstate (see
-	 * postgresBeginForeignInsert())
-	 */
-	if (fmstate->aux_fmstate)
-		resultRelInfo->ri_FdwState = fmstate->aux_fmstate;
-	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_INSERT,
-								   slots, planSlots, numSlots);
-	/* Revert that change */
-	if (fmstate->aux_fmstate)
-		resultRelInfo->ri_FdwState = fmstate;
+	/* if dmstate is NULL, we are in EXPLAIN; nothing to do */
+	if (dmstate == NULL)
+		return;
 
-	return rslot;
+	/* Release PGresult */
+	PQclear(dmstate->result);
+
+	/* Release remote connection */
+	ReleaseConnection(dmstate->conn);
+	dmstate->conn = NULL;
+
+	/* MemoryContext will be deleted automatically. */
 }
 
 /*
- * postgresGetForeignModifyBatchSize
- *		Determine the maximum number of tuples that can be inserted in bulk
- *
- * Returns the batch size specified for server or table. When batching is not
- * allowed (e.g. for tables with BEFORE/AFTER ROW triggers or with RETURNING
- * clause), returns 1.
+ * postgresExplainForeignScan
+ *		Produce extra output for EXPLAIN of a ForeignScan on a foreign table
  */
-static int
-postgresGetForeignModifyBatchSize(ResultRelInfo *resultRelInfo)
+static void
+postgresExplainForeignScan(ForeignScanState *node, ExplainState *es)
 {
-	int			batch_size;
-	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
-
-	/* should be called only once */
-	Assert(resultRelInfo->ri_BatchSize == 0);
+	ForeignScan *plan = castNode(ForeignScan, node->ss.ps.plan);
+	List	   *fdw_private = plan->fdw_private;
 
 	/*
-	 * Should never get called when the insert is being performed on a table
-	 * that is also among the target relations of an UPDATE operation, because
-	 * postgresBeginForeignInsert() currently rejects such insert attempts.
+	 * Identify foreign scans that are really joins or upper relations.  The
+	 * input looks something like "(1) LEFT JOIN (2)", and we must replace the
+	 * digit string(s), which are RT indexes, with the correct relation names.
+	 * We do that here, not when the plan is created, because we can't know
+	 * what aliases ruleutils.c will assign at plan creation time.
 	 */
-	Assert(fmstate == NULL || fmstate->aux_fmstate == NULL);
+	if (list_length(fdw_private) > FdwScanPrivateRelations)
+	{
+		StringInfo	relations;
+		char	   *rawrelations;
+		char	   *ptr;
+		int			minrti,
+					rtoffset;
 
-	/*
-	 * In EXPLAIN without ANALYZE, ri_FdwState is NULL, so we have to lookup
-	 * the option directly in server/table options. Otherwise just use the
-	 * value we determined earlier.
-	 */
-	if (fmstate)
-		batch_size = fmstate->batch_size;
-	else
-		batch_size = get_batch_size_option(resultRelInfo->ri_RelationDesc);
+		rawrelations = strVal(list_nth(fdw_private, FdwScanPrivateRelations));
 
-	/*
-	 * Disable batching when we have to use RETURNING, there are any
-	 * BEFORE/AFTER ROW INSERT triggers on the foreign table, or there are any
-	 * WITH CHECK OPTION constraints from parent views.
-	 *
-	 * When there are any BEFORE ROW INSERT triggers on the table, we can't
-	 * support it, because such triggers might query the table we're inserting
-	 * into and act differently if the tuples that have already been processed
-	 * and prepared for insertion are not there.
-	 */
-	if (resultRelInfo->ri_projectReturning != NULL ||
-		resultRelInfo->ri_WithCheckOptions != NIL ||
-		(resultRelInfo->ri_TrigDesc &&
-		 (resultRelInfo->ri_TrigDesc->trig_insert_before_row ||
-		  resultRelInfo->ri_TrigDesc->trig_insert_after_row)))
-		return 1;
+		/*
+		 * A difficulty with using a string representation of RT indexes is
+		 * that setrefs.c won't update the string when flattening the
+		 * rangetable.  To find out what rtoffset was applied, identify the
+		 * minimum RT index appearing in the string and compare it to the
+		 * minimum member of plan->fs_base_relids.  (We expect all the relids
+		 * in the join will have been offset by the same amount; the Asserts
+		 * below should catch it if that ever changes.)
+		 */
+		minrti = INT_MAX;
+		ptr = rawrelations;
+		while (*ptr)
+		{
+			if (isdigit((unsigned char) *ptr))
+			{
+				int			rti = strtol(ptr, &ptr, 10);
 
-	/*
-	 * If the foreign table has no columns, disable batching as the INSERT
-	 * syntax doesn't allow batching multiple empty rows into a zero-column
-	 * table in a single statement.  This is needed for COPY FROM, in which
-	 * case fmstate must be non-NULL.
-	 */
-	if (fmstate && list_length(fmstate->target_attrs) == 0)
-		return 1;
+				if (rti < minrti)
+					minrti = rti;
+			}
+			else
+				ptr++;
+		}
+		rtoffset = bms_next_member(plan->fs_base_relids, -1) - minrti;
 
-	/*
-	 * Otherwise use the batch size specified for server/table. The number of
-	 * parameters in a batch is limited to 65535 (uint16), so make sure we
-	 * don't exceed this limit by using the maximum batch_size possible.
-	 */
-	if (fmstate && fmstate->p_nums > 0)
-		batch_size = Min(batch_size, PQ_QUERY_PARAM_MAX_LIMIT / fmstate->p_nums);
+		/* Now we can translate the string */
+		relations = makeStringInfo();
+		ptr = rawrelations;
+		while (*ptr)
+		{
+			if (isdigit((unsigned char) *ptr))
+			{
+				int			rti = strtol(ptr, &ptr, 10);
+				RangeTblEntry *rte;
+				char	   *relname;
+				char	   *refname;
 
-	return batch_size;
-}
+				rti += rtoffset;
+				Assert(bms_is_member(rti, plan->fs_base_relids));
+				rte = rt_fetch(rti, es->rtable);
+				Assert(rte->rtekind == RTE_RELATION);
+				/* This logic should agree with explain.c's ExplainTargetRel */
+				relname = get_rel_name(rte->relid);
+				if (es->verbose)
+				{
+					char	   *namespace;
 
-/*
- * postgresExecForeignUpdate
- *		Update one row in a foreign table
- */
-static TupleTableSlot *
-postgresExecForeignUpdate(EState *estate,
-						  ResultRelInfo *resultRelInfo,
-						  TupleTableSlot *slot,
-						  TupleTableSlot *planSlot)
-{
-	TupleTableSlot **rslot;
-	int			numSlots = 1;
+					namespace = get_namespace_name_or_temp(get_rel_namespace(rte->relid));
+					appendStringInfo(relations, "%s.%s",
+									 quote_identifier(namespace),
+									 quote_identifier(relname));
+				}
+				else
+					appendStringInfoString(relations,
+										   quote_identifier(relname));
+				refname = (char *) list_nth(es->rtable_names, rti - 1);
+				if (refname == NULL)
+					refname = rte->eref->aliasname;
+				if (strcmp(refname, relname) != 0)
+					appendStringInfo(relations, " %s",
+									 quote_identifier(refname));
+			}
+			else
+				appendStringInfoChar(relations, *ptr++);
+		}
+		ExplainPropertyText("Relations", relations->data, es);
+	}
+
+	/*
+	 * Add remote query, when VERBOSE option is specified.
+	 */
+	if (es->verbose)
+	{
+		char	   *sql;
 
-	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_UPDATE,
-								   &slot, &planSlot, &numSlots);
+		sql = strVal(list_nth(fdw_private, FdwScanPrivateSelectSql));
+		ExplainPropertyText("Remote SQL", sql, es);
 
-	return rslot ? rslot[0] : NULL;
-}
+		/* A scan that may run in two phases has two more queries */
+		if (list_length(fdw_private) > FdwScanPrivateLateMaterialization &&
+			list_nth(fdw_private, FdwScanPrivateLateMaterialization) != NIL)
+		{
+			List	   *late = (List *) list_nth(fdw_private,
+												 FdwScanPrivateLateMaterialization);
 
-/*
- * postgresExecForeignDelete
- *		Delete one row from a foreign table
- */
-static TupleTableSlot *
-postgresExecForeignDelete(EState *estate,
-						  ResultRelInfo *resultRelInfo,
-						  TupleTableSlot *slot,
-						  TupleTableSlot *planSlot)
-{
-	TupleTableSlot **rslot;
-	int			numSlots = 1;
+			ExplainPropertyText("Remote Locator SQL",
+								strVal(list_nth(late, FdwLateLocatorSql)), es);
+			ExplainPropertyText("Remote Fetch SQL",
+								strVal(list_nth(late, FdwLateFetchSql)), es);
+		}
 
-	rslot = execute_foreign_modify(estate, resultRelInfo, CMD_DELETE,
-								   &slot, &planSlot, &numSlots);
+		/* A scan joining with the keys remotely restricts them too */
+		if (list_length(fdw_private) > FdwScanPrivateKeyTable &&
+			list_nth(fdw_private, FdwScanPrivateKeyTable) != NIL)
+		{
+			List	   *key_table = (List *) list_nth(fdw_private,
+													  FdwScanPrivateKeyTable);
 
-	return rslot ? rslot[0] : NULL;
-}
+			ExplainPropertyText("Remote Key Table Columns",
+								strVal(list_nth(key_table, FdwKeyTableColumns)),
+								es);
+		}
 
-/*
- * postgresEndForeignModify
- *		Finish an insert/update/delete operation on a foreign table
- */
-static void
-postgresEndForeignModify(EState *estate,
-						 ResultRelInfo *resultRelInfo)
-{
-	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
+		/* A scan looking up batches of keys runs a query of its own */
+		if (list_length(fdw_private) > FdwScanPrivateKeyArraySql &&
+			list_nth(fdw_private, FdwScanPrivateKeyArraySql) != NULL)
+			ExplainPropertyText("Remote Lookup SQL",
+								strVal(list_nth(fdw_private,
+												FdwScanPrivateKeyArraySql)),
+								es);
+	}
 
-	/* If fmstate is NULL, we are in EXPLAIN; nothing to do */
-	if (fmstate == NULL)
-		return;
+	/*
+	 * Show how many keys went into the remote key table, when ANALYZE option
+	 * is specified.
+	 */
+	if (es->analyze && node->fdw_state != NULL &&
+		((PgFdwScanState *) node->fdw_state)->key_table != NULL)
+		ExplainPropertyUInteger("Semijoin Key Table Rows", NULL,
+								((PgFdwScanState *) node->fdw_state)->key_table_rows,
+								es);
 
-	/* Destroy the execution state */
-	finish_foreign_modify(fmstate);
+	/* Likewise for the keys looked up by batches, and how many batches */
+	if (es->analyze && node->fdw_state != NULL &&
+		((PgFdwScanState *) node->fdw_state)->key_array)
+	{
+		PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+
+		ExplainPropertyUInteger("Semijoin Key Array Keys", NULL,
+								fsstate->key_array_keys, es);
+		ExplainPropertyInteger("Semijoin Key Array Batches", NULL,
+							   list_length(fsstate->late_batches), es);
+	}
+
+	/*
+	 * Add what went into the semijoin filter, when ANALYZE option is
+	 * specified and the executor built one.
+	 */
+	if (es->analyze && node->semijoin_instr)
+		explain_semijoin_filter(node, es);
 }
 
 /*
- * postgresBeginForeignInsert
- *		Begin an insert operation on a foreign table
+ * Show the semijoin filter shipped with the remote query: its shape, how
+ * many local rows and keys went into it, what building it cost, and what it
+ * did on the remote side.
  */
 static void
-postgresBeginForeignInsert(ModifyTableState *mtstate,
-						   ResultRelInfo *resultRelInfo)
+explain_semijoin_filter(ForeignScanState *node, ExplainState *es)
 {
-	PgFdwModifyState *fmstate;
-	ModifyTable *plan = castNode(ModifyTable, mtstate->ps.plan);
-	EState	   *estate = mtstate->ps.state;
-	Index		resultRelation;
-	Relation	rel = resultRelInfo->ri_RelationDesc;
-	RangeTblEntry *rte;
-	TupleDesc	tupdesc = RelationGetDescr(rel);
-	int			attnum;
-	int			values_end_len;
-	StringInfoData sql;
-	List	   *targetAttrs = NIL;
-	List	   *retrieved_attrs = NIL;
-	bool		doNothing = false;
-
-	/*
-	 * If the foreign table we are about to insert routed rows into is also an
-	 * UPDATE subplan result rel that will be updated later, proceeding with
-	 * the INSERT will result in the later UPDATE incorrectly modifying those
-	 * routed rows, so prevent the INSERT --- it would be nice if we could
-	 * handle this case; but for now, throw an error for safety.
-	 */
-	if (plan && plan->operation == CMD_UPDATE &&
-		(resultRelInfo->ri_usesFdwDirectModify ||
-		 resultRelInfo->ri_FdwState))
-		ereport(ERROR,
-				(errcode(ERRCODE_FEATURE_NOT_SUPPORTED),
-				 errmsg("cannot route tuples into foreign table to be updated \"%s\"",
-						RelationGetRelationName(rel))));
-
-	initStringInfo(&sql);
+	SemijoinFilterInstrumentation *instr = node->semijoin_instr;
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
 
-	/* We transmit all columns that are defined in the foreign table. */
-	for (attnum = 1; attnum <= tupdesc->natts; attnum++)
+	if (instr->npartitions == 0)
 	{
-		Form_pg_attribute attr = TupleDescAttr(tupdesc, attnum - 1);
-
-		if (!attr->attisdropped)
-			targetAttrs = lappend_int(targetAttrs, attnum);
+		/* Too large for work_mem, or out of memory */
+		ExplainPropertyText("Semijoin Filter", "none", es);
+		ExplainPropertyFloat("Semijoin Filter Outer Rows", NULL,
+							 instr->outer_rows, 0, es);
+		return;
 	}
 
-	/* Check if we add the ON CONFLICT clause to the remote query. */
-	if (plan)
+	ExplainPropertyText("Semijoin Filter",
+						instr->shared ? "Bloom (shared)" : "Bloom", es);
+	if (instr->nbuilds > 1)
+		ExplainPropertyInteger("Semijoin Filter Builds", NULL,
+							   instr->nbuilds, es);
+	if (instr->npartitions > 1)
+		ExplainPropertyInteger("Semijoin Filter Partitions", NULL,
+							   instr->npartitions, es);
+	ExplainPropertyUInteger("Semijoin Filter Bits", NULL, instr->nbits, es);
+	ExplainPropertyInteger("Semijoin Filter Hash Functions", NULL,
+						   instr->hash_count, es);
+	ExplainPropertyFloat("Semijoin Filter Target FPR", NULL, instr->fpr, 4, es);
+	ExplainPropertyFloat("Semijoin Filter Outer Rows", NULL,
+						 instr->outer_rows, 0, es);
+	ExplainPropertyFloat("Semijoin Filter Distinct Keys", NULL,
+						 instr->distinct_keys, 0, es);
+	ExplainPropertyUInteger("Semijoin Filter Serialized Size", "bytes",
+							instr->serialized_bytes, es);
+	if (es->timing)
+	{
+		ExplainPropertyFloat("Semijoin Filter Build Time", "ms",
+							 instr->build_time, 3, es);
+		ExplainPropertyFloat("Semijoin Filter Encode Time", "ms",
+							 instr->encode_time, 3, es);
+	}
+
+	/*
+	 * The remote reports on the filter as its cursor goes away.  Execution is
+	 * over by now, so close the cursor rather than wait for
+	 * postgresEndForeignScan to do so after we've been shown.
+	 */
+	if (fsstate->cursor_exists)
+		close_scan_cursor(node);
+	if (fsstate->late_batches != NIL)
+		ExplainPropertyInteger("Semijoin Late Materialization Batches", NULL,
+							   list_length(fsstate->late_batches), es);
+	if (fsstate->filter_reported)
 	{
-		OnConflictAction onConflictAction = plan->onConflictAction;
-
-		/* We only support DO NOTHING without an inference specification. */
-		if (onConflictAction == ONCONFLICT_NOTHING)
-			doNothing = true;
-		else if (onConflictAction != ONCONFLICT_NONE)
-			elog(ERROR, "unexpected ON CONFLICT specification: %d",
-				 (int) onConflictAction);
+		ExplainPropertyUInteger("Semijoin Filter Remote Rows Scanned", NULL,
+								fsstate->filter_scanned, es);
+		ExplainPropertyUInteger("Semijoin Filter Remote Rows Rejected", NULL,
+								fsstate->filter_rejected, es);
+		ExplainPropertyUInteger("Semijoin Filter Remote Rows Passed", NULL,
+								fsstate->filter_scanned -
+								fsstate->filter_rejected, es);
 	}
 
 	/*
-	 * If the foreign table is a partition that doesn't have a corresponding
-	 * RTE entry, we need to create a new RTE describing the foreign table for
-	 * use by deparseInsertSql and create_foreign_modify() below, after first
-	 * copying the parent's RTE and modifying some fields to describe the
-	 * foreign partition to work on. However, if this is invoked by UPDATE,
-	 * the existing RTE may already correspond to this partition if it is one
-	 * of the UPDATE subplan target rels; in that case, we can just use the
-	 * existing RTE as-is.
+	 * Rows let through without a matching local key are false positives; the
+	 * rejected rows are the true negatives.
 	 */
-	if (resultRelInfo->ri_RangeTableIndex == 0)
+	if (instr->keyset && fsstate->filter_checked > 0)
 	{
-		ResultRelInfo *rootResultRelInfo = resultRelInfo->ri_RootResultRelInfo;
+		uint64		false_positives;
 
-		rte = exec_rt_fetch(rootResultRelInfo->ri_RangeTableIndex, estate);
-		rte = copyObject(rte);
-		rte->relid = RelationGetRelid(rel);
-		rte->relkind = RELKIND_FOREIGN_TABLE;
+		false_positives = fsstate->filter_checked - fsstate->filter_matched;
+		ExplainPropertyUInteger("Semijoin Filter False Positives", NULL,
+								false_positives, es);
+		if (fsstate->filter_reported &&
+			fsstate->filter_rejected + false_positives > 0)
+			ExplainPropertyFloat("Semijoin Filter Actual FPR", NULL,
+								 (double) false_positives /
+								 (fsstate->filter_rejected + false_positives),
+								 4, es);
+	}
+}
+
+/*
+ * postgresExplainForeignModify
+ *		Produce extra output for EXPLAIN of a ModifyTable on a foreign table
+ */
+static void
+postgresExplainForeignModify(ModifyTableState *mtstate,
+							 ResultRelInfo *rinfo,
+							 List *fdw_private,
+							 int subplan_index,
+							 ExplainState *es)
+{
+	if (es->verbose)
+	{
+		char	   *sql = strVal(list_nth(fdw_private,
+										  FdwModifyPrivateUpdateSql));
+
+		ExplainPropertyText("Remote SQL", sql, es);
 
 		/*
-		 * For UPDATE, we must use the RT index of the first subplan target
-		 * rel's RTE, because the core code would have built expressions for
-		 * the partition, such as RETURNING, using that RT index as varno of
-		 * Vars contained in those expressions.
+		 * For INSERT we should always have batch size >= 1, but UPDATE and
+		 * DELETE don't support batching so don't show the property.
 		 */
-		if (plan && plan->operation == CMD_UPDATE &&
-			rootResultRelInfo->ri_RangeTableIndex == plan->rootRelation)
-			resultRelation = mtstate->resultRelInfo[0].ri_RangeTableIndex;
-		else
-			resultRelation = rootResultRelInfo->ri_RangeTableIndex;
-	}
-	else
-	{
-		resultRelation = resultRelInfo->ri_RangeTableIndex;
-		rte = exec_rt_fetch(resultRelation, estate);
+		if (rinfo->ri_BatchSize > 0)
+			ExplainPropertyInteger("Batch Size", NULL, rinfo->ri_BatchSize, es);
 	}
+}
 
-	/* Construct the SQL command string. */
-	deparseInsertSql(&sql, rte, resultRelation, rel, targetAttrs, doNothing,
-					 resultRelInfo->ri_WithCheckOptions,
-					 resultRelInfo->ri_returningList,
-					 &retrieved_attrs, &values_end_len);
-
-	/* Construct an execution state. */
-	fmstate = create_foreign_modify(mtstate->ps.state,
-									rte,
-									resultRelInfo,
-									CMD_INSERT,
-									NULL,
-									sql.data,
-									targetAttrs,
-									values_end_len,
-									retrieved_attrs != NIL,
-									retrieved_attrs);
+/*
+ * postgresExplainDirectModify
+ *		Produce extra output for EXPLAIN of a ForeignScan that modifies a
+ *		foreign table directly
+ */
+static void
+postgresExplainDirectModify(ForeignScanState *node, ExplainState *es)
+{
+	List	   *fdw_private;
+	char	   *sql;
 
-	/*
-	 * If the given resultRelInfo already has PgFdwModifyState set, it means
-	 * the foreign table is an UPDATE subplan result rel; in which case, store
-	 * the resulting state into the aux_fmstate of the PgFdwModifyState.
-	 */
-	if (resultRelInfo->ri_FdwState)
+	if (es->verbose)
 	{
-		Assert(plan && plan->operation == CMD_UPDATE);
-		Assert(resultRelInfo->ri_usesFdwDirectModify == false);
-		((PgFdwModifyState *) resultRelInfo->ri_FdwState)->aux_fmstate = fmstate;
+		fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
+		sql = strVal(list_nth(fdw_private, FdwDirectModifyPrivateUpdateSql));
+		ExplainPropertyText("Remote SQL", sql, es);
 	}
-	else
-		resultRelInfo->ri_FdwState = fmstate;
 }
 
 /*
- * postgresEndForeignInsert
- *		Finish an insert operation on a foreign table
+ * postgresExecForeignTruncate
+ *		Truncate one or more foreign tables
  */
 static void
-postgresEndForeignInsert(EState *estate,
-						 ResultRelInfo *resultRelInfo)
+postgresExecForeignTruncate(List *rels,
+							DropBehavior behavior,
+							bool restart_seqs)
 {
-	PgFdwModifyState *fmstate = (PgFdwModifyState *) resultRelInfo->ri_FdwState;
-
-	Assert(fmstate != NULL);
+	Oid			serverid = InvalidOid;
+	UserMapping *user = NULL;
+	PGconn	   *conn = NULL;
+	StringInfoData sql;
+	ListCell   *lc;
+	bool		server_truncatable = true;
 
 	/*
-	 * If the fmstate has aux_fmstate set, get the aux_fmstate (see
-	 * postgresBeginForeignInsert())
+	 * By default, all postgres_fdw foreign tables are assumed truncatable.
+	 * This can be overridden by a per-server setting, which in turn can be
+	 * overridden by a per-table setting.
 	 */
-	if (fmstate->aux_fmstate)
-		fmstate = fmstate->aux_fmstate;
+	foreach(lc, rels)
+	{
+		ForeignServer *server = NULL;
+		Relation	rel = lfirst(lc);
+		ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
+		ListCell   *cell;
+		bool		truncatable;
 
-	/* Destroy the execution state */
-	finish_foreign_modify(fmstate);
-}
+		/*
+		 * First time through, determine whether the foreign server allows
+		 * truncates. Since all specified foreign tables are assumed to belong
+		 * to the same foreign server, this result can be used for other
+		 * foreign tables.
+		 */
+		if (!OidIsValid(serverid))
+		{
+			serverid = table->serverid;
+			server = GetForeignServer(serverid);
 
-/*
- * postgresIsForeignRelUpdatable
- *		Determine whether a foreign table supports INSERT, UPDATE and/or
- *		DELETE.
- */
-static int
-postgresIsForeignRelUpdatable(Relation rel)
-{
-	bool		updatable;
-	ForeignTable *table;
-	ForeignServer *server;
-	ListCell   *lc;
+			foreach(cell, server->options)
+			{
+				DefElem    *defel = (DefElem *) lfirst(cell);
 
-	/*
-	 * By default, all postgres_fdw foreign tables are assumed updatable. This
-	 * can be overridden by a per-server setting, which in turn can be
-	 * overridden by a per-table setting.
-	 */
-	updatable = true;
+				if (strcmp(defel->defname, "truncatable") == 0)
+				{
+					server_truncatable = defGetBoolean(defel);
+					break;
+				}
+			}
+		}
 
-	table = GetForeignTable(RelationGetRelid(rel));
-	server = GetForeignServer(table->serverid);
+		/*
+		 * Confirm that all specified foreign tables belong to the same
+		 * foreign server.
+		 */
+		Assert(table->serverid == serverid);
 
-	foreach(lc, server->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
+		/* Determine whether this foreign table allows truncations */
+		truncatable = server_truncatable;
+		foreach(cell, table->options)
+		{
+			DefElem    *defel = (DefElem *) lfirst(cell);
 
-		if (strcmp(def->defname, "updatable") == 0)
-			updatable = defGetBoolean(def);
-	}
-	foreach(lc, table->options)
-	{
-		DefElem    *def = (DefElem *) lfirst(lc);
+			if (strcmp(defel->defname, "truncatable") == 0)
+			{
+				truncatable = defGetBoolean(defel);
+				break;
+			}
+		}
 
-		if (strcmp(def->defname, "updatable") == 0)
-			updatable = defGetBoolean(def);
+		if (!truncatable)
+			ereport(ERROR,
+					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
+					 errmsg("foreign table \"%s\" does not allow truncates",
+							RelationGetRelationName(rel))));
 	}
+	Assert(OidIsValid(serverid));
 
 	/*
-	 * Currently "updatable" means support for INSERT, UPDATE and DELETE.
+	 * Get connection to the foreign server.  Connection manager will
+	 * establish new connection if necessary.
 	 */
-	return updatable ?
-		(1 << CMD_INSERT) | (1 << CMD_UPDATE) | (1 << CMD_DELETE) : 0;
-}
-
-/*
- * postgresRecheckForeignScan
- *		Execute a local join execution plan for a foreign join
- */
-static bool
-postgresRecheckForeignScan(ForeignScanState *node, TupleTableSlot *slot)
-{
-	Index		scanrelid = ((Scan *) node->ss.ps.plan)->scanrelid;
-	PlanState  *outerPlan = outerPlanState(node);
-	TupleTableSlot *result;
-
-	/* For base foreign relations, it suffices to set fdw_recheck_quals */
-	if (scanrelid > 0)
-		return true;
-
-	Assert(outerPlan != NULL);
+	user = GetUserMapping(GetUserId(), serverid);
+	conn = GetConnection(user, false, NULL);
 
-	/* Execute a local join execution plan */
-	result = ExecProcNode(outerPlan);
-	if (TupIsNull(result))
-		return false;
+	/* Construct the TRUNCATE command string */
+	initStringInfo(&sql);
+	deparseTruncateSql(&sql, rels, behavior, restart_seqs);
 
-	/* Store result in the given slot */
-	ExecCopySlot(slot, result);
+	/* Issue the TRUNCATE command to remote server */
+	do_sql_command(conn, sql.data);
 
-	return true;
+	pfree(sql.data);
 }
 
 /*
- * find_modifytable_subplan
- *		Helper routine for postgresPlanDirectModify to find the
- *		ModifyTable subplan node that scans the specified RTI.
+ * estimate_path_cost_size
+ *		Get cost and size estimates for a foreign scan on given foreign relation
+ *		either a base relation or a join between foreign relations or an upper
+ *		relation containing foreign relations.
  *
- * Returns NULL if the subplan couldn't be identified.  That's not a fatal
- * error condition, we just abandon trying to do the update directly.
+ * param_join_conds are the parameterization clauses with outer relations.
+ * pathkeys specify the expected sort order if any for given path being costed.
+ * fpextra specifies additional post-scan/join-processing steps such as the
+ * final sort and the LIMIT restriction.
+ *
+ * The function returns the cost and size estimates in p_rows, p_width,
+ * p_startup_cost and p_total_cost variables.
  */
-static ForeignScan *
-find_modifytable_subplan(PlannerInfo *root,
-						 ModifyTable *plan,
-						 Index rtindex,
-						 int subplan_index)
+static void
+estimate_path_cost_size(PlannerInfo *root,
+						RelOptInfo *foreignrel,
+						List *param_join_conds,
+						List *pathkeys,
+						PgFdwPathExtraData *fpextra,
+						double *p_rows, int *p_width,
+						Cost *p_startup_cost, Cost *p_total_cost)
 {
-	Plan	   *subplan = outerPlan(plan);
+	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
+	double		rows;
+	double		retrieved_rows;
+	int			width;
+	Cost		startup_cost;
+	Cost		total_cost;
+
+	/* Make sure the core code has set up the relation's reltarget */
+	Assert(foreignrel->reltarget);
 
 	/*
-	 * The cases we support are (1) the desired ForeignScan is the immediate
-	 * child of ModifyTable, or (2) it is the subplan_index'th child of an
-	 * Append node that is the immediate child of ModifyTable.  There is no
-	 * point in looking further down, as that would mean that local joins are
-	 * involved, so we can't do the update directly.
-	 *
-	 * There could be a Result atop the Append too, acting to compute the
-	 * UPDATE targetlist values.  We ignore that here; the tlist will be
-	 * checked by our caller.
-	 *
-	 * In principle we could examine all the children of the Append, but it's
-	 * currently unlikely that the core planner would generate such a plan
-	 * with the children out-of-order.  Moreover, such a search risks costing
-	 * O(N^2) time when there are a lot of children.
+	 * If the table or the server is configured to use remote estimates,
+	 * connect to the foreign server and execute EXPLAIN to estimate the
+	 * number of rows selected by the restriction+join clauses.  Otherwise,
+	 * estimate rows using whatever statistics we have locally, in a way
+	 * similar to ordinary tables.
 	 */
-	if (IsA(subplan, Append))
+	if (fpinfo->use_remote_estimate)
 	{
-		Append	   *appendplan = (Append *) subplan;
+		List	   *remote_param_join_conds;
+		List	   *local_param_join_conds;
+		StringInfoData sql;
+		PGconn	   *conn;
+		Selectivity local_sel;
+		QualCost	local_cost;
+		List	   *fdw_scan_tlist = NIL;
+		List	   *remote_conds;
 
-		if (subplan_index < list_length(appendplan->appendplans))
-			subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
-	}
-	else if (IsA(subplan, Result) &&
-			 outerPlan(subplan) != NULL &&
-			 IsA(outerPlan(subplan), Append))
-	{
-		Append	   *appendplan = (Append *) outerPlan(subplan);
+		/* Required only to be passed to deparseSelectStmtForRel */
+		List	   *retrieved_attrs;
 
-		if (subplan_index < list_length(appendplan->appendplans))
-			subplan = (Plan *) list_nth(appendplan->appendplans, subplan_index);
-	}
+		/*
+		 * param_join_conds might contain both clauses that are safe to send
+		 * across, and clauses that aren't.
+		 */
+		classifyConditions(root, foreignrel, param_join_conds,
+						   &remote_param_join_conds, &local_param_join_conds);
 
-	/* Now, have we got a ForeignScan on the desired rel? */
-	if (IsA(subplan, ForeignScan))
-	{
-		ForeignScan *fscan = (ForeignScan *) subplan;
+		/* Build the list of columns to be fetched from the foreign server. */
+		if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
+			fdw_scan_tlist = build_tlist_to_deparse(foreignrel);
+		else
+			fdw_scan_tlist = NIL;
 
-		if (bms_is_member(rtindex, fscan->fs_base_relids))
-			return fscan;
-	}
+		/*
+		 * The complete list of remote conditions includes everything from
+		 * baserestrictinfo plus any extra join_conds relevant to this
+		 * particular path.
+		 */
+		remote_conds = list_concat(remote_param_join_conds,
+								   fpinfo->remote_conds);
 
-	return NULL;
-}
+		/*
+		 * Construct EXPLAIN query including the desired SELECT, FROM, and
+		 * WHERE clauses. Params and other-relation Vars are replaced by dummy
+		 * values, so don't request params_list.
+		 */
+		initStringInfo(&sql);
+		appendStringInfoString(&sql, "EXPLAIN ");
+		deparseSelectStmtForRel(&sql, root, foreignrel, fdw_scan_tlist,
+								remote_conds, pathkeys,
+								fpextra ? fpextra->has_final_sort : false,
+								fpextra ? fpextra->has_limit : false,
+								false, &retrieved_attrs, NULL);
 
-/*
- * postgresPlanDirectModify
- *		Consider a direct foreign table modification
- *
- * Decide whether it is safe to modify a foreign table directly, and if so,
- * rewrite subplan accordingly.
- */
-static bool
-postgresPlanDirectModify(PlannerInfo *root,
-						 ModifyTable *plan,
-						 Index resultRelation,
-						 int subplan_index)
-{
-	CmdType		operation = plan->operation;
-	RelOptInfo *foreignrel;
-	RangeTblEntry *rte;
-	PgFdwRelationInfo *fpinfo;
-	Relation	rel;
-	StringInfoData sql;
-	ForeignScan *fscan;
-	List	   *processed_tlist = NIL;
-	List	   *targetAttrs = NIL;
-	List	   *remote_exprs;
-	List	   *params_list = NIL;
-	List	   *returningList = NIL;
-	List	   *retrieved_attrs = NIL;
+		/* Get the remote estimate */
+		conn = GetConnection(fpinfo->user, false, NULL);
+		get_remote_estimate(sql.data, conn, &rows, &width,
+							&startup_cost, &total_cost);
+		ReleaseConnection(conn);
 
-	/*
-	 * Decide whether it is safe to modify a foreign table directly.
-	 */
+		retrieved_rows = rows;
 
-	/*
-	 * The table modification must be an UPDATE or DELETE.
-	 */
-	if (operation != CMD_UPDATE && operation != CMD_DELETE)
-		return false;
+		/* Factor in the selectivity of the locally-checked quals */
+		local_sel = clauselist_selectivity(root,
+										   local_param_join_conds,
+										   foreignrel->relid,
+										   JOIN_INNER,
+										   NULL);
+		local_sel *= fpinfo->local_conds_sel;
 
-	/*
-	 * Try to locate the ForeignScan subplan that's scanning resultRelation.
-	 */
-	fscan = find_modifytable_subplan(root, plan, resultRelation, subplan_index);
-	if (!fscan)
-		return false;
+		rows = clamp_row_est(rows * local_sel);
 
-	/*
-	 * It's unsafe to modify a foreign table directly if there are any quals
-	 * that should be evaluated locally.
-	 */
-	if (fscan->scan.plan.qual != NIL)
-		return false;
+		/* Add in the eval cost of the locally-checked quals */
+		startup_cost += fpinfo->local_conds_cost.startup;
+		total_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
+		cost_qual_eval(&local_cost, local_param_join_conds, root);
+		startup_cost += local_cost.startup;
+		total_cost += local_cost.per_tuple * retrieved_rows;
 
-	/* Safe to fetch data about the target foreign rel */
-	if (fscan->scan.scanrelid == 0)
-	{
-		foreignrel = find_join_rel(root, fscan->fs_relids);
-		/* We should have a rel for this foreign join. */
-		Assert(foreignrel);
+		/*
+		 * Add in tlist eval cost for each output row.  In case of an
+		 * aggregate, some of the tlist expressions such as grouping
+		 * expressions will be evaluated remotely, so adjust the costs.
+		 */
+		startup_cost += foreignrel->reltarget->cost.startup;
+		total_cost += foreignrel->reltarget->cost.startup;
+		total_cost += foreignrel->reltarget->cost.per_tuple * rows;
+		if (IS_UPPER_REL(foreignrel))
+		{
+			QualCost	tlist_cost;
+
+			cost_qual_eval(&tlist_cost, fdw_scan_tlist, root);
+			startup_cost -= tlist_cost.startup;
+			total_cost -= tlist_cost.startup;
+			total_cost -= tlist_cost.per_tuple * rows;
+		}
 	}
 	else
-		foreignrel = root->simple_rel_array[resultRelation];
-	rte = root->simple_rte_array[resultRelation];
-	fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
-
-	/*
-	 * It's unsafe to update a foreign table directly, if any expressions to
-	 * assign to the target columns are unsafe to evaluate remotely.
-	 */
-	if (operation == CMD_UPDATE)
 	{
-		ListCell   *lc,
-				   *lc2;
+		Cost		run_cost = 0;
 
 		/*
-		 * The expressions of concern are the first N columns of the processed
-		 * targetlist, where N is the length of the rel's update_colnos.
+		 * We don't support join conditions in this mode (hence, no
+		 * parameterized paths can be made).
 		 */
-		get_translated_update_targetlist(root, resultRelation,
-										 &processed_tlist, &targetAttrs);
-		forboth(lc, processed_tlist, lc2, targetAttrs)
-		{
-			TargetEntry *tle = lfirst_node(TargetEntry, lc);
-			AttrNumber	attno = lfirst_int(lc2);
+		Assert(param_join_conds == NIL);
 
-			/* update's new-value expressions shouldn't be resjunk */
-			Assert(!tle->resjunk);
+		/*
+		 * We will come here again and again with different set of pathkeys or
+		 * additional post-scan/join-processing steps that caller wants to
+		 * cost.  We don't need to calculate the cost/size estimates for the
+		 * underlying scan, join, or grouping each time.  Instead, use those
+		 * estimates if we have cached them already.
+		 */
+		if (fpinfo->rel_startup_cost >= 0 && fpinfo->rel_total_cost >= 0)
+		{
+			Assert(fpinfo->retrieved_rows >= 0);
 
-			if (attno <= InvalidAttrNumber) /* shouldn't happen */
-				elog(ERROR, "system-column update is not supported");
+			rows = fpinfo->rows;
+			retrieved_rows = fpinfo->retrieved_rows;
+			width = fpinfo->width;
+			startup_cost = fpinfo->rel_startup_cost;
+			run_cost = fpinfo->rel_total_cost - fpinfo->rel_startup_cost;
 
-			if (!is_foreign_expr(root, foreignrel, (Expr *) tle->expr))
-				return false;
+			/*
+			 * If we estimate the costs of a foreign scan or a foreign join
+			 * with additional post-scan/join-processing steps, the scan or
+			 * join costs obtained from the cache wouldn't yet contain the
+			 * eval costs for the final scan/join target, which would've been
+			 * updated by apply_scanjoin_target_to_paths(); add the eval costs
+			 * now.
+			 */
+			if (fpextra && !IS_UPPER_REL(foreignrel))
+			{
+				/* Shouldn't get here unless we have LIMIT */
+				Assert(fpextra->has_limit);
+				Assert(foreignrel->reloptkind == RELOPT_BASEREL ||
+					   foreignrel->reloptkind == RELOPT_JOINREL);
+				startup_cost += foreignrel->reltarget->cost.startup;
+				run_cost += foreignrel->reltarget->cost.per_tuple * rows;
+			}
 		}
-	}
+		else if (IS_JOIN_REL(foreignrel))
+		{
+			PgFdwRelationInfo *fpinfo_i;
+			PgFdwRelationInfo *fpinfo_o;
+			QualCost	join_cost;
+			QualCost	remote_conds_cost;
+			double		nrows;
 
-	/*
-	 * Ok, rewrite subplan so as to modify the foreign table directly.
-	 */
-	initStringInfo(&sql);
+			/* Use rows/width estimates made by the core code. */
+			rows = foreignrel->rows;
+			width = foreignrel->reltarget->width;
 
-	/*
-	 * Core code already has some lock on each rel being planned, so we can
-	 * use NoLock here.
-	 */
-	rel = table_open(rte->relid, NoLock);
+			/* For join we expect inner and outer relations set */
+			Assert(fpinfo->innerrel && fpinfo->outerrel);
 
-	/*
-	 * Recall the qual clauses that must be evaluated remotely.  (These are
-	 * bare clauses not RestrictInfos, but deparse.c's appendConditions()
-	 * doesn't care.)
-	 */
-	remote_exprs = fpinfo->final_remote_exprs;
+			fpinfo_i = (PgFdwRelationInfo *) fpinfo->innerrel->fdw_private;
+			fpinfo_o = (PgFdwRelationInfo *) fpinfo->outerrel->fdw_private;
 
-	/*
-	 * Extract the relevant RETURNING list if any.
-	 */
-	if (plan->returningLists)
-	{
-		returningList = (List *) list_nth(plan->returningLists, subplan_index);
+			/* Estimate of number of rows in cross product */
+			nrows = fpinfo_i->rows * fpinfo_o->rows;
 
-		/*
-		 * When performing an UPDATE/DELETE .. RETURNING on a join directly,
-		 * we fetch from the foreign server any Vars specified in RETURNING
-		 * that refer not only to the target relation but to non-target
-		 * relations.  So we'll deparse them into the RETURNING clause of the
-		 * remote query; use a targetlist consisting of them instead, which
-		 * will be adjusted to be new fdw_scan_tlist of the foreign-scan plan
-		 * node below.
-		 */
-		if (fscan->scan.scanrelid == 0)
-			returningList = build_remote_returning(resultRelation, rel,
-												   returningList);
-	}
+			/*
+			 * Back into an estimate of the number of retrieved rows.  Just in
+			 * case this is nuts, clamp to at most nrows.
+			 */
+			retrieved_rows = clamp_row_est(rows / fpinfo->local_conds_sel);
+			retrieved_rows = Min(retrieved_rows, nrows);
 
-	/*
-	 * Construct the SQL command string.
-	 */
-	switch (operation)
-	{
-		case CMD_UPDATE:
-			deparseDirectUpdateSql(&sql, root, resultRelation, rel,
-								   foreignrel,
-								   processed_tlist,
-								   targetAttrs,
-								   remote_exprs, &params_list,
-								   returningList, &retrieved_attrs);
-			break;
-		case CMD_DELETE:
-			deparseDirectDeleteSql(&sql, root, resultRelation, rel,
-								   foreignrel,
-								   remote_exprs, &params_list,
-								   returningList, &retrieved_attrs);
-			break;
-		default:
-			elog(ERROR, "unexpected operation: %d", (int) operation);
-			break;
-	}
+			/*
+			 * The cost of foreign join is estimated as cost of generating
+			 * rows for the joining relations + cost for applying quals on the
+			 * rows.
+			 */
 
-	/*
-	 * Update the operation and target relation info.
-	 */
-	fscan->operation = operation;
-	fscan->resultRelation = resultRelation;
+			/*
+			 * Calculate the cost of clauses pushed down to the foreign server
+			 */
+			cost_qual_eval(&remote_conds_cost, fpinfo->remote_conds, root);
+			/* Calculate the cost of applying join clauses */
+			cost_qual_eval(&join_cost, fpinfo->joinclauses, root);
 
-	/*
-	 * Update the fdw_exprs list that will be available to the executor.
-	 */
-	fscan->fdw_exprs = params_list;
+			/*
+			 * Startup cost includes startup cost of joining relations and the
+			 * startup cost for join and other clauses. We do not include the
+			 * startup cost specific to join strategy (e.g. setting up hash
+			 * tables) since we do not know what strategy the foreign server
+			 * is going to use.
+			 */
+			startup_cost = fpinfo_i->rel_startup_cost + fpinfo_o->rel_startup_cost;
+			startup_cost += join_cost.startup;
+			startup_cost += remote_conds_cost.startup;
+			startup_cost += fpinfo->local_conds_cost.startup;
 
-	/*
-	 * Update the fdw_private list that will be available to the executor.
-	 * Items in the list must match enum FdwDirectModifyPrivateIndex, above.
-	 */
-	fscan->fdw_private = list_make4(makeString(sql.data),
-									makeBoolean((retrieved_attrs != NIL)),
-									retrieved_attrs,
-									makeBoolean(plan->canSetTag));
+			/*
+			 * Run time cost includes:
+			 *
+			 * 1. Run time cost (total_cost - startup_cost) of relations being
+			 * joined
+			 *
+			 * 2. Run time cost of applying join clauses on the cross product
+			 * of the joining relations.
+			 *
+			 * 3. Run time cost of applying pushed down other clauses on the
+			 * result of join
+			 *
+			 * 4. Run time cost of applying nonpushable other clauses locally
+			 * on the result fetched from the foreign server.
+			 */
+			run_cost = fpinfo_i->rel_total_cost - fpinfo_i->rel_startup_cost;
+			run_cost += fpinfo_o->rel_total_cost - fpinfo_o->rel_startup_cost;
+			run_cost += nrows * join_cost.per_tuple;
+			nrows = clamp_row_est(nrows * fpinfo->joinclause_sel);
+			run_cost += nrows * remote_conds_cost.per_tuple;
+			run_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
+
+			/* Add in tlist eval cost for each output row */
+			startup_cost += foreignrel->reltarget->cost.startup;
+			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
+		}
+		else if (IS_UPPER_REL(foreignrel))
+		{
+			RelOptInfo *outerrel = fpinfo->outerrel;
+			PgFdwRelationInfo *ofpinfo;
+			AggClauseCosts aggcosts;
+			double		input_rows;
+			int			numGroupCols;
+			double		numGroups = 1;
 
-	/*
-	 * Update the foreign-join-related fields.
-	 */
-	if (fscan->scan.scanrelid == 0)
-	{
-		/* No need for the outer subplan. */
-		fscan->scan.plan.lefttree = NULL;
+			/* The upper relation should have its outer relation set */
+			Assert(outerrel);
+			/* and that outer relation should have its reltarget set */
+			Assert(outerrel->reltarget);
 
-		/* Build new fdw_scan_tlist if UPDATE/DELETE .. RETURNING. */
-		if (returningList)
-			rebuild_fdw_scan_tlist(fscan, returningList);
-	}
+			/*
+			 * This cost model is mixture of costing done for sorted and
+			 * hashed aggregates in cost_agg().  We are not sure which
+			 * strategy will be considered at remote side, thus for
+			 * simplicity, we put all startup related costs in startup_cost
+			 * and all finalization and run cost are added in total_cost.
+			 */
 
-	/*
-	 * Finally, unset the async-capable flag if it is set, as we currently
-	 * don't support asynchronous execution of direct modifications.
-	 */
-	if (fscan->scan.plan.async_capable)
-		fscan->scan.plan.async_capable = false;
+			ofpinfo = (PgFdwRelationInfo *) outerrel->fdw_private;
 
-	table_close(rel, NoLock);
-	return true;
-}
+			/* Get rows from input rel */
+			input_rows = ofpinfo->rows;
 
-/*
- * postgresBeginDirectModify
- *		Prepare a direct foreign table modification
- */
-static void
-postgresBeginDirectModify(ForeignScanState *node, int eflags)
-{
-	ForeignScan *fsplan = (ForeignScan *) node->ss.ps.plan;
-	EState	   *estate = node->ss.ps.state;
-	PgFdwDirectModifyState *dmstate;
-	Index		rtindex;
-	Oid			userid;
-	ForeignTable *table;
-	UserMapping *user;
-	int			numParams;
+			/* Collect statistics about aggregates for estimating costs. */
+			MemSet(&aggcosts, 0, sizeof(AggClauseCosts));
+			if (root->parse->hasAggs)
+			{
+				get_agg_clause_costs(root, AGGSPLIT_SIMPLE, &aggcosts);
+			}
 
-	/*
-	 * Do nothing in EXPLAIN (no ANALYZE) case.  node->fdw_state stays NULL.
-	 */
-	if (eflags & EXEC_FLAG_EXPLAIN_ONLY)
-		return;
+			/* Get number of grouping columns and possible number of groups */
+			numGroupCols = list_length(root->processed_groupClause);
+			numGroups = estimate_num_groups(root,
+											get_sortgrouplist_exprs(root->processed_groupClause,
+																	fpinfo->grouped_tlist),
+											input_rows, NULL, NULL);
 
-	/*
-	 * We'll save private state in node->fdw_state.
-	 */
-	dmstate = (PgFdwDirectModifyState *) palloc0(sizeof(PgFdwDirectModifyState));
-	node->fdw_state = (void *) dmstate;
+			/*
+			 * Get the retrieved_rows and rows estimates.  If there are HAVING
+			 * quals, account for their selectivity.
+			 */
+			if (root->hasHavingQual)
+			{
+				/* Factor in the selectivity of the remotely-checked quals */
+				retrieved_rows =
+					clamp_row_est(numGroups *
+								  clauselist_selectivity(root,
+														 fpinfo->remote_conds,
+														 0,
+														 JOIN_INNER,
+														 NULL));
+				/* Factor in the selectivity of the locally-checked quals */
+				rows = clamp_row_est(retrieved_rows * fpinfo->local_conds_sel);
+			}
+			else
+			{
+				rows = retrieved_rows = numGroups;
+			}
 
-	/*
-	 * Identify which user to do the remote access as.  This should match what
-	 * ExecCheckPermissions() does.
-	 */
-	userid = OidIsValid(fsplan->checkAsUser) ? fsplan->checkAsUser : GetUserId();
+			/* Use width estimate made by the core code. */
+			width = foreignrel->reltarget->width;
 
-	/* Get info about foreign table. */
-	rtindex = node->resultRelInfo->ri_RangeTableIndex;
-	if (fsplan->scan.scanrelid == 0)
-		dmstate->rel = ExecOpenScanRelation(estate, rtindex, eflags);
-	else
-		dmstate->rel = node->ss.ss_currentRelation;
-	table = GetForeignTable(RelationGetRelid(dmstate->rel));
-	user = GetUserMapping(userid, table->serverid);
+			/*-----
+			 * Startup cost includes:
+			 *	  1. Startup cost for underneath input relation, adjusted for
+			 *	     tlist replacement by apply_scanjoin_target_to_paths()
+			 *	  2. Cost of performing aggregation, per cost_agg()
+			 *-----
+			 */
+			startup_cost = ofpinfo->rel_startup_cost;
+			startup_cost += outerrel->reltarget->cost.startup;
+			startup_cost += aggcosts.transCost.startup;
+			startup_cost += aggcosts.transCost.per_tuple * input_rows;
+			startup_cost += aggcosts.finalCost.startup;
+			startup_cost += (cpu_operator_cost * numGroupCols) * input_rows;
 
-	/*
-	 * Get connection to the foreign server.  Connection manager will
-	 * establish new connection if necessary.
-	 */
-	dmstate->conn = GetConnection(user, false, &dmstate->conn_state);
+			/*-----
+			 * Run time cost includes:
+			 *	  1. Run time cost of underneath input relation, adjusted for
+			 *	     tlist replacement by apply_scanjoin_target_to_paths()
+			 *	  2. Run time cost of performing aggregation, per cost_agg()
+			 *-----
+			 */
+			run_cost = ofpinfo->rel_total_cost - ofpinfo->rel_startup_cost;
+			run_cost += outerrel->reltarget->cost.per_tuple * input_rows;
+			run_cost += aggcosts.finalCost.per_tuple * numGroups;
+			run_cost += cpu_tuple_cost * numGroups;
 
-	/* Update the foreign-join-related fields. */
-	if (fsplan->scan.scanrelid == 0)
-	{
-		/* Save info about foreign table. */
-		dmstate->resultRel = dmstate->rel;
+			/* Account for the eval cost of HAVING quals, if any */
+			if (root->hasHavingQual)
+			{
+				QualCost	remote_cost;
 
-		/*
-		 * Set dmstate->rel to NULL to teach get_returning_data() and
-		 * make_tuple_from_result_row() that columns fetched from the remote
-		 * server are described by fdw_scan_tlist of the foreign-scan plan
-		 * node, not the tuple descriptor for the target relation.
-		 */
-		dmstate->rel = NULL;
-	}
+				/* Add in the eval cost of the remotely-checked quals */
+				cost_qual_eval(&remote_cost, fpinfo->remote_conds, root);
+				startup_cost += remote_cost.startup;
+				run_cost += remote_cost.per_tuple * numGroups;
+				/* Add in the eval cost of the locally-checked quals */
+				startup_cost += fpinfo->local_conds_cost.startup;
+				run_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
+			}
 
-	/* Initialize state variable */
-	dmstate->num_tuples = -1;	/* -1 means not set yet */
+			/* Add in tlist eval cost for each output row */
+			startup_cost += foreignrel->reltarget->cost.startup;
+			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
+		}
+		else
+		{
+			Cost		cpu_per_tuple;
 
-	/* Get private info created by planner functions. */
-	dmstate->query = strVal(list_nth(fsplan->fdw_private,
-									 FdwDirectModifyPrivateUpdateSql));
-	dmstate->has_returning = boolVal(list_nth(fsplan->fdw_private,
-											  FdwDirectModifyPrivateHasReturning));
-	dmstate->retrieved_attrs = (List *) list_nth(fsplan->fdw_private,
-												 FdwDirectModifyPrivateRetrievedAttrs);
-	dmstate->set_processed = boolVal(list_nth(fsplan->fdw_private,
-											  FdwDirectModifyPrivateSetProcessed));
+			/* Use rows/width estimates made by set_baserel_size_estimates. */
+			rows = foreignrel->rows;
+			width = foreignrel->reltarget->width;
 
-	/* Create context for per-tuple temp workspace. */
-	dmstate->temp_cxt = AllocSetContextCreate(estate->es_query_cxt,
-											  "postgres_fdw temporary data",
-											  ALLOCSET_SMALL_SIZES);
+			/*
+			 * Back into an estimate of the number of retrieved rows.  Just in
+			 * case this is nuts, clamp to at most foreignrel->tuples.
+			 */
+			retrieved_rows = clamp_row_est(rows / fpinfo->local_conds_sel);
+			retrieved_rows = Min(retrieved_rows, foreignrel->tuples);
 
-	/* Prepare for input conversion of RETURNING results. */
-	if (dmstate->has_returning)
-	{
-		TupleDesc	tupdesc;
+			/*
+			 * Cost as though this were a seqscan, which is pessimistic.  We
+			 * effectively imagine the local_conds are being evaluated
+			 * remotely, too.
+			 */
+			startup_cost = 0;
+			run_cost = 0;
+			run_cost += seq_page_cost * foreignrel->pages;
 
-		if (fsplan->scan.scanrelid == 0)
-			tupdesc = get_tupdesc_for_join_scan_tuples(node);
-		else
-			tupdesc = RelationGetDescr(dmstate->rel);
+			startup_cost += foreignrel->baserestrictcost.startup;
+			cpu_per_tuple = cpu_tuple_cost + foreignrel->baserestrictcost.per_tuple;
+			run_cost += cpu_per_tuple * foreignrel->tuples;
 
-		dmstate->attinmeta = TupleDescGetAttInMetadata(tupdesc);
+			/* Add in tlist eval cost for each output row */
+			startup_cost += foreignrel->reltarget->cost.startup;
+			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
+		}
 
 		/*
-		 * When performing an UPDATE/DELETE .. RETURNING on a join directly,
-		 * initialize a filter to extract an updated/deleted tuple from a scan
-		 * tuple.
+		 * Without remote estimates, we have no real way to estimate the cost
+		 * of generating sorted output.  It could be free if the query plan
+		 * the remote side would have chosen generates properly-sorted output
+		 * anyway, but in most cases it will cost something.  Estimate a value
+		 * high enough that we won't pick the sorted path when the ordering
+		 * isn't locally useful, but low enough that we'll err on the side of
+		 * pushing down the ORDER BY clause when it's useful to do so.
 		 */
-		if (fsplan->scan.scanrelid == 0)
-			init_returning_filter(dmstate, fsplan->fdw_scan_tlist, rtindex);
+		if (pathkeys != NIL)
+		{
+			if (IS_UPPER_REL(foreignrel))
+			{
+				Assert(foreignrel->reloptkind == RELOPT_UPPER_REL &&
+					   fpinfo->stage == UPPERREL_GROUP_AGG);
+				adjust_foreign_grouping_path_cost(root, pathkeys,
+												  retrieved_rows, width,
+												  fpextra->limit_tuples,
+												  &startup_cost, &run_cost);
+			}
+			else
+			{
+				startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+				run_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+			}
+		}
+
+		total_cost = startup_cost + run_cost;
+
+		/* Adjust the cost estimates if we have LIMIT */
+		if (fpextra && fpextra->has_limit)
+		{
+			adjust_limit_rows_costs(&rows, &startup_cost, &total_cost,
+									fpextra->offset_est, fpextra->count_est);
+			retrieved_rows = rows;
+		}
 	}
 
 	/*
-	 * Prepare for processing of parameters used in remote query, if any.
+	 * If this includes the final sort step, the given target, which will be
+	 * applied to the resulting path, might have different expressions from
+	 * the foreignrel's reltarget (see make_sort_input_target()); adjust tlist
+	 * eval costs.
 	 */
-	numParams = list_length(fsplan->fdw_exprs);
-	dmstate->numParams = numParams;
-	if (numParams > 0)
-		prepare_query_params((PlanState *) node,
-							 fsplan->fdw_exprs,
-							 numParams,
-							 &dmstate->param_flinfo,
-							 &dmstate->param_exprs,
-							 &dmstate->param_values);
-}
-
-/*
- * postgresIterateDirectModify
- *		Execute a direct foreign table modification
- */
-static TupleTableSlot *
-postgresIterateDirectModify(ForeignScanState *node)
-{
-	PgFdwDirectModifyState *dmstate = (PgFdwDirectModifyState *) node->fdw_state;
-	EState	   *estate = node->ss.ps.state;
-	ResultRelInfo *resultRelInfo = node->resultRelInfo;
+	if (fpextra && fpextra->has_final_sort &&
+		fpextra->target != foreignrel->reltarget)
+	{
+		QualCost	oldcost = foreignrel->reltarget->cost;
+		QualCost	newcost = fpextra->target->cost;
 
-	/*
-	 * If this is the first call after Begin, execute the statement.
-	 */
-	if (dmstate->num_tuples == -1)
-		execute_dml_stmt(node);
+		startup_cost += newcost.startup - oldcost.startup;
+		total_cost += newcost.startup - oldcost.startup;
+		total_cost += (newcost.per_tuple - oldcost.per_tuple) * rows;
+	}
 
 	/*
-	 * If the local query doesn't specify RETURNING, just clear tuple slot.
+	 * Cache the retrieved rows and cost estimates for scans, joins, or
+	 * groupings without any parameterization, pathkeys, or additional
+	 * post-scan/join-processing steps, before adding the costs for
+	 * transferring data from the foreign server.  These estimates are useful
+	 * for costing remote joins involving this relation or costing other
+	 * remote operations on this relation such as remote sorts and remote
+	 * LIMIT restrictions, when the costs can not be obtained from the foreign
+	 * server.  This function will be called at least once for every foreign
+	 * relation without any parameterization, pathkeys, or additional
+	 * post-scan/join-processing steps.
 	 */
-	if (!resultRelInfo->ri_projectReturning)
+	if (pathkeys == NIL && param_join_conds == NIL && fpextra == NULL)
 	{
-		TupleTableSlot *slot = node->ss.ss_ScanTupleSlot;
-		Instrumentation *instr = node->ss.ps.instrument;
-
-		Assert(!dmstate->has_returning);
-
-		/* Increment the command es_processed count if necessary. */
-		if (dmstate->set_processed)
-			estate->es_processed += dmstate->num_tuples;
-
-		/* Increment the tuple count for EXPLAIN ANALYZE if necessary. */
-		if (instr)
-			instr->tuplecount += dmstate->num_tuples;
-
-		return ExecClearTuple(slot);
+		fpinfo->retrieved_rows = retrieved_rows;
+		fpinfo->rel_startup_cost = startup_cost;
+		fpinfo->rel_total_cost = total_cost;
 	}
 
 	/*
-	 * Get the next RETURNING tuple.
+	 * Add some additional cost factors to account for connection overhead
+	 * (fdw_startup_cost), transferring data across the network
+	 * (fdw_tuple_cost per retrieved row), and local manipulation of the data
+	 * (cpu_tuple_cost per retrieved row).
 	 */
-	return get_returning_data(node);
-}
-
-/*
- * postgresEndDirectModify
- *		Finish a direct foreign table modification
- */
-static void
-postgresEndDirectModify(ForeignScanState *node)
-{
-	PgFdwDirectModifyState *dmstate = (PgFdwDirectModifyState *) node->fdw_state;
-
-	/* if dmstate is NULL, we are in EXPLAIN; nothing to do */
-	if (dmstate == NULL)
-		return;
-
-	/* Release PGresult */
-	PQclear(dmstate->result);
+	startup_cost += fpinfo->fdw_startup_cost;
+	total_cost += fpinfo->fdw_startup_cost;
+	total_cost += fpinfo->fdw_tuple_cost * retrieved_rows;
+	total_cost += cpu_tuple_cost * retrieved_rows;
 
-	/* Release remote connection */
-	ReleaseConnection(dmstate->conn);
-	dmstate->conn = NULL;
+	/*
+	 * If we have LIMIT, we should prefer performing the restriction remotely
+	 * rather than locally, as the former avoids extra row fetches from the
+	 * remote that the latter might cause.  But since the core code doesn't
+	 * account for such fetches when estimating the costs of the local
+	 * restriction (see create_limit_path()), there would be no difference
+	 * between the costs of the local restriction and the costs of the remote
+	 * restriction estimated above if we don't use remote estimates (except
+	 * for the case where the foreignrel is a grouping relation, the given
+	 * pathkeys is not NIL, and the effects of a bounded sort for that rel is
+	 * accounted for in costing the remote restriction).  Tweak the costs of
+	 * the remote restriction to ensure we'll prefer it if LIMIT is a useful
+	 * one.
+	 */
+	if (!fpinfo->use_remote_estimate &&
+		fpextra && fpextra->has_limit &&
+		fpextra->limit_tuples > 0 &&
+		fpextra->limit_tuples < fpinfo->rows)
+	{
+		Assert(fpinfo->rows > 0);
+		total_cost -= (total_cost - startup_cost) * 0.05 *
+			(fpinfo->rows - fpextra->limit_tuples) / fpinfo->rows;
+	}
 
-	/* MemoryContext will be deleted automatically. */
+	/* Return results. */
+	*p_rows = rows;
+	*p_width = width;
+	*p_startup_cost = startup_cost;
+	*p_total_cost = total_cost;
 }
 
 /*
- * postgresExplainForeignScan
- *		Produce extra output for EXPLAIN of a ForeignScan on a foreign table
+ * Estimate costs of executing a SQL statement remotely.
+ * The given "sql" must be an EXPLAIN command.
  */
 static void
-postgresExplainForeignScan(ForeignScanState *node, ExplainState *es)
+get_remote_estimate(const char *sql, PGconn *conn,
+					double *rows, int *width,
+					Cost *startup_cost, Cost *total_cost)
 {
-	ForeignScan *plan = castNode(ForeignScan, node->ss.ps.plan);
-	List	   *fdw_private = plan->fdw_private;
+	PGresult   *volatile res = NULL;
 
-	/*
-	 * Identify foreign scans that are really joins or upper relations.  The
-	 * input looks something like "(1) LEFT JOIN (2)", and we must replace the
-	 * digit string(s), which are RT indexes, with the correct relation names.
-	 * We do that here, not when the plan is created, because we can't know
-	 * what aliases ruleutils.c will assign at plan creation time.
-	 */
-	if (list_length(fdw_private) > FdwScanPrivateRelations)
+	/* PGresult must be released before leaving this function. */
+	PG_TRY();
 	{
-		StringInfo	relations;
-		char	   *rawrelations;
-		char	   *ptr;
-		int			minrti,
-					rtoffset;
-
-		rawrelations = strVal(list_nth(fdw_private, FdwScanPrivateRelations));
+		char	   *line;
+		char	   *p;
+		int			n;
 
 		/*
-		 * A difficulty with using a string representation of RT indexes is
-		 * that setrefs.c won't update the string when flattening the
-		 * rangetable.  To find out what rtoffset was applied, identify the
-		 * minimum RT index appearing in the string and compare it to the
-		 * minimum member of plan->fs_base_relids.  (We expect all the relids
-		 * in the join will have been offset by the same amount; the Asserts
-		 * below should catch it if that ever changes.)
+		 * Execute EXPLAIN remotely.
 		 */
-		minrti = INT_MAX;
-		ptr = rawrelations;
-		while (*ptr)
-		{
-			if (isdigit((unsigned char) *ptr))
-			{
-				int			rti = strtol(ptr, &ptr, 10);
-
-				if (rti < minrti)
-					minrti = rti;
-			}
-			else
-				ptr++;
-		}
-		rtoffset = bms_next_member(plan->fs_base_relids, -1) - minrti;
-
-		/* Now we can translate the string */
-		relations = makeStringInfo();
-		ptr = rawrelations;
-		while (*ptr)
-		{
-			if (isdigit((unsigned char) *ptr))
-			{
-				int			rti = strtol(ptr, &ptr, 10);
-				RangeTblEntry *rte;
-				char	   *relname;
-				char	   *refname;
-
-				rti += rtoffset;
-				Assert(bms_is_member(rti, plan->fs_base_relids));
-				rte = rt_fetch(rti, es->rtable);
-				Assert(rte->rtekind == RTE_RELATION);
-				/* This logic should agree with explain.c's ExplainTargetRel */
-				relname = get_rel_name(rte->relid);
-				if (es->verbose)
-				{
-					char	   *namespace;
+		res = pgfdw_exec_query(conn, sql, NULL);
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			pgfdw_report_error(ERROR, res, conn, false, sql);
 
-					namespace = get_namespace_name_or_temp(get_rel_namespace(rte->relid));
-					appendStringInfo(relations, "%s.%s",
-									 quote_identifier(namespace),
-									 quote_identifier(relname));
-				}
-				else
-					appendStringInfoString(relations,
-										   quote_identifier(relname));
-				refname = (char *) list_nth(es->rtable_names, rti - 1);
-				if (refname == NULL)
-					refname = rte->eref->aliasname;
-				if (strcmp(refname, relname) != 0)
-					appendStringInfo(relations, " %s",
-									 quote_identifier(refname));
-			}
-			else
-				appendStringInfoChar(relations, *ptr++);
-		}
-		ExplainPropertyText("Relations", relations->data, es);
+		/*
+		 * Extract cost numbers for topmost plan node.  Note we search for a
+		 * left paren from the end of the line to avoid being confused by
+		 * other uses of parentheses.
+		 */
+		line = PQgetvalue(res, 0, 0);
+		p = strrchr(line, '(');
+		if (p == NULL)
+			elog(ERROR, "could not interpret EXPLAIN output: \"%s\"", line);
+		n = sscanf(p, "(cost=%lf..%lf rows=%lf width=%d)",
+				   startup_cost, total_cost, rows, width);
+		if (n != 4)
+			elog(ERROR, "could not interpret EXPLAIN output: \"%s\"", line);
 	}
-
-	/*
-	 * Add remote query, when VERBOSE option is specified.
-	 */
-	if (es->verbose)
+	PG_FINALLY();
 	{
-		char	   *sql;
-
-		sql = strVal(list_nth(fdw_private, FdwScanPrivateSelectSql));
-		ExplainPropertyText("Remote SQL", sql, es);
+		PQclear(res);
 	}
+	PG_END_TRY();
 }
 
 /*
- * postgresExplainForeignModify
- *		Produce extra output for EXPLAIN of a ModifyTable on a foreign table
+ * Adjust the cost estimates of a foreign grouping path to include the cost of
+ * generating properly-sorted output.
  */
 static void
-postgresExplainForeignModify(ModifyTableState *mtstate,
-							 ResultRelInfo *rinfo,
-							 List *fdw_private,
-							 int subplan_index,
-							 ExplainState *es)
+adjust_foreign_grouping_path_cost(PlannerInfo *root,
+								  List *pathkeys,
+								  double retrieved_rows,
+								  double width,
+								  double limit_tuples,
+								  Cost *p_startup_cost,
+								  Cost *p_run_cost)
 {
-	if (es->verbose)
+	/*
+	 * If the GROUP BY clause isn't sort-able, the plan chosen by the remote
+	 * side is unlikely to generate properly-sorted output, so it would need
+	 * an explicit sort; adjust the given costs with cost_sort().  Likewise,
+	 * if the GROUP BY clause is sort-able but isn't a superset of the given
+	 * pathkeys, adjust the costs with that function.  Otherwise, adjust the
+	 * costs by applying the same heuristic as for the scan or join case.
+	 */
+	if (!grouping_is_sortable(root->processed_groupClause) ||
+		!pathkeys_contained_in(pathkeys, root->group_pathkeys))
 	{
-		char	   *sql = strVal(list_nth(fdw_private,
-										  FdwModifyPrivateUpdateSql));
+		Path		sort_path;	/* dummy for result of cost_sort */
 
-		ExplainPropertyText("Remote SQL", sql, es);
+		cost_sort(&sort_path,
+				  root,
+				  pathkeys,
+				  *p_startup_cost + *p_run_cost,
+				  retrieved_rows,
+				  width,
+				  0.0,
+				  work_mem,
+				  limit_tuples);
 
+		*p_startup_cost = sort_path.startup_cost;
+		*p_run_cost = sort_path.total_cost - sort_path.startup_cost;
+	}
+	else
+	{
 		/*
-		 * For INSERT we should always have batch size >= 1, but UPDATE and
-		 * DELETE don't support batching so don't show the property.
+		 * The default extra cost seems too large for foreign-grouping cases;
+		 * add 1/4th of that default.
 		 */
-		if (rinfo->ri_BatchSize > 0)
-			ExplainPropertyInteger("Batch Size", NULL, rinfo->ri_BatchSize, es);
+		double		sort_multiplier = 1.0 + (DEFAULT_FDW_SORT_MULTIPLIER
+											 - 1.0) * 0.25;
+
+		*p_startup_cost *= sort_multiplier;
+		*p_run_cost *= sort_multiplier;
 	}
 }
 
 /*
- * postgresExplainDirectModify
- *		Produce extra output for EXPLAIN of a ForeignScan that modifies a
- *		foreign table directly
+ * Detect whether we want to process an EquivalenceClass member.
+ *
+ * This is a callback for use by generate_implied_equalities_for_column.
  */
-static void
-postgresExplainDirectModify(ForeignScanState *node, ExplainState *es)
+static bool
+ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
+						  EquivalenceClass *ec, EquivalenceMember *em,
+						  void *arg)
 {
-	List	   *fdw_private;
-	char	   *sql;
+	ec_member_foreign_arg *state = (ec_member_foreign_arg *) arg;
+	Expr	   *expr = em->em_expr;
 
-	if (es->verbose)
-	{
-		fdw_private = ((ForeignScan *) node->ss.ps.plan)->fdw_private;
-		sql = strVal(list_nth(fdw_private, FdwDirectModifyPrivateUpdateSql));
-		ExplainPropertyText("Remote SQL", sql, es);
-	}
+	/*
+	 * If we've identified what we're processing in the current scan, we only
+	 * want to match that expression.
+	 */
+	if (state->current != NULL)
+		return equal(expr, state->current);
+
+	/*
+	 * Otherwise, ignore anything we've already processed.
+	 */
+	if (list_member(state->already_used, expr))
+		return false;
+
+	/* This is the new target to process. */
+	state->current = expr;
+	return true;
 }
 
 /*
- * postgresExecForeignTruncate
- *		Truncate one or more foreign tables
+ * Create cursor for node's query with current parameter values.
+ *
+ * In sync mode, the first FETCH is pipelined behind the DECLARE, so that the
+ * cursor comes back with its first batch of rows in one round trip.  In async
+ * mode, the caller sends the FETCH itself without waiting for it.
  */
 static void
-postgresExecForeignTruncate(List *rels,
-							DropBehavior behavior,
-							bool restart_seqs)
+create_cursor(ForeignScanState *node)
 {
-	Oid			serverid = InvalidOid;
-	UserMapping *user = NULL;
-	PGconn	   *conn = NULL;
-	StringInfoData sql;
-	ListCell   *lc;
-	bool		server_truncatable = true;
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	ExprContext *econtext = node->ss.ps.ps_ExprContext;
+	int			numParams = fsstate->numParams;
+	const char **values = fsstate->param_values;
+	PGconn	   *conn = fsstate->conn;
+	bool		pipelined = !fsstate->async_capable;
+	StringInfoData buf;
+	PGresult   *res;
+	PGresult   *fetch_res = NULL;
+	const char *late_value;
+	bool		send_filter;
+	volatile int nqueued = 0;
+
+	/* First, process a pending asynchronous request, if any. */
+	if (fsstate->conn_state->pendingAreq)
+		process_pending_request(fsstate->conn_state->pendingAreq);
 
 	/*
-	 * By default, all postgres_fdw foreign tables are assumed truncatable.
-	 * This can be overridden by a per-server setting, which in turn can be
-	 * overridden by a per-table setting.
+	 * A two-phase scan first finds the rows that really join, if the
+	 * executor could keep the exact keys, and then declares its cursors for
+	 * batches of them.
 	 */
-	foreach(lc, rels)
+	if (fsstate->late_batch < 0 && fsstate->locator_query != NULL &&
+		node->semijoin_filters != NIL && node->semijoin_instr->keyset != NULL)
+		collect_late_matches(node);
+
+	/*
+	 * A scan joining with the keys remotely uploads them first; one looking
+	 * up batches of them makes up the batches.
+	 */
+	if (fsstate->key_table != NULL && !node->child_materialised)
+		upload_semijoin_keys(node);
+	if (fsstate->key_array && !node->child_materialised)
+		collect_key_batches(node);
+	send_filter = node->semijoin_filters != NIL && fsstate->late_batch < 0;
+
+	/*
+	 * Construct array of query parameter values in text format.  We do the
+	 * conversions in the short-lived per-tuple context, so as not to cause a
+	 * memory leak over repeated scans.
+	 */
+	if (numParams > 0)
 	{
-		ForeignServer *server = NULL;
-		Relation	rel = lfirst(lc);
-		ForeignTable *table = GetForeignTable(RelationGetRelid(rel));
-		ListCell   *cell;
-		bool		truncatable;
+		MemoryContext oldcontext;
 
-		/*
-		 * First time through, determine whether the foreign server allows
-		 * truncates. Since all specified foreign tables are assumed to belong
-		 * to the same foreign server, this result can be used for other
-		 * foreign tables.
-		 */
-		if (!OidIsValid(serverid))
-		{
-			serverid = table->serverid;
-			server = GetForeignServer(serverid);
+		oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
 
-			foreach(cell, server->options)
-			{
-				DefElem    *defel = (DefElem *) lfirst(cell);
+		process_query_params(econtext,
+							 fsstate->param_flinfo,
+							 fsstate->param_exprs,
+							 values);
 
-				if (strcmp(defel->defname, "truncatable") == 0)
-				{
-					server_truncatable = defGetBoolean(defel);
-					break;
-				}
-			}
-		}
+		MemoryContextSwitchTo(oldcontext);
+	}
 
-		/*
-		 * Confirm that all specified foreign tables belong to the same
-		 * foreign server.
-		 */
-		Assert(table->serverid == serverid);
+	/* Construct the DECLARE CURSOR command */
+	initStringInfo(&buf);
+	if (fsstate->late_batch >= 0)
+	{
+		appendStringInfo(&buf, "DECLARE c%u CURSOR FOR\n%s",
+						 fsstate->cursor_number, fsstate->fetch_query);
+		late_value = (const char *) list_nth(fsstate->late_batches,
+											 fsstate->late_batch);
+		numParams = 1;
+		values = &late_value;
+	}
+	else
+		appendStringInfo(&buf, "DECLARE c%u CURSOR FOR\n%s",
+						 fsstate->cursor_number, fsstate->query);
 
-		/* Determine whether this foreign table allows truncations */
-		truncatable = server_truncatable;
-		foreach(cell, table->options)
-		{
-			DefElem    *defel = (DefElem *) lfirst(cell);
+	/*
+	 * If the executor built a semijoin filter, append it after a '#', behind
+	 * the positions of the key columns; the remote server splits it off
+	 * before parsing the command, and applies it to the rows fetched from
+	 * this cursor.  A filter split into key-hash
+	 * partitions gets one cursor per partition, opened one after another.
+	 */
+	if (send_filter)
+	{
+		appendStringInfoChar(&buf, '#');
+		if (fsstate->nfilterkeys > 0)
+			append_filter_key_header(&buf, fsstate->nfilterkeys,
+									 fsstate->filterkeys);
+		appendStringInfoString(&buf, (char *) list_nth(node->semijoin_filters,
+													   fsstate->filter_part));
+	}
 
-			if (strcmp(defel->defname, "truncatable") == 0)
-			{
-				truncatable = defGetBoolean(defel);
-				break;
-			}
-		}
+	if (pipelined && !PQenterPipelineMode(conn))
+		pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
 
-		if (!truncatable)
-			ereport(ERROR,
-					(errcode(ERRCODE_OBJECT_NOT_IN_PREREQUISITE_STATE),
-					 errmsg("foreign table \"%s\" does not allow truncates",
-							RelationGetRelationName(rel))));
+	/*
+	 * Notice that we pass NULL for paramTypes, thus forcing the remote server
+	 * to infer types for all parameters.  Since we explicitly cast every
+	 * parameter (see deparse.c), the "inference" is trivial and will produce
+	 * the desired result.  This allows us to avoid assuming that the remote
+	 * server has the same OIDs we do for the parameters' types.
+	 *
+	 * With a large semijoin filter, sending is where the time goes.
+	 *
+	 * If sending fails halfway through the pipeline, leave pipeline mode
+	 * before the error propagates, or the abort cleanup could not use the
+	 * connection.
+	 */
+	PG_TRY();
+	{
+		bool		sent;
+
+		if (send_filter)
+		{
+			TRACE_POSTGRESQL_SEMIJOIN_SEND(fsstate->cursor_number, buf.len);
+			pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_SEND);
+		}
+		sent = PQsendQueryParams(conn, buf.data, numParams,
+								 NULL, values, NULL, NULL, 0);
+		if (send_filter)
+			pgstat_report_wait_end();
+		if (!sent)
+			pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
+
+		if (pipelined)
+		{
+			nqueued = 1;
+			send_fetch_query(fsstate, buf.data);
+			nqueued = 2;
+			if (!PQpipelineSync(conn))
+				pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
+		}
 	}
-	Assert(OidIsValid(serverid));
+	PG_CATCH();
+	{
+		if (pipelined)
+			abandon_pipeline(conn, nqueued, buf.data);
+		PG_RE_THROW();
+	}
+	PG_END_TRY();
 
 	/*
-	 * Get connection to the foreign server.  Connection manager will
-	 * establish new connection if necessary.
+	 * Get the result, and check for success.
+	 *
+	 * We don't use a PG_TRY block here, so be careful not to throw error
+	 * without releasing the PGresult.
 	 */
-	user = GetUserMapping(GetUserId(), serverid);
-	conn = GetConnection(user, false, NULL);
+	res = pgfdw_get_result(conn, buf.data);
+	if (pipelined)
+	{
+		PGresult   *sync_res;
 
-	/* Construct the TRUNCATE command string */
-	initStringInfo(&sql);
-	deparseTruncateSql(&sql, rels, behavior, restart_seqs);
+		/*
+		 * Collect everything up to the sync point and leave pipeline mode
+		 * before looking at the results, so that an error leaves the
+		 * connection usable.  If the DECLARE failed, the FETCH was skipped.
+		 */
+		fetch_res = pgfdw_get_result(conn, buf.data);
+		sync_res = pgfdw_get_result(conn, buf.data);
+		PQclear(sync_res);
+		if (!PQexitPipelineMode(conn))
+		{
+			PQclear(res);
+			PQclear(fetch_res);
+			pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
+		}
+	}
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+	{
+		PQclear(fetch_res);
+		pgfdw_report_error(ERROR, res, conn, true, fsstate->query);
+	}
+	PQclear(res);
+	/* On error, report the original query, not the FETCH. */
+	if (pipelined && PQresultStatus(fetch_res) != PGRES_TUPLES_OK)
+		pgfdw_report_error(ERROR, fetch_res, conn, true, fsstate->query);
 
-	/* Issue the TRUNCATE command to remote server */
-	do_sql_command(conn, sql.data);
+	/* Mark the cursor as created, and show no tuples have been retrieved */
+	fsstate->cursor_exists = true;
+	fsstate->tuples = NULL;
+	fsstate->num_tuples = 0;
+	fsstate->next_tuple = 0;
+	fsstate->fetch_ct_2 = 0;
+	fsstate->eof_reached = false;
+
+	/* Store the first batch, if we fetched it along */
+	if (pipelined)
+		store_fetched_rows(node, fetch_res);
+
+	/* Clean up */
+	pfree(buf.data);
+}
+
+/*
+ * Leave pipeline mode after failing to send a pipeline in full.  The nqueued
+ * commands that did go out are ended with a sync, and their results are
+ * discarded.  If not even the sync can be sent, the connection is broken and
+ * stays in pipeline mode; it is then thrown away.
+ */
+static void
+abandon_pipeline(PGconn *conn, int nqueued, const char *query)
+{
+	if (PQpipelineSync(conn))
+	{
+		int			i;
 
-	pfree(sql.data);
+		/* The results of the commands, then the sync's */
+		for (i = 0; i <= nqueued; i++)
+			PQclear(pgfdw_get_result(conn, query));
+	}
+	(void) PQexitPipelineMode(conn);
 }
 
 /*
- * estimate_path_cost_size
- *		Get cost and size estimates for a foreign scan on given foreign relation
- *		either a base relation or a join between foreign relations or an upper
- *		relation containing foreign relations.
- *
- * param_join_conds are the parameterization clauses with outer relations.
- * pathkeys specify the expected sort order if any for given path being costed.
- * fpextra specifies additional post-scan/join-processing steps such as the
- * final sort and the LIMIT restriction.
- *
- * The function returns the cost and size estimates in p_rows, p_width,
- * p_startup_cost and p_total_cost variables.
+ * Fetch some more rows from the node's cursor.
  */
 static void
-estimate_path_cost_size(PlannerInfo *root,
-						RelOptInfo *foreignrel,
-						List *param_join_conds,
-						List *pathkeys,
-						PgFdwPathExtraData *fpextra,
-						double *p_rows, int *p_width,
-						Cost *p_startup_cost, Cost *p_total_cost)
+fetch_more_data(ForeignScanState *node)
 {
-	PgFdwRelationInfo *fpinfo = (PgFdwRelationInfo *) foreignrel->fdw_private;
-	double		rows;
-	double		retrieved_rows;
-	int			width;
-	Cost		startup_cost;
-	Cost		total_cost;
-
-	/* Make sure the core code has set up the relation's reltarget */
-	Assert(foreignrel->reltarget);
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	PGconn	   *conn = fsstate->conn;
+	PGresult   *res;
 
-	/*
-	 * If the table or the server is configured to use remote estimates,
-	 * connect to the foreign server and execute EXPLAIN to estimate the
-	 * number of rows selected by the restriction+join clauses.  Otherwise,
-	 * estimate rows using whatever statistics we have locally, in a way
-	 * similar to ordinary tables.
-	 */
-	if (fpinfo->use_remote_estimate)
+	if (fsstate->async_capable)
 	{
-		List	   *remote_param_join_conds;
-		List	   *local_param_join_conds;
-		StringInfoData sql;
-		PGconn	   *conn;
-		Selectivity local_sel;
-		QualCost	local_cost;
-		List	   *fdw_scan_tlist = NIL;
-		List	   *remote_conds;
-
-		/* Required only to be passed to deparseSelectStmtForRel */
-		List	   *retrieved_attrs;
+		Assert(fsstate->conn_state->pendingAreq);
 
 		/*
-		 * param_join_conds might contain both clauses that are safe to send
-		 * across, and clauses that aren't.
+		 * The query was already sent by an earlier call to
+		 * fetch_more_data_begin.  So now we just fetch the result.
 		 */
-		classifyConditions(root, foreignrel, param_join_conds,
-						   &remote_param_join_conds, &local_param_join_conds);
+		res = pgfdw_get_result(conn, fsstate->query);
+		/* On error, report the original query, not the FETCH. */
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			pgfdw_report_error(ERROR, res, conn, true, fsstate->query);
 
-		/* Build the list of columns to be fetched from the foreign server. */
-		if (IS_JOIN_REL(foreignrel) || IS_UPPER_REL(foreignrel))
-			fdw_scan_tlist = build_tlist_to_deparse(foreignrel);
-		else
-			fdw_scan_tlist = NIL;
+		/* Reset per-connection state */
+		fsstate->conn_state->pendingAreq = NULL;
+	}
+	else
+	{
+		/* This is a regular synchronous fetch. */
+		if (fsstate->conn_state->pendingAreq)
+			process_pending_request(fsstate->conn_state->pendingAreq);
+		send_fetch_query(fsstate, fsstate->query);
 
-		/*
-		 * The complete list of remote conditions includes everything from
-		 * baserestrictinfo plus any extra join_conds relevant to this
-		 * particular path.
-		 */
-		remote_conds = list_concat(remote_param_join_conds,
-								   fpinfo->remote_conds);
+		res = pgfdw_get_result(conn, fsstate->query);
+		/* On error, report the original query, not the FETCH. */
+		if (PQresultStatus(res) != PGRES_TUPLES_OK)
+			pgfdw_report_error(ERROR, res, conn, true, fsstate->query);
+	}
 
-		/*
-		 * Construct EXPLAIN query including the desired SELECT, FROM, and
-		 * WHERE clauses. Params and other-relation Vars are replaced by dummy
-		 * values, so don't request params_list.
-		 */
-		initStringInfo(&sql);
-		appendStringInfoString(&sql, "EXPLAIN ");
-		deparseSelectStmtForRel(&sql, root, foreignrel, fdw_scan_tlist,
-								remote_conds, pathkeys,
-								fpextra ? fpextra->has_final_sort : false,
-								fpextra ? fpextra->has_limit : false,
-								false, &retrieved_attrs, NULL);
+	store_fetched_rows(node, res);
+}
 
-		/* Get the remote estimate */
-		conn = GetConnection(fpinfo->user, false, NULL);
-		get_remote_estimate(sql.data, conn, &rows, &width,
-							&startup_cost, &total_cost);
-		ReleaseConnection(conn);
+/*
+ * Convert the rows of a FETCH result into the node's next batch of tuples.
+ * The PGresult is released.
+ */
+static void
+store_fetched_rows(ForeignScanState *node, PGresult *res)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	MemoryContext oldcontext;
 
-		retrieved_rows = rows;
+	/*
+	 * We'll store the tuples in the batch_cxt.  First, flush the previous
+	 * batch.
+	 */
+	fsstate->tuples = NULL;
+	MemoryContextReset(fsstate->batch_cxt);
+	oldcontext = MemoryContextSwitchTo(fsstate->batch_cxt);
 
-		/* Factor in the selectivity of the locally-checked quals */
-		local_sel = clauselist_selectivity(root,
-										   local_param_join_conds,
-										   foreignrel->relid,
-										   JOIN_INNER,
-										   NULL);
-		local_sel *= fpinfo->local_conds_sel;
+	/* PGresult must be released before leaving this function. */
+	PG_TRY();
+	{
+		int			numrows;
+		int			i;
 
-		rows = clamp_row_est(rows * local_sel);
+		/* Binary values can only be decoded as the type they were sent as */
+		if (fsstate->recvfuncs)
+			check_binary_result(fsstate, res);
 
-		/* Add in the eval cost of the locally-checked quals */
-		startup_cost += fpinfo->local_conds_cost.startup;
-		total_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
-		cost_qual_eval(&local_cost, local_param_join_conds, root);
-		startup_cost += local_cost.startup;
-		total_cost += local_cost.per_tuple * retrieved_rows;
+		/* Convert the data into HeapTuples */
+		numrows = PQntuples(res);
+		fsstate->tuples = (HeapTuple *) palloc0(numrows * sizeof(HeapTuple));
+		fsstate->num_tuples = numrows;
+		fsstate->next_tuple = 0;
 
-		/*
-		 * Add in tlist eval cost for each output row.  In case of an
-		 * aggregate, some of the tlist expressions such as grouping
-		 * expressions will be evaluated remotely, so adjust the costs.
-		 */
-		startup_cost += foreignrel->reltarget->cost.startup;
-		total_cost += foreignrel->reltarget->cost.startup;
-		total_cost += foreignrel->reltarget->cost.per_tuple * rows;
-		if (IS_UPPER_REL(foreignrel))
+		for (i = 0; i < numrows; i++)
 		{
-			QualCost	tlist_cost;
+			Assert(IsA(node->ss.ps.plan, ForeignScan));
 
-			cost_qual_eval(&tlist_cost, fdw_scan_tlist, root);
-			startup_cost -= tlist_cost.startup;
-			total_cost -= tlist_cost.startup;
-			total_cost -= tlist_cost.per_tuple * rows;
+			fsstate->tuples[i] =
+				make_tuple_from_result_row(res, i,
+										   fsstate->rel,
+										   fsstate->attinmeta,
+										   fsstate->recvfuncs,
+										   fsstate->retrieved_attrs,
+										   node,
+										   fsstate->temp_cxt);
 		}
-	}
-	else
-	{
-		Cost		run_cost = 0;
 
 		/*
-		 * We don't support join conditions in this mode (hence, no
-		 * parameterized paths can be made).
+		 * Under EXPLAIN ANALYZE, count the rows that really join.  A
+		 * two-phase scan counted them while locating them.
 		 */
-		Assert(param_join_conds == NIL);
+		if (node->semijoin_instr && node->semijoin_instr->keyset &&
+			fsstate->late_batch < 0)
+			count_filter_matches(node, res);
 
-		/*
-		 * We will come here again and again with different set of pathkeys or
-		 * additional post-scan/join-processing steps that caller wants to
-		 * cost.  We don't need to calculate the cost/size estimates for the
-		 * underlying scan, join, or grouping each time.  Instead, use those
-		 * estimates if we have cached them already.
-		 */
-		if (fpinfo->rel_startup_cost >= 0 && fpinfo->rel_total_cost >= 0)
-		{
-			Assert(fpinfo->retrieved_rows >= 0);
+		/* Update fetch_ct_2 */
+		if (fsstate->fetch_ct_2 < 2)
+			fsstate->fetch_ct_2++;
 
-			rows = fpinfo->rows;
-			retrieved_rows = fpinfo->retrieved_rows;
-			width = fpinfo->width;
-			startup_cost = fpinfo->rel_startup_cost;
-			run_cost = fpinfo->rel_total_cost - fpinfo->rel_startup_cost;
+		/* Must be EOF if we didn't get as many tuples as we asked for. */
+		fsstate->eof_reached = (numrows < fsstate->fetch_size);
 
-			/*
-			 * If we estimate the costs of a foreign scan or a foreign join
-			 * with additional post-scan/join-processing steps, the scan or
-			 * join costs obtained from the cache wouldn't yet contain the
-			 * eval costs for the final scan/join target, which would've been
-			 * updated by apply_scanjoin_target_to_paths(); add the eval costs
-			 * now.
-			 */
-			if (fpextra && !IS_UPPER_REL(foreignrel))
-			{
-				/* Shouldn't get here unless we have LIMIT */
-				Assert(fpextra->has_limit);
-				Assert(foreignrel->reloptkind == RELOPT_BASEREL ||
-					   foreignrel->reloptkind == RELOPT_JOINREL);
-				startup_cost += foreignrel->reltarget->cost.startup;
-				run_cost += foreignrel->reltarget->cost.per_tuple * rows;
-			}
-		}
-		else if (IS_JOIN_REL(foreignrel))
-		{
-			PgFdwRelationInfo *fpinfo_i;
-			PgFdwRelationInfo *fpinfo_o;
-			QualCost	join_cost;
-			QualCost	remote_conds_cost;
-			double		nrows;
+		/* If not, size the next batch */
+		if (!fsstate->eof_reached)
+			adjust_fetch_size(fsstate, numrows);
+	}
+	PG_FINALLY();
+	{
+		PQclear(res);
+	}
+	PG_END_TRY();
 
-			/* Use rows/width estimates made by the core code. */
-			rows = foreignrel->rows;
-			width = foreignrel->reltarget->width;
+	MemoryContextSwitchTo(oldcontext);
+}
 
-			/* For join we expect inner and outer relations set */
-			Assert(fpinfo->innerrel && fpinfo->outerrel);
+/*
+ * Send a FETCH for the next batch of the node's cursor, without waiting for
+ * the result.  query is what to report on failure.
+ */
+static void
+send_fetch_query(PgFdwScanState *fsstate, const char *query)
+{
+	char		sql[64];
 
-			fpinfo_i = (PgFdwRelationInfo *) fpinfo->innerrel->fdw_private;
-			fpinfo_o = (PgFdwRelationInfo *) fpinfo->outerrel->fdw_private;
+	snprintf(sql, sizeof(sql), "FETCH %d FROM c%u",
+			 fsstate->fetch_size, fsstate->cursor_number);
+
+	/*
+	 * The extended protocol lets us choose the result format per FETCH,
+	 * whatever way the cursor was declared.
+	 */
+	if (!PQsendQueryParams(fsstate->conn, sql, 0, NULL, NULL, NULL, NULL,
+						   fsstate->recvfuncs ? 1 : 0))
+		pgfdw_report_error(ERROR, NULL, fsstate->conn, false, query);
+}
+
+/*
+ * Set up for fetching the scan's rows in binary format, if every retrieved
+ * column allows for that, by looking up the columns' receive functions.
+ *
+ * Only built-in base types and arrays of them qualify: their OIDs, which
+ * binary array values embed, are the same on every server.  Composite values
+ * embed the OIDs of their column types, and so are left to text format.  A
+ * single column that doesn't qualify keeps the whole scan in text format,
+ * since libpq can only ask for one result format for all columns.
+ */
+static void
+prepare_binary_transfer(PgFdwScanState *fsstate)
+{
+	TupleDesc	tupdesc = fsstate->tupdesc;
+	FmgrInfo   *recvfuncs;
+	Oid		   *recvtypes;
+	ListCell   *lc;
+	int			j;
+
+	recvfuncs = (FmgrInfo *) palloc0(tupdesc->natts * sizeof(FmgrInfo));
+	recvtypes = (Oid *) palloc0(Max(list_length(fsstate->retrieved_attrs), 1) *
+								sizeof(Oid));
+
+	j = 0;
+	foreach(lc, fsstate->retrieved_attrs)
+	{
+		int			i = lfirst_int(lc);
+
+		if (i > 0)
+		{
+			Oid			typid = TupleDescAttr(tupdesc, i - 1)->atttypid;
+			Oid			basetype = getBaseType(typid);
+			Oid			elemtype = get_element_type(basetype);
+			Oid			recvfunc;
+			Oid			typioparam;
+
+			if (basetype >= FirstGenbkiObjectId ||
+				get_typtype(basetype) != TYPTYPE_BASE ||
+				(OidIsValid(elemtype) &&
+				 get_typtype(elemtype) != TYPTYPE_BASE))
+				return;
 
-			/* Estimate of number of rows in cross product */
-			nrows = fpinfo_i->rows * fpinfo_o->rows;
+			/* Domains get domain_recv, which checks their constraints */
+			getTypeBinaryInputInfo(typid, &recvfunc, &typioparam);
+			fmgr_info(recvfunc, &recvfuncs[i - 1]);
+			recvtypes[j] = basetype;
+		}
+		else if (i == SelfItemPointerAttributeNumber)
+			recvtypes[j] = TIDOID;
+		j++;
+	}
 
-			/*
-			 * Back into an estimate of the number of retrieved rows.  Just in
-			 * case this is nuts, clamp to at most nrows.
-			 */
-			retrieved_rows = clamp_row_est(rows / fpinfo->local_conds_sel);
-			retrieved_rows = Min(retrieved_rows, nrows);
+	fsstate->recvfuncs = recvfuncs;
+	fsstate->recvtypes = recvtypes;
+}
 
-			/*
-			 * The cost of foreign join is estimated as cost of generating
-			 * rows for the joining relations + cost for applying quals on the
-			 * rows.
-			 */
+/*
+ * Check that the columns of a binary FETCH result have the types we're going
+ * to decode them as.  Unlike text, binary data of one type can often be read
+ * as another without complaint, so a foreign table whose column types differ
+ * from the remote ones would silently yield garbage.
+ */
+static void
+check_binary_result(PgFdwScanState *fsstate, PGresult *res)
+{
+	int			j;
 
-			/*
-			 * Calculate the cost of clauses pushed down to the foreign server
-			 */
-			cost_qual_eval(&remote_conds_cost, fpinfo->remote_conds, root);
-			/* Calculate the cost of applying join clauses */
-			cost_qual_eval(&join_cost, fpinfo->joinclauses, root);
+	if (!PQbinaryTuples(res))
+		return;
 
-			/*
-			 * Startup cost includes startup cost of joining relations and the
-			 * startup cost for join and other clauses. We do not include the
-			 * startup cost specific to join strategy (e.g. setting up hash
-			 * tables) since we do not know what strategy the foreign server
-			 * is going to use.
-			 */
-			startup_cost = fpinfo_i->rel_startup_cost + fpinfo_o->rel_startup_cost;
-			startup_cost += join_cost.startup;
-			startup_cost += remote_conds_cost.startup;
-			startup_cost += fpinfo->local_conds_cost.startup;
+	for (j = 0; j < PQnfields(res) &&
+		 j < list_length(fsstate->retrieved_attrs); j++)
+	{
+		if (OidIsValid(fsstate->recvtypes[j]) &&
+			PQftype(res, j) != fsstate->recvtypes[j])
+			ereport(ERROR,
+					(errcode(ERRCODE_FDW_INVALID_DATA_TYPE),
+					 errmsg("remote column \"%s\" has type OID %u, but binary transfer expects %u",
+							PQfname(res, j), PQftype(res, j),
+							fsstate->recvtypes[j]),
+					 errhint("Make the foreign table's column types match the remote ones, or turn off semijoin.binary_transfer.")));
+	}
+}
 
-			/*
-			 * Run time cost includes:
-			 *
-			 * 1. Run time cost (total_cost - startup_cost) of relations being
-			 * joined
-			 *
-			 * 2. Run time cost of applying join clauses on the cross product
-			 * of the joining relations.
-			 *
-			 * 3. Run time cost of applying pushed down other clauses on the
-			 * result of join
-			 *
-			 * 4. Run time cost of applying nonpushable other clauses locally
-			 * on the result fetched from the foreign server.
-			 */
-			run_cost = fpinfo_i->rel_total_cost - fpinfo_i->rel_startup_cost;
-			run_cost += fpinfo_o->rel_total_cost - fpinfo_o->rel_startup_cost;
-			run_cost += nrows * join_cost.per_tuple;
-			nrows = clamp_row_est(nrows * fpinfo->joinclause_sel);
-			run_cost += nrows * remote_conds_cost.per_tuple;
-			run_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
+/*
+ * Size the next batch from what the last, full one took in memory.  More
+ * rows are to come, so double the batch size to save round trips, but keep
+ * the batch within batch_mem_limit; a batch that overran it makes for a
+ * smaller one next.  Never go below the configured fetch_size.
+ */
+static void
+adjust_fetch_size(PgFdwScanState *fsstate, int numrows)
+{
+	double		row_bytes;
+	double		rows;
 
-			/* Add in tlist eval cost for each output row */
-			startup_cost += foreignrel->reltarget->cost.startup;
-			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
-		}
-		else if (IS_UPPER_REL(foreignrel))
-		{
-			RelOptInfo *outerrel = fpinfo->outerrel;
-			PgFdwRelationInfo *ofpinfo;
-			AggClauseCosts aggcosts;
-			double		input_rows;
-			int			numGroupCols;
-			double		numGroups = 1;
+	if (numrows <= 0)
+		return;
 
-			/* The upper relation should have its outer relation set */
-			Assert(outerrel);
-			/* and that outer relation should have its reltarget set */
-			Assert(outerrel->reltarget);
+	row_bytes = (double) MemoryContextMemAllocated(fsstate->batch_cxt, true) /
+		numrows;
+	rows = Min(fsstate->fetch_size * 2.0,
+			   fsstate->batch_mem_limit / Max(row_bytes, 1.0));
+	rows = Min(rows, INT_MAX);
+	fsstate->fetch_size = (int) Max(rows, fsstate->base_fetch_size);
+}
 
-			/*
-			 * This cost model is mixture of costing done for sorted and
-			 * hashed aggregates in cost_agg().  We are not sure which
-			 * strategy will be considered at remote side, thus for
-			 * simplicity, we put all startup related costs in startup_cost
-			 * and all finalization and run cost are added in total_cost.
-			 */
+/*
+ * Once the cursor of one semijoin filter partition is exhausted, close it and
+ * open the cursor for the next partition.  Returns false if there is none.
+ * In the second phase of a two-phase scan, the cursors are those of the
+ * batches of matching rows instead.
+ */
+static bool
+begin_next_filter_partition(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
 
-			ofpinfo = (PgFdwRelationInfo *) outerrel->fdw_private;
+	if (fsstate->late_batch >= 0)
+	{
+		if (fsstate->late_batch + 1 >= list_length(fsstate->late_batches))
+			return false;
+		close_scan_cursor(node);
+		fsstate->late_batch++;
+	}
+	else
+	{
+		if (fsstate->filter_part + 1 >= list_length(node->semijoin_filters))
+			return false;
+		close_scan_cursor(node);
+		fsstate->filter_part++;
+	}
+	create_cursor(node);
 
-			/* Get rows from input rel */
-			input_rows = ofpinfo->rows;
+	/* Rows of earlier partitions are gone; a rescan must start over */
+	fsstate->fetch_ct_2 = 2;
 
-			/* Collect statistics about aggregates for estimating costs. */
-			MemSet(&aggcosts, 0, sizeof(AggClauseCosts));
-			if (root->parse->hasAggs)
-			{
-				get_agg_clause_costs(root, AGGSPLIT_SIMPLE, &aggcosts);
-			}
+	return true;
+}
 
-			/* Get number of grouping columns and possible number of groups */
-			numGroupCols = list_length(root->processed_groupClause);
-			numGroups = estimate_num_groups(root,
-											get_sortgrouplist_exprs(root->processed_groupClause,
-																	fpinfo->grouped_tlist),
-											input_rows, NULL, NULL);
+/*
+ * Count the fetched rows whose key is one of the keys the semijoin filter was
+ * built from.  The key is made up the way the remote made it for the filter
+ * check: the text of the non-null key columns, joined with '|'.  A result
+ * in binary format has no text to go by, so the values of the tuples already
+ * made from it are formatted with their output functions instead.
+ */
+static void
+count_filter_matches(ForeignScanState *node, PGresult *res)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	HTAB	   *keyset = node->semijoin_instr->keyset;
+	bool		binary = PQbinaryTuples(res);
+	TupleDesc	tupdesc;
+	StringInfoData key;
+	int			numrows = PQntuples(res);
+	int			nkeys = fsstate->nfilterkeys > 0 ? fsstate->nfilterkeys :
+		PQnfields(res);
+	int			i;
 
-			/*
-			 * Get the retrieved_rows and rows estimates.  If there are HAVING
-			 * quals, account for their selectivity.
-			 */
-			if (root->hasHavingQual)
-			{
-				/* Factor in the selectivity of the remotely-checked quals */
-				retrieved_rows =
-					clamp_row_est(numGroups *
-								  clauselist_selectivity(root,
-														 fpinfo->remote_conds,
-														 0,
-														 JOIN_INNER,
-														 NULL));
-				/* Factor in the selectivity of the locally-checked quals */
-				rows = clamp_row_est(retrieved_rows * fpinfo->local_conds_sel);
-			}
-			else
-			{
-				rows = retrieved_rows = numGroups;
-			}
+	if (fsstate->rel)
+		tupdesc = RelationGetDescr(fsstate->rel);
+	else
+		tupdesc = node->ss.ss_ScanTupleSlot->tts_tupleDescriptor;
 
-			/* Use width estimate made by the core code. */
-			width = foreignrel->reltarget->width;
+	initStringInfo(&key);
+	for (i = 0; i < numrows; i++)
+	{
+		MemoryContext oldcontext;
+		bool		key_null = true;
+		int			k;
 
-			/*-----
-			 * Startup cost includes:
-			 *	  1. Startup cost for underneath input relation, adjusted for
-			 *	     tlist replacement by apply_scanjoin_target_to_paths()
-			 *	  2. Cost of performing aggregation, per cost_agg()
-			 *-----
-			 */
-			startup_cost = ofpinfo->rel_startup_cost;
-			startup_cost += outerrel->reltarget->cost.startup;
-			startup_cost += aggcosts.transCost.startup;
-			startup_cost += aggcosts.transCost.per_tuple * input_rows;
-			startup_cost += aggcosts.finalCost.startup;
-			startup_cost += (cpu_operator_cost * numGroupCols) * input_rows;
+		/* The output functions may leak; clean up after each row */
+		oldcontext = MemoryContextSwitchTo(fsstate->temp_cxt);
 
-			/*-----
-			 * Run time cost includes:
-			 *	  1. Run time cost of underneath input relation, adjusted for
-			 *	     tlist replacement by apply_scanjoin_target_to_paths()
-			 *	  2. Run time cost of performing aggregation, per cost_agg()
-			 *-----
-			 */
-			run_cost = ofpinfo->rel_total_cost - ofpinfo->rel_startup_cost;
-			run_cost += outerrel->reltarget->cost.per_tuple * input_rows;
-			run_cost += aggcosts.finalCost.per_tuple * numGroups;
-			run_cost += cpu_tuple_cost * numGroups;
+		resetStringInfo(&key);
+		for (k = 0; k < nkeys; k++)
+		{
+			int			j = fsstate->nfilterkeys > 0 ?
+				fsstate->filterkeys[k] - 1 : k;
 
-			/* Account for the eval cost of HAVING quals, if any */
-			if (root->hasHavingQual)
-			{
-				QualCost	remote_cost;
+			if (PQgetisnull(res, i, j))
+				continue;
+			key_null = false;
+			if (k > 0)
+				appendStringInfoChar(&key, '|');
+			if (binary)
+				appendStringInfoString(&key,
+									   binary_column_text(fsstate->tuples[i],
+														  tupdesc,
+														  list_nth_int(fsstate->retrieved_attrs,
+																	   j)));
+			else
+				appendStringInfoString(&key, PQgetvalue(res, i, j));
+		}
 
-				/* Add in the eval cost of the remotely-checked quals */
-				cost_qual_eval(&remote_cost, fpinfo->remote_conds, root);
-				startup_cost += remote_cost.startup;
-				run_cost += remote_cost.per_tuple * numGroups;
-				/* Add in the eval cost of the locally-checked quals */
-				startup_cost += fpinfo->local_conds_cost.startup;
-				run_cost += fpinfo->local_conds_cost.per_tuple * retrieved_rows;
-			}
+		MemoryContextSwitchTo(oldcontext);
+		MemoryContextReset(fsstate->temp_cxt);
 
-			/* Add in tlist eval cost for each output row */
-			startup_cost += foreignrel->reltarget->cost.startup;
-			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
-		}
-		else
+		fsstate->filter_checked++;
+		if (!key_null)
 		{
-			Cost		cpu_per_tuple;
+			uint64		keyhash;
 
-			/* Use rows/width estimates made by set_baserel_size_estimates. */
-			rows = foreignrel->rows;
-			width = foreignrel->reltarget->width;
+			keyhash = DatumGetUInt64(hash_any_extended((unsigned char *) key.data,
+													   key.len, 0));
+			if (hash_search(keyset, &keyhash, HASH_FIND, NULL) != NULL)
+				fsstate->filter_matched++;
+		}
+	}
+	pfree(key.data);
+}
 
-			/*
-			 * Back into an estimate of the number of retrieved rows.  Just in
-			 * case this is nuts, clamp to at most foreignrel->tuples.
-			 */
-			retrieved_rows = clamp_row_est(rows / fpinfo->local_conds_sel);
-			retrieved_rows = Min(retrieved_rows, foreignrel->tuples);
+/*
+ * The text form of column attno of a tuple made from a binary result row,
+ * which must not be null there.  Besides ordinary columns, only ctid is
+ * retrieved.
+ */
+static char *
+binary_column_text(HeapTuple tuple, TupleDesc tupdesc, int attno)
+{
+	Datum		value;
+	bool		isnull;
+	Oid			typoutput;
+	bool		typisvarlena;
+
+	if (attno == SelfItemPointerAttributeNumber)
+		return DatumGetCString(DirectFunctionCall1(tidout,
+												   PointerGetDatum(&tuple->t_self)));
+
+	Assert(attno > 0 && attno <= tupdesc->natts);
+	value = heap_getattr(tuple, attno, tupdesc, &isnull);
+	Assert(!isnull);
+	getTypeOutputInfo(TupleDescAttr(tupdesc, attno - 1)->atttypid,
+					  &typoutput, &typisvarlena);
+	return OidOutputFunctionCall(typoutput, value);
+}
 
-			/*
-			 * Cost as though this were a seqscan, which is pessimistic.  We
-			 * effectively imagine the local_conds are being evaluated
-			 * remotely, too.
-			 */
-			startup_cost = 0;
-			run_cost = 0;
-			run_cost += seq_page_cost * foreignrel->pages;
+/*
+ * First phase of a two-phase semijoin-filtered scan: run the locator query
+ * under each filter partition, and keep the ctids of the rows whose key is
+ * really one of the keys the filter was built from.  The false positives of
+ * the filter thus cost the transfer of their key columns only, not of the
+ * whole rows.  The ctids are kept as tid[] literals of at most
+ * LATE_MATERIALIZATION_BATCH elements, for the fetch query's cursors.
+ *
+ * The remote builds the keys it checks against the filter from the key
+ * columns only, which the 'K' header of the filter lists.
+ */
+static void
+collect_late_matches(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	HTAB	   *keyset = node->semijoin_instr->keyset;
+	PGconn	   *conn = fsstate->conn;
+	MemoryContext oldcontext;
+	StringInfoData sql;
+	StringInfoData key;
+	StringInfoData ctids;
+	int			nctids = 0;
+	int			part;
 
-			startup_cost += foreignrel->baserestrictcost.startup;
-			cpu_per_tuple = cpu_tuple_cost + foreignrel->baserestrictcost.per_tuple;
-			run_cost += cpu_per_tuple * foreignrel->tuples;
+	/* The batches must outlive the per-tuple context we're called in */
+	oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	list_free_deep(fsstate->late_batches);
+	fsstate->late_batches = NIL;
 
-			/* Add in tlist eval cost for each output row */
-			startup_cost += foreignrel->reltarget->cost.startup;
-			run_cost += foreignrel->reltarget->cost.per_tuple * rows;
-		}
+	initStringInfo(&sql);
+	initStringInfo(&key);
+	initStringInfo(&ctids);
+	appendStringInfoChar(&ctids, '{');
+
+	for (part = 0; part < list_length(node->semijoin_filters); part++)
+	{
+		PGresult   *res;
+		bool		eof = false;
+		int			k;
+
+		resetStringInfo(&sql);
+		appendStringInfo(&sql, "DECLARE c%u CURSOR FOR\n%s#",
+						 fsstate->cursor_number, fsstate->locator_query);
+		append_filter_key_header(&sql, fsstate->nkeycols, fsstate->keycols);
+		appendStringInfoString(&sql, (char *) list_nth(node->semijoin_filters,
+													   part));
 
 		/*
-		 * Without remote estimates, we have no real way to estimate the cost
-		 * of generating sorted output.  It could be free if the query plan
-		 * the remote side would have chosen generates properly-sorted output
-		 * anyway, but in most cases it will cost something.  Estimate a value
-		 * high enough that we won't pick the sorted path when the ordering
-		 * isn't locally useful, but low enough that we'll err on the side of
-		 * pushing down the ORDER BY clause when it's useful to do so.
+		 * The remote splits the filter off in its Parse message handler
+		 * only, so this must go through the extended query protocol, like
+		 * create_cursor's DECLARE.  Two-phase scans are never parameterized,
+		 * which the planner and BeginForeignScan see to.
 		 */
-		if (pathkeys != NIL)
+		TRACE_POSTGRESQL_SEMIJOIN_SEND(fsstate->cursor_number, sql.len);
+		pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_SEND);
+		if (!PQsendQueryParams(conn, sql.data, 0, NULL, NULL, NULL, NULL, 0))
 		{
-			if (IS_UPPER_REL(foreignrel))
+			pgstat_report_wait_end();
+			pgfdw_report_error(ERROR, NULL, conn, false, sql.data);
+		}
+		pgstat_report_wait_end();
+		res = pgfdw_get_result(conn, sql.data);
+		if (PQresultStatus(res) != PGRES_COMMAND_OK)
+			pgfdw_report_error(ERROR, res, conn, true, fsstate->locator_query);
+		PQclear(res);
+		fsstate->cursor_exists = true;
+
+		while (!eof)
+		{
+			resetStringInfo(&sql);
+			appendStringInfo(&sql, "FETCH %d FROM c%u",
+							 fsstate->fetch_size, fsstate->cursor_number);
+			res = pgfdw_exec_query(conn, sql.data, fsstate->conn_state);
+
+			/* PGresult must be released before leaving this function. */
+			PG_TRY();
 			{
-				Assert(foreignrel->reloptkind == RELOPT_UPPER_REL &&
-					   fpinfo->stage == UPPERREL_GROUP_AGG);
-				adjust_foreign_grouping_path_cost(root, pathkeys,
-												  retrieved_rows, width,
-												  fpextra->limit_tuples,
-												  &startup_cost, &run_cost);
+				int			numrows;
+				int			i;
+
+				if (PQresultStatus(res) != PGRES_TUPLES_OK)
+					pgfdw_report_error(ERROR, res, conn, false,
+									   fsstate->locator_query);
+
+				numrows = PQntuples(res);
+				for (i = 0; i < numrows; i++)
+				{
+					uint64		keyhash;
+					bool		key_null = true;
+
+					resetStringInfo(&key);
+					for (k = 0; k < fsstate->nkeycols; k++)
+					{
+						if (PQgetisnull(res, i, fsstate->keycols[k] - 1))
+							continue;
+						key_null = false;
+						if (k > 0)
+							appendStringInfoChar(&key, '|');
+						appendStringInfoString(&key,
+											   PQgetvalue(res, i,
+														  fsstate->keycols[k] - 1));
+					}
+
+					fsstate->filter_checked++;
+					if (key_null)
+						continue;
+					keyhash = DatumGetUInt64(hash_any_extended((unsigned char *) key.data,
+															   key.len, 0));
+					if (hash_search(keyset, &keyhash, HASH_FIND, NULL) == NULL)
+						continue;
+					fsstate->filter_matched++;
+
+					if (nctids > 0)
+						appendStringInfoChar(&ctids, ',');
+					appendStringInfo(&ctids, "\"%s\"",
+									 PQgetvalue(res, i, fsstate->ctid_col - 1));
+					if (++nctids >= LATE_MATERIALIZATION_BATCH)
+					{
+						appendStringInfoChar(&ctids, '}');
+						fsstate->late_batches = lappend(fsstate->late_batches,
+														pstrdup(ctids.data));
+						resetStringInfo(&ctids);
+						appendStringInfoChar(&ctids, '{');
+						nctids = 0;
+					}
+				}
+				eof = (numrows < fsstate->fetch_size);
 			}
-			else
+			PG_FINALLY();
 			{
-				startup_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
-				run_cost *= DEFAULT_FDW_SORT_MULTIPLIER;
+				PQclear(res);
 			}
+			PG_END_TRY();
 		}
 
-		total_cost = startup_cost + run_cost;
+		/* Collects what the remote reports on the filter */
+		close_scan_cursor(node);
+	}
 
-		/* Adjust the cost estimates if we have LIMIT */
-		if (fpextra && fpextra->has_limit)
-		{
-			adjust_limit_rows_costs(&rows, &startup_cost, &total_cost,
-									fpextra->offset_est, fpextra->count_est);
-			retrieved_rows = rows;
-		}
+	/* There is always at least one cursor to declare, even if empty */
+	if (nctids > 0 || fsstate->late_batches == NIL)
+	{
+		appendStringInfoChar(&ctids, '}');
+		fsstate->late_batches = lappend(fsstate->late_batches,
+										pstrdup(ctids.data));
 	}
+	fsstate->late_batch = 0;
 
-	/*
-	 * If this includes the final sort step, the given target, which will be
-	 * applied to the resulting path, might have different expressions from
-	 * the foreignrel's reltarget (see make_sort_input_target()); adjust tlist
-	 * eval costs.
-	 */
-	if (fpextra && fpextra->has_final_sort &&
-		fpextra->target != foreignrel->reltarget)
+	pfree(sql.data);
+	pfree(key.data);
+	pfree(ctids.data);
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * Copy the keys from the outer plan into the scan's remote key table, which
+ * the remote query joins with, creating the table first if need be.  Keys
+ * with a null column can't match and are left out.  Analyzing the table
+ * lets the remote planner choose how to join with it.
+ *
+ * The outer plan is read here rather than by the executor, which builds no
+ * filter for us; child_materialised tells it the keys are in place for the
+ * current outer plan parameters.
+ */
+static void
+upload_semijoin_keys(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	PlanState  *outerNode = outerPlanState(node);
+	TupleDesc	outerdesc = ExecGetResultType(outerNode);
+	PGconn	   *conn = fsstate->conn;
+	FmgrInfo   *outfuncs;
+	StringInfoData sql;
+	StringInfoData buf;
+	PGresult   *res;
+	uint64		nrows = 0;
+	int			j;
+
+	initStringInfo(&sql);
+	if (fsstate->key_table_created)
+		appendStringInfo(&sql, "TRUNCATE %s", fsstate->key_table);
+	else
+		appendStringInfo(&sql, "CREATE TEMP TABLE %s ON COMMIT DROP AS %s WITH NO DATA",
+						 fsstate->key_table, fsstate->key_table_select);
+	res = pgfdw_exec_query(conn, sql.data, fsstate->conn_state);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pgfdw_report_error(ERROR, res, conn, true, sql.data);
+	PQclear(res);
+	fsstate->key_table_created = true;
+
+	outfuncs = (FmgrInfo *) palloc(fsstate->key_table_ncols * sizeof(FmgrInfo));
+	for (j = 0; j < fsstate->key_table_ncols; j++)
 	{
-		QualCost	oldcost = foreignrel->reltarget->cost;
-		QualCost	newcost = fpextra->target->cost;
+		Oid			typoutput;
+		bool		typisvarlena;
 
-		startup_cost += newcost.startup - oldcost.startup;
-		total_cost += newcost.startup - oldcost.startup;
-		total_cost += (newcost.per_tuple - oldcost.per_tuple) * rows;
+		getTypeOutputInfo(TupleDescAttr(outerdesc,
+										fsstate->key_table_outer[j] - 1)->atttypid,
+						  &typoutput, &typisvarlena);
+		fmgr_info(typoutput, &outfuncs[j]);
 	}
 
 	/*
-	 * Cache the retrieved rows and cost estimates for scans, joins, or
-	 * groupings without any parameterization, pathkeys, or additional
-	 * post-scan/join-processing steps, before adding the costs for
-	 * transferring data from the foreign server.  These estimates are useful
-	 * for costing remote joins involving this relation or costing other
-	 * remote operations on this relation such as remote sorts and remote
-	 * LIMIT restrictions, when the costs can not be obtained from the foreign
-	 * server.  This function will be called at least once for every foreign
-	 * relation without any parameterization, pathkeys, or additional
-	 * post-scan/join-processing steps.
+	 * Start the COPY.  pgfdw_get_result() would wait for the end of the
+	 * command, which only comes once we have sent the data.
 	 */
-	if (pathkeys == NIL && param_join_conds == NIL && fpextra == NULL)
+	resetStringInfo(&sql);
+	appendStringInfo(&sql, "COPY %s FROM STDIN", fsstate->key_table);
+	if (!PQsendQuery(conn, sql.data))
+		pgfdw_report_error(ERROR, NULL, conn, false, sql.data);
+	res = PQgetResult(conn);
+	if (PQresultStatus(res) != PGRES_COPY_IN)
+		pgfdw_report_error(ERROR, res, conn, true, sql.data);
+	PQclear(res);
+
+	initStringInfo(&buf);
+	PG_TRY();
 	{
-		fpinfo->retrieved_rows = retrieved_rows;
-		fpinfo->rel_startup_cost = startup_cost;
-		fpinfo->rel_total_cost = total_cost;
-	}
+		for (;;)
+		{
+			TupleTableSlot *slot = ExecProcNode(outerNode);
+			MemoryContext oldcontext;
+			int			start = buf.len;
+			int			nestlevel;
 
-	/*
-	 * Add some additional cost factors to account for connection overhead
-	 * (fdw_startup_cost), transferring data across the network
-	 * (fdw_tuple_cost per retrieved row), and local manipulation of the data
-	 * (cpu_tuple_cost per retrieved row).
-	 */
-	startup_cost += fpinfo->fdw_startup_cost;
-	total_cost += fpinfo->fdw_startup_cost;
-	total_cost += fpinfo->fdw_tuple_cost * retrieved_rows;
-	total_cost += cpu_tuple_cost * retrieved_rows;
+			if (TupIsNull(slot))
+				break;
 
-	/*
-	 * If we have LIMIT, we should prefer performing the restriction remotely
-	 * rather than locally, as the former avoids extra row fetches from the
-	 * remote that the latter might cause.  But since the core code doesn't
-	 * account for such fetches when estimating the costs of the local
-	 * restriction (see create_limit_path()), there would be no difference
-	 * between the costs of the local restriction and the costs of the remote
-	 * restriction estimated above if we don't use remote estimates (except
-	 * for the case where the foreignrel is a grouping relation, the given
-	 * pathkeys is not NIL, and the effects of a bounded sort for that rel is
-	 * accounted for in costing the remote restriction).  Tweak the costs of
-	 * the remote restriction to ensure we'll prefer it if LIMIT is a useful
-	 * one.
-	 */
-	if (!fpinfo->use_remote_estimate &&
-		fpextra && fpextra->has_limit &&
-		fpextra->limit_tuples > 0 &&
-		fpextra->limit_tuples < fpinfo->rows)
+			/*
+			 * The remote reads the row in the settings it runs under.  They
+			 * are in effect for the output calls only, not for the outer
+			 * plan reading the next row.
+			 */
+			MemoryContextReset(fsstate->temp_cxt);
+			oldcontext = MemoryContextSwitchTo(fsstate->temp_cxt);
+			nestlevel = set_transmission_modes();
+			for (j = 0; j < fsstate->key_table_ncols; j++)
+			{
+				Datum		value;
+				bool		isnull;
+
+				value = slot_getattr(slot, fsstate->key_table_outer[j], &isnull);
+				if (isnull)
+					break;
+				if (j > 0)
+					appendStringInfoChar(&buf, '\t');
+				append_copy_text(&buf, OutputFunctionCall(&outfuncs[j], value));
+			}
+			reset_transmission_modes(nestlevel);
+			MemoryContextSwitchTo(oldcontext);
+
+			if (j < fsstate->key_table_ncols)
+			{
+				/* A null key column: drop what we have of the row */
+				buf.len = start;
+				buf.data[start] = '\0';
+				continue;
+			}
+			appendStringInfoChar(&buf, '\n');
+			nrows++;
+
+			if (buf.len >= KEY_TABLE_COPY_CHUNK)
+			{
+				if (PQputCopyData(conn, buf.data, buf.len) != 1)
+					pgfdw_report_error(ERROR, NULL, conn, false, sql.data);
+				resetStringInfo(&buf);
+			}
+		}
+		if (buf.len > 0 && PQputCopyData(conn, buf.data, buf.len) != 1)
+			pgfdw_report_error(ERROR, NULL, conn, false, sql.data);
+	}
+	PG_CATCH();
 	{
-		Assert(fpinfo->rows > 0);
-		total_cost -= (total_cost - startup_cost) * 0.05 *
-			(fpinfo->rows - fpextra->limit_tuples) / fpinfo->rows;
+		/* Let the remote fail the COPY, so the connection stays usable */
+		(void) PQputCopyEnd(conn, "local error while reading keys");
+		PG_RE_THROW();
 	}
+	PG_END_TRY();
 
-	/* Return results. */
-	*p_rows = rows;
-	*p_width = width;
-	*p_startup_cost = startup_cost;
-	*p_total_cost = total_cost;
+	if (PQputCopyEnd(conn, NULL) != 1)
+		pgfdw_report_error(ERROR, NULL, conn, false, sql.data);
+	res = pgfdw_get_result(conn, sql.data);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pgfdw_report_error(ERROR, res, conn, true, sql.data);
+	PQclear(res);
+
+	resetStringInfo(&sql);
+	appendStringInfo(&sql, "ANALYZE %s", fsstate->key_table);
+	res = pgfdw_exec_query(conn, sql.data, fsstate->conn_state);
+	if (PQresultStatus(res) != PGRES_COMMAND_OK)
+		pgfdw_report_error(ERROR, res, conn, true, sql.data);
+	PQclear(res);
+
+	fsstate->key_table_rows = nrows;
+	node->child_materialised = true;
+
+	pfree(outfuncs);
+	pfree(sql.data);
+	pfree(buf.data);
 }
 
 /*
- * Estimate costs of executing a SQL statement remotely.
- * The given "sql" must be an EXPLAIN command.
+ * Read the keys from the outer plan into array literals of at most
+ * KEY_ARRAY_BATCH elements each, one per cursor of the scan's key lookup
+ * query, and set up for declaring the first.  Null keys can't match and are
+ * left out.  Duplicates are harmless; the planner may have removed them.
+ *
+ * As for upload_semijoin_keys, the executor builds no filter for us, and
+ * child_materialised tells it the batches are made for the current outer
+ * plan parameters.
  */
 static void
-get_remote_estimate(const char *sql, PGconn *conn,
-					double *rows, int *width,
-					Cost *startup_cost, Cost *total_cost)
+collect_key_batches(ForeignScanState *node)
 {
-	PGresult   *volatile res = NULL;
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
+	PlanState  *outerNode = outerPlanState(node);
+	TupleDesc	outerdesc = ExecGetResultType(outerNode);
+	MemoryContext oldcontext;
+	FmgrInfo	outfunc;
+	Oid			typoutput;
+	bool		typisvarlena;
+	StringInfoData keys;
+	int			nkeys = 0;
+
+	getTypeOutputInfo(TupleDescAttr(outerdesc, 0)->atttypid,
+					  &typoutput, &typisvarlena);
+	fmgr_info(typoutput, &outfunc);
+
+	/* The batches must outlive the per-tuple context we're called in */
+	oldcontext = MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+	list_free_deep(fsstate->late_batches);
+	fsstate->late_batches = NIL;
+	fsstate->key_array_keys = 0;
+
+	initStringInfo(&keys);
+	appendStringInfoChar(&keys, '{');
+	for (;;)
+	{
+		TupleTableSlot *slot = ExecProcNode(outerNode);
+		Datum		value;
+		bool		isnull;
+		const char *ptr;
+		int			nestlevel;
 
-	/* PGresult must be released before leaving this function. */
-	PG_TRY();
-	{
-		char	   *line;
-		char	   *p;
-		int			n;
+		if (TupIsNull(slot))
+			break;
+		value = slot_getattr(slot, 1, &isnull);
+		if (isnull)
+			continue;
 
-		/*
-		 * Execute EXPLAIN remotely.
-		 */
-		res = pgfdw_exec_query(conn, sql, NULL);
-		if (PQresultStatus(res) != PGRES_TUPLES_OK)
-			pgfdw_report_error(ERROR, res, conn, false, sql);
+		MemoryContextReset(fsstate->temp_cxt);
+		MemoryContextSwitchTo(fsstate->temp_cxt);
+		if (nkeys > 0)
+			appendStringInfoChar(&keys, ',');
+		appendStringInfoChar(&keys, '"');
 
 		/*
-		 * Extract cost numbers for topmost plan node.  Note we search for a
-		 * left paren from the end of the line to avoid being confused by
-		 * other uses of parentheses.
+		 * The remote reads the key in the settings it runs under.  Only the
+		 * output call gets them, not the outer plan reading the next key.
 		 */
-		line = PQgetvalue(res, 0, 0);
-		p = strrchr(line, '(');
-		if (p == NULL)
-			elog(ERROR, "could not interpret EXPLAIN output: \"%s\"", line);
-		n = sscanf(p, "(cost=%lf..%lf rows=%lf width=%d)",
-				   startup_cost, total_cost, rows, width);
-		if (n != 4)
-			elog(ERROR, "could not interpret EXPLAIN output: \"%s\"", line);
+		nestlevel = set_transmission_modes();
+		ptr = OutputFunctionCall(&outfunc, value);
+		reset_transmission_modes(nestlevel);
+		for (; *ptr; ptr++)
+		{
+			if (*ptr == '"' || *ptr == '\\')
+				appendStringInfoChar(&keys, '\\');
+			appendStringInfoChar(&keys, *ptr);
+		}
+		appendStringInfoChar(&keys, '"');
+		MemoryContextSwitchTo(node->ss.ps.state->es_query_cxt);
+		fsstate->key_array_keys++;
+
+		if (++nkeys >= KEY_ARRAY_BATCH)
+		{
+			appendStringInfoChar(&keys, '}');
+			fsstate->late_batches = lappend(fsstate->late_batches,
+											pstrdup(keys.data));
+			resetStringInfo(&keys);
+			appendStringInfoChar(&keys, '{');
+			nkeys = 0;
+		}
 	}
-	PG_FINALLY();
+
+	/* There is always at least one cursor to declare, even if empty */
+	if (nkeys > 0 || fsstate->late_batches == NIL)
 	{
-		PQclear(res);
+		appendStringInfoChar(&keys, '}');
+		fsstate->late_batches = lappend(fsstate->late_batches,
+										pstrdup(keys.data));
 	}
-	PG_END_TRY();
+	fsstate->late_batch = 0;
+	node->child_materialised = true;
+
+	pfree(keys.data);
+	MemoryContextSwitchTo(oldcontext);
 }
 
 /*
- * Adjust the cost estimates of a foreign grouping path to include the cost of
- * generating properly-sorted output.
+ * Append value to buf as a column of COPY's text format.
  */
 static void
-adjust_foreign_grouping_path_cost(PlannerInfo *root,
-								  List *pathkeys,
-								  double retrieved_rows,
-								  double width,
-								  double limit_tuples,
-								  Cost *p_startup_cost,
-								  Cost *p_run_cost)
+append_copy_text(StringInfo buf, const char *value)
 {
-	/*
-	 * If the GROUP BY clause isn't sort-able, the plan chosen by the remote
-	 * side is unlikely to generate properly-sorted output, so it would need
-	 * an explicit sort; adjust the given costs with cost_sort().  Likewise,
-	 * if the GROUP BY clause is sort-able but isn't a superset of the given
-	 * pathkeys, adjust the costs with that function.  Otherwise, adjust the
-	 * costs by applying the same heuristic as for the scan or join case.
-	 */
-	if (!grouping_is_sortable(root->processed_groupClause) ||
-		!pathkeys_contained_in(pathkeys, root->group_pathkeys))
+	const char *ptr;
+
+	for (ptr = value; *ptr; ptr++)
 	{
-		Path		sort_path;	/* dummy for result of cost_sort */
+		switch (*ptr)
+		{
+			case '\\':
+				appendStringInfoString(buf, "\\\\");
+				break;
+			case '\n':
+				appendStringInfoString(buf, "\\n");
+				break;
+			case '\r':
+				appendStringInfoString(buf, "\\r");
+				break;
+			case '\t':
+				appendStringInfoString(buf, "\\t");
+				break;
+			default:
+				appendStringInfoChar(buf, *ptr);
+				break;
+		}
+	}
+}
 
-		cost_sort(&sort_path,
-				  root,
-				  pathkeys,
-				  *p_startup_cost + *p_run_cost,
-				  retrieved_rows,
-				  width,
-				  0.0,
-				  work_mem,
-				  limit_tuples);
+/*
+ * Close the scan's remote cursor.  If it was declared with a semijoin filter,
+ * collect what the remote reports on the filter as the cursor goes away.
+ */
+static void
+close_scan_cursor(ForeignScanState *node)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
 
-		*p_startup_cost = sort_path.startup_cost;
-		*p_run_cost = sort_path.total_cost - sort_path.startup_cost;
+	fsstate->cursor_exists = false;
+
+	if (node->semijoin_filters == NIL)
+	{
+		close_cursor(fsstate->conn, fsstate->cursor_number,
+					 fsstate->conn_state);
+		return;
+	}
+
+	fsstate->prev_notice_receiver =
+		PQsetNoticeReceiver(fsstate->conn, semijoin_stats_receiver, fsstate);
+	PG_TRY();
+	{
+		close_cursor(fsstate->conn, fsstate->cursor_number,
+					 fsstate->conn_state);
 	}
-	else
+	PG_FINALLY();
 	{
-		/*
-		 * The default extra cost seems too large for foreign-grouping cases;
-		 * add 1/4th of that default.
-		 */
-		double		sort_multiplier = 1.0 + (DEFAULT_FDW_SORT_MULTIPLIER
-											 - 1.0) * 0.25;
-
-		*p_startup_cost *= sort_multiplier;
-		*p_run_cost *= sort_multiplier;
+		PQsetNoticeReceiver(fsstate->conn, fsstate->prev_notice_receiver,
+							NULL);
 	}
+	PG_END_TRY();
 }
 
 /*
- * Detect whether we want to process an EquivalenceClass member.
- *
- * This is a callback for use by generate_implied_equalities_for_column.
+ * Attach to the shared semijoin filter statistics, creating them if this is
+ * the first session to use them since the server started.  Returns false if
+ * they can't be had, which is reported once per session with a WARNING, and
+ * not as an error: collecting statistics must not fail the query whose scan
+ * they are about.
  */
 static bool
-ec_member_matches_foreign(PlannerInfo *root, RelOptInfo *rel,
-						  EquivalenceClass *ec, EquivalenceMember *em,
-						  void *arg)
+semijoin_stats_attach(void)
 {
-	ec_member_foreign_arg *state = (ec_member_foreign_arg *) arg;
-	Expr	   *expr = em->em_expr;
+	MemoryContext oldcontext = CurrentMemoryContext;
+	HASHCTL		ctl;
+	bool		found;
 
-	/*
-	 * If we've identified what we're processing in the current scan, we only
-	 * want to match that expression.
-	 */
-	if (state->current != NULL)
-		return equal(expr, state->current);
+	if (SemijoinStatsHash != NULL)
+		return true;
+	if (SemijoinStatsFailed)
+		return false;
 
-	/*
-	 * Otherwise, ignore anything we've already processed.
-	 */
-	if (list_member(state->already_used, expr))
+	PG_TRY();
+	{
+		LWLockAcquire(AddinShmemInitLock, LW_EXCLUSIVE);
+		SemijoinStats = ShmemInitStruct("postgres_fdw semijoin statistics",
+										sizeof(SemijoinStatsShared), &found);
+		if (!found)
+		{
+			SemijoinStats->tranche_id = LWLockNewTrancheId();
+			LWLockInitialize(&SemijoinStats->lock, SemijoinStats->tranche_id);
+			SemijoinStats->dropped = 0;
+		}
+		ctl.keysize = sizeof(SemijoinStatsKey);
+		ctl.entrysize = sizeof(SemijoinStatsEntry);
+		SemijoinStatsHash = ShmemInitHash("postgres_fdw semijoin statistics hash",
+										  SEMIJOIN_STATS_MAX, SEMIJOIN_STATS_MAX,
+										  &ctl,
+										  HASH_ELEM | HASH_BLOBS | HASH_FIXED_SIZE);
+		LWLockRelease(AddinShmemInitLock);
+	}
+	PG_CATCH();
+	{
+		ErrorData  *edata;
+
+		/* Shared memory allocation fails cleanly, save for our lock */
+		MemoryContextSwitchTo(oldcontext);
+		edata = CopyErrorData();
+		FlushErrorState();
+		if (LWLockHeldByMe(AddinShmemInitLock))
+			LWLockRelease(AddinShmemInitLock);
+
+		SemijoinStats = NULL;
+		SemijoinStatsHash = NULL;
+		SemijoinStatsFailed = true;
+		ereport(WARNING,
+				(errmsg("could not set up semijoin filter statistics: %s",
+						edata->message),
+				 errdetail("This session collects no semijoin filter statistics.")));
+		FreeErrorData(edata);
 		return false;
+	}
+	PG_END_TRY();
 
-	/* This is the new target to process. */
-	state->current = expr;
+	LWLockRegisterTranche(SemijoinStats->tranche_id,
+						  "postgres_fdw_semijoin_stats");
 	return true;
 }
 
 /*
- * Create cursor for node's query with current parameter values.
+ * Add what the scan's semijoin filter did to the cumulative statistics,
+ * which postgres_fdw_semijoin_stats() shows.
  */
 static void
-create_cursor(ForeignScanState *node)
+record_semijoin_stats(ForeignScanState *node)
 {
 	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
-	ExprContext *econtext = node->ss.ps.ps_ExprContext;
-	int			numParams = fsstate->numParams;
-	const char **values = fsstate->param_values;
-	PGconn	   *conn = fsstate->conn;
-	StringInfoData buf;
-	PGresult   *res;
+	SemijoinFilterInstrumentation *instr = node->semijoin_instr;
+	SemijoinStatsKey key;
+	SemijoinStatsEntry *entry;
+	bool		found;
 
-	/* First, process a pending asynchronous request, if any. */
-	if (fsstate->conn_state->pendingAreq)
-		process_pending_request(fsstate->conn_state->pendingAreq);
+	if (!semijoin_stats_attach())
+		return;
+
+	memset(&key, 0, sizeof(key));
+	key.dbid = MyDatabaseId;
+	key.serverid = castNode(ForeignScan, node->ss.ps.plan)->fs_server;
+	key.relid = fsstate->rel ? RelationGetRelid(fsstate->rel) : InvalidOid;
+
+	LWLockAcquire(&SemijoinStats->lock, LW_EXCLUSIVE);
+	entry = (SemijoinStatsEntry *) hash_search(SemijoinStatsHash, &key,
+											   HASH_ENTER_NULL, &found);
+	if (entry == NULL)
+	{
+		/* Out of entries; count what is lost */
+		SemijoinStats->dropped++;
+		LWLockRelease(&SemijoinStats->lock);
+		return;
+	}
+	if (!found)
+		memset((char *) entry + sizeof(SemijoinStatsKey), 0,
+			   sizeof(SemijoinStatsEntry) - sizeof(SemijoinStatsKey));
+
+	if (instr->npartitions == 0)
+		entry->fallbacks++;
+	else if (instr->shared)
+		entry->filters_shared++;
+	else
+	{
+		/* A scan rebuilds its filter when its parameters change */
+		entry->filters_built += instr->nbuilds;
+		entry->filter_bytes += instr->total_bytes;
+		entry->build_time += instr->total_time;
+	}
+	entry->rows_scanned += fsstate->filter_scanned;
+	entry->rows_rejected += fsstate->filter_rejected;
 
 	/*
-	 * Construct array of query parameter values in text format.  We do the
-	 * conversions in the short-lived per-tuple context, so as not to cause a
-	 * memory leak over repeated scans.
+	 * Only scans that checked their rows for false positives tell the
+	 * observed rate, so count their true negatives apart.
 	 */
-	if (numParams > 0)
+	if (fsstate->filter_checked > 0)
 	{
-		MemoryContext oldcontext;
+		entry->checked_rejected += fsstate->filter_rejected;
+		entry->rows_checked += fsstate->filter_checked;
+		entry->false_positives += fsstate->filter_checked -
+			fsstate->filter_matched;
+	}
+	LWLockRelease(&SemijoinStats->lock);
+}
 
-		oldcontext = MemoryContextSwitchTo(econtext->ecxt_per_tuple_memory);
+/*
+ * postgres_fdw_semijoin_stats
+ *
+ * Returns the cumulative semijoin filter statistics of the current database,
+ * over all sessions since the server started or the statistics were reset,
+ * one row per foreign server and table, with the average filter size and the
+ * observed false-positive rate worked out.  The rate is NULL until some rows have been
+ * checked for false positives, which happens under EXPLAIN ANALYZE.
+ */
+Datum
+postgres_fdw_semijoin_stats(PG_FUNCTION_ARGS)
+{
+	ReturnSetInfo *rsinfo = (ReturnSetInfo *) fcinfo->resultinfo;
+	HASH_SEQ_STATUS scan;
+	SemijoinStatsEntry *entry;
 
-		process_query_params(econtext,
-							 fsstate->param_flinfo,
-							 fsstate->param_exprs,
-							 values);
+	InitMaterializedSRF(fcinfo, 0);
 
-		MemoryContextSwitchTo(oldcontext);
-	}
+	if (!semijoin_stats_attach())
+		PG_RETURN_VOID();
 
-	/* Construct the DECLARE CURSOR command */
-	initStringInfo(&buf);
-	appendStringInfo(&buf, "DECLARE c%u CURSOR FOR\n%s",
-					 fsstate->cursor_number, fsstate->query);
+	LWLockAcquire(&SemijoinStats->lock, LW_SHARED);
+	hash_seq_init(&scan, SemijoinStatsHash);
+	while ((entry = (SemijoinStatsEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		Datum		values[SEMIJOIN_STATS_COLS];
+		bool		nulls[SEMIJOIN_STATS_COLS];
+		int64		negatives;
+		int			i = 0;
 
-	/*
-	 * Notice that we pass NULL for paramTypes, thus forcing the remote server
-	 * to infer types for all parameters.  Since we explicitly cast every
-	 * parameter (see deparse.c), the "inference" is trivial and will produce
-	 * the desired result.  This allows us to avoid assuming that the remote
-	 * server has the same OIDs we do for the parameters' types.
-	 */
-	if (!PQsendQueryParams(conn, buf.data, numParams,
-						   NULL, values, NULL, NULL, 0))
-		pgfdw_report_error(ERROR, NULL, conn, false, buf.data);
+		/* The OIDs mean nothing in other databases */
+		if (entry->key.dbid != MyDatabaseId)
+			continue;
 
-	/*
-	 * Get the result, and check for success.
-	 *
-	 * We don't use a PG_TRY block here, so be careful not to throw error
-	 * without releasing the PGresult.
-	 */
-	res = pgfdw_get_result(conn, buf.data);
-	if (PQresultStatus(res) != PGRES_COMMAND_OK)
-		pgfdw_report_error(ERROR, res, conn, true, fsstate->query);
-	PQclear(res);
+		memset(nulls, 0, sizeof(nulls));
 
-	/* Mark the cursor as created, and show no tuples have been retrieved */
-	fsstate->cursor_exists = true;
-	fsstate->tuples = NULL;
-	fsstate->num_tuples = 0;
-	fsstate->next_tuple = 0;
-	fsstate->fetch_ct_2 = 0;
-	fsstate->eof_reached = false;
+		values[i++] = ObjectIdGetDatum(entry->key.serverid);
+		if (OidIsValid(entry->key.relid))
+			values[i++] = ObjectIdGetDatum(entry->key.relid);
+		else
+			nulls[i++] = true;
+		values[i++] = Int64GetDatum(entry->filters_built);
+		values[i++] = Int64GetDatum(entry->filters_shared);
+		values[i++] = Int64GetDatum(entry->fallbacks);
+		values[i++] = Int64GetDatum(entry->filter_bytes);
+		if (entry->filters_built > 0)
+			values[i++] = Float8GetDatum((double) entry->filter_bytes /
+										 entry->filters_built);
+		else
+			nulls[i++] = true;
+		values[i++] = Float8GetDatum(entry->build_time);
+		values[i++] = Int64GetDatum(entry->rows_scanned);
+		values[i++] = Int64GetDatum(entry->rows_rejected);
+		values[i++] = Int64GetDatum(entry->checked_rejected);
+		values[i++] = Int64GetDatum(entry->false_positives);
 
-	/* Clean up */
-	pfree(buf.data);
+		/*
+		 * Rows rejected by the scans that checked for false positives are
+		 * their true negatives.
+		 */
+		negatives = entry->checked_rejected + entry->false_positives;
+		if (entry->rows_checked > 0 && negatives > 0)
+			values[i++] = Float8GetDatum((double) entry->false_positives /
+										 negatives);
+		else
+			nulls[i++] = true;
+
+		Assert(i == SEMIJOIN_STATS_COLS);
+		tuplestore_putvalues(rsinfo->setResult, rsinfo->setDesc,
+							 values, nulls);
+	}
+	LWLockRelease(&SemijoinStats->lock);
+
+	PG_RETURN_VOID();
 }
 
 /*
- * Fetch some more rows from the node's cursor.
+ * postgres_fdw_semijoin_stats_dropped
+ *
+ * Returns the number of scans whose statistics were lost because the shared
+ * hash table was full, since the server started or the statistics were last
+ * reset in any database; NULL if this session has no statistics.  If it is
+ * not zero, postgres_fdw_semijoin_stats() is incomplete.
  */
-static void
-fetch_more_data(ForeignScanState *node)
+Datum
+postgres_fdw_semijoin_stats_dropped(PG_FUNCTION_ARGS)
 {
-	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
-	PGresult   *volatile res = NULL;
-	MemoryContext oldcontext;
-
-	/*
-	 * We'll store the tuples in the batch_cxt.  First, flush the previous
-	 * batch.
-	 */
-	fsstate->tuples = NULL;
-	MemoryContextReset(fsstate->batch_cxt);
-	oldcontext = MemoryContextSwitchTo(fsstate->batch_cxt);
+	int64		dropped;
 
-	/* PGresult must be released before leaving this function. */
-	PG_TRY();
-	{
-		PGconn	   *conn = fsstate->conn;
-		int			numrows;
-		int			i;
+	if (!semijoin_stats_attach())
+		PG_RETURN_NULL();
 
-		if (fsstate->async_capable)
-		{
-			Assert(fsstate->conn_state->pendingAreq);
+	LWLockAcquire(&SemijoinStats->lock, LW_SHARED);
+	dropped = SemijoinStats->dropped;
+	LWLockRelease(&SemijoinStats->lock);
 
-			/*
-			 * The query was already sent by an earlier call to
-			 * fetch_more_data_begin.  So now we just fetch the result.
-			 */
-			res = pgfdw_get_result(conn, fsstate->query);
-			/* On error, report the original query, not the FETCH. */
-			if (PQresultStatus(res) != PGRES_TUPLES_OK)
-				pgfdw_report_error(ERROR, res, conn, false, fsstate->query);
+	PG_RETURN_INT64(dropped);
+}
 
-			/* Reset per-connection state */
-			fsstate->conn_state->pendingAreq = NULL;
-		}
-		else
-		{
-			char		sql[64];
+/*
+ * postgres_fdw_semijoin_stats_reset
+ *
+ * Discards the cumulative semijoin filter statistics of the current database,
+ * and the count of lost updates, which are not told apart by database.
+ */
+Datum
+postgres_fdw_semijoin_stats_reset(PG_FUNCTION_ARGS)
+{
+	HASH_SEQ_STATUS scan;
+	SemijoinStatsEntry *entry;
 
-			/* This is a regular synchronous fetch. */
-			snprintf(sql, sizeof(sql), "FETCH %d FROM c%u",
-					 fsstate->fetch_size, fsstate->cursor_number);
+	if (!semijoin_stats_attach())
+		PG_RETURN_VOID();
 
-			res = pgfdw_exec_query(conn, sql, fsstate->conn_state);
-			/* On error, report the original query, not the FETCH. */
-			if (PQresultStatus(res) != PGRES_TUPLES_OK)
-				pgfdw_report_error(ERROR, res, conn, false, fsstate->query);
-		}
+	LWLockAcquire(&SemijoinStats->lock, LW_EXCLUSIVE);
+	hash_seq_init(&scan, SemijoinStatsHash);
+	while ((entry = (SemijoinStatsEntry *) hash_seq_search(&scan)) != NULL)
+	{
+		if (entry->key.dbid == MyDatabaseId)
+			hash_search(SemijoinStatsHash, &entry->key, HASH_REMOVE, NULL);
+	}
+	SemijoinStats->dropped = 0;
+	LWLockRelease(&SemijoinStats->lock);
 
-		/* Convert the data into HeapTuples */
-		numrows = PQntuples(res);
-		fsstate->tuples = (HeapTuple *) palloc0(numrows * sizeof(HeapTuple));
-		fsstate->num_tuples = numrows;
-		fsstate->next_tuple = 0;
+	PG_RETURN_VOID();
+}
 
-		for (i = 0; i < numrows; i++)
-		{
-			Assert(IsA(node->ss.ps.plan, ForeignScan));
+/*
+ * Key number i of the given type for the Bloom filter benchmark, formatted
+ * the way get_attr_val_from_slot() formats keys.  Distinct numbers give
+ * distinct keys.
+ */
+static char *
+bloom_benchmark_key(const char *key_type, int64 i)
+{
+	if (strcmp(key_type, "int") == 0)
+		return psprintf(INT64_FORMAT, i);
+	if (strcmp(key_type, "text") == 0)
+		return psprintf("key-" INT64_FORMAT, i);
+	/* Multiplying by an odd constant is a bijection on 64 bits */
+	if (strcmp(key_type, "hex") == 0)
+		return psprintf("%016" INT64_MODIFIER "x",
+						(uint64) i * UINT64CONST(0x9e3779b97f4a7c15));
+	ereport(ERROR,
+			(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+			 errmsg("unrecognized key type \"%s\"", key_type),
+			 errhint("Valid key types are \"int\", \"text\" and \"hex\".")));
+	return NULL;				/* keep compiler quiet */
+}
 
-			fsstate->tuples[i] =
-				make_tuple_from_result_row(res, i,
-										   fsstate->rel,
-										   fsstate->attinmeta,
-										   fsstate->retrieved_attrs,
-										   node,
-										   fsstate->temp_cxt);
-		}
+/*
+ * postgres_fdw_bloom_benchmark
+ *
+ * Builds a Bloom filter of nkeys keys of the given type at the given target
+ * false-positive rate, optionally with another number of hash functions, and
+ * returns the add, check, encode and decode times along with the memory per
+ * key.  The members are the even key numbers; nprobes odd ones, which the
+ * filter has never seen, give the empirical false-positive rate.  Raises an
+ * error if a member is missed, as a Bloom filter must never do that.
+ */
+Datum
+postgres_fdw_bloom_benchmark(PG_FUNCTION_ARGS)
+{
+	int64		nkeys = PG_GETARG_INT64(0);
+	double		fpr = PG_GETARG_FLOAT8(1);
+	char	   *key_type = text_to_cstring(PG_GETARG_TEXT_PP(2));
+	int			hash_count = PG_GETARG_INT32(3);
+	int64		nprobes = PG_GETARG_INT64(4);
+	TupleDesc	tupdesc;
+	MemoryContext cxt;
+	MemoryContext oldcxt;
+	CustomBloomFilter *filter;
+	CustomBloomFilter *decoded;
+	char	  **members;
+	char	  **probes;
+	char	   *hex;
+	size_t		hexlen;
+	int64		false_positives = 0;
+	instr_time	start;
+	instr_time	add_time;
+	instr_time	check_time;
+	instr_time	encode_time;
+	instr_time	decode_time;
+	Datum		values[BLOOM_BENCHMARK_COLS];
+	bool		nulls[BLOOM_BENCHMARK_COLS];
+	int			i = 0;
+
+	if (nkeys <= 0 || nkeys > MaxAllocSize / sizeof(char *))
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("number of keys must be between 1 and %zu",
+						MaxAllocSize / sizeof(char *))));
+	if (fpr <= 0.0 || fpr >= 1.0)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("false-positive rate must be between 0 and 1")));
+	if (hash_count < 0 || hash_count > 255)
+		ereport(ERROR,
+				(errcode(ERRCODE_INVALID_PARAMETER_VALUE),
+				 errmsg("hash count must be between 0 and 255")));
+	if (nprobes <= 0)
+		nprobes = nkeys;
+	nprobes = Min(nprobes, MaxAllocSize / sizeof(char *));
+
+	if (get_call_result_type(fcinfo, NULL, &tupdesc) != TYPEFUNC_COMPOSITE)
+		elog(ERROR, "return type must be a row type");
+
+	/* Keys are generated up front, so that only the filter is timed */
+	cxt = AllocSetContextCreate(CurrentMemoryContext,
+								"bloom benchmark",
+								ALLOCSET_DEFAULT_SIZES);
+	oldcxt = MemoryContextSwitchTo(cxt);
+	members = palloc(nkeys * sizeof(char *));
+	for (int64 k = 0; k < nkeys; k++)
+		members[k] = bloom_benchmark_key(key_type, 2 * k);
+	probes = palloc(nprobes * sizeof(char *));
+	for (int64 k = 0; k < nprobes; k++)
+		probes[k] = bloom_benchmark_key(key_type, 2 * k + 1);
+
+	filter = bloom_filter_create(nkeys, fpr);
+	if (filter == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory"),
+				 errdetail("Failed to allocate a Bloom filter for " INT64_FORMAT " keys.",
+						   nkeys)));
+	if (hash_count > 0)
+		filter->hash_count = hash_count;
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (int64 k = 0; k < nkeys; k++)
+		bloom_filter_add(filter, members[k]);
+	INSTR_TIME_SET_CURRENT(add_time);
+	INSTR_TIME_SUBTRACT(add_time, start);
+
+	INSTR_TIME_SET_CURRENT(start);
+	for (int64 k = 0; k < nprobes; k++)
+		false_positives += bloom_filter_check(filter, probes[k]);
+	INSTR_TIME_SET_CURRENT(check_time);
+	INSTR_TIME_SUBTRACT(check_time, start);
+
+	INSTR_TIME_SET_CURRENT(start);
+	hex = bloom_filter_encode_hex_with_metadata(filter);
+	INSTR_TIME_SET_CURRENT(encode_time);
+	INSTR_TIME_SUBTRACT(encode_time, start);
+	if (hex == NULL)
+		ereport(ERROR,
+				(errcode(ERRCODE_OUT_OF_MEMORY),
+				 errmsg("out of memory")));
+	hexlen = strlen(hex);
+
+	INSTR_TIME_SET_CURRENT(start);
+	decoded = bloom_filter_decode_hex_with_metadata(hex);
+	INSTR_TIME_SET_CURRENT(decode_time);
+	INSTR_TIME_SUBTRACT(decode_time, start);
+	if (decoded == NULL)
+		elog(ERROR, "could not decode the encoded Bloom filter");
+
+	/* The decoded filter must still hold every member */
+	for (int64 k = 0; k < nkeys; k++)
+	{
+		if (!bloom_filter_check(decoded, members[k]))
+			elog(ERROR, "Bloom filter misses key \"%s\"", members[k]);
+	}
+
+	memset(nulls, 0, sizeof(nulls));
+	values[i++] = Int64GetDatum(nkeys);
+	values[i++] = Float8GetDatum(fpr);
+	values[i++] = Int32GetDatum(filter->hash_count);
+	values[i++] = Int64GetDatum((int64) filter->size);
+	values[i++] = Float8GetDatum((double) ((filter->size + 7) / 8) / nkeys);
+	values[i++] = Float8GetDatum(INSTR_TIME_GET_DOUBLE(add_time) * 1e9 / nkeys);
+	values[i++] = Float8GetDatum(INSTR_TIME_GET_DOUBLE(check_time) * 1e9 / nprobes);
+	values[i++] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(encode_time));
+	values[i++] = Float8GetDatum(INSTR_TIME_GET_MILLISEC(decode_time));
+	values[i++] = Int64GetDatum((int64) hexlen);
+	values[i++] = Int64GetDatum(nprobes);
+	values[i++] = Int64GetDatum(false_positives);
+	values[i++] = Float8GetDatum((double) false_positives / nprobes);
+	values[i++] = Float8GetDatum(bloom_filter_estimate_count(filter));
+	Assert(i == BLOOM_BENCHMARK_COLS);
+
+	MemoryContextSwitchTo(oldcxt);
+	MemoryContextDelete(cxt);
+
+	PG_RETURN_DATUM(HeapTupleGetDatum(heap_form_tuple(tupdesc, values, nulls)));
+}
 
-		/* Update fetch_ct_2 */
-		if (fsstate->fetch_ct_2 < 2)
-			fsstate->fetch_ct_2++;
+/*
+ * Notice receiver picking up the remote's report on a semijoin filter.
+ *
+ * Other notices are passed on to the receiver that was installed before.
+ * That is libpq's default one, which ignores its argument.
+ */
+static void
+semijoin_stats_receiver(void *arg, const PGresult *res)
+{
+	PgFdwScanState *fsstate = (PgFdwScanState *) arg;
+	const char *message = PQresultErrorField(res, PG_DIAG_MESSAGE_PRIMARY);
+	uint64		scanned;
+	uint64		rejected;
 
-		/* Must be EOF if we didn't get as many tuples as we asked for. */
-		fsstate->eof_reached = (numrows < fsstate->fetch_size);
-	}
-	PG_FINALLY();
+	if (message != NULL &&
+		sscanf(message, BLOOM_FILTER_STATS_FORMAT, &scanned, &rejected) == 2)
 	{
-		PQclear(res);
+		fsstate->filter_scanned += scanned;
+		fsstate->filter_rejected += rejected;
+		fsstate->filter_reported = true;
 	}
-	PG_END_TRY();
-
-	MemoryContextSwitchTo(oldcontext);
+	else if (fsstate->prev_notice_receiver)
+		fsstate->prev_notice_receiver(NULL, res);
 }
 
 /*
@@ -4621,6 +7541,7 @@ store_returning_result(PgFdwModifyState *fmstate,
 		newtup = make_tuple_from_result_row(res, 0,
 											fmstate->rel,
 											fmstate->attinmeta,
+											NULL,
 											fmstate->retrieved_attrs,
 											NULL,
 											fmstate->temp_cxt);
@@ -4914,6 +7835,7 @@ get_returning_data(ForeignScanState *node)
 												dmstate->next_tuple,
 												dmstate->rel,
 												dmstate->attinmeta,
+												NULL,
 												dmstate->retrieved_attrs,
 												node,
 												dmstate->temp_cxt);
@@ -5704,6 +8626,7 @@ analyze_row_processor(PGresult *res, int row, PgFdwAnalyzeState *astate)
 		astate->rows[pos] = make_tuple_from_result_row(res, row,
 													   astate->rel,
 													   astate->attinmeta,
+													   NULL,
 													   astate->retrieved_attrs,
 													   NULL,
 													   astate->temp_cxt);
@@ -7563,6 +10486,10 @@ produce_tuple_asynchronously(AsyncRequest *areq, bool fetch)
 	/* This should not be called if the request is currently in-process */
 	Assert(areq != pendingAreq);
 
+	/* At EOF, go on with the next semijoin filter partition, if any */
+	if (fsstate->next_tuple >= fsstate->num_tuples && fsstate->eof_reached)
+		(void) begin_next_filter_partition(node);
+
 	/* Fetch some more tuples, if we've run out */
 	if (fsstate->next_tuple >= fsstate->num_tuples)
 	{
@@ -7597,6 +10524,10 @@ produce_tuple_asynchronously(AsyncRequest *areq, bool fetch)
 	/* We must have run out of tuples */
 	Assert(fsstate->next_tuple >= fsstate->num_tuples);
 
+	/* At EOF, go on with the next semijoin filter partition, if any */
+	if (fsstate->eof_reached)
+		(void) begin_next_filter_partition(node);
+
 	/* Fetch some more tuples, if we've not detected EOF yet */
 	if (!fsstate->eof_reached)
 	{
@@ -7628,7 +10559,6 @@ fetch_more_data_begin(AsyncRequest *areq)
 {
 	ForeignScanState *node = (ForeignScanState *) areq->requestee;
 	PgFdwScanState *fsstate = (PgFdwScanState *) node->fdw_state;
-	char		sql[64];
 
 	Assert(!fsstate->conn_state->pendingAreq);
 
@@ -7637,11 +10567,7 @@ fetch_more_data_begin(AsyncRequest *areq)
 		create_cursor(node);
 
 	/* We will send this query, but not wait for the response. */
-	snprintf(sql, sizeof(sql), "FETCH %d FROM c%u",
-			 fsstate->fetch_size, fsstate->cursor_number);
-
-	if (!PQsendQuery(fsstate->conn, sql))
-		pgfdw_report_error(ERROR, NULL, fsstate->conn, false, fsstate->query);
+	send_fetch_query(fsstate, fsstate->query);
 
 	/* Remember that the request is in process */
 	fsstate->conn_state->pendingAreq = areq;
@@ -7710,6 +10636,8 @@ complete_pending_request(AsyncRequest *areq)
  * rel is the local representation of the foreign table, attinmeta is
  * conversion data for the rel's tupdesc, and retrieved_attrs is an
  * integer list of the table column numbers present in the PGresult.
+ * recvfuncs, if not NULL, are the receive functions for the tupdesc's
+ * columns, used for a result in binary format.
  * fsstate is the ForeignScan plan node's execution state.
  * temp_context is a working context that can be reset after each tuple.
  *
@@ -7722,6 +10650,7 @@ make_tuple_from_result_row(PGresult *res,
 						   int row,
 						   Relation rel,
 						   AttInMetadata *attinmeta,
+						   FmgrInfo *recvfuncs,
 						   List *retrieved_attrs,
 						   ForeignScanState *fsstate,
 						   MemoryContext temp_context)
@@ -7731,6 +10660,7 @@ make_tuple_from_result_row(PGresult *res,
 	Datum	   *values;
 	bool	   *nulls;
 	ItemPointer ctid = NULL;
+	bool		binary = PQbinaryTuples(res);
 	ConversionLocation errpos;
 	ErrorContextCallback errcallback;
 	MemoryContext oldcontext;
@@ -7782,13 +10712,23 @@ make_tuple_from_result_row(PGresult *res,
 	{
 		int			i = lfirst_int(lc);
 		char	   *valstr;
+		StringInfoData valbuf;
 
-		/* fetch next column's textual value */
+		/* fetch next column's value */
 		if (PQgetisnull(res, row, j))
 			valstr = NULL;
 		else
 			valstr = PQgetvalue(res, row, j);
 
+		/* or, in binary format, point a read-only buffer at it */
+		if (binary && valstr != NULL)
+		{
+			valbuf.data = valstr;
+			valbuf.len = PQgetlength(res, row, j);
+			valbuf.maxlen = valbuf.len + 1;
+			valbuf.cursor = 0;
+		}
+
 		/*
 		 * convert value to internal representation
 		 *
@@ -7801,10 +10741,19 @@ make_tuple_from_result_row(PGresult *res,
 			Assert(i <= tupdesc->natts);
 			nulls[i - 1] = (valstr == NULL);
 			/* Apply the input function even to nulls, to support domains */
-			values[i - 1] = InputFunctionCall(&attinmeta->attinfuncs[i - 1],
-											  valstr,
-											  attinmeta->attioparams[i - 1],
-											  attinmeta->atttypmods[i - 1]);
+			if (binary)
+			{
+				Assert(recvfuncs);
+				values[i - 1] = ReceiveFunctionCall(&recvfuncs[i - 1],
+													valstr ? &valbuf : NULL,
+													attinmeta->attioparams[i - 1],
+													attinmeta->atttypmods[i - 1]);
+			}
+			else
+				values[i - 1] = InputFunctionCall(&attinmeta->attinfuncs[i - 1],
+												  valstr,
+												  attinmeta->attioparams[i - 1],
+												  attinmeta->atttypmods[i - 1]);
 		}
 		else if (i == SelfItemPointerAttributeNumber)
 		{
@@ -7813,7 +10762,11 @@ make_tuple_from_result_row(PGresult *res,
 			{
 				Datum		datum;
 
-				datum = DirectFunctionCall1(tidin, CStringGetDatum(valstr));
+				if (binary)
+					datum = DirectFunctionCall1(tidrecv,
+												PointerGetDatum(&valbuf));
+				else
+					datum = DirectFunctionCall1(tidin, CStringGetDatum(valstr));
 				ctid = (ItemPointer) DatumGetPointer(datum);
 			}
 		}
@@ -8112,3 +11065,85 @@ get_batch_size_option(Relation rel)
 
 	return batch_size;
 }
+
+/*
+ * Define the custom variables controlling the semijoin machinery of foreign
+ * scans.  This happens the first time the handler runs, that is, before any
+ * foreign scan is planned.  They have a prefix of their own rather than
+ * "postgres_fdw", which is reserved as soon as the library loads: that way a
+ * value set before then is kept as a placeholder and picked up here.
+ */
+static void
+define_semijoin_variables(void)
+{
+	static bool defined = false;
+
+	if (defined)
+		return;
+
+	DefineCustomBoolVariable("semijoin.enable_filter",
+							 "Enables semijoin-filtered foreign scans.",
+							 NULL,
+							 &semijoin_enable_filter,
+							 true,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("semijoin.binary_transfer",
+							 "Fetches foreign scan results in binary format.",
+							 "Applies to scans whose columns are all of built-in types. "
+							 "The foreign table's column types must match the remote ones.",
+							 &semijoin_binary_transfer,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("semijoin.late_materialization",
+							 "Fetches only the rows of semijoin-filtered scans that really join.",
+							 "The scan first fetches the join keys and ctid of the rows passing "
+							 "the filter, then the full rows whose key matches a local one. "
+							 "The foreign tables must be plain tables on the remote side.",
+							 &semijoin_late_materialization,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("semijoin.enable_key_table",
+							 "Lets the planner join foreign tables with the local keys remotely.",
+							 "Instead of a Bloom filter, the keys are copied into a temporary "
+							 "table on the remote server, which the remote query joins with. "
+							 "The remote server must allow creating temporary tables.",
+							 &semijoin_enable_key_table,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	DefineCustomBoolVariable("semijoin.enable_key_array",
+							 "Lets the planner look up foreign rows by batches of local keys.",
+							 "The remote query is run once per batch of single-column keys, "
+							 "passed as an array parameter. The costing assumes an index on "
+							 "the foreign key column.",
+							 &semijoin_enable_key_array,
+							 false,
+							 PGC_USERSET,
+							 0,
+							 NULL,
+							 NULL,
+							 NULL);
+
+	MarkGUCPrefixReserved("semijoin");
+
+	defined = true;
+}
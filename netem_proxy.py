@@ -0,0 +1,120 @@
+#!/usr/bin/env python3
+
+"""TCP proxy emulating a slower network, for benchmarking postgres_fdw.
+
+Forwards connections from --listen-port to --target-port.  Data in each
+direction is paced to --bandwidth megabits per second and delivered
+--latency milliseconds later, give or take up to --jitter milliseconds;
+data is never reordered.  When a connection closes, the bytes that went
+each way are appended to --log, one line per connection:
+
+    <connection> <client to server bytes> <server to client bytes>
+"""
+
+import argparse
+import asyncio
+import itertools
+import random
+import time
+
+CHUNK_SIZE = 64 * 1024
+
+
+class Link:
+    """One direction of a connection: a paced, delayed pipe."""
+
+    def __init__(self, args):
+        self.bytes_per_sec = args.bandwidth * 1e6 / 8 if args.bandwidth > 0 else 0
+        self.latency = args.latency / 1000.0
+        self.jitter = args.jitter / 1000.0
+        self.queue = asyncio.Queue()
+        self.tx_free = 0.0          # when the link has sent what it was given
+        self.last_delivery = 0.0    # data may not overtake earlier data
+        self.nbytes = 0
+
+    def push(self, data):
+        now = time.monotonic()
+        self.nbytes += len(data)
+        self.tx_free = max(self.tx_free, now)
+        if self.bytes_per_sec:
+            self.tx_free += len(data) / self.bytes_per_sec
+        delivery = self.tx_free + self.latency
+        if self.jitter:
+            delivery += random.uniform(-self.jitter, self.jitter)
+        self.last_delivery = max(self.last_delivery, delivery)
+        self.queue.put_nowait((self.last_delivery, data))
+
+    async def reader(self, stream):
+        while True:
+            data = await stream.read(CHUNK_SIZE)
+            if not data:
+                self.queue.put_nowait((None, None))
+                return
+            self.push(data)
+
+    async def writer(self, stream):
+        while True:
+            delivery, data = await self.queue.get()
+            if data is None:
+                if stream.can_write_eof():
+                    stream.write_eof()
+                return
+            delay = delivery - time.monotonic()
+            if delay > 0:
+                await asyncio.sleep(delay)
+            stream.write(data)
+            await stream.drain()
+
+
+async def handle(args, connection, client_reader, client_writer):
+    try:
+        server_reader, server_writer = await asyncio.open_connection(
+            args.target_host, args.target_port)
+    except OSError:
+        client_writer.close()
+        return
+
+    up = Link(args)
+    down = Link(args)
+    try:
+        await asyncio.gather(up.reader(client_reader),
+                             up.writer(server_writer),
+                             down.reader(server_reader),
+                             down.writer(client_writer))
+    except (ConnectionError, OSError):
+        pass
+    finally:
+        client_writer.close()
+        server_writer.close()
+        if args.log:
+            with open(args.log, "a") as log:
+                log.write("%d %d %d\n" % (connection, up.nbytes, down.nbytes))
+
+
+async def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n")[0])
+    parser.add_argument("--listen-port", type=int, required=True)
+    parser.add_argument("--target-host", default="localhost")
+    parser.add_argument("--target-port", type=int, required=True)
+    parser.add_argument("--bandwidth", type=float, default=0,
+                        help="megabits per second each way; 0 is unlimited")
+    parser.add_argument("--latency", type=float, default=0,
+                        help="one-way delay in milliseconds")
+    parser.add_argument("--jitter", type=float, default=0,
+                        help="maximum deviation from the delay in milliseconds")
+    parser.add_argument("--log", help="file to append per-connection byte counts to")
+    args = parser.parse_args()
+
+    counter = itertools.count(1)
+    server = await asyncio.start_server(
+        lambda r, w: handle(args, next(counter), r, w),
+        "localhost", args.listen_port)
+    async with server:
+        await server.serve_forever()
+
+
+if __name__ == "__main__":
+    try:
+        asyncio.run(main())
+    except KeyboardInterrupt:
+        pass
@@ -0,0 +1,250 @@
+#!/bin/bash
+
+# Differential test of semijoin-filtered foreign scans.
+#
+# Starts two scratch clusters and, for several rounds of random data, runs
+# semi, anti, inner, outer and multi-column joins against a foreign table
+# with the filter off, on, on with binary transfer, on with late
+# materialization, and with the key table or key arrays allowed, also
+# over a table partitioned into two foreign tables scanned by an async
+# Append.  Results must be identical, also where the foreign table's unmatched rows are
+# part of the result and so must not be filtered.  Where the filter was
+# used, the foreign scan must not return more rows than without it, the
+# observed false-positive rate must stay under $MAX_FPR and the filter
+# under $MAX_BYTES_PER_KEY bytes per distinct key.  Keys include NULLs and
+# empty strings, joins list their columns in another order than the foreign
+# table and select columns that are not keys, and dates are output in a
+# non-ISO style, to check the keys sent match those the remote computes.
+# Output is TAP, and the exit status is 1 if any test failed.
+#
+#     SEED=42 ROUNDS=20 SKIP_BUILD=1 ./run_diff_test.sh
+
+# --- CONFIGURATION ---
+USER_NAME=$(whoami)
+INSTALL_DIR="$HOME/postgres-build"
+SOURCE_DIR=$(pwd)
+
+# Paths
+BIN_DIR="$INSTALL_DIR/bin"
+LIB_DIR="$INSTALL_DIR/lib"
+DATA_LOCAL="$INSTALL_DIR/diff_data_local"
+DATA_FOREIGN="$INSTALL_DIR/diff_data_foreign"
+LOG_LOCAL="$INSTALL_DIR/diff_local.log"
+LOG_FOREIGN="$INSTALL_DIR/diff_foreign.log"
+LOCAL_PORT=${LOCAL_PORT:-5435}
+REMOTE_PORT=${REMOTE_PORT:-5436}
+WORK_DIR=$(mktemp -d)
+
+SEED=${SEED:-$RANDOM}
+ROUNDS=${ROUNDS:-8}
+MAX_LOCAL_ROWS=${MAX_LOCAL_ROWS:-2000}
+MAX_REMOTE_ROWS=${MAX_REMOTE_ROWS:-50000}
+MAX_FPR=${MAX_FPR:-0.05}
+MAX_BYTES_PER_KEY=${MAX_BYTES_PER_KEY:-2}
+
+# Export environment
+export PATH="$BIN_DIR:$PATH"
+export LD_LIBRARY_PATH="$LIB_DIR:$LD_LIBRARY_PATH"
+
+LOCAL_PSQL=("$BIN_DIR/psql" -X -q -At -v ON_ERROR_STOP=1 -p "$LOCAL_PORT" -d localdb)
+REMOTE_PSQL=("$BIN_DIR/psql" -X -q -At -v ON_ERROR_STOP=1 -p "$REMOTE_PORT" -d foreigndb)
+
+# The local side keys a as int8 against the remote int4, for mixed types.
+# rp is r partitioned by id into two async-capable foreign tables; its
+# queries join on columns of equal types, as the key table and key arrays
+# require.  b is NULL, empty or 'k<n>'.
+QUERIES=(
+    "SELECT l.id FROM l WHERE EXISTS (SELECT 1 FROM r WHERE r.a = l.a) ORDER BY 1"
+    "SELECT l.id FROM l WHERE EXISTS (SELECT 1 FROM r WHERE r.a = l.a AND r.b = l.b) ORDER BY 1"
+    "SELECT l.id FROM l WHERE l.d IN (SELECT r.d FROM r) ORDER BY 1"
+    "SELECT l.id, r.id FROM l JOIN r ON r.a = l.a ORDER BY 1, 2"
+    "SELECT l.id, r.id FROM l JOIN r ON r.a = l.a AND r.b = l.b ORDER BY 1, 2"
+    "SELECT l.id, r.id, r.b FROM l JOIN r ON r.b = l.b WHERE l.id % 7 = 0 ORDER BY 1, 2"
+    "SELECT l.id, r.id FROM l JOIN r ON r.d = l.d AND r.a = l.a ORDER BY 1, 2"
+    "SELECT l.id FROM l WHERE NOT EXISTS (SELECT 1 FROM r WHERE r.a = l.a) ORDER BY 1"
+    "SELECT l.id FROM l WHERE NOT EXISTS (SELECT 1 FROM r WHERE r.a = l.a AND r.b = l.b) ORDER BY 1"
+    "SELECT l.id, r.id FROM l LEFT JOIN r ON r.a = l.a ORDER BY 1, 2"
+    "SELECT l.id, r.id FROM l LEFT JOIN r ON r.b = l.b WHERE l.id % 7 = 0 ORDER BY 1, 2"
+    "SELECT r.id, l.id FROM r LEFT JOIN l ON l.a = r.a ORDER BY 1, 2"
+    "SELECT r.id FROM r WHERE NOT EXISTS (SELECT 1 FROM l WHERE l.a = r.a) ORDER BY 1"
+    "SELECT l.id, r.id FROM l FULL JOIN r ON r.a = l.a ORDER BY 1, 2"
+    "SELECT l.id, rp.id FROM l JOIN rp ON rp.d = l.d ORDER BY 1, 2"
+    "SELECT l.id FROM l WHERE EXISTS (SELECT 1 FROM rp WHERE rp.b = l.b AND rp.d = l.d) ORDER BY 1"
+    "SELECT l.d, l.id, r.id, r.d FROM l LEFT JOIN r ON r.b = l.b AND r.a = l.a ORDER BY 2, 3"
+    "SELECT l.id FROM l WHERE EXISTS (SELECT 1 FROM r WHERE r.d = l.d AND r.b = l.b) ORDER BY 1"
+    "SELECT l.id, r.id FROM l JOIN r ON r.b = l.b WHERE l.b = '' ORDER BY 1, 2"
+)
+
+TESTS=0
+FAILURES=0
+
+# --- CLEANUP FUNCTION ---
+cleanup() {
+    "$BIN_DIR/pg_ctl" -D "$DATA_LOCAL" stop -m immediate > /dev/null 2>&1
+    "$BIN_DIR/pg_ctl" -D "$DATA_FOREIGN" stop -m immediate > /dev/null 2>&1
+    rm -rf "$WORK_DIR"
+}
+trap 'cleanup; exit 1' SIGINT
+
+# ok CONDITION DESCRIPTION [DIAGNOSTIC]
+ok() {
+    TESTS=$((TESTS + 1))
+    if [ "$1" = "0" ]; then
+        echo "ok $TESTS - $2"
+    else
+        FAILURES=$((FAILURES + 1))
+        echo "not ok $TESTS - $2"
+        [ -n "$3" ] && echo "$3" | sed 's/^/# /'
+    fi
+}
+
+mode_settings() {
+    echo "SET DateStyle = 'SQL, DMY';"
+    case "$1" in
+        off) echo "SET semijoin.enable_filter = off;" ;;
+        on) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = off; SET semijoin.late_materialization = off;" ;;
+        on_binary) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = on; SET semijoin.late_materialization = off;" ;;
+        on_late) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = off; SET semijoin.late_materialization = on;" ;;
+        on_key_table) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = off; SET semijoin.enable_key_table = on;" ;;
+        on_key_array) echo "SET semijoin.enable_filter = on; SET semijoin.binary_transfer = off; SET semijoin.enable_key_array = on;" ;;
+    esac
+}
+
+# explain_value EXPLAIN_OUTPUT LABEL
+explain_value() {
+    echo "$1" | grep -m 1 "$2:" | sed -E "s/.*$2: ([0-9.]+).*/\1/"
+}
+
+# --- STEP 1: BUILD ---
+echo "# seed $SEED"
+if [ "$SKIP_BUILD" != "1" ]; then
+    make -j4 install > build.log 2>&1
+    if [ $? -ne 0 ]; then echo "Bail out! Core build failed. See build.log"; exit 1; fi
+    cd contrib/postgres_fdw || exit
+    make install >> ../../build.log 2>&1
+    if [ $? -ne 0 ]; then echo "Bail out! Extension build failed. See build.log"; exit 1; fi
+    cd ../..
+fi
+
+# --- STEP 2: START SERVERS ---
+rm -rf "$DATA_LOCAL" "$DATA_FOREIGN"
+"$BIN_DIR/initdb" -D "$DATA_FOREIGN" > /dev/null 2>&1
+"$BIN_DIR/initdb" -D "$DATA_LOCAL" > /dev/null 2>&1
+"$BIN_DIR/pg_ctl" -D "$DATA_FOREIGN" -l "$LOG_FOREIGN" -o "-p $REMOTE_PORT" -w start > /dev/null
+"$BIN_DIR/pg_ctl" -D "$DATA_LOCAL" -l "$LOG_LOCAL" -o "-p $LOCAL_PORT" -w start > /dev/null
+"$BIN_DIR/createdb" -p "$REMOTE_PORT" foreigndb
+"$BIN_DIR/createdb" -p "$LOCAL_PORT" localdb
+
+"${LOCAL_PSQL[@]}" <<EOF
+CREATE EXTENSION postgres_fdw;
+CREATE SERVER foreign_server FOREIGN DATA WRAPPER postgres_fdw OPTIONS (host 'localhost', port '$REMOTE_PORT', dbname 'foreigndb');
+CREATE USER MAPPING FOR CURRENT_USER SERVER foreign_server OPTIONS (user '$USER_NAME');
+EOF
+if [ $? -ne 0 ]; then echo "Bail out! Could not set up the clusters"; cleanup; exit 1; fi
+
+# --- STEP 3: RUN ---
+RANDOM=$SEED
+for round in $(seq 1 "$ROUNDS"); do
+    # The first two rounds have an empty side
+    case $round in
+        1) nlocal=0; nremote=$((RANDOM % MAX_REMOTE_ROWS + 1)) ;;
+        2) nlocal=$((RANDOM % MAX_LOCAL_ROWS + 1)); nremote=0 ;;
+        *) nlocal=$((RANDOM % MAX_LOCAL_ROWS + 1)); nremote=$((RANDOM * 32768 % MAX_REMOTE_ROWS + RANDOM % MAX_REMOTE_ROWS + 1)) ;;
+    esac
+    nremote=$((nremote > MAX_REMOTE_ROWS ? MAX_REMOTE_ROWS : nremote))
+    # Key domain: from mostly matching to mostly disjoint
+    nkeys=$((RANDOM % (4 * MAX_LOCAL_ROWS) + 10))
+    seed=0.$((RANDOM % 1000))
+    echo "# round $round: $nlocal local rows, $nremote remote rows, $nkeys keys"
+
+    # NULLs and duplicates on both sides
+    "${REMOTE_PSQL[@]}" <<EOF
+SELECT setseed($seed);
+DROP TABLE IF EXISTS r;
+CREATE TABLE r AS
+    SELECT g AS id,
+           CASE WHEN random() < 0.05 THEN NULL ELSE floor(random() * $nkeys)::int4 END AS a,
+           CASE WHEN random() < 0.05 THEN NULL WHEN random() < 0.05 THEN '' ELSE 'k' || floor(random() * 20)::int END AS b,
+           DATE '2000-01-01' + floor(random() * $nkeys)::int AS d
+    FROM generate_series(1, $nremote) g;
+ANALYZE r;
+DROP TABLE IF EXISTS rp1, rp2;
+CREATE TABLE rp1 AS SELECT * FROM r WHERE id <= $((nremote / 2));
+CREATE TABLE rp2 AS SELECT * FROM r WHERE id > $((nremote / 2));
+ANALYZE rp1;
+ANALYZE rp2;
+EOF
+    "${LOCAL_PSQL[@]}" <<EOF
+SELECT setseed($seed);
+DROP FOREIGN TABLE IF EXISTS r;
+IMPORT FOREIGN SCHEMA public LIMIT TO (r) FROM SERVER foreign_server INTO public;
+DROP TABLE IF EXISTS rp;
+CREATE TABLE rp (id int4, a int4, b text, d date) PARTITION BY RANGE (id);
+CREATE FOREIGN TABLE rp1 PARTITION OF rp FOR VALUES FROM (MINVALUE) TO ($((nremote / 2 + 1)))
+    SERVER foreign_server OPTIONS (table_name 'rp1', async_capable 'true');
+CREATE FOREIGN TABLE rp2 PARTITION OF rp FOR VALUES FROM ($((nremote / 2 + 1))) TO (MAXVALUE)
+    SERVER foreign_server OPTIONS (table_name 'rp2', async_capable 'true');
+ANALYZE rp;
+DROP TABLE IF EXISTS l;
+CREATE TABLE l AS
+    SELECT g AS id,
+           CASE WHEN random() < 0.05 THEN NULL ELSE floor(random() * $nkeys)::int8 END AS a,
+           CASE WHEN random() < 0.05 THEN NULL WHEN random() < 0.05 THEN '' ELSE 'k' || floor(random() * 20)::int END AS b,
+           DATE '2000-01-01' + floor(random() * $nkeys)::int AS d
+    FROM generate_series(1, $nlocal) g;
+ANALYZE l;
+ANALYZE r;
+EOF
+
+    for q in "${!QUERIES[@]}"; do
+        sql=${QUERIES[$q]}
+        for mode in off on on_binary on_late on_key_table on_key_array; do
+            "${LOCAL_PSQL[@]}" > "$WORK_DIR/$mode.out" 2>&1 <<EOF
+$(mode_settings $mode)
+$sql;
+EOF
+            echo $? > "$WORK_DIR/$mode.status"
+        done
+
+        ok "$(cat "$WORK_DIR/off.status")" "round $round query $((q + 1)) runs without filter" "$(head -n 5 "$WORK_DIR/off.out")"
+        for mode in on on_binary on_late on_key_table on_key_array; do
+            diffs=$(diff "$WORK_DIR/off.out" "$WORK_DIR/$mode.out" | head -n 10)
+            ok "$([ -z "$diffs" ]; echo $?)" "round $round query $((q + 1)) same result with filter $mode" "$diffs"
+        done
+
+        # Performance properties, for the plans that used a filter
+        plan_off=$("${LOCAL_PSQL[@]}" 2>&1 <<EOF
+$(mode_settings off)
+EXPLAIN (ANALYZE, VERBOSE, TIMING OFF) $sql;
+EOF
+)
+        plan_on=$("${LOCAL_PSQL[@]}" 2>&1 <<EOF
+$(mode_settings on)
+EXPLAIN (ANALYZE, VERBOSE, TIMING OFF) $sql;
+EOF
+)
+        if ! echo "$plan_on" | grep -q "Semijoin Filter: Bloom"; then
+            echo "# round $round query $((q + 1)): no filter used"
+            continue
+        fi
+        rows_off=$(echo "$plan_off" | grep -m 1 "Foreign Scan on public.r" | sed -E 's/.*actual rows=([0-9]+).*/\1/')
+        rows_on=$(echo "$plan_on" | grep -m 1 "Foreign Scan on public.r" | sed -E 's/.*actual rows=([0-9]+).*/\1/')
+        ok "$([ "${rows_on:-0}" -le "${rows_off:-0}" ]; echo $?)" "round $round query $((q + 1)) filter fetches no more rows ($rows_on <= $rows_off)"
+
+        fpr=$(explain_value "$plan_on" "Semijoin Filter Actual FPR")
+        if [ -n "$fpr" ]; then
+            ok "$(awk -v f="$fpr" -v m="$MAX_FPR" 'BEGIN { exit !(f <= m) }'; echo $?)" "round $round query $((q + 1)) false-positive rate $fpr <= $MAX_FPR"
+        fi
+
+        bytes=$(explain_value "$plan_on" "Semijoin Filter Serialized Size")
+        keys=$(explain_value "$plan_on" "Semijoin Filter Distinct Keys")
+        if [ -n "$bytes" ] && [ -n "$keys" ]; then
+            ok "$(awk -v b="$bytes" -v k="$keys" -v m="$MAX_BYTES_PER_KEY" 'BEGIN { exit !(b <= k * m + 64) }'; echo $?)" "round $round query $((q + 1)) filter of $bytes bytes for $keys keys"
+        fi
+    done
+done
+
+echo "1..$TESTS"
+[ "$FAILURES" -gt 0 ] && echo "# $FAILURES of $TESTS tests failed (seed $SEED)"
+cleanup
+exit $((FAILURES > 0))
@@ -88,6 +88,41 @@ CREATE SERVER foreign_server FOREIGN DATA WRAPPER postgres_fdw OPTIONS (host 'lo
 CREATE USER MAPPING FOR CURRENT_USER SERVER foreign_server OPTIONS (user '$USER_NAME');
 IMPORT FOREIGN SCHEMA public LIMIT TO (takes) FROM SERVER foreign_server INTO public;
 ANALYZE course;
+
+-- Semijoin filter statistics of all sessions (not in the extension script)
+CREATE FUNCTION postgres_fdw_semijoin_stats (
+    OUT serverid oid, OUT relid oid,
+    OUT filters_built int8, OUT filters_shared int8, OUT fallbacks int8,
+    OUT total_bytes int8, OUT avg_bytes float8, OUT build_time float8,
+    OUT rows_scanned int8, OUT rows_rejected int8, OUT checked_rejected int8,
+    OUT false_positives int8, OUT observed_fpr float8)
+RETURNS SETOF record
+AS '\$libdir/postgres_fdw', 'postgres_fdw_semijoin_stats'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+CREATE FUNCTION postgres_fdw_semijoin_stats_dropped () RETURNS int8
+AS '\$libdir/postgres_fdw', 'postgres_fdw_semijoin_stats_dropped'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+CREATE FUNCTION postgres_fdw_semijoin_stats_reset () RETURNS void
+AS '\$libdir/postgres_fdw', 'postgres_fdw_semijoin_stats_reset'
+LANGUAGE C STRICT PARALLEL RESTRICTED;
+CREATE VIEW pg_stat_semijoin_filters AS
+    SELECT s.srvname AS server, c.relname AS foreign_table, f.*
+    FROM postgres_fdw_semijoin_stats() f
+         JOIN pg_foreign_server s ON s.oid = f.serverid
+         LEFT JOIN pg_class c ON c.oid = f.relid;
+CREATE VIEW pg_stat_semijoin_filters_by_server AS
+    SELECT server, sum(filters_built) AS filters_built,
+           sum(filters_shared) AS filters_shared, sum(fallbacks) AS fallbacks,
+           sum(total_bytes) AS total_bytes,
+           sum(total_bytes) / nullif(sum(filters_built), 0) AS avg_bytes,
+           sum(build_time) AS build_time, sum(rows_scanned) AS rows_scanned,
+           sum(rows_rejected) AS rows_rejected,
+           sum(checked_rejected) AS checked_rejected,
+           sum(false_positives) AS false_positives,
+           sum(false_positives)::float8 /
+               nullif(sum(false_positives) + sum(checked_rejected), 0) AS observed_fpr
+    FROM pg_stat_semijoin_filters
+    GROUP BY server;
 EOF
 
 # --- STEP 5: START LIVE LOG STREAMING ---
@@ -501,6 +501,17 @@ standard_ExecutorEnd(QueryDesc *queryDesc)
 	Assert(estate->es_finished ||
 		   (estate->es_top_eflags & EXEC_FLAG_EXPLAIN_ONLY));
 
+	/*
+	 * If this is a cursor declared with a semijoin filter, tell the client
+	 * what the filter did; postgres_fdw picks this up as it closes the
+	 * cursor.
+	 */
+	if (estate->es_rcvd_filter != NULL)
+		ereport(NOTICE,
+				(errmsg_internal(BLOOM_FILTER_STATS_FORMAT,
+								 estate->es_rcvd_filter_scanned,
+								 estate->es_rcvd_filter_rejected)));
+
 	/*
 	 * Switch into per-query memory context to run ExecEndPlan
 	 */
@@ -1621,10 +1632,18 @@ ExecCloseRangeTableRelations(EState *estate)
 	}
 }
 
-char *get_attr_val_from_slot(TupleTableSlot *slot)
+/*
+ * Build the filter key of the row in slot: the text of its non-null key
+ * columns, joined with '|'.  The key columns are the nkeys columns at the
+ * positions in keys, in that order, or all columns if nkeys is 0.  *all_null
+ * is set if all key columns are null; the key is then empty, but so is that
+ * of a single empty string.
+ */
+char *get_attr_val_from_slot(TupleTableSlot *slot, int nkeys,
+							 const AttrNumber *keys, bool *all_null)
 {
 	TupleDesc typeinfo = slot->tts_tupleDescriptor;
-	int natts = typeinfo->natts;
+	int natts = nkeys > 0 ? nkeys : typeinfo->natts;
 	int i;
 	Datum attr;
 	char *value;
@@ -1635,12 +1654,16 @@ char *get_attr_val_from_slot(TupleTableSlot *slot)
 	StringInfoData composite_key;
 	initStringInfo(&composite_key);
 
+	*all_null = true;
 	for (i = 0; i < natts; ++i)
 	{
-		attr = slot_getattr(slot, i + 1, &isnull);
+		AttrNumber	attnum = nkeys > 0 ? keys[i] : i + 1;
+
+		attr = slot_getattr(slot, attnum, &isnull);
 		if (isnull)
 			continue;
-		getTypeOutputInfo(TupleDescAttr(typeinfo, i)->atttypid,
+		*all_null = false;
+		getTypeOutputInfo(TupleDescAttr(typeinfo, attnum - 1)->atttypid,
 						  &typoutput, &typisvarlena);
 
 		value = OidOutputFunctionCall(typoutput, attr);
@@ -1649,11 +1672,8 @@ char *get_attr_val_from_slot(TupleTableSlot *slot)
 			appendStringInfoString(&composite_key, "|");
 		appendStringInfoString(&composite_key, value);
 	}
-	
-	if (composite_key.len > 0)
-		return composite_key.data;
-	else
-		return NULL;
+
+	return composite_key.data;
 }
 
 /* ----------------------------------------------------------------
@@ -1702,11 +1722,6 @@ ExecutePlan(EState *estate,
 	estate->es_use_parallel_mode = use_parallel_mode;
 	if (use_parallel_mode)
 		EnterParallelMode();
-	/* Decode the bloom filter if present */
-	if (dest->has_rcvd_filter)
-	{
-		dest->rcvd_filter = bloom_filter_decode_hex_with_metadata(dest->rcvd_filter_hex);
-	}
 
 	/*
 	 * Loop until we've processed the proper number of tuples from the plan.
@@ -1745,10 +1760,42 @@ ExecutePlan(EState *estate,
 		 */
 		if (sendTuples)
 		{
-			/* Check in the bloom filter */
-			char *value = get_attr_val_from_slot(slot);
-			if (dest->has_rcvd_filter && dest->rcvd_filter != NULL && !bloom_filter_check(dest->rcvd_filter, value))
-				continue;
+			/*
+			 * If the cursor was declared with a semijoin filter, skip rows
+			 * whose key it rejects.  A row whose key is all NULL can't join.
+			 */
+			if (estate->es_rcvd_filter != NULL)
+			{
+				CustomBloomFilter *filter = estate->es_rcvd_filter;
+				MemoryContext oldcontext;
+				char	   *value;
+				bool		key_null;
+
+				oldcontext = MemoryContextSwitchTo(GetPerTupleMemoryContext(estate));
+				value = get_attr_val_from_slot(slot,
+											   estate->es_rcvd_filter_nkeys,
+											   estate->es_rcvd_filter_keys,
+											   &key_null);
+				MemoryContextSwitchTo(oldcontext);
+
+				/*
+				 * Rows of other key-hash partitions are left to the cursors
+				 * of those partitions, uncounted; rows without a key are
+				 * counted by partition 0's.
+				 */
+				if (filter->npartitions > 1 &&
+					(key_null ? filter->partition != 0 :
+					 bloom_filter_partition_of(value, filter->npartitions) != filter->partition))
+					continue;
+
+				estate->es_rcvd_filter_scanned++;
+				if (key_null || !bloom_filter_check(filter, value))
+				{
+					estate->es_rcvd_filter_rejected++;
+					continue;
+				}
+			}
+
 			/*
 			 * If we are not able to send the tuple, we assume the destination
 			 * has closed and no more tuples can be sent. If that's the case,
@@ -1776,6 +1823,11 @@ ExecutePlan(EState *estate,
 			break;
 	}
 
+	/* Each FETCH from a filtered cursor ends a batch of filter probes */
+	if (estate->es_rcvd_filter != NULL)
+		TRACE_POSTGRESQL_SEMIJOIN_PROBE_BATCH(estate->es_rcvd_filter_scanned,
+											  estate->es_rcvd_filter_rejected);
+
 	/*
 	 * If we know we won't need to back up, we can release resources at this
 	 * point.
@@ -22,15 +22,36 @@
  */
 #include "postgres.h"
 
+#include "catalog/pg_type.h"
+#include "common/hashfn.h"
 #include "executor/executor.h"
 #include "executor/nodeForeignscan.h"
+#include "executor/instrument.h"
 #include "foreign/fdwapi.h"
+#include "lib/hyperloglog.h"
+#include "miscadmin.h"
 #include "utils/memutils.h"
 #include "utils/rel.h"
+#include "utils/builtins.h"
 #include "utils/lsyscache.h"
+#include "utils/tuplestore.h"
+#include "utils/wait_event.h"
+
+/*
+ * A semijoin filter built during this query, remembered in
+ * estate->es_semijoin_filters together with the outer plan it came from.
+ */
+typedef struct SemijoinFilterEntry
+{
+	Plan	   *source;			/* outer plan the filter was built from */
+	List	   *filters;		/* hex-encoded filters, one per partition */
+	SemijoinFilterInstrumentation *instr;	/* how building them went */
+} SemijoinFilterEntry;
 
 static TupleTableSlot *ForeignNext(ForeignScanState *node);
 static bool ForeignRecheck(ForeignScanState *node, TupleTableSlot *slot);
+static void ExecForeignScanInitFilter(ForeignScanState *node);
+static void ExecForeignScanResetFilter(ForeignScanState *node);
 
 /* ----------------------------------------------------------------
  *		ForeignNext
@@ -106,7 +127,12 @@ ForeignRecheck(ForeignScanState *node, TupleTableSlot *slot)
 	return ExecQual(node->fdw_recheck_quals, econtext);
 }
 
-static void appendSlotValuetoString(StringInfoData *result, CustomBloomFilter *filter , TupleTableSlot *slot)
+/*
+ * Build the filter key for the join key held in slot.  Multi-column keys are
+ * joined with '|', matching what the remote side builds for its own rows.
+ */
+static char *
+SlotGetFilterKey(TupleTableSlot *slot)
 {
 	TupleDesc typeinfo = slot->tts_tupleDescriptor;
 	int natts = typeinfo->natts;
@@ -116,7 +142,6 @@ static void appendSlotValuetoString(StringInfoData *result, CustomBloomFilter *f
 	bool isnull;
 	Oid typoutput;
 	bool typisvarlena;
-	Oid attr_oid;
 
 	StringInfoData composite_key;
 	initStringInfo(&composite_key);
@@ -131,80 +156,406 @@ static void appendSlotValuetoString(StringInfoData *result, CustomBloomFilter *f
 
 		// Extract the attribute value (Datum)
 		value = OidOutputFunctionCall(typoutput, attr);
-		attr_oid = typeinfo->attrs[i].atttypid;
 
-		// Use type-specific functions to convert to string
-		switch (attr_oid)
-		{
-		case VARCHAROID:
-		case TEXTOID:
-		{
-			appendStringInfoString(result, "'");
-			appendStringInfoString(result, value);
-			appendStringInfoString(result, "'");
+		// Build composite key
+		if (i > 0)
+			appendStringInfoString(&composite_key, "|");
+		appendStringInfoString(&composite_key, value);
+		pfree(value);
+	}
+
+	return composite_key.data;
+}
+
+/*
+ * ExecForeignScanBuildFilter
+ *
+ *		Run the outer plan to completion and build the semijoin filters that
+ *		the FDW ships along with its remote query.
+ *
+ * The keys are spooled as text into a tuplestore, which spills to disk
+ * beyond work_mem, so that the filter can be sized from the actual number of
+ * keys.  The filter bit arrays and their hex encoding (twice their size) must
+ * also fit in work_mem together.  If the filter at the target false-positive
+ * rate would not, we settle for a coarser rate, and if even
+ * BLOOM_FILTER_MAX_FPR does not fit, or an allocation fails, we ship no
+ * filter at all; the remote scan is then just unfiltered, never wrong.
+ *
+ * A filter larger than BLOOM_FILTER_PARTITION_BYTES is split by key hash
+ * into a power-of-two number of partitions, each with its own smaller filter.
+ * The FDW runs one remote cursor per partition, and the remote side returns
+ * from each cursor only rows whose key hashes into that partition.  Keys are
+ * counted per BLOOM_FILTER_MAX_PARTITIONS buckets while spooling, which
+ * gives exact per-partition counts for any partition count dividing it.
+ * Partitions without any key need no cursor and get no filter.
+ *
+ * What the build took and produced goes into node->semijoin_instr, for
+ * EXPLAIN ANALYZE.  Under EXPLAIN ANALYZE, or if the FDW set
+ * node->semijoin_keep_keys, the exact set of keys is kept as well, so that
+ * false positives among the rows the filters let through can be told apart;
+ * unless it would take more than work_mem.
+ */
+static void
+ExecForeignScanBuildFilter(ForeignScanState *node)
+{
+	PlanState  *outerNode = outerPlanState(node);
+	Tuplestorestate *keystore;
+	TupleDesc	keydesc;
+	TupleTableSlot *slot;
+	CustomBloomFilter *filters[BLOOM_FILTER_MAX_PARTITIONS];
+	size_t		bucket_keys[BLOOM_FILTER_MAX_PARTITIONS];
+	size_t		num_keys = 0;
+	double		distinct_ratio = 1.0;
+	hyperLogLogState distinct_keys;
+	size_t		filter_bytes;
+	size_t		budget;
+	double		fpr = BLOOM_FILTER_DEFAULT_FPR;
+	int			nparts;
+	int			part;
+	SemijoinFilterInstrumentation *instr;
+	instr_time	starttime;
+	instr_time	endtime;
+
+	instr = (SemijoinFilterInstrumentation *)
+		palloc0(sizeof(SemijoinFilterInstrumentation));
+	if (node->semijoin_instr)
+	{
+		instr->nbuilds = node->semijoin_instr->nbuilds;
+		instr->total_bytes = node->semijoin_instr->total_bytes;
+		instr->total_time = node->semijoin_instr->total_time;
+		pfree(node->semijoin_instr);
+	}
+	instr->nbuilds++;
+	node->semijoin_instr = instr;
+	INSTR_TIME_SET_CURRENT(starttime);
+	TRACE_POSTGRESQL_SEMIJOIN_BUILD_START(node->ss.ps.plan->plan_node_id);
+
+	/*
+	 * First pass: spool all keys and count them.  The planner may not have
+	 * removed duplicates from the outer plan's output, so also estimate the
+	 * number of distinct keys, which is what the filter must be sized for.
+	 */
+	keydesc = CreateTemplateTupleDesc(1);
+	TupleDescInitEntry(keydesc, (AttrNumber) 1, "key", TEXTOID, -1, 0);
+	keystore = tuplestore_begin_heap(false, false, work_mem);
+	memset(bucket_keys, 0, sizeof(bucket_keys));
+	initHyperLogLog(&distinct_keys, 12);
+	for (;;)
+	{
+		char	   *key;
+		Datum		value;
+		bool		isnull = false;
+
+		slot = ExecProcNode(outerNode);
+		if (TupIsNull(slot))
 			break;
-		}
-		case NUMERICOID:
+		key = SlotGetFilterKey(slot);
+		bucket_keys[bloom_filter_partition_of(key, BLOOM_FILTER_MAX_PARTITIONS)]++;
+		addHyperLogLog(&distinct_keys,
+					   hash_bytes((const unsigned char *) key, strlen(key)));
+		value = CStringGetTextDatum(key);
+		tuplestore_putvalues(keystore, keydesc, &value, &isnull);
+		pfree(DatumGetPointer(value));
+		pfree(key);
+		num_keys++;
+	}
+
+	instr->outer_rows = num_keys;
+
+	/*
+	 * Size the filter for the distinct keys, within the memory budget.  With
+	 * 2^12 registers the estimate is within about 1.6%; round it up a bit,
+	 * as too small a filter costs more than too large a one.
+	 */
+	if (num_keys > 0)
+	{
+		double		ndistinct = ceil(estimateHyperLogLog(&distinct_keys) * 1.05);
+
+		if (ndistinct < num_keys)
 		{
-			appendStringInfoString(result, value);
-			break;
+			distinct_ratio = ndistinct / num_keys;
+			num_keys = (size_t) ndistinct;
 		}
-		case INT4OID:
+	}
+	freeHyperLogLog(&distinct_keys);
+	if (num_keys == 0)
+		num_keys = 10;
+	budget = Min((Size) work_mem * 1024L, MaxAllocSize) / 3;
+	filter_bytes = bloom_filter_size_bytes(num_keys, fpr);
+	if (filter_bytes > budget)
+	{
+		fpr = bloom_filter_fpr_for_bytes(num_keys, budget);
+		filter_bytes = budget;
+		elog(DEBUG1, "semijoin filter for %zu keys exceeds work_mem, coarsening false-positive rate to %g",
+			 num_keys, fpr);
+	}
+	if (fpr > BLOOM_FILTER_MAX_FPR)
+	{
+		elog(DEBUG1, "semijoin filter for %zu keys does not fit in work_mem, scanning without it",
+			 num_keys);
+		tuplestore_end(keystore);
+		return;
+	}
+	instr->fpr = fpr;
+
+	nparts = 1;
+	while (nparts < BLOOM_FILTER_MAX_PARTITIONS &&
+		   filter_bytes / nparts > BLOOM_FILTER_PARTITION_BYTES)
+		nparts *= 2;
+
+	for (part = 0; part < nparts; part++)
+	{
+		size_t		part_keys = 0;
+		int			bucket;
+
+		for (bucket = part; bucket < BLOOM_FILTER_MAX_PARTITIONS; bucket += nparts)
+			part_keys += bucket_keys[bucket];
+		part_keys = (size_t) ceil(part_keys * distinct_ratio);
+
+		filters[part] = NULL;
+		if (nparts > 1 && part_keys == 0)
+			continue;
+		filters[part] = bloom_filter_create(Max(part_keys, 10), fpr);
+		if (filters[part] == NULL)
 		{
-			int32 num = DatumGetInt32(attr);
-			appendStringInfo(result, "%d", num);
-			break;
+			elog(DEBUG1, "could not allocate semijoin filter for %zu keys, scanning without it",
+				 num_keys);
+			while (--part >= 0)
+				bloom_filter_free(filters[part]);
+			tuplestore_end(keystore);
+			return;
 		}
-		case FLOAT4OID:
+		filters[part]->partition = part;
+		filters[part]->npartitions = nparts;
+	}
+
+	if ((node->ss.ps.instrument != NULL || node->semijoin_keep_keys) &&
+		num_keys * (sizeof(uint64) + 32) <= (Size) work_mem * 1024L)
+	{
+		HASHCTL		ctl;
+
+		ctl.keysize = sizeof(uint64);
+		ctl.entrysize = sizeof(uint64);
+		ctl.hcxt = CurrentMemoryContext;
+		instr->keyset = hash_create("semijoin filter keys", num_keys, &ctl,
+									HASH_ELEM | HASH_BLOBS | HASH_CONTEXT);
+	}
+
+	// Second pass: add all spooled keys to the bloom filters
+	pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_BUILD);
+	slot = MakeSingleTupleTableSlot(keydesc, &TTSOpsMinimalTuple);
+	while (tuplestore_gettupleslot(keystore, true, false, slot))
+	{
+		bool		isnull;
+		char	   *key;
+
+		key = TextDatumGetCString(slot_getattr(slot, 1, &isnull));
+		bloom_filter_add(filters[bloom_filter_partition_of(key, nparts)], key);
+		if (instr->keyset)
 		{
-			float4 num = DatumGetFloat4(attr);
-			appendStringInfo(result, "%f", num);
-			break;
+			uint64		keyhash;
+
+			keyhash = DatumGetUInt64(hash_any_extended((unsigned char *) key,
+													   strlen(key), 0));
+			(void) hash_search(instr->keyset, &keyhash, HASH_ENTER, NULL);
 		}
+		pfree(key);
+	}
+	ExecDropSingleTupleTableSlot(slot);
+	tuplestore_end(keystore);
+	pgstat_report_wait_end();
+
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_SUBTRACT(endtime, starttime);
+	instr->build_time = INSTR_TIME_GET_MILLISEC(endtime);
+	INSTR_TIME_SET_CURRENT(starttime);
+	TRACE_POSTGRESQL_SEMIJOIN_ENCODE_START(node->ss.ps.plan->plan_node_id);
+	pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_ENCODE);
+
+	for (part = 0; part < nparts; part++)
+	{
+		char	   *hex;
+
+		if (filters[part] == NULL)
+			continue;
+		instr->nbits += filters[part]->size;
+		instr->hash_count = filters[part]->hash_count;
+		instr->distinct_keys += bloom_filter_estimate_count(filters[part]);
+		hex = bloom_filter_encode_hex_with_metadata(filters[part]);
+		bloom_filter_free(filters[part]);
+		if (hex == NULL)
+		{
+			/* Out of memory: give up on filtering altogether */
+			while (++part < nparts)
+				bloom_filter_free(filters[part]);
+			list_free_deep(node->semijoin_filters);
+			node->semijoin_filters = NIL;
+			instr->nbits = 0;
+			instr->serialized_bytes = 0;
+			pgstat_report_wait_end();
+			return;
 		}
-		
-		// Build composite key
-		if (i > 0)
-			appendStringInfoString(&composite_key, "|");
-		appendStringInfoString(&composite_key, value);
+		instr->serialized_bytes += strlen(hex);
+		node->semijoin_filters = lappend(node->semijoin_filters, hex);
 	}
-	
-	// Add composite key to bloom filter
-	elog(NOTICE, "Bloom Filter: Adding value: %s", composite_key.data);
-	bloom_filter_add(filter, composite_key.data);
-	pfree(composite_key.data);
+	instr->npartitions = nparts;
+	pgstat_report_wait_end();
+
+	INSTR_TIME_SET_CURRENT(endtime);
+	INSTR_TIME_SUBTRACT(endtime, starttime);
+	instr->encode_time = INSTR_TIME_GET_MILLISEC(endtime);
+	instr->total_bytes += instr->serialized_bytes;
+	instr->total_time += instr->build_time + instr->encode_time;
+	TRACE_POSTGRESQL_SEMIJOIN_ENCODE_DONE(node->ss.ps.plan->plan_node_id,
+										  instr->serialized_bytes);
+	TRACE_POSTGRESQL_SEMIJOIN_BUILD_DONE(node->ss.ps.plan->plan_node_id,
+										 instr->outer_rows, instr->nbits,
+										 nparts);
 }
 
-static NameData get_scan_attribute(ForeignScanState *node)
+/*
+ * Do two outer plans certainly produce the same set of join keys?
+ *
+ * Only the node types that postgres_fdw puts beneath a semijoin scan are
+ * recognized; anything else, and anything depending on executor parameters,
+ * is conservatively treated as different.
+ */
+static bool
+SemijoinSourceEqual(Plan *a, Plan *b)
 {
-	ForeignScan *foreignScan = (ForeignScan *)node->ss.ps.plan;
-	ListCell *lc;
-	NameData attname;
-
-	memset(&attname, 0, sizeof(NameData));
+	if (a == NULL || b == NULL)
+		return a == b;
+	if (nodeTag(a) != nodeTag(b))
+		return false;
+	if (!bms_is_empty(a->extParam) || !bms_is_empty(b->extParam))
+		return false;
+	if (!equal(a->targetlist, b->targetlist) || !equal(a->qual, b->qual))
+		return false;
 
-	/* Iterate over the target list */
-	foreach (lc, foreignScan->scan.plan.targetlist)
+	switch (nodeTag(a))
 	{
-		TargetEntry *tle = (TargetEntry *)lfirst(lc);
+		case T_SeqScan:
+			return ((Scan *) a)->scanrelid == ((Scan *) b)->scanrelid;
+		case T_IndexScan:
+			return ((Scan *) a)->scanrelid == ((Scan *) b)->scanrelid &&
+				equal(((IndexScan *) a)->indexqualorig,
+					  ((IndexScan *) b)->indexqualorig);
+		case T_IndexOnlyScan:
+			return ((Scan *) a)->scanrelid == ((Scan *) b)->scanrelid &&
+				equal(((IndexOnlyScan *) a)->indexqual,
+					  ((IndexOnlyScan *) b)->indexqual);
+		case T_BitmapHeapScan:
+			return ((Scan *) a)->scanrelid == ((Scan *) b)->scanrelid &&
+				equal(((BitmapHeapScan *) a)->bitmapqualorig,
+					  ((BitmapHeapScan *) b)->bitmapqualorig);
+		case T_Result:
+			if (!equal(((Result *) a)->resconstantqual,
+					   ((Result *) b)->resconstantqual))
+				return false;
+			/* FALLTHROUGH */
+		case T_Sort:
+		case T_IncrementalSort:
+		case T_Unique:
+		case T_Agg:
+		case T_Material:
+		case T_Gather:
+			return SemijoinSourceEqual(a->lefttree, b->lefttree) &&
+				SemijoinSourceEqual(a->righttree, b->righttree);
+		default:
+			return false;
+	}
+}
 
-		/* Check if the TargetEntry is valid and contains a Var node */
-		if (IsA(tle->expr, Var))
-		{
-			Var *var = (Var *)tle->expr;
+/*
+ * ExecForeignScanInitFilter
+ *
+ *		Set up node->semijoin_filters, reusing a filter another ForeignScan
+ *		of this query already built from an equivalent outer plan.
+ *
+ * A partitioned table whose partitions are foreign tables on several shards
+ * yields one ForeignScan per partition, each with its own copy of the same
+ * outer plan.  Sharing means the local side is scanned and encoded once, and
+ * with async Append every shard receives the filter as soon as the first
+ * request is made rather than after the preceding shards are done.
+ */
+static void
+ExecForeignScanInitFilter(ForeignScanState *node)
+{
+	EState	   *estate = node->ss.ps.state;
+	Plan	   *source = outerPlan(node->ss.ps.plan);
+	SemijoinFilterEntry *entry;
+	MemoryContext oldcontext;
+	ListCell   *lc;
+
+	node->child_materialised = true;
 
-			/* Access the attribute number and type */
-			int attno = var->varattno;	/* Attribute number */
-			attname = node->ss.ss_currentRelation->rd_att->attrs[attno-1].attname;
-			return attname;
+	foreach(lc, estate->es_semijoin_filters)
+	{
+		entry = (SemijoinFilterEntry *) lfirst(lc);
+		if (SemijoinSourceEqual(entry->source, source))
+		{
+			node->semijoin_filters = entry->filters;
+			node->semijoin_instr = (SemijoinFilterInstrumentation *)
+				MemoryContextAlloc(estate->es_query_cxt,
+								   sizeof(SemijoinFilterInstrumentation));
+			*node->semijoin_instr = *entry->instr;
+			node->semijoin_instr->shared = true;
+			return;
 		}
-		else
+	}
+
+	oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+
+	ExecForeignScanBuildFilter(node);
+
+	/*
+	 * A filter depending on parameters is rebuilt when they change (see
+	 * ExecForeignScanResetFilter), so it is ours alone.
+	 */
+	if (!bms_is_empty(source->allParam))
+	{
+		MemoryContextSwitchTo(oldcontext);
+		return;
+	}
+
+	entry = (SemijoinFilterEntry *) palloc(sizeof(SemijoinFilterEntry));
+	entry->source = source;
+	entry->filters = node->semijoin_filters;
+	entry->instr = node->semijoin_instr;
+	estate->es_semijoin_filters = lappend(estate->es_semijoin_filters, entry);
+
+	MemoryContextSwitchTo(oldcontext);
+}
+
+/*
+ * ExecForeignScanResetFilter
+ *
+ *		Drop the filter, to be built again from the outer plan on the next
+ *		fetch.
+ *
+ * The previous filter and its key set are freed, unless they belong to the
+ * scan that shared them with us.  The instrumentation stays until the next
+ * build, which counts itself on top of the earlier ones.
+ */
+static void
+ExecForeignScanResetFilter(ForeignScanState *node)
+{
+	SemijoinFilterInstrumentation *instr = node->semijoin_instr;
+
+	if (!node->child_materialised)
+		return;
+
+	if (instr != NULL && !instr->shared)
+	{
+		list_free_deep(node->semijoin_filters);
+		if (instr->keyset)
 		{
-			/* Handle other types of expressions in the target list if needed */
-			elog(WARNING, "Unexpected node type in fdw_scan_tlist.");
+			hash_destroy(instr->keyset);
+			instr->keyset = NULL;
 		}
 	}
-	return attname;
+	node->semijoin_filters = NIL;
+	node->child_materialised = false;
 }
 
 /* ----------------------------------------------------------------
@@ -222,97 +573,15 @@ ExecForeignScan(PlanState *pstate)
 	ForeignScanState *node = castNode(ForeignScanState, pstate);
 	ForeignScan *plan = (ForeignScan *)node->ss.ps.plan;
 	EState *estate = node->ss.ps.state;
-	StringInfoData query;
-	StringInfoData result;
-	if (pstate->lefttree && !node->child_materialised) // If there is a child subtree, run only once for this query
-	{
-		// Safety check
-		if (!pstate->lefttree->plan) {
-			elog(WARNING, "Left tree plan is NULL, skipping bloom filter");
-			goto skip_bloom_filter;
-		}
-		
-		double estimated_rows = pstate->lefttree->plan->plan_rows;
-		
-		TupleTableSlot *slot;
-		bool local_scan_done = false;
-		char **query_ptr;
-		
-		// First pass: materialize all tuples and count them
-		elog(NOTICE, "Dynamic Bloom Filter: Starting materialization...");
-		int actual_tuple_count = 0;
-		TupleTableSlot **materialized_slots = NULL;
-		int slots_capacity = 100; // Initial capacity
-		
-		materialized_slots = (TupleTableSlot **)palloc(sizeof(TupleTableSlot *) * slots_capacity);
-		
-		while (!local_scan_done)
-		{
-			slot = ExecProcNode(outerPlanState(pstate));
-			if (TupIsNull(slot))
-			{
-				local_scan_done = true;
-			}
-			else
-			{
-				// Expand array if needed
-				if (actual_tuple_count >= slots_capacity) {
-					slots_capacity *= 2;
-					materialized_slots = (TupleTableSlot **)repalloc(materialized_slots, 
-																	  sizeof(TupleTableSlot *) * slots_capacity);
-				}
-				
-				// Store a copy of the slot
-				materialized_slots[actual_tuple_count] = MakeSingleTupleTableSlot(slot->tts_tupleDescriptor, 
-																				   &TTSOpsHeapTuple);
-				ExecCopySlot(materialized_slots[actual_tuple_count], slot);
-				actual_tuple_count++;
-			}
-		}
-		
-		// Now create bloom filter with the ACTUAL count
-		size_t num_rows = actual_tuple_count > 0 ? actual_tuple_count : 10;
-		CustomBloomFilter *filter = bloom_filter_create(num_rows, 0.01);
-		
-		elog(NOTICE, "Bloom Filter: actual: %d rows", 
-			 actual_tuple_count);
-		elog(NOTICE, "Bloom Filter: %lu bits, %d hash functions", 
-			 filter->size, filter->hash_count);
-		
-		// Second pass: add all materialized tuples to the bloom filter
-		initStringInfo(&result);
-		bool not_first_slot = false;
-		
-		for (int i = 0; i < actual_tuple_count; i++)
-		{
-			if (not_first_slot)
-			{
-				appendStringInfoString(&result, ",");
-			}
-			appendSlotValuetoString(&result, filter, materialized_slots[i]);
-			not_first_slot = true;
-			
-			// Clean up the slot
-			ExecDropSingleTupleTableSlot(materialized_slots[i]);
-		}
-		
-		// Free the array
-		if (materialized_slots)
-			pfree(materialized_slots);
-		
-		// elog(LOG, "Added %d tuples to bloom filter", actual_tuple_count);
-		
-		(void) get_scan_attribute(node);
-		query_ptr = (char **)((char *)node->fdw_state + 24);
-		initStringInfo(&query);
-		appendStringInfoString(&query, *query_ptr);
-		appendStringInfoString(&query, "#");
-		appendStringInfoString(&query, bloom_filter_encode_hex_with_metadata(filter));
-		*query_ptr = query.data;
-		node->child_materialised = true; // set it such that for this block is not run anymore for this query
-	}
 
-skip_bloom_filter:
+	/*
+	 * Build the filter on the first fetch, and after a parameter change;
+	 * unless the FDW ships the keys some other way.
+	 */
+	if (pstate->lefttree && !node->child_materialised &&
+		!node->semijoin_fdw_keys)
+		ExecForeignScanInitFilter(node);
+
 	/*
 	 * Ignore direct modifications when EvalPlanQual is active --- they are
 	 * irrelevant for EvalPlanQual rechecking
@@ -349,6 +618,10 @@ ExecInitForeignScan(ForeignScan *node, EState *estate, int eflags)
 	scanstate->ss.ps.plan = (Plan *) node;
 	scanstate->ss.ps.state = estate;
 	scanstate->child_materialised = false;
+	scanstate->semijoin_filters = NIL;
+	scanstate->semijoin_instr = NULL;
+	scanstate->semijoin_keep_keys = false;
+	scanstate->semijoin_fdw_keys = false;
 	scanstate->ss.ps.ExecProcNode = ExecForeignScan;
 
 	/*
@@ -537,12 +810,23 @@ ExecReScanForeignScan(ForeignScanState *node)
 	node->fdwroutine->ReScanForeignScan(node);
 
 	/*
-	 * If chgParam of subnode is not null then plan will be re-scanned by
-	 * first ExecProcNode.  outerPlan may also be NULL, in which case there is
-	 * nothing to rescan at all.
+	 * The outer plan is only read to build the semijoin filter, or by the
+	 * FDW for its keys, which then sets child_materialised itself.  If any of
+	 * its parameters changed, its output and so the filter may have too:
+	 * build the filter again, and let the first ExecProcNode rescan the
+	 * outer plan as usual for a non-null chgParam.  The FDW recreates its
+	 * remote cursor in that case anyway, as our own chgParam is then set
+	 * too.  Otherwise the filter still holds, and once built there is no
+	 * point in rescanning the outer plan.  outerPlan may also be NULL, in
+	 * which case there is nothing to rescan at all.
 	 */
-	if (outerPlan != NULL && outerPlan->chgParam == NULL)
-		ExecReScan(outerPlan);
+	if (outerPlan != NULL)
+	{
+		if (outerPlan->chgParam != NULL)
+			ExecForeignScanResetFilter(node);
+		else if (!node->child_materialised)
+			ExecReScan(outerPlan);
+	}
 
 	ExecScanReScan(&node->ss);
 }
@@ -659,6 +943,15 @@ ExecAsyncForeignScanRequest(AsyncRequest *areq)
 	ForeignScanState *node = (ForeignScanState *) areq->requestee;
 	FdwRoutine *fdwroutine = node->fdwroutine;
 
+	/*
+	 * The FDW opens its cursor from inside the request, without going
+	 * through ExecForeignScan, so the filter must be ready before that;
+	 * unless the FDW ships the keys some other way.
+	 */
+	if (outerPlanState(node) && !node->child_materialised &&
+		!node->semijoin_fdw_keys)
+		ExecForeignScanInitFilter(node);
+
 	Assert(fdwroutine->ForeignAsyncRequest != NULL);
 	fdwroutine->ForeignAsyncRequest(areq);
 }
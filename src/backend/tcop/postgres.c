@@ -84,8 +84,11 @@
  * ----------------
  */
 
-char *rcvd_bloom_hex;
-bool has_rcvd_bloom;
+/*
+ * Semijoin filter that arrived appended to the last Parse message, kept in
+ * TopMemoryContext until the DECLARE CURSOR it came with has been executed.
+ */
+static char *pending_filter_hex = NULL;
 
 const char *debug_query_string; /* client-supplied query string */
 
@@ -198,6 +201,8 @@ static bool IsTransactionExitStmt(Node *parsetree);
 static bool IsTransactionExitStmtList(List *pstmts);
 static bool IsTransactionStmtList(List *pstmts);
 static void drop_unnamed_stmt(void);
+static void split_semijoin_filter(char *query_string);
+static void attach_pending_filter(Portal portal);
 static void log_disconnections(int code, Datum arg);
 static void enable_statement_timeout(void);
 static void disable_statement_timeout(void);
@@ -1242,12 +1247,6 @@ exec_simple_query(const char *query_string)
 		 */
 		PortalStart(portal, NULL, 0, InvalidSnapshot);
 
-        if (has_rcvd_bloom)
-		{
-			portal->has_rcvd_filter = true;
-			portal->rcvd_filter_hex = rcvd_bloom_hex;
-		}
-
 		/*
 		 * Select the appropriate output format: text unless we are doing a
 		 * FETCH from a binary cursor.  (Pretty grotty to have to do this here
@@ -2106,6 +2105,146 @@ exec_bind_message(StringInfo input_message)
 	debug_query_string = NULL;
 }
 
+/*
+ * split_semijoin_filter
+ *
+ * postgres_fdw sends a semijoin filter appended to a DECLARE CURSOR command,
+ * after a '#' (see create_cursor in postgres_fdw.c).  Cut the filter off the
+ * query string, in place, and keep it in pending_filter_hex until the cursor
+ * has been declared.  Only a well-formed encoded filter after the last '#' of
+ * a DECLARE counts, so that '#' operators and literals in other statements,
+ * named statements and parameter types all go through untouched.
+ */
+static void
+split_semijoin_filter(char *query_string)
+{
+	const char *hexdigits = "0123456789abcdef";
+	char	   *sep;
+	char	   *filter;
+	size_t		len;
+
+	/* A filter is only good for the statement it came with */
+	if (pending_filter_hex != NULL)
+	{
+		pfree(pending_filter_hex);
+		pending_filter_hex = NULL;
+	}
+
+	if (pg_strncasecmp(query_string, "DECLARE ", 8) != 0 ||
+		(sep = strrchr(query_string, '#')) == NULL)
+		return;
+
+	/*
+	 * Optional key column header, then optional partition header, then size,
+	 * hash count and bit array
+	 */
+	filter = sep + 1;
+	if (filter[0] == 'K')
+	{
+		int			nkeys;
+
+		if (strspn(filter + 1, hexdigits) < 2 ||
+			sscanf(filter + 1, "%2x", &nkeys) != 1 || nkeys == 0 ||
+			strspn(filter + 3, hexdigits) < 2 * nkeys)
+			return;
+		filter += 3 + 2 * nkeys;
+	}
+	if (filter[0] == 'P')
+	{
+		if (strspn(filter + 1, hexdigits) < 4)
+			return;
+		filter += 5;
+	}
+	len = strlen(filter);
+	if (len < 10 || len % 2 != 0 || strspn(filter, hexdigits) != len)
+		return;
+
+	pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_RECEIVE);
+	pending_filter_hex = MemoryContextStrdup(TopMemoryContext, sep + 1);
+	*sep = '\0';
+	pgstat_report_wait_end();
+	TRACE_POSTGRESQL_SEMIJOIN_RECEIVE(strlen(pending_filter_hex));
+}
+
+/*
+ * attach_pending_filter
+ *
+ * If portal has just run a DECLARE CURSOR that arrived with a semijoin
+ * filter, decode the filter into the new cursor's executor state, so that
+ * every FETCH from that cursor returns only rows passing it.  Binding the
+ * filter to its cursor, rather than to the session, keeps several filtered
+ * cursors apart, and leaves later unfiltered queries alone.  The filter goes
+ * away with the cursor.
+ */
+static void
+attach_pending_filter(Portal portal)
+{
+	if (list_length(portal->stmts) == 1)
+	{
+		PlannedStmt *pstmt = linitial_node(PlannedStmt, portal->stmts);
+
+		if (pstmt->utilityStmt && IsA(pstmt->utilityStmt, DeclareCursorStmt))
+		{
+			DeclareCursorStmt *stmt = (DeclareCursorStmt *) pstmt->utilityStmt;
+			Portal		cursor = GetPortalByName(stmt->portalname);
+
+			if (PortalIsValid(cursor) && cursor->queryDesc != NULL &&
+				cursor->queryDesc->estate != NULL)
+			{
+				EState	   *estate = cursor->queryDesc->estate;
+				const char *filter = pending_filter_hex;
+				MemoryContext oldcontext;
+
+				oldcontext = MemoryContextSwitchTo(estate->es_query_cxt);
+
+				/*
+				 * The key is made of the listed columns of the cursor's rows,
+				 * or of all of them if there is no list.  A position beyond
+				 * the row leaves the rows unfiltered.
+				 */
+				if (filter[0] == 'K')
+				{
+					int			nkeys;
+					int			i;
+
+					sscanf(filter + 1, "%2x", &nkeys);
+					estate->es_rcvd_filter_keys = palloc(nkeys * sizeof(AttrNumber));
+					for (i = 0; i < nkeys; i++)
+					{
+						int			attnum;
+
+						sscanf(filter + 3 + 2 * i, "%2x", &attnum);
+						estate->es_rcvd_filter_keys[i] = (AttrNumber) attnum;
+					}
+					estate->es_rcvd_filter_nkeys = nkeys;
+					filter += 3 + 2 * nkeys;
+					for (i = 0; i < nkeys; i++)
+					{
+						if (estate->es_rcvd_filter_keys[i] < 1 ||
+							estate->es_rcvd_filter_keys[i] > cursor->tupDesc->natts)
+							filter = NULL;
+					}
+				}
+
+				if (filter != NULL)
+				{
+					TRACE_POSTGRESQL_SEMIJOIN_DECODE_START(strlen(filter));
+					pgstat_report_wait_start(WAIT_EVENT_SEMIJOIN_FILTER_DECODE);
+					estate->es_rcvd_filter =
+						bloom_filter_decode_hex_with_metadata(filter);
+					pgstat_report_wait_end();
+				}
+				TRACE_POSTGRESQL_SEMIJOIN_DECODE_DONE(estate->es_rcvd_filter ?
+													  estate->es_rcvd_filter->size : 0);
+				MemoryContextSwitchTo(oldcontext);
+			}
+		}
+	}
+
+	pfree(pending_filter_hex);
+	pending_filter_hex = NULL;
+}
+
 /*
  * exec_execute_message
  *
@@ -2276,6 +2415,10 @@ exec_execute_message(const char *portal_name, long max_rows)
 
 	receiver->rDestroy(receiver);
 
+	/* Hand a filter that came with DECLARE CURSOR over to the new cursor */
+	if (pending_filter_hex != NULL)
+		attach_pending_filter(portal);
+
 	/* Done executing; remove the params error callback */
 	error_context_stack = error_context_stack->previous;
 
@@ -4755,42 +4898,13 @@ PostgresMain(const char *dbname, const char *username)
 					Oid		   *paramTypes = NULL;
 
 					forbidden_in_wal_sender(firstchar);
-                    char *result = (char *)malloc(input_message.len);
-
-			        // Copy the data from input_message
-			        for (int i = 0; i < input_message.len; i++)
-			        {
-			        	result[i] = input_message.data[i + 1];
-			        }
-
-			        /* Set statement_timestamp() */
-			        SetCurrentStatementStartTimestamp();
-			        /* Delimiter for a potentially received bloom filter */
-			        const char delimiter[] = "#";
-			        char *qString;
-
-			        // Split the string using strtok
-			        qString = strtok(result, delimiter);	  // Query that is to be parsed as normal
-			        rcvd_bloom_hex = strtok(NULL, delimiter); // Bloom filter if any should be here
-			        if (rcvd_bloom_hex != NULL)
-			        	has_rcvd_bloom = true; // Set flag to notify post processing of filter
-
-			        // Reset the input message
-			        for (int i = 0; i < input_message.len; i++)
-			        {
-			        	input_message.data[i] = '\0';
-			        }
-			        input_message.cursor = 0;
-			        input_message.len = strlen(qString) + 4;
-			        // Copy the extracted query string into input_message keeping first character as null
-			        for (int i = 0; i < strlen(qString); i++)
-			        {
-			        	input_message.data[i + 1] = qString[i];
-			        }
-
-			        // Normal query parsing resumes from here
+
+					/* Set statement_timestamp() */
+					SetCurrentStatementStartTimestamp();
+
 					stmt_name = pq_getmsgstring(&input_message);
 					query_string = pq_getmsgstring(&input_message);
+					split_semijoin_filter((char *) query_string);
 					numParams = pq_getmsgint(&input_message, 2);
 					if (numParams > 0)
 					{
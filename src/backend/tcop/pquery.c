@@ -1014,12 +1014,7 @@ FillPortalStore(Portal portal, bool isTopLevel)
 									NULL,
 									NULL);
 
-	if(portal->has_rcvd_filter){
-		treceiver->has_rcvd_filter = true;
-		treceiver->rcvd_filter_hex = portal->rcvd_filter_hex;
-	}
-
-    switch (portal->strategy)
+	switch (portal->strategy)
 	{
 		case PORTAL_ONE_RETURNING:
 		case PORTAL_ONE_MOD_WITH:
@@ -4,28 +4,97 @@
 #include <math.h>
 #include <stdint.h>
 #include <ctype.h>
-/* MurmurHash3 implementation for simplicity */
+
+#include "port/pg_bitutils.h"
+/*
+ * MurmurHash3 (x86, 32-bit)
+ *
+ * Every seed gives an independent hash function.  Each 4-byte block and the
+ * tail are mixed in, and the final avalanche spreads all input bits over all
+ * output bits, so that short keys such as small integers still give indexes
+ * spread over the whole filter.
+ */
+static inline uint32_t
+murmurhash_rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
 uint32_t murmurhash(const char *key, size_t len, uint32_t seed)
 {
+    const uint8_t *data = (const uint8_t *) key;
+    const size_t nblocks = len / 4;
+    const uint32_t c1 = 0xcc9e2d51;
+    const uint32_t c2 = 0x1b873593;
     uint32_t h = seed;
-    for (size_t i = 0; i < len; i++)
+    uint32_t k;
+
+    for (size_t i = 0; i < nblocks; i++)
     {
-        h ^= key[i];
-        h *= 0x5bd1e995;
-        h ^= h >> 15;
+        memcpy(&k, data + i * 4, sizeof(k));
+        k *= c1;
+        k = murmurhash_rotl32(k, 15);
+        k *= c2;
+        h ^= k;
+        h = murmurhash_rotl32(h, 13);
+        h = h * 5 + 0xe6546b64;
     }
+
+    k = 0;
+    switch (len & 3)
+    {
+        case 3:
+            k ^= (uint32_t) data[nblocks * 4 + 2] << 16;
+            /* FALLTHROUGH */
+        case 2:
+            k ^= (uint32_t) data[nblocks * 4 + 1] << 8;
+            /* FALLTHROUGH */
+        case 1:
+            k ^= data[nblocks * 4];
+            k *= c1;
+            k = murmurhash_rotl32(k, 15);
+            k *= c2;
+            h ^= k;
+    }
+
+    h ^= (uint32_t) len;
+    h ^= h >> 16;
+    h *= 0x85ebca6b;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35;
+    h ^= h >> 16;
     return h;
 }
 
-/* Initialize the Bloom filter */
+/* Number of bytes needed for a filter holding n items at false-positive rate p */
+size_t bloom_filter_size_bytes(size_t n, double p)
+{
+    double bits = ceil(-(n * log(p)) / (log(2) * log(2)));
+
+    return ((size_t) bits + 7) / 8;
+}
+
+/* Best false-positive rate achievable for n items within nbytes of bit array */
+double bloom_filter_fpr_for_bytes(size_t n, size_t nbytes)
+{
+    double bits = (double) nbytes * 8;
+
+    if (n == 0)
+        return 0.0;
+    return exp(-(bits / n) * (log(2) * log(2)));
+}
+
+/*
+ * Initialize the Bloom filter
+ *
+ * The filter is allocated in CurrentMemoryContext.  Returns NULL rather than
+ * raising an error if the bit array cannot be allocated, so that callers can
+ * fall back to scanning without a filter.
+ */
 CustomBloomFilter *bloom_filter_create(size_t n, double p)
 {
-    CustomBloomFilter *filter = (CustomBloomFilter *)malloc(sizeof(CustomBloomFilter));
-    if (!filter)
-    {
-        perror("Failed to allocate memory for Bloom filter");
-        exit(EXIT_FAILURE);
-    }
+    CustomBloomFilter *filter = (CustomBloomFilter *) palloc(sizeof(CustomBloomFilter));
+    size_t byte_size;
 
     // Calculate the size of the bit array (in bits)
     filter->size = ceil(-(n * log(p)) / (log(2) * log(2)));
@@ -34,17 +103,34 @@ CustomBloomFilter *bloom_filter_create(size_t n, double p)
     filter->hash_count = ceil((filter->size / (double)n) * log(2));
 
     // Allocate the bit array
-    size_t byte_size = (filter->size + 7) / 8; // Convert bits to bytes
-    filter->bit_array = (uint8_t *)calloc(byte_size, sizeof(uint8_t));
+    byte_size = (filter->size + 7) / 8; // Convert bits to bytes
+    filter->bit_array = (uint8_t *) palloc_extended(byte_size,
+                                                    MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM | MCXT_ALLOC_ZERO);
     if (!filter->bit_array)
     {
-        perror("Failed to allocate memory for Bloom filter bit array");
-        free(filter);
-        exit(EXIT_FAILURE);
+        pfree(filter);
+        return NULL;
     }
-    // elog(INFO, "CREATED FILTER SIZE %d HASH %d\n", filter->size, filter->hash_count);
+    filter->partition = 0;
+    filter->npartitions = 1;
     return filter;
 }
+
+/*
+ * Key-hash partition an item belongs to.  The seed differs from those of the
+ * filter's own hash functions, so the bits set within a partition's filter
+ * stay independent of the partitioning.  For npartitions dividing N, the
+ * partition out of npartitions is the partition out of N modulo npartitions.
+ */
+#define BLOOM_PARTITION_SEED 0x9e3779b9
+
+int bloom_filter_partition_of(const char *item, int npartitions)
+{
+    if (npartitions <= 1)
+        return 0;
+    return murmurhash(item, strlen(item), BLOOM_PARTITION_SEED) % npartitions;
+}
+
 /* Add an item to the Bloom filter */
 void bloom_filter_add(CustomBloomFilter *filter, const char *item)
 {
@@ -62,6 +148,12 @@ void bloom_filter_add(CustomBloomFilter *filter, const char *item)
 int bloom_filter_check(CustomBloomFilter *filter, const char *item)
 {
     size_t len = strlen(item);
+
+    // Items of other partitions are left to the filters of those partitions
+    if (filter->npartitions > 1 &&
+        bloom_filter_partition_of(item, filter->npartitions) != filter->partition)
+        return 0;
+
     for (int i = 0; i < filter->hash_count; i++)
     {
         uint32_t hash = murmurhash(item, len, i);
@@ -79,22 +171,48 @@ void bloom_filter_free(CustomBloomFilter *filter)
 {
     if (filter)
     {
-        free(filter->bit_array);
-        free(filter);
+        pfree(filter->bit_array);
+        pfree(filter);
     }
 }
 
-/* Encode Bloom filter to Hexadecimal */
+/*
+ * Estimate the number of distinct items added to the filter from the number
+ * X of bits set, as n = -(m / k) * ln(1 - X / m) for m bits and k hash
+ * functions.  A saturated filter only tells that there are many.
+ */
+double bloom_filter_estimate_count(CustomBloomFilter *filter)
+{
+    size_t byte_size = (filter->size + 7) / 8;
+    double bits_set = (double) pg_popcount((const char *) filter->bit_array, byte_size);
+    double m = (double) filter->size;
+
+    if (bits_set >= m)
+        return m;
+    return -(m / filter->hash_count) * log(1.0 - bits_set / m);
+}
+
+/*
+ * Encode Bloom filter to Hexadecimal
+ *
+ * A partitioned filter starts with 'P', its partition and the number of
+ * partitions (2 hex chars each); then follow the size in bits (8 hex chars),
+ * the hash count (2 hex chars) and the bit array.
+ */
 char *bloom_filter_encode_hex_with_metadata(CustomBloomFilter *filter)
 {
     size_t byte_size = (filter->size + 7) / 8;                       // Bits to bytes
-    size_t metadata_size = 8 + 2;                                    // 8 chars for size, 2 chars for hash_count
-    char *hex = (char *)malloc(metadata_size + (byte_size * 2) + 1); // +1 for null terminator
+    size_t partition_size = filter->npartitions > 1 ? 1 + 2 + 2 : 0; // 'P', partition, npartitions
+    size_t metadata_size = partition_size + 8 + 2;                   // 8 chars for size, 2 chars for hash_count
+    char *hex = (char *) palloc_extended(metadata_size + (byte_size * 2) + 1, // +1 for null terminator
+                                         MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
     if (!hex)
         return NULL;
 
-    // Encode metadata: size (8 hex chars) and hash count (2 hex chars)
-    sprintf(hex, "%08lx%02x", filter->size, filter->hash_count);
+    // Encode metadata: partition, if any, size (8 hex chars) and hash count (2 hex chars)
+    if (partition_size > 0)
+        sprintf(hex, "P%02x%02x", filter->partition, filter->npartitions);
+    sprintf(hex + partition_size, "%08lx%02x", filter->size, filter->hash_count);
 
     // Append bit array as hex
     for (size_t i = 0; i < byte_size; i++)
@@ -115,19 +233,27 @@ CustomBloomFilter *bloom_filter_decode_hex_with_metadata(const char *hex)
         return NULL;
     }
 
-    // Decode metadata: size and hash count
+    // Decode metadata: partition, if any, size and hash count
     size_t size;
     int hash_count;
+    int partition = 0;
+    int npartitions = 1;
+    if (hex[0] == 'P')
+    {
+        sscanf(hex + 1, "%02x%02x", &partition, &npartitions);
+        hex += 1 + 2 + 2;
+    }
     sscanf(hex, "%08lx%02x", &size, &hash_count);
 
     // Calculate bit array size
     size_t byte_size = (size + 7) / 8;
 
     // Allocate memory for bit array
-    uint8_t *bit_array = (uint8_t *)malloc(byte_size);
+    uint8_t *bit_array = (uint8_t *) palloc_extended(byte_size,
+                                                     MCXT_ALLOC_HUGE | MCXT_ALLOC_NO_OOM);
     if (!bit_array)
     {
-        perror("Failed to allocate memory for bit array");
+        elog(WARNING, "could not allocate %zu bytes for received filter", byte_size);
         return NULL;
     }
 
@@ -141,16 +267,12 @@ CustomBloomFilter *bloom_filter_decode_hex_with_metadata(const char *hex)
     }
 
     // Create BloomFilter
-    CustomBloomFilter *filter = (CustomBloomFilter *)malloc(sizeof(CustomBloomFilter));
-    if (!filter)
-    {
-        perror("Failed to allocate memory for CustomBloomFilter");
-        free(bit_array);
-        return NULL;
-    }
+    CustomBloomFilter *filter = (CustomBloomFilter *) palloc(sizeof(CustomBloomFilter));
 
     filter->size = size;
     filter->hash_count = hash_count;
     filter->bit_array = bit_array;
+    filter->partition = partition;
+    filter->npartitions = npartitions;
     return filter;
-}
\ No newline at end of file
+}
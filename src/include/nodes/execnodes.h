@@ -717,6 +717,24 @@ typedef struct EState
 	 */
 	List	   *es_insert_pending_result_relations;
 	List	   *es_insert_pending_modifytables;
+
+	/*
+	 * Semijoin filters built by ForeignScan nodes so far, so that scans
+	 * whose outer plans produce the same keys (e.g. the foreign partitions
+	 * under one Append) share a single filter.  See nodeForeignscan.c.
+	 */
+	List	   *es_semijoin_filters;
+
+	/*
+	 * Semijoin filter received with the DECLARE CURSOR this executor runs
+	 * for; rows whose key it rejects are not returned.  NULL if none.
+	 */
+	CustomBloomFilter *es_rcvd_filter;
+	int			es_rcvd_filter_nkeys;	/* number of key columns, or 0 if the
+										 * key is made of all the columns */
+	AttrNumber *es_rcvd_filter_keys;	/* their positions, in key order */
+	uint64		es_rcvd_filter_scanned; /* rows checked against it */
+	uint64		es_rcvd_filter_rejected;	/* rows it rejected */
 } EState;
 
 
@@ -1950,6 +1968,37 @@ typedef struct WorkTableScanState
 	RecursiveUnionState *rustate;
 } WorkTableScanState;
 
+/* ----------------
+ *	 SemijoinFilterInstrumentation information
+ *
+ *		What went into, and came out of, building the semijoin filters of a
+ *		ForeignScan, for EXPLAIN ANALYZE.  npartitions is 0 if no filter
+ *		could be shipped.
+ * ----------------
+ */
+typedef struct SemijoinFilterInstrumentation
+{
+	bool		shared;			/* built by another scan of the query? */
+	int			nbuilds;		/* times built; more than once if rescans
+								 * changed the outer plan's parameters */
+	double		outer_rows;		/* rows produced by the outer plan */
+	double		distinct_keys;	/* keys estimated from the filters' bits */
+	double		fpr;			/* false-positive rate sized for */
+	int			npartitions;	/* number of key-hash partition filters */
+	uint64		nbits;			/* bits, over all partitions */
+	int			hash_count;		/* hash functions per key */
+	uint64		serialized_bytes;	/* encoded size, over all partitions */
+	double		build_time;		/* ms to run outer plan and fill filters */
+	double		encode_time;	/* ms to encode the filters */
+	uint64		total_bytes;	/* serialized_bytes, over all builds */
+	double		total_time;		/* build and encode time, over all builds */
+	HTAB	   *keyset;			/* hash_any_extended(key, strlen(key), 0) of
+								 * every key, for telling false positives;
+								 * only under EXPLAIN ANALYZE or if the FDW
+								 * asked for it, and within work_mem, else
+								 * NULL */
+} SemijoinFilterInstrumentation;
+
 /* ----------------
  *	 ForeignScanState information
  *
@@ -1965,7 +2014,17 @@ typedef struct ForeignScanState
 	/* use struct pointer to avoid including fdwapi.h here */
 	struct FdwRoutine *fdwroutine;
 	void	   *fdw_state;		/* foreign-data wrapper can keep state here */
-	bool child_materialised;
+	bool child_materialised;	/* semijoin_filters built for the current
+								 * outer plan parameters? */
+	List	   *semijoin_filters;	/* hex-encoded filters built from the outer
+									 * plan, one per key-hash partition, to
+									 * ship with the remote query */
+	SemijoinFilterInstrumentation *semijoin_instr;	/* NULL if no filter
+													 * was built */
+	bool		semijoin_keep_keys; /* FDW wants semijoin_instr->keyset even
+									 * outside EXPLAIN ANALYZE */
+	bool		semijoin_fdw_keys;	/* FDW reads the outer plan's keys
+									 * itself, so build no filter */
 } ForeignScanState;
 
 /* ----------------
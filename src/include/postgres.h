@@ -55,11 +55,82 @@ typedef struct {
     uint8_t *bit_array;  // Array to hold the bits
     size_t size;         // Size of the bit array in bits
     int hash_count;      // Number of hash functions
+    int partition;       // Key-hash partition this filter covers
+    int npartitions;     // Number of partitions; 1 if not partitioned
 } CustomBloomFilter;
-/* MurmurHash3 implementation for simplicity */
+
+/* False-positive rate targeted when sizing a semijoin filter */
+#define BLOOM_FILTER_DEFAULT_FPR	0.01
+/* Coarsest false-positive rate worth shipping; beyond it we skip the filter */
+#define BLOOM_FILTER_MAX_FPR		0.5
+/* Filters larger than this are split into key-hash partitions */
+#define BLOOM_FILTER_PARTITION_BYTES	(8 * 1024 * 1024)
+/* Maximum number of partitions; must be a power of 2 */
+#define BLOOM_FILTER_MAX_PARTITIONS	64
+/* What the remote reports about a cursor's filter when the cursor goes away */
+#define BLOOM_FILTER_STATS_FORMAT \
+	"semijoin filter: " UINT64_FORMAT " rows scanned, " UINT64_FORMAT " rejected"
+
+/*
+ * Wait events reported during the CPU-bound phases of building, shipping and
+ * applying a filter, so that a backend busy with them doesn't look idle in
+ * pg_stat_activity.  This release can't name extension wait events, so all
+ * of them show as "Extension"; the event id tells them apart.  Use with
+ * pgstat_report_wait_start() from utils/wait_event.h.
+ */
+#define WAIT_EVENT_SEMIJOIN_FILTER_BUILD	(PG_WAIT_EXTENSION | 0x5301)
+#define WAIT_EVENT_SEMIJOIN_FILTER_ENCODE	(PG_WAIT_EXTENSION | 0x5302)
+#define WAIT_EVENT_SEMIJOIN_FILTER_SEND		(PG_WAIT_EXTENSION | 0x5303)
+#define WAIT_EVENT_SEMIJOIN_FILTER_RECEIVE	(PG_WAIT_EXTENSION | 0x5304)
+#define WAIT_EVENT_SEMIJOIN_FILTER_DECODE	(PG_WAIT_EXTENSION | 0x5305)
+
+/*
+ * Static trace points of the filter phases, under the "postgresql" provider
+ * like those of utils/probes.d, for perf, bpftrace and friends.  They're
+ * SystemTap-style USDT probes, so they need --enable-dtrace on Linux.
+ */
+#if defined(ENABLE_DTRACE) && defined(__linux__)
+#include <sys/sdt.h>
+#define TRACE_POSTGRESQL_SEMIJOIN_BUILD_START(nodeid) \
+	DTRACE_PROBE1(postgresql, semijoin__build__start, nodeid)
+#define TRACE_POSTGRESQL_SEMIJOIN_BUILD_DONE(nodeid, keys, bits, nparts) \
+	DTRACE_PROBE4(postgresql, semijoin__build__done, nodeid, keys, bits, nparts)
+#define TRACE_POSTGRESQL_SEMIJOIN_ENCODE_START(nodeid) \
+	DTRACE_PROBE1(postgresql, semijoin__encode__start, nodeid)
+#define TRACE_POSTGRESQL_SEMIJOIN_ENCODE_DONE(nodeid, bytes) \
+	DTRACE_PROBE2(postgresql, semijoin__encode__done, nodeid, bytes)
+#define TRACE_POSTGRESQL_SEMIJOIN_SEND(cursor, bytes) \
+	DTRACE_PROBE2(postgresql, semijoin__send, cursor, bytes)
+#define TRACE_POSTGRESQL_SEMIJOIN_RECEIVE(bytes) \
+	DTRACE_PROBE1(postgresql, semijoin__receive, bytes)
+#define TRACE_POSTGRESQL_SEMIJOIN_DECODE_START(bytes) \
+	DTRACE_PROBE1(postgresql, semijoin__decode__start, bytes)
+#define TRACE_POSTGRESQL_SEMIJOIN_DECODE_DONE(bits) \
+	DTRACE_PROBE1(postgresql, semijoin__decode__done, bits)
+#define TRACE_POSTGRESQL_SEMIJOIN_PROBE_BATCH(scanned, rejected) \
+	DTRACE_PROBE2(postgresql, semijoin__probe__batch, scanned, rejected)
+#else
+#define TRACE_POSTGRESQL_SEMIJOIN_BUILD_START(nodeid) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_BUILD_DONE(nodeid, keys, bits, nparts) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_ENCODE_START(nodeid) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_ENCODE_DONE(nodeid, bytes) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_SEND(cursor, bytes) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_RECEIVE(bytes) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_DECODE_START(bytes) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_DECODE_DONE(bits) do {} while (0)
+#define TRACE_POSTGRESQL_SEMIJOIN_PROBE_BATCH(scanned, rejected) do {} while (0)
+#endif
+
+/* MurmurHash3 (x86, 32-bit); each seed gives another hash function */
 uint32_t murmurhash(const char *key, size_t len, uint32_t seed);
-/* Initialize the Bloom filter */
+/* Number of bytes needed for a filter of n items at false-positive rate p */
+size_t bloom_filter_size_bytes(size_t n, double p);
+/* Best false-positive rate for n items within nbytes of bit array */
+double bloom_filter_fpr_for_bytes(size_t n, size_t nbytes);
+/* Initialize the Bloom filter; NULL if out of memory */
 CustomBloomFilter *bloom_filter_create(size_t n, double p);
+/* Key-hash partition (0 .. npartitions - 1) an item belongs to */
+int bloom_filter_partition_of(const char *item, int npartitions);
 /* Add an item to the Bloom filter */
 void bloom_filter_add(CustomBloomFilter *filter, const char *item);
 /* Check if an item is in the Bloom filter */
@@ -74,6 +145,9 @@ CustomBloomFilter *bloom_filter_decode_hex_with_metadata(const char *hex);
 /* Free the Bloom filter */
 void bloom_filter_free(CustomBloomFilter *filter);
 
+/* Estimate the number of distinct items added to the Bloom filter */
+double bloom_filter_estimate_count(CustomBloomFilter *filter);
+
 /* ----------------------------------------------------------------
  *				Section 1:	Datum type + support functions
  * ----------------------------------------------------------------
@@ -126,10 +126,6 @@ struct _DestReceiver
 	/* CommandDest code for this receiver */
 	CommandDest mydest;
 	/* Private fields might appear beyond this point... */
-	/* Bloom filter related data */
-	bool has_rcvd_filter;
-    char* rcvd_filter_hex;
-	CustomBloomFilter* rcvd_filter;
 };
 
 extern PGDLLIMPORT DestReceiver *None_Receiver; /* permanent receiver for
@@ -203,9 +203,6 @@ typedef struct PortalData
 	/* Presentation data, primarily used by the pg_cursors system view */
 	TimestampTz creation_time;	/* time at which this portal was defined */
 	bool		visible;		/* include this portal in pg_cursors? */
-	/* Bloom filter related data */
-	bool has_rcvd_filter;
-    char* rcvd_filter_hex;
 }			PortalData;
 
 /*